@@ -1,6 +1,10 @@
 #include <thread>
+#include <functional>
 #include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <numeric>
+#include <unordered_map>
 #include "common/common.h"
 #include "llama.h"
 
@@ -9,6 +13,17 @@
 #include "AddonModelLora.h"
 #include "AddonGrammarEvaluationState.h"
 #include "AddonContext.h"
+#include "AddonThreadPool.h"
+#include "samplingKernels.h"
+#include "embeddingFormats.h"
+#include "AddonSessionStore.h"
+#include "stateFileCompression.h"
+#include "mappedSequenceStateFile.h"
+#include "contextThreadpools.h"
+#include "AddonContextScheduler.h"
+#include "NgramDraftIndex.h"
+#include "speculativeDecoding.h"
+#include "globals/addonProgress.h"
 
 static uint64_t calculateBatchMemorySize(int32_t n_tokens_alloc, int32_t embd, int32_t n_seq_max) {
     uint64_t totalSize = 0;
@@ -30,6 +45,151 @@ static uint64_t calculateBatchMemorySize(int32_t n_tokens_alloc, int32_t embd, i
     return totalSize;
 }
 
+static bool parseContextThreadpoolOptions(const Napi::Object& options, ContextThreadpoolOptions& threadpoolOptions) {
+    if (options.Has("cpuMask") && options.Get("cpuMask").IsArray()) {
+        Napi::Array cpuMask = options.Get("cpuMask").As<Napi::Array>();
+
+        threadpoolOptions.cpuMask.reserve(cpuMask.Length());
+        for (uint32_t i = 0; i < cpuMask.Length(); i++) {
+            threadpoolOptions.cpuMask.push_back(cpuMask.Get(i).As<Napi::Number>().Uint32Value());
+        }
+    }
+
+    if (options.Has("strictCpu")) {
+        threadpoolOptions.strictCpu = options.Get("strictCpu").As<Napi::Boolean>().Value();
+    }
+
+    if (options.Has("priority") &&
+        !parseThreadpoolPriority(options.Get("priority").As<Napi::String>().Utf8Value(), threadpoolOptions.priority)
+    ) {
+        return false;
+    }
+
+    if (options.Has("poll")) {
+        threadpoolOptions.poll = std::min(100u, options.Get("poll").As<Napi::Number>().Uint32Value());
+    }
+
+    return true;
+}
+
+AddonContextDecodeLock::AddonContextDecodeLock(AddonContext* context)
+    : context(context),
+      lock(context->decodeMutex) {
+    context->applyRequestedThreads();
+}
+AddonContextDecodeLock::~AddonContextDecodeLock() {
+    context->refreshMemoryInfo();
+}
+
+// expects `ctx->decodeMutex` to be held by the caller
+static bool decodeContextBatchLocked(AddonContext* ctx, std::string& errorMessage) {
+    // Perform the evaluation using llama_decode.
+    int r = llama_decode(ctx->ctx, ctx->batch);
+
+    if (r != 0) {
+        if (r == 1) {
+            errorMessage = "could not find a KV slot for the batch (try reducing the size of the batch or increase the context)";
+        } else {
+            errorMessage = "Eval has failed";
+        }
+
+        return false;
+    }
+
+    llama_synchronize(ctx->ctx);
+
+    int32_t outputs = 0;
+    for (int32_t i = 0; i < ctx->batch.n_tokens; i++) {
+        if (ctx->batch.logits[i]) {
+            outputs++;
+        }
+    }
+    ctx->decodedBatchOutputs = outputs;
+
+    return true;
+}
+
+static bool decodeContextBatch(AddonContext* ctx, std::string& errorMessage) {
+    AddonContextDecodeLock decodeLock(ctx);
+    return decodeContextBatchLocked(ctx, errorMessage);
+}
+
+void sampleTokensInParallel(
+    AddonContext* ctx,
+    const std::vector<int32_t>& batchLogitIndexes,
+    const std::vector<AddonSampler*>& samplers,
+    std::vector<llama_token>& result
+) {
+    result.assign(batchLogitIndexes.size(), -1);
+
+    // the items are joined with a union-find over their sampler and grammar evaluation state,
+    // so an item that links two existing groups (like a sampler of one and the grammar state of another) merges them
+    std::vector<size_t> parents(samplers.size());
+    std::iota(parents.begin(), parents.end(), 0);
+
+    const auto findRoot = [&parents](size_t i) {
+        while (parents[i] != i) {
+            parents[i] = parents[parents[i]];
+            i = parents[i];
+        }
+
+        return i;
+    };
+
+    std::unordered_map<const void*, size_t> firstItemByKey;
+    for (size_t i = 0; i < samplers.size(); i++) {
+        const void* keys[] = {samplers[i], samplers[i]->grammarEvaluationState};
+
+        for (const void* key : keys) {
+            if (key == nullptr) {
+                continue;
+            }
+
+            const auto [keyIt, inserted] = firstItemByKey.emplace(key, i);
+            if (!inserted) {
+                parents[findRoot(i)] = findRoot(keyIt->second);
+            }
+        }
+    }
+
+    std::vector<std::vector<size_t>> groups;
+    std::unordered_map<size_t, size_t> groupIndexByRoot;
+    for (size_t i = 0; i < samplers.size(); i++) {
+        const auto [groupIt, inserted] = groupIndexByRoot.emplace(findRoot(i), groups.size());
+        if (inserted) {
+            groups.emplace_back();
+        }
+
+        groups[groupIt->second].push_back(i);
+    }
+
+    // the first logits access after a decode can reorder the outputs of the batch, which mutates the context,
+    // so the logits of all the items are resolved on this thread before the sampling is spread across the pool
+    std::vector<const float*> itemLogits(batchLogitIndexes.size(), nullptr);
+    for (size_t i = 0; i < batchLogitIndexes.size(); i++) {
+        itemLogits[i] = llama_get_logits_ith(ctx->ctx, batchLogitIndexes[i]);
+    }
+
+    AddonThreadPool::shared().run(groups.size(), [&](size_t groupIndex) {
+        for (size_t i : groups[groupIndex]) {
+            AddonSampler* sampler = samplers[i];
+            const float* logits = itemLogits[i];
+            if (logits == nullptr) {
+                continue;
+            }
+
+            llama_token_data_array cur_p;
+            if (!sampler->sample(logits, cur_p)) {
+                continue;
+            }
+
+            auto new_token_id = cur_p.data[cur_p.selected].id;
+            sampler->acceptToken(new_token_id);
+            result[i] = new_token_id;
+        }
+    });
+}
+
 class AddonContextDecodeBatchWorker : public Napi::AsyncWorker {
     public:
         AddonContext* ctx;
@@ -53,20 +213,10 @@ class AddonContextDecodeBatchWorker : public Napi::AsyncWorker {
 
         void Execute() {
             try {
-                // Perform the evaluation using llama_decode.
-                int r = llama_decode(ctx->ctx, ctx->batch);
-
-                if (r != 0) {
-                    if (r == 1) {
-                        SetError("could not find a KV slot for the batch (try reducing the size of the batch or increase the context)");
-                    } else {
-                        SetError("Eval has failed");
-                    }
-
-                    return;
+                std::string errorMessage;
+                if (!decodeContextBatch(ctx, errorMessage)) {
+                    SetError(errorMessage);
                 }
-
-                llama_synchronize(ctx->ctx);
             } catch (const std::exception& e) {
                 SetError(e.what());
             } catch(...) {
@@ -104,9 +254,23 @@ class AddonContextLoadContextWorker : public Napi::AsyncWorker {
 
         void Execute() {
             try {
+                if (context->threadpoolOptions != nullptr) {
+                    context->threadpools = std::make_unique<ContextThreadpools>(
+                        std::max(context->context_params.n_threads, context->context_params.n_threads_batch),
+                        *context->threadpoolOptions,
+                        *context->batchThreadpoolOptions
+                    );
+                }
+
                 context->ctx = llama_init_from_model(context->model->model, context->context_params);
 
                 context->contextLoaded = context->ctx != nullptr && context->ctx != NULL;
+
+                if (context->contextLoaded && context->threadpools != nullptr) {
+                    llama_attach_threadpool(context->ctx, context->threadpools->threadpool, context->threadpools->batchThreadpool);
+                } else if (!context->contextLoaded) {
+                    context->threadpools.reset();
+                }
             } catch (const std::exception& e) {
                 SetError(e.what());
             } catch(...) {
@@ -118,6 +282,7 @@ class AddonContextLoadContextWorker : public Napi::AsyncWorker {
                 uint64_t contextMemorySize = llama_state_get_size(context->ctx);
                 adjustNapiExternalMemoryAdd(Env(), contextMemorySize);
                 context->loadedContextMemorySize = contextMemorySize;
+                context->stateSize = contextMemorySize;
             }
 
             deferred.Resolve(Napi::Boolean::New(Env(), context->contextLoaded));
@@ -149,14 +314,19 @@ class AddonContextUnloadContextWorker : public Napi::AsyncWorker {
 
         void Execute() {
             try {
-                llama_free(context->ctx);
-                context->contextLoaded = false;
+                {
+                    // wait for memory operations and state restores that are still running on other workers
+                    std::lock_guard<std::mutex> decodeLock(context->decodeMutex);
+                    llama_free(context->ctx);
+                    context->contextLoaded = false;
+                }
 
                 try {
                     if (context->has_batch) {
                         llama_batch_free(context->batch);
                         context->has_batch = false;
                         context->batch_n_tokens = 0;
+                        context->batchCapacity = 0;
                     }
 
                     context->dispose();
@@ -195,9 +365,10 @@ class AddonContextSampleTokenWorker : public Napi::AsyncWorker {
         bool returnConfidence = false;
         float tokenConfidence = -1;
         bool has_probabilities = false;
-        size_t probabilities_size;
-        llama_token * probabilities_tokens;
-        float * probabilities_probs;
+        size_t maxProbabilities = 0; // 0 = no limit
+        float minProbability = 0.0f;
+        std::vector<llama_token> probabilities_tokens;
+        std::vector<float> probabilities_probs;
         int32_t batchLogitIndex;
         llama_token result;
         bool no_output = false;
@@ -213,16 +384,15 @@ class AddonContextSampleTokenWorker : public Napi::AsyncWorker {
             arrayResult = info.Length() > 2 && info[2].IsBoolean();
             returnProbabilities = arrayResult ? info[2].As<Napi::Boolean>().Value() : false;
             returnConfidence = arrayResult && info.Length() > 3 && info[3].IsBoolean() ? info[3].As<Napi::Boolean>().Value() : false;
+            maxProbabilities = arrayResult && info.Length() > 4 && info[4].IsNumber()
+                ? static_cast<size_t>(std::max<int64_t>(0, info[4].As<Napi::Number>().Int64Value()))
+                : 0;
+            minProbability = arrayResult && info.Length() > 5 && info[5].IsNumber() ? info[5].As<Napi::Number>().FloatValue() : 0.0f;
             sampler->Ref();
         }
         ~AddonContextSampleTokenWorker() {
             ctx->Unref();
             sampler->Unref();
-
-            if (has_probabilities) {
-                delete[] probabilities_tokens;
-                delete[] probabilities_probs;
-            }
         }
 
         Napi::Promise GetPromise() {
@@ -248,101 +418,74 @@ class AddonContextSampleTokenWorker : public Napi::AsyncWorker {
                 return;
             }
 
-            sampler->rebuildChainIfNeeded();
-
             const auto * logits = llama_get_logits_ith(ctx->ctx, batchLogitIndex);
-            const int n_vocab = llama_vocab_n_tokens(ctx->model->vocab);
-
-            auto & candidates = sampler->tokenCandidates;
-            for (llama_token token_id = 0; token_id < n_vocab; token_id++) {
-                candidates[token_id] = llama_token_data{token_id, logits[token_id], 0.0f};
-            }
-
-            llama_token_data_array cur_p = {
-                /* .data       = */ candidates.data(),
-                /* .size       = */ candidates.size(),
-                /* .selected   = */ -1,
-                /* .sorted     = */ false,
-            };
 
-            llama_sampler_apply(sampler->chain, &cur_p);
-
-            if (!(cur_p.selected >= 0 && cur_p.selected < (int32_t)cur_p.size)) {
+            llama_token_data_array cur_p;
+            if (!sampler->sample(logits, cur_p)) {
                 no_output = true;
                 return;
             }
 
             auto new_token_id = cur_p.data[cur_p.selected].id;
+            const float new_token_logit = cur_p.data[cur_p.selected].logit;
 
-            if (returnProbabilities || returnConfidence) {
-                if (!cur_p.sorted) {
-                    std::sort(cur_p.data, cur_p.data + cur_p.size, [](const llama_token_data & a, const llama_token_data & b) {
-                        return a.logit > b.logit;
-                    });
-                    cur_p.sorted = true;
-
-                    for (size_t i = 0; i < cur_p.size; i++) {
-                        if (cur_p.data[i].id == new_token_id) {
-                            cur_p.selected = i;
-                            break;
-                        }
-                    }
-                }
+            if (!returnProbabilities && !returnConfidence) {
+                sampler->acceptToken(new_token_id);
+                result = new_token_id;
+                return;
             }
 
+            const auto & kernels = getSamplingKernels();
+
             if (returnProbabilities) {
-                probabilities_size = cur_p.size;
-                probabilities_tokens = new llama_token[probabilities_size];
-                probabilities_probs = new float[probabilities_size];
-                float maxLogit = cur_p.size > 0 ? cur_p.data[0].logit : -INFINITY;
+                size_t probabilitiesCount = maxProbabilities > 0
+                    ? std::min(maxProbabilities, cur_p.size)
+                    : cur_p.size;
 
-                for (size_t i = 0; i < cur_p.size; i++) {
-                    auto logit = cur_p.data[i].logit;
+                if (!cur_p.sorted) {
+                    // only the returned candidates have to be ordered
+                    selectTopTokenCandidates(cur_p.data, cur_p.size, probabilitiesCount);
+                }
 
-                    probabilities_tokens[i] = cur_p.data[i].id;
-                    probabilities_probs[i] = logit;
+                probabilities_probs.resize(probabilitiesCount);
 
-                    if (logit > maxLogit) {
-                        maxLogit = logit;
+                if (probabilitiesCount == cur_p.size) {
+                    computeTokenCandidatesProbabilities(kernels, cur_p.data, cur_p.size, probabilities_probs.data());
+                } else {
+                    const auto softmax = getTokenCandidatesSoftmax(kernels, cur_p.data, cur_p.size);
+                    for (size_t i = 0; i < probabilitiesCount; i++) {
+                        probabilities_probs[i] = softmax.probabilityOf(cur_p.data[i].logit);
                     }
-                }
 
-                if (probabilities_size > 0 && maxLogit != -INFINITY) {
-                    float sum = 0.0f;
-                    for (size_t i = 0; i < probabilities_size; i++) {
-                        float prob = expf(probabilities_probs[i] - maxLogit);
-                        probabilities_probs[i] = prob;
-                        sum += prob;
+                    if (returnConfidence) {
+                        tokenConfidence = softmax.probabilityOf(new_token_logit);
                     }
+                }
 
-                    for (size_t i = 0; i < probabilities_size; i++) {
-                        probabilities_probs[i] /= sum;
+                if (minProbability > 0.0f) {
+                    // the probabilities are sorted in descending order
+                    while (probabilitiesCount > 0 && probabilities_probs[probabilitiesCount - 1] < minProbability) {
+                        probabilitiesCount--;
                     }
-                }
 
-                has_probabilities = true;
-            }
+                    probabilities_probs.resize(probabilitiesCount);
+                }
 
-            if (returnConfidence) {
-                if (has_probabilities && cur_p.selected < probabilities_size) {
-                    tokenConfidence = probabilities_probs[cur_p.selected];
-                } else {
-                    float maxLogit = cur_p.data[0].logit;
-                    float sum = 0.0f;
-                    for (size_t i = 0; i < cur_p.size; i++) {
-                        auto logit = cur_p.data[i].logit;
+                probabilities_tokens.resize(probabilitiesCount);
+                for (size_t i = 0; i < probabilitiesCount; i++) {
+                    probabilities_tokens[i] = cur_p.data[i].id;
 
-                        if (logit > maxLogit) {
-                            maxLogit = logit;
-                        }
+                    if (returnConfidence && tokenConfidence == -1 && cur_p.data[i].id == new_token_id) {
+                        tokenConfidence = probabilities_probs[i];
                     }
+                }
 
-                    for (size_t i = 0; i < cur_p.size; i++) {
-                        sum += expf(cur_p.data[i].logit - maxLogit);
-                    }
+                has_probabilities = true;
+            }
 
-                    tokenConfidence = expf(cur_p.data[cur_p.selected].logit - maxLogit) / sum;
-                }
+            if (returnConfidence && tokenConfidence == -1) {
+                // the candidates don't have to be sorted for this
+                tokenConfidence = getTokenCandidatesSoftmax(kernels, cur_p.data, cur_p.size).probabilityOf(new_token_logit);
             }
 
             sampler->acceptToken(new_token_id);
@@ -365,11 +508,18 @@ class AddonContextSampleTokenWorker : public Napi::AsyncWorker {
             resultArray.Set(Napi::Number::New(Env(), 0), resultToken);
 
             if (has_probabilities) {
-                Napi::Array probabilities = Napi::Array::New(Env(), probabilities_size * 2);
-                for (size_t i = 0; i < probabilities_size; i++) {
-                    probabilities.Set(i * 2, Napi::Number::New(Env(), probabilities_tokens[i]));
-                    probabilities.Set(i * 2 + 1, Napi::Number::New(Env(), probabilities_probs[i]));
+                const size_t probabilitiesCount = probabilities_tokens.size();
+                Napi::Uint32Array tokens = Napi::Uint32Array::New(Env(), probabilitiesCount);
+                Napi::Float32Array probs = Napi::Float32Array::New(Env(), probabilitiesCount);
+
+                if (probabilitiesCount > 0) {
+                    std::memcpy(tokens.Data(), probabilities_tokens.data(), probabilitiesCount * sizeof(llama_token));
+                    std::memcpy(probs.Data(), probabilities_probs.data(), probabilitiesCount * sizeof(float));
                 }
+
+                Napi::Array probabilities = Napi::Array::New(Env(), 2);
+                probabilities.Set(Napi::Number::New(Env(), 0), tokens);
+                probabilities.Set(Napi::Number::New(Env(), 1), probs);
                 resultArray.Set(1, probabilities);
             }
 
@@ -384,158 +534,763 @@ class AddonContextSampleTokenWorker : public Napi::AsyncWorker {
         }
 };
 
-AddonContext::AddonContext(const Napi::CallbackInfo& info) : Napi::ObjectWrap<AddonContext>(info) {
-    model = Napi::ObjectWrap<AddonModel>::Unwrap(info[0].As<Napi::Object>());
-    model->Ref();
-
-    context_params = llama_context_default_params();
-    context_params.n_ctx = 4096;
-    context_params.n_threads = std::max(cpu_get_num_math(), 1);
-    context_params.n_threads_batch = context_params.n_threads;
-    context_params.no_perf = true;
-    context_params.swa_full = false;
+// the pooled embedding of the given sequence from the last decoded batch,
+// or the embedding of the last output of the sequence in the batch when the context has no pooling
+static const float* getSequenceEmbeddings(AddonContext* ctx, llama_seq_id sequenceId) {
+    if (llama_pooling_type(ctx->ctx) != LLAMA_POOLING_TYPE_NONE) {
+        const float* embeddings = llama_get_embeddings_seq(ctx->ctx, sequenceId);
+        if (embeddings != NULL) {
+            return embeddings;
+        }
+    }
 
-    if (info.Length() > 1 && info[1].IsObject()) {
-        Napi::Object options = info[1].As<Napi::Object>();
+    if (!ctx->has_batch) {
+        return NULL;
+    }
 
-        if (options.Has("contextSize")) {
-            context_params.n_ctx = options.Get("contextSize").As<Napi::Number>().Uint32Value();
+    for (int32_t i = ctx->batch.n_tokens - 1; i >= 0; i--) {
+        if (ctx->batch.logits[i] && ctx->batch.n_seq_id[i] > 0 && ctx->batch.seq_id[i][0] == sequenceId) {
+            return llama_get_embeddings_ith(ctx->ctx, i);
         }
+    }
 
-        if (options.Has("batchSize")) {
-            context_params.n_batch = options.Get("batchSize").As<Napi::Number>().Uint32Value();
-            context_params.n_ubatch = context_params.n_batch; // the batch queue is managed in the JS side, so there's no need for managing it on the C++ side
-        }
+    return NULL;
+}
 
-        if (options.Has("sequences")) {
-            context_params.n_seq_max = options.Get("sequences").As<Napi::Number>().Uint32Value();
-        }
+static void finalizeOwnedArrayBuffer(napi_env env, void* data, void* hint) {
+    delete static_cast<std::vector<uint8_t>*>(hint);
+}
 
-        if (options.Has("embeddings")) {
-            context_params.embeddings = options.Get("embeddings").As<Napi::Boolean>().Value();
-        }
+// moves the given data into a new `ArrayBuffer` without copying it when the runtime supports external buffers
+static Napi::ArrayBuffer createOwnedArrayBuffer(Napi::Env env, std::vector<uint8_t>&& data) {
+    if (data.empty()) {
+        return Napi::ArrayBuffer::New(env, 0);
+    }
 
-        if (options.Has("ranking") && options.Get("ranking").As<Napi::Boolean>().Value()) {
-            context_params.pooling_type = LLAMA_POOLING_TYPE_RANK;
-        }
+    auto* ownedData = new std::vector<uint8_t>(std::move(data));
 
-        if (options.Has("flashAttention")) {
-            context_params.flash_attn = options.Get("flashAttention").As<Napi::Boolean>().Value();
-        }
+    napi_value arrayBufferValue;
+    napi_status status = napi_create_external_arraybuffer(
+        env, ownedData->data(), ownedData->size(), finalizeOwnedArrayBuffer, ownedData, &arrayBufferValue
+    );
 
-        if (options.Has("threads")) {
-            const auto n_threads = options.Get("threads").As<Napi::Number>().Int32Value();
-            const auto resolved_n_threads = n_threads == 0 ? std::max((int32_t)std::thread::hardware_concurrency(), context_params.n_threads) : n_threads;
+    if (status != napi_ok) {
+        // external buffers are not allowed in some runtimes (like Electron), so fall back to a copy
+        Napi::ArrayBuffer result = Napi::ArrayBuffer::New(env, ownedData->size());
+        std::memcpy(result.Data(), ownedData->data(), ownedData->size());
+        delete ownedData;
+        return result;
+    }
 
-            context_params.n_threads = resolved_n_threads;
-            context_params.n_threads_batch = resolved_n_threads;
-        }
+    return Napi::ArrayBuffer(env, arrayBufferValue);
+}
 
-        if (options.Has("performanceTracking")) {
-            context_params.no_perf = !(options.Get("performanceTracking").As<Napi::Boolean>().Value());
+// the logits memory is overwritten by the next decode, which can run on other threads that can't detach JS buffers,
+// so the logits are copied on a worker thread under the decode lock instead of being exposed as a view
+class AddonContextGetLogitsWorker : public Napi::AsyncWorker {
+    public:
+        AddonContext* ctx;
+        bool allOutputs;
+        int32_t batchLogitIndex;
+        int32_t outputs;
+        std::vector<uint8_t> logits;
+
+        AddonContextGetLogitsWorker(const Napi::Env& env, AddonContext* ctx, bool allOutputs, int32_t batchLogitIndex)
+            : Napi::AsyncWorker(env, "AddonContextGetLogitsWorker"),
+              ctx(ctx),
+              allOutputs(allOutputs),
+              batchLogitIndex(batchLogitIndex),
+              outputs(ctx->decodedBatchOutputs),
+              deferred(Napi::Promise::Deferred::New(env)) {
+            ctx->Ref();
+        }
+        ~AddonContextGetLogitsWorker() {
+            ctx->Unref();
         }
 
-        if (options.Has("swaFullCache")) {
-            context_params.swa_full = options.Get("swaFullCache").As<Napi::Boolean>().Value();
+        Napi::Promise GetPromise() {
+            return deferred.Promise();
         }
-    }
-}
-AddonContext::~AddonContext() {
-    dispose();
-}
 
-void AddonContext::dispose() {
-    if (disposed) {
-        return;
-    }
+    protected:
+        Napi::Promise::Deferred deferred;
 
-    disposed = true;
-    if (contextLoaded) {
-        contextLoaded = false;
-        llama_free(ctx);
+        void Execute() {
+            try {
+                AddonContextDecodeLock decodeLock(ctx);
 
-        adjustNapiExternalMemorySubtract(Env(), loadedContextMemorySize);
-        loadedContextMemorySize = 0;
-    }
+                if (!ctx->contextLoaded) {
+                    SetError("Context is disposed");
+                    return;
+                }
 
-    model->Unref();
+                if (llama_get_logits(ctx->ctx) == nullptr) {
+                    SetError("This model does not support token generation");
+                    return;
+                }
 
-    disposeBatch();
-}
-void AddonContext::disposeBatch() {
-    if (!has_batch) {
-        return;
-    }
+                const size_t vocabularySize = llama_vocab_n_tokens(ctx->model->vocab);
+                const float* source = allOutputs
+                    ? llama_get_logits(ctx->ctx)
+                    : llama_get_logits_ith(ctx->ctx, batchLogitIndex);
+                const size_t length = allOutputs
+                    ? static_cast<size_t>(outputs) * vocabularySize
+                    : vocabularySize;
 
-    llama_batch_free(batch);
-    has_batch = false;
-    batch_n_tokens = 0;
+                if (source == nullptr) {
+                    SetError(std::string("Failed to get logits for batch logit index ") + std::to_string(batchLogitIndex));
+                    return;
+                }
 
-    adjustNapiExternalMemorySubtract(Env(), batchMemorySize);
-    batchMemorySize = 0;
-}
+                logits.resize(length * sizeof(float));
+                std::memcpy(logits.data(), source, logits.size());
+            } catch (const std::exception& e) {
+                SetError(e.what());
+            } catch(...) {
+                SetError("Unknown error when calling \"llama_get_logits_ith\"");
+            }
+        }
+        void OnOK() {
+            const size_t length = logits.size() / sizeof(float);
+            Napi::ArrayBuffer arrayBuffer = createOwnedArrayBuffer(Env(), std::move(logits));
+            deferred.Resolve(Napi::Float32Array::New(Env(), length, arrayBuffer, 0));
+        }
+        void OnError(const Napi::Error& err) {
+            deferred.Reject(err.Value());
+        }
+};
 
-Napi::Value AddonContext::Init(const Napi::CallbackInfo& info) {
-    if (disposed) {
-        Napi::Error::New(info.Env(), "Context is disposed").ThrowAsJavaScriptException();
-        return info.Env().Undefined();
-    }
+class AddonContextGetEmbeddingsWorker : public Napi::AsyncWorker {
+    public:
+        AddonContext* ctx;
+        EmbeddingFormat format;
+        std::vector<llama_seq_id> sequenceIds;
+        size_t vectorSize = 0;
+        std::vector<uint8_t> vectors;
+        std::vector<float> scales;
+
+        AddonContextGetEmbeddingsWorker(const Napi::CallbackInfo& info, AddonContext* ctx, EmbeddingFormat format)
+            : Napi::AsyncWorker(info.Env(), "AddonContextGetEmbeddingsWorker"),
+              ctx(ctx),
+              format(format),
+              deferred(Napi::Promise::Deferred::New(info.Env())) {
+            ctx->Ref();
 
-    AddonContextLoadContextWorker* worker = new AddonContextLoadContextWorker(this->Env(), this);
-    worker->Queue();
-    return worker->GetPromise();
-}
-Napi::Value AddonContext::Dispose(const Napi::CallbackInfo& info) {
-    if (disposed) {
-        return info.Env().Undefined();
-    }
+            Napi::Uint32Array sequenceIdsArray = info[0].As<Napi::Uint32Array>();
+            sequenceIds.resize(sequenceIdsArray.ElementLength());
+            for (size_t i = 0; i < sequenceIds.size(); i++) {
+                sequenceIds[i] = static_cast<llama_seq_id>(sequenceIdsArray[i]);
+            }
 
-    if (contextLoaded) {
-        contextLoaded = false;
+            const int32_t n_embd = llama_model_n_embd(ctx->model->model);
+            const int32_t maxVectorSize = (info.Length() > 2 && info[2].IsNumber()) ? info[2].As<Napi::Number>().Int32Value() : 0;
+            vectorSize = maxVectorSize <= 0 ? n_embd : std::min(n_embd, maxVectorSize);
+        }
+        ~AddonContextGetEmbeddingsWorker() {
+            ctx->Unref();
+        }
 
-        AddonContextUnloadContextWorker* worker = new AddonContextUnloadContextWorker(this->Env(), this);
-        worker->Queue();
-        return worker->GetPromise();
-    } else {
-        dispose();
+        Napi::Promise GetPromise() {
+            return deferred.Promise();
+        }
 
-        Napi::Promise::Deferred deferred = Napi::Promise::Deferred::New(info.Env());
-        deferred.Resolve(info.Env().Undefined());
-        return deferred.Promise();
-    }
-}
+    protected:
+        Napi::Promise::Deferred deferred;
 
-Napi::Value AddonContext::GetContextSize(const Napi::CallbackInfo& info) {
-    if (disposed) {
-        Napi::Error::New(info.Env(), "Context is disposed").ThrowAsJavaScriptException();
-        return info.Env().Undefined();
-    }
+        void Execute() {
+            try {
+                const size_t vectorByteSize = getEmbeddingFormatVectorByteSize(format, vectorSize);
+                vectors.resize(sequenceIds.size() * vectorByteSize);
+                scales.resize(sequenceIds.size());
 
-    return Napi::Number::From(info.Env(), llama_n_ctx(ctx));
+                for (size_t i = 0; i < sequenceIds.size(); i++) {
+                    const float* embeddings = getSequenceEmbeddings(ctx, sequenceIds[i]);
+
+                    if (embeddings == NULL) {
+                        SetError(std::string("Failed to get embeddings for sequence ") + std::to_string(sequenceIds[i]));
+                        return;
+                    }
+
+                    scales[i] = convertEmbedding(format, embeddings, vectorSize, vectors.data() + i * vectorByteSize);
+                }
+            } catch (const std::exception& e) {
+                SetError(e.what());
+            } catch(...) {
+                SetError("Unknown error when getting embeddings");
+            }
+        }
+        void OnOK() {
+            const size_t totalValues = sequenceIds.size() * vectorSize;
+            const size_t totalBytes = vectors.size();
+            Napi::ArrayBuffer arrayBuffer = createOwnedArrayBuffer(Env(), std::move(vectors));
+
+            switch (format) {
+                case EmbeddingFormat::float32:
+                case EmbeddingFormat::normalized:
+                    deferred.Resolve(Napi::Float32Array::New(Env(), totalValues, arrayBuffer, 0));
+                    break;
+                case EmbeddingFormat::float16:
+                    deferred.Resolve(Napi::Uint16Array::New(Env(), totalValues, arrayBuffer, 0));
+                    break;
+                case EmbeddingFormat::int8: {
+                    Napi::Float32Array scalesArray = Napi::Float32Array::New(Env(), scales.size());
+                    std::memcpy(scalesArray.Data(), scales.data(), scales.size() * sizeof(float));
+
+                    Napi::Array result = Napi::Array::New(Env(), 2);
+                    result.Set(Napi::Number::New(Env(), 0), Napi::Int8Array::New(Env(), totalValues, arrayBuffer, 0));
+                    result.Set(Napi::Number::New(Env(), 1), scalesArray);
+                    deferred.Resolve(result);
+                    break;
+                }
+                case EmbeddingFormat::binary:
+                    deferred.Resolve(Napi::Uint8Array::New(Env(), totalBytes, arrayBuffer, 0));
+                    break;
+            }
+        }
+        void OnError(const Napi::Error& err) {
+            deferred.Reject(err.Value());
+        }
+};
+
+class AddonContextRankBatchWorker : public Napi::AsyncWorker {
+    public:
+        AddonContext* ctx;
+        std::vector<llama_seq_id> sequenceIds;
+        std::vector<float> scores;
+
+        AddonContextRankBatchWorker(const Napi::Env& env, AddonContext* ctx, std::vector<llama_seq_id>&& sequenceIds)
+            : Napi::AsyncWorker(env, "AddonContextRankBatchWorker"),
+              ctx(ctx),
+              sequenceIds(std::move(sequenceIds)),
+              deferred(Napi::Promise::Deferred::New(env)) {
+            ctx->Ref();
+        }
+        ~AddonContextRankBatchWorker() {
+            ctx->Unref();
+        }
+
+        Napi::Promise GetPromise() {
+            return deferred.Promise();
+        }
+
+    protected:
+        Napi::Promise::Deferred deferred;
+
+        void Execute() {
+            try {
+                // the cells are cleared and decoded under the same lock so the native scheduler can't place tokens in between
+                AddonContextDecodeLock decodeLock(ctx);
+
+                llama_memory_t memory = llama_get_memory(ctx->ctx);
+                for (const auto sequenceId : sequenceIds) {
+                    llama_memory_seq_rm(memory, sequenceId, -1, -1);
+                }
+
+                std::string errorMessage;
+                const bool decoded = decodeContextBatchLocked(ctx, errorMessage);
+
+                if (decoded) {
+                    scores.resize(sequenceIds.size());
+                    for (size_t i = 0; i < sequenceIds.size(); i++) {
+                        const float* embeddings = llama_get_embeddings_seq(ctx->ctx, sequenceIds[i]);
+
+                        if (embeddings == NULL) {
+                            errorMessage = std::string("Failed to get the ranking score for sequence ") + std::to_string(sequenceIds[i]);
+                            break;
+                        }
+
+                        scores[i] = embeddings[0];
+                    }
+                }
+
+                // the sequences are only used for a single decode, so their cells can be freed right away
+                for (const auto sequenceId : sequenceIds) {
+                    llama_memory_seq_rm(memory, sequenceId, -1, -1);
+                }
+
+                if (!errorMessage.empty()) {
+                    SetError(errorMessage);
+                }
+            } catch (const std::exception& e) {
+                SetError(e.what());
+            } catch(...) {
+                SetError("Unknown error when calling \"llama_decode\"");
+            }
+        }
+        void OnOK() {
+            Napi::Float32Array result = Napi::Float32Array::New(Env(), scores.size());
+            std::memcpy(result.Data(), scores.data(), scores.size() * sizeof(float));
+            deferred.Resolve(result);
+        }
+        void OnError(const Napi::Error& err) {
+            deferred.Reject(err.Value());
+        }
+};
+
+class AddonContextDecodeBatchAndSampleWorker : public Napi::AsyncWorker {
+    public:
+        AddonContext* ctx;
+        std::vector<int32_t> batchLogitIndexes;
+        std::vector<AddonSampler*> samplers;
+        std::vector<llama_token> result;
+
+        AddonContextDecodeBatchAndSampleWorker(const Napi::CallbackInfo& info, AddonContext* ctx)
+            : Napi::AsyncWorker(info.Env(), "AddonContextDecodeBatchAndSampleWorker"),
+              ctx(ctx),
+              deferred(Napi::Promise::Deferred::New(info.Env())) {
+            ctx->Ref();
+
+            Napi::Uint32Array logitIndexes = info[0].As<Napi::Uint32Array>();
+            Napi::Array samplersArray = info[1].As<Napi::Array>();
+
+            batchLogitIndexes.resize(logitIndexes.ElementLength());
+            samplers.resize(logitIndexes.ElementLength());
+
+            for (size_t i = 0; i < batchLogitIndexes.size(); i++) {
+                batchLogitIndexes[i] = static_cast<int32_t>(logitIndexes[i]);
+                samplers[i] = Napi::ObjectWrap<AddonSampler>::Unwrap(samplersArray.Get(i).As<Napi::Object>());
+                samplers[i]->Ref();
+            }
+        }
+        ~AddonContextDecodeBatchAndSampleWorker() {
+            ctx->Unref();
+
+            for (auto sampler : samplers) {
+                sampler->Unref();
+            }
+        }
+
+        Napi::Promise GetPromise() {
+            return deferred.Promise();
+        }
+
+    protected:
+        Napi::Promise::Deferred deferred;
+
+        void Execute() {
+            try {
+                std::string errorMessage;
+                if (!decodeContextBatch(ctx, errorMessage)) {
+                    SetError(errorMessage);
+                    return;
+                }
+            } catch (const std::exception& e) {
+                SetError(e.what());
+                return;
+            } catch(...) {
+                SetError("Unknown error when calling \"llama_decode\"");
+                return;
+            }
+
+            try {
+                SampleTokens();
+            } catch (const std::exception& e) {
+                SetError(e.what());
+            } catch(...) {
+                SetError("Unknown error when calling \"SampleTokens\"");
+            }
+        }
+
+        void SampleTokens() {
+            if (batchLogitIndexes.empty()) {
+                return;
+            }
+
+            if (llama_get_logits(ctx->ctx) == nullptr) {
+                SetError("This model does not support token generation");
+                return;
+            }
+
+            sampleTokensInParallel(ctx, batchLogitIndexes, samplers, result);
+        }
+        void OnOK() {
+            Napi::Int32Array resultTokens = Napi::Int32Array::New(Env(), result.size());
+            for (size_t i = 0; i < result.size(); i++) {
+                resultTokens[i] = result[i];
+            }
+
+            deferred.Resolve(resultTokens);
+        }
+        void OnError(const Napi::Error& err) {
+            deferred.Reject(err.Value());
+        }
+};
+
+AddonContext::AddonContext(const Napi::CallbackInfo& info) : Napi::ObjectWrap<AddonContext>(info) {
+    model = Napi::ObjectWrap<AddonModel>::Unwrap(info[0].As<Napi::Object>());
+    model->Ref();
+
+    context_params = llama_context_default_params();
+    context_params.n_ctx = 4096;
+    context_params.n_threads = std::max(cpu_get_num_math(), 1);
+    context_params.n_threads_batch = context_params.n_threads;
+    context_params.no_perf = true;
+    context_params.swa_full = false;
+
+    if (info.Length() > 1 && info[1].IsObject()) {
+        Napi::Object options = info[1].As<Napi::Object>();
+
+        if (options.Has("contextSize")) {
+            context_params.n_ctx = options.Get("contextSize").As<Napi::Number>().Uint32Value();
+        }
+
+        if (options.Has("batchSize")) {
+            context_params.n_batch = options.Get("batchSize").As<Napi::Number>().Uint32Value();
+            context_params.n_ubatch = context_params.n_batch;
+        }
+
+        if (options.Has("microBatchSize")) {
+            context_params.n_ubatch = std::min(
+                context_params.n_batch,
+                std::max(1u, options.Get("microBatchSize").As<Napi::Number>().Uint32Value())
+            );
+        }
+
+        if (options.Has("sequences")) {
+            context_params.n_seq_max = options.Get("sequences").As<Napi::Number>().Uint32Value();
+        }
+
+        if (options.Has("embeddings")) {
+            context_params.embeddings = options.Get("embeddings").As<Napi::Boolean>().Value();
+        }
+
+        if (options.Has("ranking") && options.Get("ranking").As<Napi::Boolean>().Value()) {
+            context_params.pooling_type = LLAMA_POOLING_TYPE_RANK;
+        }
+
+        if (options.Has("flashAttention")) {
+            context_params.flash_attn = options.Get("flashAttention").As<Napi::Boolean>().Value();
+        }
+
+        if (options.Has("threads")) {
+            const auto n_threads = options.Get("threads").As<Napi::Number>().Int32Value();
+            const auto resolved_n_threads = n_threads == 0 ? std::max((int32_t)std::thread::hardware_concurrency(), context_params.n_threads) : n_threads;
+
+            context_params.n_threads = resolved_n_threads;
+            context_params.n_threads_batch = resolved_n_threads;
+        }
+
+        if (options.Has("performanceTracking")) {
+            context_params.no_perf = !(options.Get("performanceTracking").As<Napi::Boolean>().Value());
+        }
+
+        if (options.Has("swaFullCache")) {
+            context_params.swa_full = options.Get("swaFullCache").As<Napi::Boolean>().Value();
+        }
+
+        if (options.Has("unifiedKvCache")) {
+            context_params.kv_unified = options.Get("unifiedKvCache").As<Napi::Boolean>().Value();
+        }
+
+        if (options.Has("nativeScheduler")) {
+            nativeSchedulerEnabled = options.Get("nativeScheduler").As<Napi::Boolean>().Value();
+        }
+
+        if (options.Has("kvCacheKeyType")) {
+            context_params.type_k = static_cast<ggml_type>(options.Get("kvCacheKeyType").As<Napi::Number>().Int32Value());
+        }
+
+        if (options.Has("kvCacheValueType")) {
+            context_params.type_v = static_cast<ggml_type>(options.Get("kvCacheValueType").As<Napi::Number>().Int32Value());
+        }
+
+        if (options.Has("sessionStore") && options.Get("sessionStore").IsObject()) {
+            Napi::Object sessionStoreOptions = options.Get("sessionStore").As<Napi::Object>();
+
+            const uint64_t maxMemorySize = sessionStoreOptions.Has("memorySize")
+                ? (uint64_t)std::max<int64_t>(0, sessionStoreOptions.Get("memorySize").As<Napi::Number>().Int64Value())
+                : 0;
+            const uint64_t maxDiskSize = sessionStoreOptions.Has("diskSize")
+                ? (uint64_t)std::max<int64_t>(0, sessionStoreOptions.Get("diskSize").As<Napi::Number>().Int64Value())
+                : 0;
+            const std::string directory = sessionStoreOptions.Has("directory")
+                ? sessionStoreOptions.Get("directory").As<Napi::String>().Utf8Value()
+                : std::string();
+
+            sessionStore = std::make_shared<AddonSessionStore>(maxMemorySize, maxDiskSize, directory);
+        }
+
+        if (options.Has("threadpool") && options.Get("threadpool").IsObject()) {
+            ContextThreadpoolOptions parsedThreadpoolOptions;
+            ContextThreadpoolOptions parsedBatchThreadpoolOptions;
+            const bool hasBatchThreadpoolOptions = options.Has("batchThreadpool") && options.Get("batchThreadpool").IsObject();
+
+            if (!parseContextThreadpoolOptions(options.Get("threadpool").As<Napi::Object>(), parsedThreadpoolOptions) || (
+                hasBatchThreadpoolOptions &&
+                !parseContextThreadpoolOptions(options.Get("batchThreadpool").As<Napi::Object>(), parsedBatchThreadpoolOptions)
+            )) {
+                Napi::Error::New(info.Env(), "Unsupported threadpool priority").ThrowAsJavaScriptException();
+                return;
+            }
+
+            threadpoolOptions = std::make_unique<ContextThreadpoolOptions>(parsedThreadpoolOptions);
+            batchThreadpoolOptions = std::make_unique<ContextThreadpoolOptions>(
+                hasBatchThreadpoolOptions
+                    ? parsedBatchThreadpoolOptions
+                    : parsedThreadpoolOptions
+            );
+        }
+    }
+}
+AddonContext::~AddonContext() {
+    dispose();
+}
+
+void AddonContext::dispose() {
+    if (disposed) {
+        return;
+    }
+
+    disposed = true;
+
+    stopScheduler();
+    ngramDraftIndexes.clear();
+
+    if (sessionStore != nullptr) {
+        sessionStore->clear();
+        sessionStore.reset();
+    }
+
+    if (contextLoaded) {
+        contextLoaded = false;
+        llama_free(ctx);
+
+        adjustNapiExternalMemorySubtract(Env(), loadedContextMemorySize);
+        loadedContextMemorySize = 0;
+    }
+
+    // the threadpools must be freed only after the context that uses them
+    threadpools.reset();
+
+    model->Unref();
+
+    disposeBatch();
+}
+void AddonContext::initBatch(int32_t n_tokens) {
+    if (has_batch && n_tokens <= batchCapacity) {
+        common_batch_clear(batch);
+        batch_n_tokens = n_tokens;
+        return;
+    }
+
+    if (has_batch) {
+        llama_batch_free(batch);
+    }
+
+    // grow geometrically up to the batch size, so a batch that grows gradually doesn't reallocate on every cycle
+    const int32_t newCapacity = std::max(
+        n_tokens,
+        std::min(batchCapacity * 2, static_cast<int32_t>(context_params.n_batch))
+    );
+
+    // the arguments of `calculateBatchMemorySize` below must match the ones used here
+    batch = llama_batch_init(newCapacity, 0, 1);
+    has_batch = true;
+    batch_n_tokens = n_tokens;
+    batchCapacity = newCapacity;
+    batchAllocations++;
+
+    uint64_t newBatchMemorySize = calculateBatchMemorySize(newCapacity, 0, 1);
+    if (newBatchMemorySize > batchMemorySize) {
+        adjustNapiExternalMemoryAdd(Env(), newBatchMemorySize - batchMemorySize);
+        batchMemorySize = newBatchMemorySize;
+    } else if (newBatchMemorySize < batchMemorySize) {
+        adjustNapiExternalMemorySubtract(Env(), batchMemorySize - newBatchMemorySize);
+        batchMemorySize = newBatchMemorySize;
+    }
+}
+
+void AddonContext::disposeBatch() {
+    if (!has_batch) {
+        return;
+    }
+
+    llama_batch_free(batch);
+    has_batch = false;
+    batch_n_tokens = 0;
+    batchCapacity = 0;
+
+    adjustNapiExternalMemorySubtract(Env(), batchMemorySize);
+    batchMemorySize = 0;
+}
+
+void AddonContext::stopScheduler() {
+    if (scheduler == nullptr) {
+        return;
+    }
+
+    scheduler->stop();
+    scheduler.reset();
+}
+
+void AddonContext::applyRequestedThreads() {
+    const int32_t threads = requestedThreads.load();
+    if (!contextLoaded || threads <= 0 || llama_n_threads(ctx) == threads) {
+        return;
+    }
+
+    llama_set_n_threads(ctx, threads, threads);
+}
+
+void AddonContext::refreshMemoryInfo() {
+    if (!contextLoaded) {
+        return;
+    }
+
+    llama_memory_t memory = llama_get_memory(ctx);
+    std::vector<std::pair<llama_pos, llama_pos>> positions(llama_n_seq_max(ctx));
+    for (size_t i = 0; i < positions.size(); i++) {
+        const llama_seq_id sequenceId = static_cast<llama_seq_id>(i);
+        positions[i] = {llama_memory_seq_pos_min(memory, sequenceId), llama_memory_seq_pos_max(memory, sequenceId)};
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(sequencePositionsMutex);
+        sequencePositions.swap(positions);
+    }
+
+    if (stateSizeRequested.exchange(false)) {
+        stateSize = llama_state_get_size(ctx);
+    }
+}
+
+class AddonContextSpeculativeStepWorker : public Napi::AsyncWorker {
+    public:
+        AddonContext* ctx;
+        AddonContext* draftCtx;
+        std::shared_ptr<NgramDraftIndex> ngramIndex;
+        SpeculativeStepParams params;
+        SpeculativeStepResult result;
+
+        AddonContextSpeculativeStepWorker(
+            const Napi::CallbackInfo& info, AddonContext* ctx, AddonContext* draftCtx, std::shared_ptr<NgramDraftIndex> ngramIndex,
+            SpeculativeStepParams params
+        )
+            : Napi::AsyncWorker(info.Env(), "AddonContextSpeculativeStepWorker"),
+              ctx(ctx),
+              draftCtx(draftCtx),
+              ngramIndex(std::move(ngramIndex)),
+              params(std::move(params)),
+              deferred(Napi::Promise::Deferred::New(info.Env())) {
+            this->params.ngramIndex = this->ngramIndex.get();
+
+            ctx->Ref();
+            this->params.sampler->Ref();
+
+            if (draftCtx != nullptr) {
+                draftCtx->Ref();
+                this->params.draftSampler->Ref();
+            }
+        }
+        ~AddonContextSpeculativeStepWorker() {
+            ctx->Unref();
+            params.sampler->Unref();
+
+            if (draftCtx != nullptr) {
+                draftCtx->Unref();
+                params.draftSampler->Unref();
+            }
+        }
+
+        Napi::Promise GetPromise() {
+            return deferred.Promise();
+        }
+
+    protected:
+        Napi::Promise::Deferred deferred;
+
+        void Execute() {
+            try {
+                runSpeculativeStep(ctx, draftCtx, params, result);
+            } catch (const std::exception& e) {
+                SetError(e.what());
+            } catch(...) {
+                SetError("Unknown error when running a speculative step");
+            }
+        }
+        void OnOK() {
+            Napi::Env env = Env();
+            Napi::Uint32Array tokens = Napi::Uint32Array::New(env, result.tokens.size());
+            for (size_t i = 0; i < result.tokens.size(); i++) {
+                tokens[i] = static_cast<uint32_t>(result.tokens[i]);
+            }
+
+            Napi::Array resultArray = Napi::Array::New(env, 6);
+            resultArray.Set(Napi::Number::New(env, 0), tokens);
+            resultArray.Set(Napi::Number::New(env, 1), Napi::Number::New(env, result.draftedTokens));
+            resultArray.Set(Napi::Number::New(env, 2), Napi::Number::New(env, result.acceptedDraftTokens));
+            resultArray.Set(Napi::Number::New(env, 3), Napi::Number::New(env, result.nextPosition));
+            resultArray.Set(Napi::Number::New(env, 4), Napi::Number::New(env, result.draftNextPosition));
+            resultArray.Set(Napi::Number::New(env, 5), Napi::Number::New(env, result.draftBranches));
+
+            deferred.Resolve(resultArray);
+        }
+        void OnError(const Napi::Error& err) {
+            deferred.Reject(err.Value());
+        }
+};
+
+Napi::Value AddonContext::Init(const Napi::CallbackInfo& info) {
+    if (disposed) {
+        Napi::Error::New(info.Env(), "Context is disposed").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    AddonContextLoadContextWorker* worker = new AddonContextLoadContextWorker(this->Env(), this);
+    worker->Queue();
+    return worker->GetPromise();
+}
+Napi::Value AddonContext::Dispose(const Napi::CallbackInfo& info) {
+    if (disposed) {
+        return info.Env().Undefined();
+    }
+
+    // the scheduler thread must not use the context after it's freed by the unload worker
+    stopScheduler();
+
+    if (contextLoaded) {
+        contextLoaded = false;
+
+        AddonContextUnloadContextWorker* worker = new AddonContextUnloadContextWorker(this->Env(), this);
+        worker->Queue();
+        return worker->GetPromise();
+    } else {
+        dispose();
+
+        Napi::Promise::Deferred deferred = Napi::Promise::Deferred::New(info.Env());
+        deferred.Resolve(info.Env().Undefined());
+        return deferred.Promise();
+    }
 }
-Napi::Value AddonContext::InitBatch(const Napi::CallbackInfo& info) {
+
+Napi::Value AddonContext::GetContextSize(const Napi::CallbackInfo& info) {
     if (disposed) {
         Napi::Error::New(info.Env(), "Context is disposed").ThrowAsJavaScriptException();
         return info.Env().Undefined();
     }
 
-    if (has_batch) {
-        llama_batch_free(batch);
+    return Napi::Number::From(info.Env(), llama_n_ctx(ctx));
+}
+Napi::Value AddonContext::InitBatch(const Napi::CallbackInfo& info) {
+    if (disposed) {
+        Napi::Error::New(info.Env(), "Context is disposed").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
     }
 
     int32_t n_tokens = info[0].As<Napi::Number>().Int32Value();
 
-    batch = llama_batch_init(n_tokens, 0, 1);
-    has_batch = true;
-    batch_n_tokens = n_tokens;
+    initBatch(n_tokens);
+    batchInUse = true;
 
-    uint64_t newBatchMemorySize = calculateBatchMemorySize(n_tokens, llama_model_n_embd(model->model), context_params.n_batch);
-    if (newBatchMemorySize > batchMemorySize) {
-        adjustNapiExternalMemoryAdd(Env(), newBatchMemorySize - batchMemorySize);
-        batchMemorySize = newBatchMemorySize;
-    } else if (newBatchMemorySize < batchMemorySize) {
-        adjustNapiExternalMemorySubtract(Env(), batchMemorySize - newBatchMemorySize);
-        batchMemorySize = newBatchMemorySize;
+    return info.Env().Undefined();
+}
+Napi::Value AddonContext::ReleaseBatch(const Napi::CallbackInfo& info) {
+    if (!batchInUse.exchange(false)) {
+        return info.Env().Undefined();
+    }
+
+    if (scheduler != nullptr) {
+        scheduler->notify();
     }
 
     return info.Env().Undefined();
@@ -550,204 +1305,872 @@ Napi::Value AddonContext::DisposeBatch(const Napi::CallbackInfo& info) {
 
     return info.Env().Undefined();
 }
+Napi::Value AddonContext::GetBatchAllocations(const Napi::CallbackInfo& info) {
+    return Napi::Number::New(info.Env(), static_cast<double>(batchAllocations));
+}
 Napi::Value AddonContext::AddToBatch(const Napi::CallbackInfo& info) {
     if (!has_batch) {
         Napi::Error::New(info.Env(), "No batch is initialized").ThrowAsJavaScriptException();
         return info.Env().Undefined();
     }
 
-    int32_t sequenceId = info[0].As<Napi::Number>().Int32Value();
-    int32_t firstTokenContextIndex = info[1].As<Napi::Number>().Int32Value();
-    Napi::Uint32Array tokens = info[2].As<Napi::Uint32Array>();
-    Napi::Uint32Array tokenLogitIndexes = info[3].As<Napi::Uint32Array>();
+    int32_t sequenceId = info[0].As<Napi::Number>().Int32Value();
+    int32_t firstTokenContextIndex = info[1].As<Napi::Number>().Int32Value();
+    Napi::Uint32Array tokens = info[2].As<Napi::Uint32Array>();
+    Napi::Uint32Array tokenLogitIndexes = info[3].As<Napi::Uint32Array>();
+
+    auto tokensLength = tokens.ElementLength();
+    auto tokenLogitIndexesLength = tokenLogitIndexes.ElementLength();
+    GGML_ASSERT(batch.n_tokens + tokensLength <= batch_n_tokens);
+
+    Napi::Uint32Array resLogitIndexes = Napi::Uint32Array::New(info.Env(), tokenLogitIndexesLength);
+
+    for (size_t i = 0, l = 0; i < tokensLength; i++) {
+        if (l < tokenLogitIndexesLength && l < tokenLogitIndexesLength && tokenLogitIndexes[l] == i) {
+            common_batch_add(batch, static_cast<llama_token>(tokens[i]), firstTokenContextIndex + i, { sequenceId }, true);
+            resLogitIndexes[l] = batch.n_tokens - 1;
+            l++;
+        } else {
+            common_batch_add(batch, static_cast<llama_token>(tokens[i]), firstTokenContextIndex + i, { sequenceId }, false);
+        }
+    }
+
+    return resLogitIndexes;
+}
+Napi::Value AddonContext::FillBatch(const Napi::CallbackInfo& info) {
+    if (!has_batch) {
+        Napi::Error::New(info.Env(), "No batch is initialized").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    Napi::Uint32Array tokens = info[0].As<Napi::Uint32Array>();
+    Napi::Int32Array positions = info[1].As<Napi::Int32Array>();
+    Napi::Int32Array sequenceIds = info[2].As<Napi::Int32Array>();
+    Napi::Uint8Array logits = info[3].As<Napi::Uint8Array>();
+
+    const size_t tokensLength = tokens.ElementLength();
+    if (positions.ElementLength() != tokensLength || sequenceIds.ElementLength() != tokensLength ||
+        logits.ElementLength() != tokensLength
+    ) {
+        Napi::Error::New(info.Env(), "All the batch arrays must have the same length").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    if (batch.n_tokens + tokensLength > static_cast<size_t>(batch_n_tokens)) {
+        Napi::Error::New(info.Env(), "The tokens exceed the size of the initialized batch").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    // the batch arrays have the same layout as the typed arrays, so they're copied in bulk
+    const int32_t offset = batch.n_tokens;
+    std::memcpy(batch.token + offset, tokens.Data(), tokensLength * sizeof(llama_token));
+    std::memcpy(batch.pos + offset, positions.Data(), tokensLength * sizeof(llama_pos));
+    std::memcpy(batch.logits + offset, logits.Data(), tokensLength * sizeof(int8_t));
+
+    const int32_t* sequenceIdsData = sequenceIds.Data();
+    for (size_t i = 0; i < tokensLength; i++) {
+        batch.n_seq_id[offset + i] = 1;
+        batch.seq_id[offset + i][0] = sequenceIdsData[i];
+    }
+
+    batch.n_tokens += static_cast<int32_t>(tokensLength);
+
+    return info.Env().Undefined();
+}
+// runs an operation on the memory of the context on a worker thread,
+// since it has to wait for a decode of the native scheduler or a state restore that's in progress
+class AddonContextMemoryOperationWorker : public Napi::AsyncWorker {
+    public:
+        AddonContext* ctx;
+        std::function<bool(llama_memory_t)> operation;
+        bool resolveResult;
+        std::string failureMessage;
+        bool result = false;
+
+        AddonContextMemoryOperationWorker(
+            const Napi::Env& env, AddonContext* ctx, std::function<bool(llama_memory_t)> operation, bool resolveResult,
+            std::string failureMessage = ""
+        )
+            : Napi::AsyncWorker(env, "AddonContextMemoryOperationWorker"),
+              ctx(ctx),
+              operation(std::move(operation)),
+              resolveResult(resolveResult),
+              failureMessage(std::move(failureMessage)),
+              deferred(Napi::Promise::Deferred::New(env)) {
+            ctx->Ref();
+        }
+        ~AddonContextMemoryOperationWorker() {
+            ctx->Unref();
+        }
+
+        Napi::Promise GetPromise() {
+            return deferred.Promise();
+        }
+
+    protected:
+        Napi::Promise::Deferred deferred;
+
+        void Execute() {
+            try {
+                AddonContextDecodeLock decodeLock(ctx);
+
+                if (!ctx->contextLoaded) {
+                    SetError("Context is disposed");
+                    return;
+                }
+
+                result = operation(llama_get_memory(ctx->ctx));
+                if (!result && !failureMessage.empty()) {
+                    SetError(failureMessage);
+                }
+            } catch (const std::exception& e) {
+                SetError(e.what());
+            } catch(...) {
+                SetError("Unknown error when modifying the context memory");
+            }
+        }
+        void OnOK() {
+            if (resolveResult) {
+                deferred.Resolve(Napi::Boolean::New(Env(), result));
+            } else {
+                deferred.Resolve(Env().Undefined());
+            }
+        }
+        void OnError(const Napi::Error& err) {
+            deferred.Reject(err.Value());
+        }
+};
+
+static Napi::Value queueMemoryOperation(
+    const Napi::CallbackInfo& info, AddonContext* ctx, std::function<bool(llama_memory_t)> operation, bool resolveResult,
+    std::string failureMessage = ""
+) {
+    if (ctx->disposed) {
+        Napi::Error::New(info.Env(), "Context is disposed").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    AddonContextMemoryOperationWorker* worker = new AddonContextMemoryOperationWorker(
+        info.Env(), ctx, std::move(operation), resolveResult, std::move(failureMessage)
+    );
+    worker->Queue();
+    return worker->GetPromise();
+}
+
+Napi::Value AddonContext::DisposeSequence(const Napi::CallbackInfo& info) {
+    int32_t sequenceId = info[0].As<Napi::Number>().Int32Value();
+
+    if (!disposed) {
+        ngramDraftIndexes.erase(sequenceId);
+    }
+
+    return queueMemoryOperation(info, this, [sequenceId](llama_memory_t memory) {
+        return llama_memory_seq_rm(memory, sequenceId, -1, -1);
+    }, false, "Failed to dispose sequence");
+}
+Napi::Value AddonContext::RemoveTokenCellsFromSequence(const Napi::CallbackInfo& info) {
+    int32_t sequenceId = info[0].As<Napi::Number>().Int32Value();
+    int32_t startPos = info[1].As<Napi::Number>().Int32Value();
+    int32_t endPos = info[2].As<Napi::Number>().Int32Value();
+
+    return queueMemoryOperation(info, this, [sequenceId, startPos, endPos](llama_memory_t memory) {
+        return llama_memory_seq_rm(memory, sequenceId, startPos, endPos);
+    }, true);
+}
+Napi::Value AddonContext::ShiftSequenceTokenCells(const Napi::CallbackInfo& info) {
+    int32_t sequenceId = info[0].As<Napi::Number>().Int32Value();
+    int32_t startPos = info[1].As<Napi::Number>().Int32Value();
+    int32_t endPos = info[2].As<Napi::Number>().Int32Value();
+    int32_t shiftDelta = info[3].As<Napi::Number>().Int32Value();
+
+    return queueMemoryOperation(info, this, [sequenceId, startPos, endPos, shiftDelta](llama_memory_t memory) {
+        llama_memory_seq_add(memory, sequenceId, startPos, endPos, shiftDelta);
+        return true;
+    }, false);
+}
+Napi::Value AddonContext::CopySequenceTokenCells(const Napi::CallbackInfo& info) {
+    int32_t sourceSequenceId = info[0].As<Napi::Number>().Int32Value();
+    int32_t destinationSequenceId = info[1].As<Napi::Number>().Int32Value();
+    int32_t startPos = info[2].As<Napi::Number>().Int32Value();
+    int32_t endPos = info[3].As<Napi::Number>().Int32Value();
+
+    return queueMemoryOperation(info, this, [sourceSequenceId, destinationSequenceId, startPos, endPos](llama_memory_t memory) {
+        llama_memory_seq_cp(memory, sourceSequenceId, destinationSequenceId, startPos, endPos);
+        return true;
+    }, false);
+}
+Napi::Value AddonContext::KeepOnlySequence(const Napi::CallbackInfo& info) {
+    int32_t sequenceId = info[0].As<Napi::Number>().Int32Value();
+
+    return queueMemoryOperation(info, this, [sequenceId](llama_memory_t memory) {
+        llama_memory_seq_keep(memory, sequenceId);
+        return true;
+    }, false);
+}
+Napi::Value AddonContext::GetSequenceKvCacheMinPosition(const Napi::CallbackInfo& info) {
+    if (disposed) {
+        Napi::Error::New(info.Env(), "Context is disposed").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    int32_t sequenceId = info[0].As<Napi::Number>().Int32Value();
+
+    std::lock_guard<std::mutex> lock(sequencePositionsMutex);
+    const llama_pos minPosition = (sequenceId >= 0 && static_cast<size_t>(sequenceId) < sequencePositions.size())
+        ? sequencePositions[sequenceId].first
+        : -1;
+
+    return Napi::Number::New(info.Env(), minPosition);
+}
+Napi::Value AddonContext::GetSequenceKvCacheMaxPosition(const Napi::CallbackInfo& info) {
+    if (disposed) {
+        Napi::Error::New(info.Env(), "Context is disposed").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    int32_t sequenceId = info[0].As<Napi::Number>().Int32Value();
+
+    std::lock_guard<std::mutex> lock(sequencePositionsMutex);
+    const llama_pos maxPosition = (sequenceId >= 0 && static_cast<size_t>(sequenceId) < sequencePositions.size())
+        ? sequencePositions[sequenceId].second
+        : -1;
+
+    return Napi::Number::New(info.Env(), maxPosition);
+}
+Napi::Value AddonContext::DecodeBatch(const Napi::CallbackInfo& info) {
+    decodedBatchOutputs = 0;
+
+    AddonContextDecodeBatchWorker* worker = new AddonContextDecodeBatchWorker(info.Env(), this);
+    worker->Queue();
+    return worker->GetPromise();
+}
+Napi::Value AddonContext::DecodeBatchAndSample(const Napi::CallbackInfo& info) {
+    if (disposed) {
+        Napi::Error::New(info.Env(), "Context is disposed").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    if (info[0].As<Napi::Uint32Array>().ElementLength() != info[1].As<Napi::Array>().Length()) {
+        Napi::Error::New(info.Env(), "The number of logit indexes must match the number of samplers").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    decodedBatchOutputs = 0;
+
+    AddonContextDecodeBatchAndSampleWorker* worker = new AddonContextDecodeBatchAndSampleWorker(info, this);
+    worker->Queue();
+    return worker->GetPromise();
+}
+Napi::Value AddonContext::SampleToken(const Napi::CallbackInfo& info) {
+    if (info.Length() > 4 && info[4].IsNumber() && !(info[4].As<Napi::Number>().DoubleValue() >= 0)) {
+        Napi::TypeError::New(info.Env(), "The maximum number of probabilities must not be negative").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    AddonContextSampleTokenWorker* worker = new AddonContextSampleTokenWorker(info, this);
+    worker->Queue();
+    return worker->GetPromise();
+}
+
+Napi::Value AddonContext::GetLogits(const Napi::CallbackInfo& info) {
+    if (disposed) {
+        Napi::Error::New(info.Env(), "Context is disposed").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    int32_t batchLogitIndex = info[0].As<Napi::Number>().Int32Value();
+
+    AddonContextGetLogitsWorker* worker = new AddonContextGetLogitsWorker(info.Env(), this, false, batchLogitIndex);
+    worker->Queue();
+    return worker->GetPromise();
+}
+Napi::Value AddonContext::GetAllLogits(const Napi::CallbackInfo& info) {
+    if (disposed) {
+        Napi::Error::New(info.Env(), "Context is disposed").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    AddonContextGetLogitsWorker* worker = new AddonContextGetLogitsWorker(info.Env(), this, true, -1);
+    worker->Queue();
+    return worker->GetPromise();
+}
+
+Napi::Value AddonContext::GetEmbedding(const Napi::CallbackInfo& info) {
+    if (disposed) {
+        Napi::Error::New(info.Env(), "Context is disposed").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    int32_t inputTokensLength = info[0].As<Napi::Number>().Int32Value();
+    int32_t maxVectorSize = (info.Length() > 1 && info[1].IsNumber()) ? info[1].As<Napi::Number>().Int32Value() : 0;
+
+    if (inputTokensLength <= 0) {
+        Napi::Error::New(info.Env(), "Invalid input tokens length").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    const int n_embd = llama_model_n_embd(model->model);
+    const enum llama_pooling_type pooling_type = llama_pooling_type(ctx);
+    const auto* embeddings = pooling_type == LLAMA_POOLING_TYPE_NONE ? NULL : llama_get_embeddings_seq(ctx, 0);
+    if (embeddings == NULL) {
+        embeddings = llama_get_embeddings_ith(ctx, inputTokensLength - 1);
+    }
+
+    if (embeddings == NULL) {
+        Napi::Error::New(info.Env(), std::string("Failed to get embeddings for token ") + std::to_string(inputTokensLength - 1)).ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    size_t resultSize = maxVectorSize == 0 ? n_embd : std::min(n_embd, maxVectorSize);
+    Napi::Float32Array result = Napi::Float32Array::New(info.Env(), resultSize);
+    std::memcpy(result.Data(), embeddings, resultSize * sizeof(float));
+
+    return result;
+}
+
+Napi::Value AddonContext::GetEmbeddings(const Napi::CallbackInfo& info) {
+    if (disposed) {
+        Napi::Error::New(info.Env(), "Context is disposed").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    EmbeddingFormat format = EmbeddingFormat::float32;
+    if (info.Length() > 1 && info[1].IsString() && !parseEmbeddingFormat(info[1].As<Napi::String>().Utf8Value(), format)) {
+        Napi::Error::New(info.Env(), "Unsupported embedding format").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    AddonContextGetEmbeddingsWorker* worker = new AddonContextGetEmbeddingsWorker(info, this, format);
+    worker->Queue();
+    return worker->GetPromise();
+}
+
+Napi::Value AddonContext::RankBatch(const Napi::CallbackInfo& info) {
+    if (disposed) {
+        Napi::Error::New(info.Env(), "Context is disposed").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    Napi::Uint32Array sequenceIdsArray = info[0].As<Napi::Uint32Array>();
+    Napi::Uint32Array tokens = info[1].As<Napi::Uint32Array>();
+    Napi::Uint32Array tokensLengths = info[2].As<Napi::Uint32Array>();
+
+    const size_t sequencesCount = sequenceIdsArray.ElementLength();
+    if (tokensLengths.ElementLength() != sequencesCount) {
+        Napi::Error::New(info.Env(), "The number of token lengths must match the number of sequences").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    size_t totalTokens = 0;
+    for (size_t i = 0; i < sequencesCount; i++) {
+        if (tokensLengths[i] == 0) {
+            Napi::Error::New(info.Env(), "Cannot rank an empty input").ThrowAsJavaScriptException();
+            return info.Env().Undefined();
+        }
 
-    auto tokensLength = tokens.ElementLength();
-    auto tokenLogitIndexesLength = tokenLogitIndexes.ElementLength();
-    GGML_ASSERT(batch.n_tokens + tokensLength <= batch_n_tokens);
+        totalTokens += tokensLengths[i];
+    }
 
-    Napi::Uint32Array resLogitIndexes = Napi::Uint32Array::New(info.Env(), tokenLogitIndexesLength);
+    if (totalTokens != tokens.ElementLength()) {
+        Napi::Error::New(info.Env(), "The total of token lengths must match the number of tokens").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    } else if (totalTokens > context_params.n_batch) {
+        Napi::Error::New(info.Env(), "The given inputs don't fit in a single batch").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
 
-    for (size_t i = 0, l = 0; i < tokensLength; i++) {
-        if (l < tokenLogitIndexesLength && l < tokenLogitIndexesLength && tokenLogitIndexes[l] == i) {
-            common_batch_add(batch, static_cast<llama_token>(tokens[i]), firstTokenContextIndex + i, { sequenceId }, true);
-            resLogitIndexes[l] = batch.n_tokens - 1;
-            l++;
-        } else {
-            common_batch_add(batch, static_cast<llama_token>(tokens[i]), firstTokenContextIndex + i, { sequenceId }, false);
+    decodedBatchOutputs = 0;
+    initBatch(static_cast<int32_t>(totalTokens));
+
+    std::vector<llama_seq_id> sequenceIds(sequencesCount);
+    for (size_t i = 0, tokenIndex = 0; i < sequencesCount; i++) {
+        sequenceIds[i] = static_cast<llama_seq_id>(sequenceIdsArray[i]);
+
+        const size_t length = tokensLengths[i];
+        for (size_t j = 0; j < length; j++, tokenIndex++) {
+            common_batch_add(batch, static_cast<llama_token>(tokens[tokenIndex]), j, { sequenceIds[i] }, j == length - 1);
         }
     }
 
-    return resLogitIndexes;
+    AddonContextRankBatchWorker* worker = new AddonContextRankBatchWorker(info.Env(), this, std::move(sequenceIds));
+    worker->Queue();
+    return worker->GetPromise();
 }
-Napi::Value AddonContext::DisposeSequence(const Napi::CallbackInfo& info) {
+
+Napi::Value AddonContext::GetStateSize(const Napi::CallbackInfo& info) {
     if (disposed) {
         Napi::Error::New(info.Env(), "Context is disposed").ThrowAsJavaScriptException();
         return info.Env().Undefined();
     }
 
-    int32_t sequenceId = info[0].As<Napi::Number>().Int32Value();
-
-    bool result = llama_memory_seq_rm(llama_get_memory(ctx), sequenceId, -1, -1);
+    // the cached size is refreshed by the next release of the lock when it's held by a decode
+    stateSizeRequested = true;
 
-    if (!result) {
-        Napi::Error::New(info.Env(), "Failed to dispose sequence").ThrowAsJavaScriptException();
-        return info.Env().Undefined();
+    std::unique_lock<std::mutex> decodeLock(decodeMutex, std::try_to_lock);
+    if (decodeLock.owns_lock()) {
+        stateSizeRequested = false;
+        stateSize = llama_state_get_size(ctx);
     }
 
-    return info.Env().Undefined();
+    return Napi::Number::From(info.Env(), stateSize.load());
 }
-Napi::Value AddonContext::RemoveTokenCellsFromSequence(const Napi::CallbackInfo& info) {
+
+Napi::Value AddonContext::GetThreads(const Napi::CallbackInfo& info) {
     if (disposed) {
         Napi::Error::New(info.Env(), "Context is disposed").ThrowAsJavaScriptException();
         return info.Env().Undefined();
     }
 
-    int32_t sequenceId = info[0].As<Napi::Number>().Int32Value();
-    int32_t startPos = info[1].As<Napi::Number>().Int32Value();
-    int32_t endPos = info[2].As<Napi::Number>().Int32Value();
-
-    bool result = llama_memory_seq_rm(llama_get_memory(ctx), sequenceId, startPos, endPos);
-
-    return Napi::Boolean::New(info.Env(), result);
+    const int32_t threads = requestedThreads;
+    return Napi::Number::From(info.Env(), threads > 0 ? threads : llama_n_threads(ctx));
 }
-Napi::Value AddonContext::ShiftSequenceTokenCells(const Napi::CallbackInfo& info) {
+
+Napi::Value AddonContext::SetThreads(const Napi::CallbackInfo& info) {
     if (disposed) {
         Napi::Error::New(info.Env(), "Context is disposed").ThrowAsJavaScriptException();
         return info.Env().Undefined();
     }
 
-    int32_t sequenceId = info[0].As<Napi::Number>().Int32Value();
-    int32_t startPos = info[1].As<Napi::Number>().Int32Value();
-    int32_t endPos = info[2].As<Napi::Number>().Int32Value();
-    int32_t shiftDelta = info[3].As<Napi::Number>().Int32Value();
+    const auto threads = info[0].As<Napi::Number>().Int32Value();
+    const auto resolvedThreads = threads == 0
+        ? std::max((int32_t)std::thread::hardware_concurrency(), std::max(cpu_get_num_math(), 1))
+        : threads;
 
-    llama_memory_seq_add(llama_get_memory(ctx), sequenceId, startPos, endPos, shiftDelta);
+    requestedThreads = resolvedThreads;
+
+    // applied by the next acquisition of the lock when it's held by a decode
+    std::unique_lock<std::mutex> decodeLock(decodeMutex, std::try_to_lock);
+    if (decodeLock.owns_lock()) {
+        applyRequestedThreads();
+    }
 
     return info.Env().Undefined();
 }
-Napi::Value AddonContext::GetSequenceKvCacheMinPosition(const Napi::CallbackInfo& info) {
-    if (disposed) {
-        Napi::Error::New(info.Env(), "Context is disposed").ThrowAsJavaScriptException();
-        return info.Env().Undefined();
+
+// reads the state of a sequence while holding the decode lock,
+// so it can be written to a file or a session store without holding it
+static std::vector<uint8_t> getSequenceState(AddonContext* context, llama_seq_id sequenceId) {
+    AddonContextDecodeLock decodeLock(context);
+
+    if (!context->contextLoaded) {
+        throw std::runtime_error("Context is disposed");
     }
 
-    int32_t sequenceId = info[0].As<Napi::Number>().Int32Value();
+    std::vector<uint8_t> state(llama_state_seq_get_size(context->ctx, sequenceId));
+    const size_t writtenSize = llama_state_seq_get_data(context->ctx, state.data(), state.size(), sequenceId);
+    if (writtenSize == 0) {
+        throw std::runtime_error("Failed to get the sequence state");
+    }
 
+    state.resize(writtenSize);
+    return state;
+}
 
-    const auto minPosition = llama_memory_seq_pos_min(llama_get_memory(ctx), sequenceId);
+// returns the number of bytes read from `state`, or `0` on failure
+static size_t setSequenceState(AddonContext* context, llama_seq_id sequenceId, const uint8_t* state, size_t stateSize) {
+    AddonContextDecodeLock decodeLock(context);
 
-    return Napi::Number::New(info.Env(), minPosition);
+    if (!context->contextLoaded) {
+        throw std::runtime_error("Context is disposed");
+    }
+
+    return llama_state_seq_set_data(context->ctx, state, stateSize, sequenceId);
 }
-Napi::Value AddonContext::GetSequenceKvCacheMaxPosition(const Napi::CallbackInfo& info) {
+
+class AddonContextSaveSequenceStateToFileWorker : public Napi::AsyncWorker {
+    public:
+        AddonContext* context;
+        std::string filepath;
+        llama_seq_id sequenceId;
+        std::vector<llama_token> tokens;
+        StateFileCompression compression;
+        size_t savedFileSize = 0;
+
+        AddonContextSaveSequenceStateToFileWorker(const Napi::CallbackInfo& info, AddonContext* context, StateFileCompression compression)
+            : Napi::AsyncWorker(info.Env(), "AddonContextSaveSequenceStateToFileWorker"),
+              context(context),
+              compression(compression),
+              deferred(Napi::Promise::Deferred::New(info.Env())) {
+            context->Ref();
+
+            filepath = info[0].As<Napi::String>().Utf8Value();
+            sequenceId = info[1].As<Napi::Number>().Int32Value();
+            Napi::Uint32Array inputTokens = info[2].As<Napi::Uint32Array>();
+
+            tokens.resize(inputTokens.ElementLength());
+            for (size_t i = 0; i < tokens.size(); i++) {
+                tokens[i] = inputTokens[i];
+            }
+        }
+        ~AddonContextSaveSequenceStateToFileWorker() {
+            context->Unref();
+        }
+
+        Napi::Promise GetPromise() {
+            return deferred.Promise();
+        }
+
+    protected:
+        Napi::Promise::Deferred deferred;
+
+        void Execute() {
+            try {
+                // llama.cpp only serializes a sequence state into a single buffer,
+                // so the state is copied out of the context first and written to the file after the decode lock is released
+                const std::vector<uint8_t> state = getSequenceState(context, sequenceId);
+
+                if (compression != StateFileCompression::none) {
+                    savedFileSize = saveCompressedSequenceStateFile(filepath.c_str(), tokens, state, compression);
+                    return;
+                }
+
+                savedFileSize = saveSequenceStateFile(filepath.c_str(), tokens, state);
+                if (savedFileSize == 0) {
+                    SetError("Failed to save state to file");
+                    return;
+                }
+            } catch (const std::exception& e) {
+                SetError(e.what());
+            } catch(...) {
+                SetError("Unknown error when saving the sequence state file");
+            }
+        }
+        void OnOK() {
+            deferred.Resolve(Napi::Number::New(Env(), savedFileSize));
+        }
+        void OnError(const Napi::Error& err) {
+            deferred.Reject(err.Value());
+        }
+};
+Napi::Value AddonContext::SaveSequenceStateToFile(const Napi::CallbackInfo& info) {
     if (disposed) {
         Napi::Error::New(info.Env(), "Context is disposed").ThrowAsJavaScriptException();
         return info.Env().Undefined();
     }
 
-    int32_t sequenceId = info[0].As<Napi::Number>().Int32Value();
-
+    StateFileCompression compression = StateFileCompression::none;
+    if (info.Length() > 3 && info[3].IsString()) {
+        if (!parseStateFileCompression(info[3].As<Napi::String>().Utf8Value(), compression)) {
+            Napi::TypeError::New(info.Env(), "Invalid state file compression").ThrowAsJavaScriptException();
+            return info.Env().Undefined();
+        }
 
-    const auto maxPosition = llama_memory_seq_pos_max(llama_get_memory(ctx), sequenceId);
+        if (!isStateFileCompressionSupported(compression)) {
+            Napi::Error::New(info.Env(), "The state file compression \"" + info[3].As<Napi::String>().Utf8Value() + "\" is not supported by this build")
+                .ThrowAsJavaScriptException();
+            return info.Env().Undefined();
+        }
+    }
 
-    return Napi::Number::New(info.Env(), maxPosition);
-}
-Napi::Value AddonContext::DecodeBatch(const Napi::CallbackInfo& info) {
-    AddonContextDecodeBatchWorker* worker = new AddonContextDecodeBatchWorker(info.Env(), this);
-    worker->Queue();
-    return worker->GetPromise();
-}
-Napi::Value AddonContext::SampleToken(const Napi::CallbackInfo& info) {
-    AddonContextSampleTokenWorker* worker = new AddonContextSampleTokenWorker(info, this);
+    AddonContextSaveSequenceStateToFileWorker* worker = new AddonContextSaveSequenceStateToFileWorker(info, this, compression);
     worker->Queue();
     return worker->GetPromise();
 }
 
-Napi::Value AddonContext::GetEmbedding(const Napi::CallbackInfo& info) {
+class AddonContextLoadSequenceStateFromFileWorker : public Napi::AsyncWorker {
+    public:
+        AddonContext* context;
+        std::string filepath;
+        llama_seq_id sequenceId;
+        size_t maxContextSize;
+        std::vector<llama_token> tokens;
+        bool useMmap = false;
+        std::shared_ptr<std::atomic<bool>> abortFlag;
+
+        AddonThreadSafeProgressEventCallbackFunction onProgressCallback;
+        bool onProgressCallbackSet = false;
+        float lastReportedProgress = 0;
+
+        AddonContextLoadSequenceStateFromFileWorker(const Napi::CallbackInfo& info, AddonContext* context)
+            : Napi::AsyncWorker(info.Env(), "AddonContextLoadSequenceStateFromFileWorker"),
+              context(context),
+              abortFlag(std::make_shared<std::atomic<bool>>(false)),
+              deferred(Napi::Promise::Deferred::New(info.Env())) {
+            context->Ref();
+
+            filepath = info[0].As<Napi::String>().Utf8Value();
+            sequenceId = info[1].As<Napi::Number>().Int32Value();
+            maxContextSize = info[2].As<Napi::Number>().Uint32Value();
+
+            if (info.Length() > 3 && info[3].IsObject()) {
+                Napi::Object options = info[3].As<Napi::Object>();
+
+                if (options.Has("useMmap")) {
+                    useMmap = options.Get("useMmap").As<Napi::Boolean>().Value() && isMappedSequenceStateFileLoadSupported();
+                }
+
+                if (options.Has("onProgress") && options.Get("onProgress").IsFunction()) {
+                    AddonThreadSafeProgressCallbackFunctionContext* callbackContext = new Napi::Reference<Napi::Value>(Napi::Persistent(info.This()));
+                    onProgressCallback = AddonThreadSafeProgressEventCallbackFunction::New(
+                        info.Env(),
+                        options.Get("onProgress").As<Napi::Function>(),
+                        "onSequenceStateLoadProgressCallback",
+                        0,
+                        1,
+                        callbackContext,
+                        [](Napi::Env, void*, AddonThreadSafeProgressCallbackFunctionContext* ctx) {
+                            delete ctx;
+                        }
+                    );
+                    onProgressCallbackSet = true;
+                }
+            }
+
+            context->sequenceStateLoadAbortFlags[sequenceId] = abortFlag;
+        }
+        ~AddonContextLoadSequenceStateFromFileWorker() {
+            context->Unref();
+        }
+
+        Napi::Promise GetPromise() {
+            return deferred.Promise();
+        }
+
+    protected:
+        Napi::Promise::Deferred deferred;
+
+        void Execute() {
+            try {
+                if (abortFlag->load()) {
+                    SetError("The sequence state load was aborted");
+                    return;
+                }
+
+                const auto onProgress = [this](float progress) {
+                    reportProgress(progress);
+                    return !abortFlag->load();
+                };
+
+                // the file is read and decompressed without holding the decode lock, which is only held for the restore itself
+                const auto restoreState = [this](const uint8_t* state, size_t stateSize) {
+                    return setSequenceState(context, sequenceId, state, stateSize);
+                };
+
+                // compressed state files are detected by their header
+                if (isCompressedSequenceStateFile(filepath.c_str())) {
+                    loadCompressedSequenceStateFile(filepath.c_str(), maxContextSize, tokens, onProgress, restoreState);
+                } else if (useMmap) {
+                    loadMappedSequenceStateFile(filepath.c_str(), maxContextSize, tokens, onProgress, restoreState);
+                } else {
+                    loadBufferedSequenceStateFile(filepath.c_str(), maxContextSize, tokens, onProgress, restoreState);
+                }
+            } catch (const std::exception& e) {
+                SetError(e.what());
+            } catch(...) {
+                SetError("Unknown error when loading the sequence state file");
+            }
+        }
+        void OnOK() {
+            finish();
+
+            Napi::Uint32Array result = Napi::Uint32Array::New(Env(), tokens.size());
+            static_assert(sizeof(llama_token) == sizeof(uint32_t), "llama_token must be 32 bits to be copied into a Uint32Array");
+            if (!tokens.empty()) {
+                std::memcpy(result.Data(), tokens.data(), tokens.size() * sizeof(llama_token));
+            }
+
+            deferred.Resolve(result);
+        }
+        void OnError(const Napi::Error& err) {
+            finish();
+            deferred.Reject(err.Value());
+        }
+
+    private:
+        void reportProgress(float progress) {
+            if (!onProgressCallbackSet || progress <= lastReportedProgress) {
+                return;
+            }
+
+            lastReportedProgress = progress;
+
+            addon_progress_event* data = new addon_progress_event {
+                progress
+            };
+
+            auto status = onProgressCallback.NonBlockingCall(data);
+            if (status != napi_ok) {
+                delete data;
+            }
+        }
+
+        void finish() {
+            auto abortFlagEntry = context->sequenceStateLoadAbortFlags.find(sequenceId);
+            if (abortFlagEntry != context->sequenceStateLoadAbortFlags.end() && abortFlagEntry->second == abortFlag) {
+                context->sequenceStateLoadAbortFlags.erase(abortFlagEntry);
+            }
+
+            if (onProgressCallbackSet) {
+                onProgressCallback.Release();
+                onProgressCallbackSet = false;
+            }
+        }
+};
+Napi::Value AddonContext::LoadSequenceStateFromFile(const Napi::CallbackInfo& info) {
     if (disposed) {
         Napi::Error::New(info.Env(), "Context is disposed").ThrowAsJavaScriptException();
         return info.Env().Undefined();
     }
 
-    int32_t inputTokensLength = info[0].As<Napi::Number>().Int32Value();
-    int32_t maxVectorSize = (info.Length() > 1 && info[1].IsNumber()) ? info[1].As<Napi::Number>().Int32Value() : 0;
+    AddonContextLoadSequenceStateFromFileWorker* worker = new AddonContextLoadSequenceStateFromFileWorker(info, this);
+    worker->Queue();
+    return worker->GetPromise();
+}
+Napi::Value AddonContext::AbortSequenceStateLoad(const Napi::CallbackInfo& info) {
+    const llama_seq_id sequenceId = info[0].As<Napi::Number>().Int32Value();
 
-    if (inputTokensLength <= 0) {
-        Napi::Error::New(info.Env(), "Invalid input tokens length").ThrowAsJavaScriptException();
-        return info.Env().Undefined();
+    auto abortFlagEntry = sequenceStateLoadAbortFlags.find(sequenceId);
+    if (abortFlagEntry != sequenceStateLoadAbortFlags.end()) {
+        abortFlagEntry->second->store(true);
     }
 
-    const int n_embd = llama_model_n_embd(model->model);
-    const enum llama_pooling_type pooling_type = llama_pooling_type(ctx);
-    const auto* embeddings = pooling_type == LLAMA_POOLING_TYPE_NONE ? NULL : llama_get_embeddings_seq(ctx, 0);
-    if (embeddings == NULL) {
-        embeddings = llama_get_embeddings_ith(ctx, inputTokensLength - 1);
-    }
+    return info.Env().Undefined();
+}
 
-    if (embeddings == NULL) {
-        Napi::Error::New(info.Env(), std::string("Failed to get embeddings for token ") + std::to_string(inputTokensLength - 1)).ThrowAsJavaScriptException();
-        return info.Env().Undefined();
-    }
+class AddonContextGetSequenceStateWorker : public Napi::AsyncWorker {
+    public:
+        AddonContext* context;
+        llama_seq_id sequenceId;
+        std::vector<uint8_t> state;
 
-    size_t resultSize = maxVectorSize == 0 ? n_embd : std::min(n_embd, maxVectorSize);
-    Napi::Float64Array result = Napi::Float64Array::New(info.Env(), resultSize);
-    for (size_t i = 0; i < resultSize; i++) {
-        result[i] = embeddings[i];
-    }
+        AddonContextGetSequenceStateWorker(const Napi::CallbackInfo& info, AddonContext* context)
+            : Napi::AsyncWorker(info.Env(), "AddonContextGetSequenceStateWorker"),
+              context(context),
+              deferred(Napi::Promise::Deferred::New(info.Env())) {
+            context->Ref();
 
-    return result;
-}
+            sequenceId = info[0].As<Napi::Number>().Int32Value();
+        }
+        ~AddonContextGetSequenceStateWorker() {
+            context->Unref();
+        }
+
+        Napi::Promise GetPromise() {
+            return deferred.Promise();
+        }
+
+    protected:
+        Napi::Promise::Deferred deferred;
 
-Napi::Value AddonContext::GetStateSize(const Napi::CallbackInfo& info) {
+        void Execute() {
+            try {
+                state = getSequenceState(context, sequenceId);
+            } catch (const std::exception& e) {
+                SetError(e.what());
+            } catch(...) {
+                SetError("Unknown error when calling \"llama_state_seq_get_data\"");
+            }
+        }
+        void OnOK() {
+            deferred.Resolve(createOwnedArrayBuffer(Env(), std::move(state)));
+        }
+        void OnError(const Napi::Error& err) {
+            deferred.Reject(err.Value());
+        }
+};
+Napi::Value AddonContext::GetSequenceState(const Napi::CallbackInfo& info) {
     if (disposed) {
         Napi::Error::New(info.Env(), "Context is disposed").ThrowAsJavaScriptException();
         return info.Env().Undefined();
     }
 
-    return Napi::Number::From(info.Env(), llama_state_get_size(ctx));
+    AddonContextGetSequenceStateWorker* worker = new AddonContextGetSequenceStateWorker(info, this);
+    worker->Queue();
+    return worker->GetPromise();
 }
 
-Napi::Value AddonContext::GetThreads(const Napi::CallbackInfo& info) {
-    if (disposed) {
-        Napi::Error::New(info.Env(), "Context is disposed").ThrowAsJavaScriptException();
-        return info.Env().Undefined();
-    }
+class AddonContextSetSequenceStateWorker : public Napi::AsyncWorker {
+    public:
+        AddonContext* context;
+        llama_seq_id sequenceId;
+        Napi::ObjectReference stateReference;
+        const uint8_t* stateData = nullptr;
+        size_t stateSize = 0;
 
-    return Napi::Number::From(info.Env(), llama_n_threads(ctx));
-}
+        AddonContextSetSequenceStateWorker(const Napi::CallbackInfo& info, AddonContext* context)
+            : Napi::AsyncWorker(info.Env(), "AddonContextSetSequenceStateWorker"),
+              context(context),
+              deferred(Napi::Promise::Deferred::New(info.Env())) {
+            context->Ref();
 
-Napi::Value AddonContext::SetThreads(const Napi::CallbackInfo& info) {
+            sequenceId = info[0].As<Napi::Number>().Int32Value();
+
+            // the state memory is read directly on the worker thread, so the buffer is kept alive until the worker is done
+            if (info[1].IsArrayBuffer()) {
+                Napi::ArrayBuffer buffer = info[1].As<Napi::ArrayBuffer>();
+                stateData = static_cast<const uint8_t*>(buffer.Data());
+                stateSize = buffer.ByteLength();
+                stateReference = Napi::Persistent(buffer.As<Napi::Object>());
+            } else {
+                Napi::Uint8Array buffer = info[1].As<Napi::Uint8Array>();
+                stateData = buffer.Data();
+                stateSize = buffer.ByteLength();
+                stateReference = Napi::Persistent(buffer.As<Napi::Object>());
+            }
+        }
+        ~AddonContextSetSequenceStateWorker() {
+            context->Unref();
+        }
+
+        Napi::Promise GetPromise() {
+            return deferred.Promise();
+        }
+
+    protected:
+        Napi::Promise::Deferred deferred;
+
+        void Execute() {
+            try {
+                const size_t readSize = setSequenceState(context, sequenceId, stateData, stateSize);
+                if (readSize == 0) {
+                    SetError("Failed to restore the sequence state. Current context sequence size may be smaller than the given state");
+                    return;
+                }
+            } catch (const std::exception& e) {
+                SetError(e.what());
+            } catch(...) {
+                SetError("Unknown error when calling \"llama_state_seq_set_data\"");
+            }
+        }
+        void OnOK() {
+            deferred.Resolve(Env().Undefined());
+        }
+        void OnError(const Napi::Error& err) {
+            deferred.Reject(err.Value());
+        }
+};
+Napi::Value AddonContext::SetSequenceState(const Napi::CallbackInfo& info) {
     if (disposed) {
         Napi::Error::New(info.Env(), "Context is disposed").ThrowAsJavaScriptException();
         return info.Env().Undefined();
     }
 
-    const auto threads = info[0].As<Napi::Number>().Int32Value();
-    const auto resolvedThreads = threads == 0
-        ? std::max((int32_t)std::thread::hardware_concurrency(), std::max(cpu_get_num_math(), 1))
-        : threads;
-
-    if (llama_n_threads(ctx) != resolvedThreads) {
-        llama_set_n_threads(ctx, resolvedThreads, resolvedThreads);
+    if (!info[1].IsArrayBuffer() && !info[1].IsTypedArray()) {
+        Napi::TypeError::New(info.Env(), "The state must be an ArrayBuffer or a Uint8Array").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
     }
 
-    return info.Env().Undefined();
+    AddonContextSetSequenceStateWorker* worker = new AddonContextSetSequenceStateWorker(info, this);
+    worker->Queue();
+    return worker->GetPromise();
 }
 
-class AddonContextSaveSequenceStateToFileWorker : public Napi::AsyncWorker {
+class AddonContextSessionStoreSaveWorker : public Napi::AsyncWorker {
     public:
         AddonContext* context;
-        std::string filepath;
+        std::shared_ptr<AddonSessionStore> sessionStore;
+        std::string key;
         llama_seq_id sequenceId;
         std::vector<llama_token> tokens;
-        size_t savedFileSize = 0;
 
-        AddonContextSaveSequenceStateToFileWorker(const Napi::CallbackInfo& info, AddonContext* context)
-            : Napi::AsyncWorker(info.Env(), "AddonContextSaveSequenceStateToFileWorker"),
+        AddonContextSessionStoreSaveWorker(const Napi::CallbackInfo& info, AddonContext* context)
+            : Napi::AsyncWorker(info.Env(), "AddonContextSessionStoreSaveWorker"),
               context(context),
+              sessionStore(context->sessionStore),
               deferred(Napi::Promise::Deferred::New(info.Env())) {
             context->Ref();
 
-            filepath = info[0].As<Napi::String>().Utf8Value();
+            key = info[0].As<Napi::String>().Utf8Value();
             sequenceId = info[1].As<Napi::Number>().Int32Value();
             Napi::Uint32Array inputTokens = info[2].As<Napi::Uint32Array>();
 
@@ -756,7 +2179,7 @@ class AddonContextSaveSequenceStateToFileWorker : public Napi::AsyncWorker {
                 tokens[i] = inputTokens[i];
             }
         }
-        ~AddonContextSaveSequenceStateToFileWorker() {
+        ~AddonContextSessionStoreSaveWorker() {
             context->Unref();
         }
 
@@ -769,56 +2192,41 @@ class AddonContextSaveSequenceStateToFileWorker : public Napi::AsyncWorker {
 
         void Execute() {
             try {
-                savedFileSize = llama_state_seq_save_file(context->ctx, filepath.c_str(), sequenceId, tokens.data(), tokens.size());
-                if (savedFileSize == 0) {
-                    SetError("Failed to save state to file");
-                    return;
-                }
+                sessionStore->save(key, getSequenceState(context, sequenceId), std::move(tokens));
             } catch (const std::exception& e) {
                 SetError(e.what());
             } catch(...) {
-                SetError("Unknown error when calling \"llama_state_seq_save_file\"");
+                SetError("Unknown error when saving a sequence state to the session store");
             }
         }
         void OnOK() {
-            deferred.Resolve(Napi::Number::New(Env(), savedFileSize));
+            deferred.Resolve(Env().Undefined());
         }
         void OnError(const Napi::Error& err) {
             deferred.Reject(err.Value());
         }
 };
-Napi::Value AddonContext::SaveSequenceStateToFile(const Napi::CallbackInfo& info) {
-    if (disposed) {
-        Napi::Error::New(info.Env(), "Context is disposed").ThrowAsJavaScriptException();
-        return info.Env().Undefined();
-    }
-
-    AddonContextSaveSequenceStateToFileWorker* worker = new AddonContextSaveSequenceStateToFileWorker(info, this);
-    worker->Queue();
-    return worker->GetPromise();
-}
 
-class AddonContextLoadSequenceStateFromFileWorker : public Napi::AsyncWorker {
+class AddonContextSessionStoreRestoreWorker : public Napi::AsyncWorker {
     public:
         AddonContext* context;
-        std::string filepath;
+        std::shared_ptr<AddonSessionStore> sessionStore;
+        std::string key;
         llama_seq_id sequenceId;
-        size_t maxContextSize;
         std::vector<llama_token> tokens;
+        bool restored = false;
 
-        AddonContextLoadSequenceStateFromFileWorker(const Napi::CallbackInfo& info, AddonContext* context)
-            : Napi::AsyncWorker(info.Env(), "AddonContextLoadSequenceStateFromFileWorker"),
+        AddonContextSessionStoreRestoreWorker(const Napi::CallbackInfo& info, AddonContext* context)
+            : Napi::AsyncWorker(info.Env(), "AddonContextSessionStoreRestoreWorker"),
               context(context),
+              sessionStore(context->sessionStore),
               deferred(Napi::Promise::Deferred::New(info.Env())) {
             context->Ref();
 
-            filepath = info[0].As<Napi::String>().Utf8Value();
+            key = info[0].As<Napi::String>().Utf8Value();
             sequenceId = info[1].As<Napi::Number>().Int32Value();
-            maxContextSize = info[2].As<Napi::Number>().Uint32Value();
-
-            tokens.resize(maxContextSize);
         }
-        ~AddonContextLoadSequenceStateFromFileWorker() {
+        ~AddonContextSessionStoreRestoreWorker() {
             context->Unref();
         }
 
@@ -831,25 +2239,24 @@ class AddonContextLoadSequenceStateFromFileWorker : public Napi::AsyncWorker {
 
         void Execute() {
             try {
-                size_t tokenCount = 0;
-                const size_t fileSize = llama_state_seq_load_file(context->ctx, filepath.c_str(), sequenceId, tokens.data(), tokens.size(), &tokenCount);
-                if (fileSize == 0) {
-                    SetError("Failed to load state from file. Current context sequence size may be smaller that the state of the file");
-                    return;
-                }
-
-                tokens.resize(tokenCount);
+                // a spilled snapshot is read from the disk before the decode lock is acquired for the restore
+                restored = sessionStore->restore(key, tokens, [this](const uint8_t* state, size_t stateSize) {
+                    return setSequenceState(context, sequenceId, state, stateSize);
+                });
             } catch (const std::exception& e) {
                 SetError(e.what());
             } catch(...) {
-                SetError("Unknown error when calling \"llama_state_seq_load_file\"");
+                SetError("Unknown error when restoring a sequence state from the session store");
             }
         }
         void OnOK() {
-            size_t tokenCount = tokens.size();
-            Napi::Uint32Array result = Napi::Uint32Array::New(Env(), tokenCount);
+            if (!restored) {
+                deferred.Resolve(Env().Null());
+                return;
+            }
 
-            for (size_t i = 0; i < tokenCount; i++) {
+            Napi::Uint32Array result = Napi::Uint32Array::New(Env(), tokens.size());
+            for (size_t i = 0; i < tokens.size(); i++) {
                 result[i] = tokens[i];
             }
 
@@ -859,16 +2266,127 @@ class AddonContextLoadSequenceStateFromFileWorker : public Napi::AsyncWorker {
             deferred.Reject(err.Value());
         }
 };
-Napi::Value AddonContext::LoadSequenceStateFromFile(const Napi::CallbackInfo& info) {
-    if (disposed) {
+
+class AddonContextSessionStorePrefetchWorker : public Napi::AsyncWorker {
+    public:
+        AddonContext* context;
+        std::shared_ptr<AddonSessionStore> sessionStore;
+        std::string key;
+        bool found = false;
+
+        AddonContextSessionStorePrefetchWorker(const Napi::CallbackInfo& info, AddonContext* context)
+            : Napi::AsyncWorker(info.Env(), "AddonContextSessionStorePrefetchWorker"),
+              context(context),
+              sessionStore(context->sessionStore),
+              deferred(Napi::Promise::Deferred::New(info.Env())) {
+            context->Ref();
+
+            key = info[0].As<Napi::String>().Utf8Value();
+        }
+        ~AddonContextSessionStorePrefetchWorker() {
+            context->Unref();
+        }
+
+        Napi::Promise GetPromise() {
+            return deferred.Promise();
+        }
+
+    protected:
+        Napi::Promise::Deferred deferred;
+
+        void Execute() {
+            try {
+                found = sessionStore->prefetch(key);
+            } catch (const std::exception& e) {
+                SetError(e.what());
+            } catch(...) {
+                SetError("Unknown error when prefetching a sequence state in the session store");
+            }
+        }
+        void OnOK() {
+            deferred.Resolve(Napi::Boolean::New(Env(), found));
+        }
+        void OnError(const Napi::Error& err) {
+            deferred.Reject(err.Value());
+        }
+};
+
+static bool ensureSessionStoreIsEnabled(const Napi::CallbackInfo& info, AddonContext* context) {
+    if (context->disposed) {
         Napi::Error::New(info.Env(), "Context is disposed").ThrowAsJavaScriptException();
+        return false;
+    }
+
+    if (context->sessionStore == nullptr) {
+        Napi::Error::New(info.Env(), "The session store is not enabled for this context").ThrowAsJavaScriptException();
+        return false;
+    }
+
+    return true;
+}
+
+Napi::Value AddonContext::SessionStoreSave(const Napi::CallbackInfo& info) {
+    if (!ensureSessionStoreIsEnabled(info, this)) {
         return info.Env().Undefined();
     }
 
-    AddonContextLoadSequenceStateFromFileWorker* worker = new AddonContextLoadSequenceStateFromFileWorker(info, this);
+    AddonContextSessionStoreSaveWorker* worker = new AddonContextSessionStoreSaveWorker(info, this);
+    worker->Queue();
+    return worker->GetPromise();
+}
+Napi::Value AddonContext::SessionStoreRestore(const Napi::CallbackInfo& info) {
+    if (!ensureSessionStoreIsEnabled(info, this)) {
+        return info.Env().Undefined();
+    }
+
+    AddonContextSessionStoreRestoreWorker* worker = new AddonContextSessionStoreRestoreWorker(info, this);
+    worker->Queue();
+    return worker->GetPromise();
+}
+Napi::Value AddonContext::SessionStorePrefetch(const Napi::CallbackInfo& info) {
+    if (!ensureSessionStoreIsEnabled(info, this)) {
+        return info.Env().Undefined();
+    }
+
+    AddonContextSessionStorePrefetchWorker* worker = new AddonContextSessionStorePrefetchWorker(info, this);
     worker->Queue();
     return worker->GetPromise();
 }
+Napi::Value AddonContext::SessionStoreHas(const Napi::CallbackInfo& info) {
+    if (!ensureSessionStoreIsEnabled(info, this)) {
+        return info.Env().Undefined();
+    }
+
+    return Napi::Boolean::New(info.Env(), sessionStore->has(info[0].As<Napi::String>().Utf8Value()));
+}
+Napi::Value AddonContext::SessionStoreRemove(const Napi::CallbackInfo& info) {
+    if (!ensureSessionStoreIsEnabled(info, this)) {
+        return info.Env().Undefined();
+    }
+
+    return Napi::Boolean::New(info.Env(), sessionStore->remove(info[0].As<Napi::String>().Utf8Value()));
+}
+Napi::Value AddonContext::SessionStoreGetStats(const Napi::CallbackInfo& info) {
+    if (!ensureSessionStoreIsEnabled(info, this)) {
+        return info.Env().Undefined();
+    }
+
+    const AddonSessionStoreStats stats = sessionStore->getStats();
+
+    Napi::Object result = Napi::Object::New(info.Env());
+    result.Set("entries", Napi::Number::New(info.Env(), double(stats.entries)));
+    result.Set("memoryEntries", Napi::Number::New(info.Env(), double(stats.memoryEntries)));
+    result.Set("diskEntries", Napi::Number::New(info.Env(), double(stats.diskEntries)));
+    result.Set("memorySize", Napi::Number::New(info.Env(), double(stats.memorySize)));
+    result.Set("diskSize", Napi::Number::New(info.Env(), double(stats.diskSize)));
+    result.Set("memoryHits", Napi::Number::New(info.Env(), double(stats.memoryHits)));
+    result.Set("diskHits", Napi::Number::New(info.Env(), double(stats.diskHits)));
+    result.Set("misses", Napi::Number::New(info.Env(), double(stats.misses)));
+    result.Set("spills", Napi::Number::New(info.Env(), double(stats.spills)));
+    result.Set("evictions", Napi::Number::New(info.Env(), double(stats.evictions)));
+
+    return result;
+}
 
 Napi::Value AddonContext::PrintTimings(const Napi::CallbackInfo& info) {
     llama_perf_context_print(ctx);
@@ -934,6 +2452,100 @@ Napi::Value AddonContext::EnsureDraftContextIsCompatibleForSpeculative(const Nap
     return info.Env().Undefined();
 }
 
+Napi::Value AddonContext::SpeculativeStep(const Napi::CallbackInfo& info) {
+    if (disposed) {
+        Napi::Error::New(info.Env(), "Context is disposed").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    // drafting is done with an n-gram index of the target sequence when there's no draft context
+    AddonContext* draftContext = info[0].IsObject()
+        ? Napi::ObjectWrap<AddonContext>::Unwrap(info[0].As<Napi::Object>())
+        : nullptr;
+    if (draftContext != nullptr && draftContext->disposed) {
+        Napi::Error::New(info.Env(), "Draft context is disposed").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    if (!contextLoaded || (draftContext != nullptr && !draftContext->contextLoaded)) {
+        Napi::Error::New(info.Env(), "Context is not loaded").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    Napi::Object options = info[1].As<Napi::Object>();
+    SpeculativeStepParams params;
+    params.sequenceId = options.Get("sequenceId").As<Napi::Number>().Int32Value();
+    params.nextPosition = options.Get("nextTokenIndex").As<Napi::Number>().Int32Value();
+    params.token = options.Get("token").As<Napi::Number>().Int32Value();
+    params.sampler = Napi::ObjectWrap<AddonSampler>::Unwrap(options.Get("sampler").As<Napi::Object>());
+    params.draftNextPosition = options.Get("draftNextTokenIndex").As<Napi::Number>().Int32Value();
+    params.maxDraftTokens = options.Get("maxDraftTokens").As<Napi::Number>().Uint32Value();
+
+    Napi::Uint32Array draftTokens = options.Get("draftTokens").As<Napi::Uint32Array>();
+    params.draftTokens.assign(draftTokens.Data(), draftTokens.Data() + draftTokens.ElementLength());
+
+    if (params.sampler->disposed) {
+        Napi::Error::New(info.Env(), "Sampler is disposed").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    std::shared_ptr<NgramDraftIndex> ngramIndex;
+    if (draftContext != nullptr) {
+        params.draftSequenceId = options.Get("draftSequenceId").As<Napi::Number>().Int32Value();
+        params.draftSampler = Napi::ObjectWrap<AddonSampler>::Unwrap(options.Get("draftSampler").As<Napi::Object>());
+
+        if (params.draftSampler->disposed) {
+            Napi::Error::New(info.Env(), "Sampler is disposed").ThrowAsJavaScriptException();
+            return info.Env().Undefined();
+        }
+    } else {
+        Napi::Object ngramOptions = options.Get("ngram").As<Napi::Object>();
+        const uint32_t minNgramSize = ngramOptions.Get("minNgramSize").As<Napi::Number>().Uint32Value();
+        const uint32_t maxNgramSize = ngramOptions.Get("maxNgramSize").As<Napi::Number>().Uint32Value();
+
+        // the index is created again when the n-gram sizes change
+        ngramIndex = ngramDraftIndexes[params.sequenceId];
+        if (ngramIndex == nullptr ||
+            ngramIndex->getMinNgramSize() != std::max(minNgramSize, 1u) ||
+            ngramIndex->getMaxNgramSize() != std::max(maxNgramSize, std::max(minNgramSize, 1u))
+        ) {
+            if (params.draftNextPosition != 0) {
+                Napi::Error::New(info.Env(), "The n-gram index of the sequence has to be built from the first token").ThrowAsJavaScriptException();
+                return info.Env().Undefined();
+            }
+
+            ngramIndex = std::make_shared<NgramDraftIndex>(minNgramSize, maxNgramSize);
+            ngramDraftIndexes[params.sequenceId] = ngramIndex;
+        }
+
+        if (options.Has("branchSequenceIds")) {
+            Napi::Uint32Array branchSequenceIds = options.Get("branchSequenceIds").As<Napi::Uint32Array>();
+
+            // the shared nodes of the draft tree belong to multiple sequences, which a split KV cache doesn't support
+            if (branchSequenceIds.ElementLength() > 0 && !context_params.kv_unified) {
+                Napi::Error::New(info.Env(), "Draft branches require a unified KV cache").ThrowAsJavaScriptException();
+                return info.Env().Undefined();
+            }
+
+            for (size_t i = 0; i < branchSequenceIds.ElementLength(); i++) {
+                const llama_seq_id branchSequenceId = static_cast<llama_seq_id>(branchSequenceIds[i]);
+                if (branchSequenceId == params.sequenceId || branchSequenceIds[i] >= context_params.n_seq_max) {
+                    Napi::Error::New(info.Env(), "Invalid branch sequence id").ThrowAsJavaScriptException();
+                    return info.Env().Undefined();
+                }
+
+                params.branchSequenceIds.push_back(branchSequenceId);
+            }
+        }
+    }
+
+    AddonContextSpeculativeStepWorker* worker = new AddonContextSpeculativeStepWorker(
+        info, this, draftContext, std::move(ngramIndex), std::move(params)
+    );
+    worker->Queue();
+    return worker->GetPromise();
+}
+
 Napi::Value AddonContext::SetLora(const Napi::CallbackInfo& info) {
     AddonModelLora* lora = Napi::ObjectWrap<AddonModelLora>::Unwrap(info[0].As<Napi::Object>());
     float scale = info[1].As<Napi::Number>().FloatValue();
@@ -943,6 +2555,105 @@ Napi::Value AddonContext::SetLora(const Napi::CallbackInfo& info) {
     return info.Env().Undefined();
 }
 
+Napi::Value AddonContext::SchedulerSubmit(const Napi::CallbackInfo& info) {
+    if (disposed) {
+        Napi::Error::New(info.Env(), "Context is disposed").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    if (!nativeSchedulerEnabled) {
+        Napi::Error::New(info.Env(), "The native scheduler is not enabled for this context").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    if (!contextLoaded) {
+        Napi::Error::New(info.Env(), "Context is not loaded").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    Napi::Uint32Array tokens = info[2].As<Napi::Uint32Array>();
+    if (tokens.ElementLength() == 0) {
+        Napi::Error::New(info.Env(), "At least one token has to be submitted").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    AddonSampler* sampler = Napi::ObjectWrap<AddonSampler>::Unwrap(info[3].As<Napi::Object>());
+    if (sampler->disposed) {
+        Napi::Error::New(info.Env(), "Sampler is disposed").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    auto request = std::make_unique<AddonSchedulerRequest>();
+    request->sequenceId = info[0].As<Napi::Number>().Int32Value();
+    request->nextPosition = info[1].As<Napi::Number>().Int32Value();
+    request->pendingTokens.assign(tokens.Data(), tokens.Data() + tokens.ElementLength());
+    request->sampler = sampler;
+
+    Napi::Object options = info[4].As<Napi::Object>();
+    request->contextSize = options.Get("contextSize").As<Napi::Number>().Int32Value();
+
+    if (options.Has("maxTokens")) {
+        request->maxTokens = options.Get("maxTokens").As<Napi::Number>().Uint32Value();
+    }
+
+    if (options.Has("priority")) {
+        request->priority = options.Get("priority").As<Napi::Number>().Int32Value();
+    }
+
+    if (options.Has("stopSequences") && options.Get("stopSequences").IsArray()) {
+        Napi::Array stopSequences = options.Get("stopSequences").As<Napi::Array>();
+
+        for (uint32_t i = 0; i < stopSequences.Length(); i++) {
+            Napi::Uint32Array stopSequence = stopSequences.Get(i).As<Napi::Uint32Array>();
+            if (stopSequence.ElementLength() == 0) {
+                continue;
+            }
+
+            request->stopSequences.emplace_back(stopSequence.Data(), stopSequence.Data() + stopSequence.ElementLength());
+        }
+    }
+
+    if (request->nextPosition + static_cast<llama_pos>(request->pendingTokens.size()) > request->contextSize - 1) {
+        Napi::Error::New(info.Env(), "The submitted tokens don't fit in the context of the sequence").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    // released by the finalizer of the callback after the request finishes
+    sampler->Ref();
+
+    AddonSchedulerCallbackContext* callbackContext = new AddonSchedulerCallbackContext {
+        Napi::Persistent(info.This()),
+        sampler
+    };
+    request->callback = AddonThreadSafeSchedulerCallbackFunction::New(
+        info.Env(),
+        info[5].As<Napi::Function>(),
+        "schedulerCallback",
+        0,
+        1,
+        callbackContext,
+        [](Napi::Env, void*, AddonSchedulerCallbackContext* ctx) {
+            ctx->sampler->Unref();
+            delete ctx;
+        }
+    );
+    request->stream = callbackContext;
+
+    if (scheduler == nullptr) {
+        scheduler = std::make_unique<AddonContextScheduler>(this);
+    }
+
+    return Napi::Number::New(info.Env(), scheduler->submit(std::move(request)));
+}
+
+Napi::Value AddonContext::SchedulerCancel(const Napi::CallbackInfo& info) {
+    if (scheduler == nullptr) {
+        return Napi::Boolean::New(info.Env(), false);
+    }
+
+    return Napi::Boolean::New(info.Env(), scheduler->cancel(info[0].As<Napi::Number>().Uint32Value()));
+}
+
 void AddonContext::init(Napi::Object exports) {
     exports.Set(
         "AddonContext",
@@ -953,23 +2664,45 @@ void AddonContext::init(Napi::Object exports) {
                 InstanceMethod("init", &AddonContext::Init),
                 InstanceMethod("getContextSize", &AddonContext::GetContextSize),
                 InstanceMethod("initBatch", &AddonContext::InitBatch),
+                InstanceMethod("getBatchAllocations", &AddonContext::GetBatchAllocations),
                 InstanceMethod("addToBatch", &AddonContext::AddToBatch),
+                InstanceMethod("fillBatch", &AddonContext::FillBatch),
+                InstanceMethod("releaseBatch", &AddonContext::ReleaseBatch),
                 InstanceMethod("disposeSequence", &AddonContext::DisposeSequence),
                 InstanceMethod("removeTokenCellsFromSequence", &AddonContext::RemoveTokenCellsFromSequence),
                 InstanceMethod("shiftSequenceTokenCells", &AddonContext::ShiftSequenceTokenCells),
+                InstanceMethod("copySequenceTokenCells", &AddonContext::CopySequenceTokenCells),
+                InstanceMethod("keepOnlySequence", &AddonContext::KeepOnlySequence),
                 InstanceMethod("getSequenceKvCacheMinPosition", &AddonContext::GetSequenceKvCacheMinPosition),
                 InstanceMethod("getSequenceKvCacheMaxPosition", &AddonContext::GetSequenceKvCacheMaxPosition),
                 InstanceMethod("decodeBatch", &AddonContext::DecodeBatch),
+                InstanceMethod("decodeBatchAndSample", &AddonContext::DecodeBatchAndSample),
                 InstanceMethod("sampleToken", &AddonContext::SampleToken),
+                InstanceMethod("getLogits", &AddonContext::GetLogits),
+                InstanceMethod("getAllLogits", &AddonContext::GetAllLogits),
                 InstanceMethod("getEmbedding", &AddonContext::GetEmbedding),
+                InstanceMethod("getEmbeddings", &AddonContext::GetEmbeddings),
+                InstanceMethod("rankBatch", &AddonContext::RankBatch),
                 InstanceMethod("getStateSize", &AddonContext::GetStateSize),
                 InstanceMethod("getThreads", &AddonContext::GetThreads),
                 InstanceMethod("setThreads", &AddonContext::SetThreads),
                 InstanceMethod("printTimings", &AddonContext::PrintTimings),
                 InstanceMethod("ensureDraftContextIsCompatibleForSpeculative", &AddonContext::EnsureDraftContextIsCompatibleForSpeculative),
+                InstanceMethod("speculativeStep", &AddonContext::SpeculativeStep),
                 InstanceMethod("saveSequenceStateToFile", &AddonContext::SaveSequenceStateToFile),
                 InstanceMethod("loadSequenceStateFromFile", &AddonContext::LoadSequenceStateFromFile),
+                InstanceMethod("abortSequenceStateLoad", &AddonContext::AbortSequenceStateLoad),
+                InstanceMethod("getSequenceState", &AddonContext::GetSequenceState),
+                InstanceMethod("setSequenceState", &AddonContext::SetSequenceState),
+                InstanceMethod("sessionStoreSave", &AddonContext::SessionStoreSave),
+                InstanceMethod("sessionStoreRestore", &AddonContext::SessionStoreRestore),
+                InstanceMethod("sessionStorePrefetch", &AddonContext::SessionStorePrefetch),
+                InstanceMethod("sessionStoreHas", &AddonContext::SessionStoreHas),
+                InstanceMethod("sessionStoreRemove", &AddonContext::SessionStoreRemove),
+                InstanceMethod("sessionStoreGetStats", &AddonContext::SessionStoreGetStats),
                 InstanceMethod("setLora", &AddonContext::SetLora),
+                InstanceMethod("schedulerSubmit", &AddonContext::SchedulerSubmit),
+                InstanceMethod("schedulerCancel", &AddonContext::SchedulerCancel),
                 InstanceMethod("dispose", &AddonContext::Dispose),
             }
         )
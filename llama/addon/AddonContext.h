@@ -1,9 +1,20 @@
 #pragma once
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 #include "llama.h"
 #include "napi.h"
 #include "addonGlobals.h"
 #include "AddonSampler.h"
 
+class AddonSessionStore;
+class AddonContextScheduler;
+class NgramDraftIndex;
+class ContextThreadpools;
+struct ContextThreadpoolOptions;
+
 class AddonContext : public Napi::ObjectWrap<AddonContext> {
     public:
         AddonModel* model;
@@ -12,19 +23,76 @@ class AddonContext : public Napi::ObjectWrap<AddonContext> {
         llama_batch batch;
         uint64_t batchMemorySize = 0;
         bool has_batch = false;
+
+        // the number of tokens the current batch was initialized for
         int32_t batch_n_tokens = 0;
+
+        // the number of tokens the batch arrays are allocated for.
+        // the batch allocation only grows, and is reused by later batches that fit in it
+        int32_t batchCapacity = 0;
+
+        // the number of times the batch arrays were allocated
+        uint64_t batchAllocations = 0;
         int n_cur = 0;
 
         uint64_t loadedContextMemorySize = 0;
         bool contextLoaded = false;
 
+        // the number of outputs of the last successfully decoded batch
+        int32_t decodedBatchOutputs = 0;
+
+        // owned by the context, but also referenced by the session store workers that are still running
+        std::shared_ptr<AddonSessionStore> sessionStore;
+
+        // set when the context should use its own `ggml` threadpools, which are created when the context is loaded
+        std::unique_ptr<ContextThreadpoolOptions> threadpoolOptions;
+        std::unique_ptr<ContextThreadpoolOptions> batchThreadpoolOptions;
+        std::unique_ptr<ContextThreadpools> threadpools;
+
+        // created on the first submission to the native scheduler when the context was created with the `nativeScheduler` option
+        bool nativeSchedulerEnabled = false;
+        std::unique_ptr<AddonContextScheduler> scheduler;
+
+        // held by every decode, so the decodes of the native scheduler don't run concurrently with the ones of the JS evaluation path,
+        // and by every other access to the memory or thread settings of `ctx`, since the scheduler's cycles aren't tied to the JS locks.
+        // the native scheduler also doesn't decode while `batchInUse` is set, since the logits of a batch of the JS evaluation path
+        // have to stay valid from its decode until all of its sampling is done.
+        // it's never waited for on the JS thread, since it can be held for a whole decode
+        std::mutex decodeMutex;
+        std::atomic<bool> batchInUse = false;
+
+        // the number of threads set by `setThreads`, applied to `ctx` when `decodeMutex` is acquired. `0` when it was never set
+        std::atomic<int32_t> requestedThreads = 0;
+
+        // the minimum and maximum KV cache positions of each sequence, refreshed whenever `decodeMutex` is released,
+        // so they can be read on the JS thread without waiting for a decode that's in progress
+        std::mutex sequencePositionsMutex;
+        std::vector<std::pair<llama_pos, llama_pos>> sequencePositions;
+
+        // the size of the state of `ctx`, refreshed when `decodeMutex` is released after it was requested
+        std::atomic<uint64_t> stateSize = 0;
+        std::atomic<bool> stateSizeRequested = false;
+
+        // abort flags of the sequence state file loads that are in progress, by sequence id
+        std::unordered_map<llama_seq_id, std::shared_ptr<std::atomic<bool>>> sequenceStateLoadAbortFlags;
+
+        // the n-gram indexes of the sequences that generate with n-gram drafting, by sequence id.
+        // also referenced by the speculative step workers that are still running
+        std::unordered_map<llama_seq_id, std::shared_ptr<NgramDraftIndex>> ngramDraftIndexes;
+
         bool disposed = false;
 
         AddonContext(const Napi::CallbackInfo& info);
         ~AddonContext();
 
         void dispose();
+        void initBatch(int32_t n_tokens);
         void disposeBatch();
+        void stopScheduler();
+
+        // both expect `decodeMutex` to be held by the caller
+        void applyRequestedThreads();
+        void refreshMemoryInfo();
 
         Napi::Value Init(const Napi::CallbackInfo& info);
         Napi::Value Dispose(const Napi::CallbackInfo& info);
@@ -32,27 +100,79 @@ class AddonContext : public Napi::ObjectWrap<AddonContext> {
         Napi::Value GetContextSize(const Napi::CallbackInfo& info);
         Napi::Value InitBatch(const Napi::CallbackInfo& info);
         Napi::Value DisposeBatch(const Napi::CallbackInfo& info);
+        Napi::Value GetBatchAllocations(const Napi::CallbackInfo& info);
         Napi::Value AddToBatch(const Napi::CallbackInfo& info);
+        Napi::Value FillBatch(const Napi::CallbackInfo& info);
+        Napi::Value ReleaseBatch(const Napi::CallbackInfo& info);
         Napi::Value DisposeSequence(const Napi::CallbackInfo& info);
         Napi::Value RemoveTokenCellsFromSequence(const Napi::CallbackInfo& info);
         Napi::Value ShiftSequenceTokenCells(const Napi::CallbackInfo& info);
+        Napi::Value CopySequenceTokenCells(const Napi::CallbackInfo& info);
+        Napi::Value KeepOnlySequence(const Napi::CallbackInfo& info);
         Napi::Value GetSequenceKvCacheMinPosition(const Napi::CallbackInfo& info);
         Napi::Value GetSequenceKvCacheMaxPosition(const Napi::CallbackInfo& info);
         Napi::Value DecodeBatch(const Napi::CallbackInfo& info);
+        Napi::Value DecodeBatchAndSample(const Napi::CallbackInfo& info);
         Napi::Value SampleToken(const Napi::CallbackInfo& info);
+        Napi::Value GetLogits(const Napi::CallbackInfo& info);
+        Napi::Value GetAllLogits(const Napi::CallbackInfo& info);
 
         Napi::Value GetEmbedding(const Napi::CallbackInfo& info);
+        Napi::Value GetEmbeddings(const Napi::CallbackInfo& info);
+        Napi::Value RankBatch(const Napi::CallbackInfo& info);
         Napi::Value GetStateSize(const Napi::CallbackInfo& info);
         Napi::Value GetThreads(const Napi::CallbackInfo& info);
         Napi::Value SetThreads(const Napi::CallbackInfo& info);
 
         Napi::Value SaveSequenceStateToFile(const Napi::CallbackInfo& info);
         Napi::Value LoadSequenceStateFromFile(const Napi::CallbackInfo& info);
+        Napi::Value AbortSequenceStateLoad(const Napi::CallbackInfo& info);
+        Napi::Value GetSequenceState(const Napi::CallbackInfo& info);
+        Napi::Value SetSequenceState(const Napi::CallbackInfo& info);
+
+        Napi::Value SessionStoreSave(const Napi::CallbackInfo& info);
+        Napi::Value SessionStoreRestore(const Napi::CallbackInfo& info);
+        Napi::Value SessionStorePrefetch(const Napi::CallbackInfo& info);
+        Napi::Value SessionStoreHas(const Napi::CallbackInfo& info);
+        Napi::Value SessionStoreRemove(const Napi::CallbackInfo& info);
+        Napi::Value SessionStoreGetStats(const Napi::CallbackInfo& info);
 
         Napi::Value PrintTimings(const Napi::CallbackInfo& info);
         Napi::Value EnsureDraftContextIsCompatibleForSpeculative(const Napi::CallbackInfo& info);
+        Napi::Value SpeculativeStep(const Napi::CallbackInfo& info);
 
         Napi::Value SetLora(const Napi::CallbackInfo& info);
 
+        Napi::Value SchedulerSubmit(const Napi::CallbackInfo& info);
+        Napi::Value SchedulerCancel(const Napi::CallbackInfo& info);
+
         static void init(Napi::Object exports);
 };
+
+// Locks `decodeMutex` of the context for an exclusive access to its memory and decoding.
+// The threads requested by `setThreads` are applied when the lock is acquired,
+// and the cached information about the memory of the context is refreshed before it's released
+class AddonContextDecodeLock {
+    public:
+        explicit AddonContextDecodeLock(AddonContext* context);
+        ~AddonContextDecodeLock();
+
+        AddonContextDecodeLock(const AddonContextDecodeLock&) = delete;
+        AddonContextDecodeLock& operator=(const AddonContextDecodeLock&) = delete;
+
+    private:
+        AddonContext* context;
+        std::lock_guard<std::mutex> lock;
+};
+
+// Samples a token for each of the given batch logit indexes using the matching sampler.
+// The samplers are spread across the shared addon thread pool; items that share a sampler (or a grammar evaluation state)
+// are processed sequentially in the order they were given, since a sampler chain cannot be used concurrently.
+// The logits of all the items are resolved on the calling thread before the sampling starts, so callers don't have to prepare them.
+// `result` is filled with the sampled token for each item, or `-1` when the item has no logits or the sampler didn't select a token
+void sampleTokensInParallel(
+    AddonContext* ctx,
+    const std::vector<int32_t>& batchLogitIndexes,
+    const std::vector<AddonSampler*>& samplers,
+    std::vector<llama_token>& result
+);
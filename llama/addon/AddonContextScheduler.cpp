@@ -0,0 +1,366 @@
+#include <algorithm>
+#include <cstring>
+#include "common/common.h"
+#include "addonGlobals.h"
+#include "AddonContext.h"
+#include "AddonSampler.h"
+#include "AddonContextScheduler.h"
+
+void addonCallJsSchedulerCallback(
+    Napi::Env env, Napi::Function callback, AddonSchedulerCallbackContext* context, void* data
+) {
+    if (context == nullptr) {
+        return;
+    }
+
+    std::vector<llama_token> tokens;
+    llama_pos nextTokenIndex;
+    std::string finishReason;
+    std::string error;
+    {
+        std::lock_guard<std::mutex> lock(context->mutex);
+        tokens.swap(context->tokens);
+        nextTokenIndex = context->nextTokenIndex;
+        finishReason = context->finishReason;
+        error = context->error;
+        context->callPending = false;
+
+        if (!finishReason.empty()) {
+            if (context->finishReported) {
+                return;
+            }
+
+            context->finishReported = true;
+        }
+    }
+
+    if (env == nullptr || callback == nullptr || (tokens.empty() && finishReason.empty())) {
+        return;
+    }
+
+    try {
+        Napi::Uint32Array tokensArray = Napi::Uint32Array::New(env, tokens.size());
+        static_assert(sizeof(llama_token) == sizeof(uint32_t), "llama_token must be 32 bits to be copied into a Uint32Array");
+        if (!tokens.empty()) {
+            std::memcpy(tokensArray.Data(), tokens.data(), tokens.size() * sizeof(llama_token));
+        }
+
+        callback.Call({
+            tokensArray,
+            Napi::Number::New(env, nextTokenIndex),
+            finishReason.empty()
+                ? env.Undefined()
+                : Napi::String::New(env, finishReason),
+            error.empty()
+                ? env.Undefined()
+                : Napi::String::New(env, error)
+        });
+    } catch (const Napi::Error& e) {}
+}
+
+bool AddonSchedulerRequest::endsWithStopSequence() const {
+    for (const auto& stopSequence : stopSequences) {
+        if (stopSequence.empty() || stopSequence.size() > recentGeneratedTokens.size()) {
+            continue;
+        }
+
+        if (std::equal(stopSequence.rbegin(), stopSequence.rend(), recentGeneratedTokens.rbegin())) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+AddonContextScheduler::AddonContextScheduler(AddonContext* context)
+    : context(context) {
+    batchCapacity = static_cast<int32_t>(context->context_params.n_batch);
+    batch = llama_batch_init(batchCapacity, 0, 1);
+
+    thread = std::thread([this]() {
+        run();
+    });
+}
+
+AddonContextScheduler::~AddonContextScheduler() {
+    stop();
+    llama_batch_free(batch);
+}
+
+uint32_t AddonContextScheduler::submit(std::unique_ptr<AddonSchedulerRequest> request) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    request->id = nextRequestId++;
+    const uint32_t requestId = request->id;
+
+    if (stopping) {
+        request->cancelled = true;
+    }
+
+    cancellableRequests.push_back(request.get());
+    incomingRequests.push_back(std::move(request));
+    condition.notify_one();
+
+    return requestId;
+}
+
+bool AddonContextScheduler::cancel(uint32_t requestId) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for (AddonSchedulerRequest* request : cancellableRequests) {
+        if (request->id == requestId) {
+            request->cancelled = true;
+            condition.notify_one();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void AddonContextScheduler::notify() {
+    std::lock_guard<std::mutex> lock(mutex);
+    condition.notify_one();
+}
+
+void AddonContextScheduler::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping && !thread.joinable()) {
+            return;
+        }
+
+        stopping = true;
+        condition.notify_one();
+    }
+
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+void AddonContextScheduler::run() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this]() {
+                return stopping || !incomingRequests.empty() || (!requests.empty() && !context->batchInUse.load());
+            });
+
+            if (stopping) {
+                break;
+            }
+
+            if (!incomingRequests.empty()) {
+                for (auto& request : incomingRequests) {
+                    requests.push_back(std::move(request));
+                }
+                incomingRequests.clear();
+
+                std::stable_sort(requests.begin(), requests.end(), [](const auto& a, const auto& b) {
+                    return a->priority > b->priority;
+                });
+            }
+        }
+
+        runCycle();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto& request : incomingRequests) {
+            requests.push_back(std::move(request));
+        }
+        incomingRequests.clear();
+    }
+
+    for (size_t i = requests.size(); i > 0; i--) {
+        finishRequest(i - 1, "cancelled");
+    }
+}
+
+void AddonContextScheduler::runCycle() {
+    for (size_t i = requests.size(); i > 0; i--) {
+        if (requests[i - 1]->cancelled) {
+            finishRequest(i - 1, "cancelled");
+        }
+    }
+
+    if (requests.empty()) {
+        return;
+    }
+
+    // the logits of a batch of the JS evaluation path have to stay valid until all of its sampling is done
+    AddonContextDecodeLock decodeLock(context);
+    if (context->batchInUse.load()) {
+        return;
+    }
+
+    common_batch_clear(batch);
+
+    std::vector<size_t> batchedTokens(requests.size(), 0);
+    std::vector<int32_t> outputBatchIndexes(requests.size(), -1);
+    int32_t slotsLeft = batchCapacity;
+
+    // requests that generate tokens are added first, so long prompts don't stall the generation of other sequences
+    for (int pass = 0; pass < 2 && slotsLeft > 0; pass++) {
+        for (size_t i = 0; i < requests.size() && slotsLeft > 0; i++) {
+            AddonSchedulerRequest& request = *requests[i];
+            const bool generating = request.generatedTokens > 0;
+
+            if ((pass == 0) != generating || request.pendingTokens.empty()) {
+                continue;
+            }
+
+            const size_t tokensToAdd = std::min(request.pendingTokens.size(), static_cast<size_t>(slotsLeft));
+            const bool addsAllPendingTokens = tokensToAdd == request.pendingTokens.size();
+
+            for (size_t t = 0; t < tokensToAdd; t++) {
+                const bool isLastToken = addsAllPendingTokens && t == tokensToAdd - 1;
+                common_batch_add(batch, request.pendingTokens[t], request.nextPosition + t, { request.sequenceId }, isLastToken);
+            }
+
+            if (addsAllPendingTokens) {
+                outputBatchIndexes[i] = batch.n_tokens - 1;
+            }
+
+            batchedTokens[i] = tokensToAdd;
+            slotsLeft -= static_cast<int32_t>(tokensToAdd);
+        }
+    }
+
+    if (batch.n_tokens == 0) {
+        return;
+    }
+
+    const int decodeResult = llama_decode(context->ctx, batch);
+    if (decodeResult != 0) {
+        const std::string error = decodeResult == 1
+            ? "could not find a KV slot for the batch (try reducing the size of the batch or increase the context)"
+            : "Eval has failed";
+
+        for (size_t i = requests.size(); i > 0; i--) {
+            if (batchedTokens[i - 1] > 0) {
+                finishRequest(i - 1, "error", error);
+            }
+        }
+
+        return;
+    }
+
+    llama_synchronize(context->ctx);
+
+    std::vector<int32_t> samplingBatchIndexes;
+    std::vector<AddonSampler*> samplers;
+    std::vector<size_t> samplingRequestIndexes;
+    for (size_t i = 0; i < requests.size(); i++) {
+        if (batchedTokens[i] == 0) {
+            continue;
+        }
+
+        AddonSchedulerRequest& request = *requests[i];
+        request.pendingTokens.erase(request.pendingTokens.begin(), request.pendingTokens.begin() + batchedTokens[i]);
+        request.nextPosition += static_cast<llama_pos>(batchedTokens[i]);
+
+        if (outputBatchIndexes[i] >= 0) {
+            samplingBatchIndexes.push_back(outputBatchIndexes[i]);
+            samplers.push_back(request.sampler);
+            samplingRequestIndexes.push_back(i);
+        }
+    }
+
+    std::vector<llama_token> sampledTokens;
+    sampleTokensInParallel(context, samplingBatchIndexes, samplers, sampledTokens);
+
+    std::vector<std::pair<size_t, std::string>> finishedRequests;
+    for (size_t s = 0; s < samplingRequestIndexes.size(); s++) {
+        const size_t requestIndex = samplingRequestIndexes[s];
+        AddonSchedulerRequest& request = *requests[requestIndex];
+        const llama_token token = sampledTokens[s];
+
+        if (token < 0) {
+            finishedRequests.emplace_back(requestIndex, "error");
+            continue;
+        }
+
+        request.generatedTokens++;
+        pushToken(request, token);
+
+        if (llama_vocab_is_eog(context->model->vocab, token)) {
+            finishedRequests.emplace_back(requestIndex, "eogToken");
+        } else if (request.endsWithStopSequence()) {
+            finishedRequests.emplace_back(requestIndex, "stopSequence");
+        } else if (request.maxTokens > 0 && request.generatedTokens >= request.maxTokens) {
+            finishedRequests.emplace_back(requestIndex, "maxTokens");
+        } else if (request.nextPosition >= request.contextSize - 1) {
+            finishedRequests.emplace_back(requestIndex, "contextFull");
+        } else {
+            request.pendingTokens.push_back(token);
+        }
+    }
+
+    // the indexes are in ascending order, so the requests are removed from the end to keep the other indexes valid
+    for (size_t i = finishedRequests.size(); i > 0; i--) {
+        const auto& [requestIndex, finishReason] = finishedRequests[i - 1];
+        finishRequest(
+            requestIndex,
+            finishReason,
+            finishReason == "error"
+                ? "Failed to sample next token"
+                : ""
+        );
+    }
+}
+
+void AddonContextScheduler::finishRequest(size_t requestIndex, const std::string& finishReason, const std::string& error) {
+    std::unique_ptr<AddonSchedulerRequest> request = std::move(requests[requestIndex]);
+    requests.erase(requests.begin() + requestIndex);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        cancellableRequests.erase(
+            std::remove(cancellableRequests.begin(), cancellableRequests.end(), request.get()),
+            cancellableRequests.end()
+        );
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(request->stream->mutex);
+        request->stream->nextTokenIndex = request->nextPosition;
+        request->stream->finishReason = finishReason;
+        request->stream->error = error;
+        queueStreamCall(*request);
+    }
+
+    // the sampler and the context are released by the finalizer of the callback on the JS thread
+    request->callback.Release();
+}
+
+void AddonContextScheduler::pushToken(AddonSchedulerRequest& request, llama_token token) {
+    if (!request.stopSequences.empty()) {
+        size_t maxStopSequenceLength = 0;
+        for (const auto& stopSequence : request.stopSequences) {
+            maxStopSequenceLength = std::max(maxStopSequenceLength, stopSequence.size());
+        }
+
+        request.recentGeneratedTokens.push_back(token);
+        if (request.recentGeneratedTokens.size() > maxStopSequenceLength) {
+            request.recentGeneratedTokens.erase(request.recentGeneratedTokens.begin());
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(request.stream->mutex);
+    request.stream->tokens.push_back(token);
+    request.stream->nextTokenIndex = request.nextPosition;
+    queueStreamCall(request);
+}
+
+void AddonContextScheduler::queueStreamCall(AddonSchedulerRequest& request) {
+    if (request.stream->callPending) {
+        return;
+    }
+
+    if (request.callback.NonBlockingCall(nullptr) == napi_ok) {
+        request.stream->callPending = true;
+    }
+}
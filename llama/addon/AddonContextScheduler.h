@@ -0,0 +1,126 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "llama.h"
+#include "napi.h"
+
+class AddonContext;
+class AddonSampler;
+
+// The stream of the tokens of a request, shared between the scheduler thread and the JS thread.
+// The sampled tokens are accumulated until the JS thread takes them, and a call to the JS callback is queued only
+// when there isn't one pending already, so when JS falls behind, the tokens are coalesced into a single call
+struct AddonSchedulerCallbackContext {
+    public:
+        Napi::Reference<Napi::Value> contextReference;
+        AddonSampler* sampler;
+
+        std::mutex mutex;
+        std::vector<llama_token> tokens;
+
+        // the index of the next token of the sequence after the tokens that were evaluated by the request so far
+        llama_pos nextTokenIndex = 0;
+
+        // empty while the request is still running
+        std::string finishReason;
+        std::string error;
+
+        bool callPending = false;
+        bool finishReported = false;
+};
+void addonCallJsSchedulerCallback(
+    Napi::Env env, Napi::Function callback, AddonSchedulerCallbackContext* context, void* data
+);
+using AddonThreadSafeSchedulerCallbackFunction =
+    Napi::TypedThreadSafeFunction<AddonSchedulerCallbackContext, void, addonCallJsSchedulerCallback>;
+
+struct AddonSchedulerRequest {
+    public:
+        uint32_t id = 0;
+        llama_seq_id sequenceId = 0;
+        int32_t priority = 0;
+
+        // the tokens that are yet to be evaluated, and the position of the first one of them
+        std::vector<llama_token> pendingTokens;
+        llama_pos nextPosition = 0;
+
+        // the size of the context of the sequence, which the request finishes at
+        llama_pos contextSize = 0;
+
+        // used only by the scheduler thread
+        AddonSampler* sampler = nullptr;
+        uint32_t maxTokens = 0;
+        uint32_t generatedTokens = 0;
+
+        // the request finishes when the generated tokens end with one of these token sequences
+        std::vector<std::vector<llama_token>> stopSequences;
+        std::vector<llama_token> recentGeneratedTokens;
+
+        std::atomic<bool> cancelled = false;
+
+        AddonThreadSafeSchedulerCallbackFunction callback;
+
+        // owned by `callback`, and valid until the callback is released
+        AddonSchedulerCallbackContext* stream = nullptr;
+
+        bool endsWithStopSequence() const;
+};
+
+// Builds batches out of the submitted requests, decodes them and samples the next token of each request on a dedicated thread,
+// so generation doesn't wait for the JS event loop between decodes.
+//
+// Each decode cycle, the requests that generate tokens are added to the batch first (one token each), ordered by their priority,
+// and the remaining slots of the batch are filled with chunks of the pending prompt tokens of the other requests.
+// The sampled tokens are streamed to the callback of their request, and the request finishes on an end-of-generation token,
+// after `maxTokens` tokens, when the generated tokens end with one of its stop sequences, when the context is full,
+// or when it's cancelled.
+//
+// The sampler of a request must not be used elsewhere until the request finishes.
+class AddonContextScheduler {
+    public:
+        AddonContextScheduler(AddonContext* context);
+        ~AddonContextScheduler();
+
+        // takes ownership of the request and returns its id
+        uint32_t submit(std::unique_ptr<AddonSchedulerRequest> request);
+
+        // returns `false` when there's no running request with the given id
+        bool cancel(uint32_t requestId);
+
+        // wakes up the scheduler thread after the batch of the JS evaluation path was released
+        void notify();
+
+        // cancels all the requests and stops the scheduler thread
+        void stop();
+
+    private:
+        AddonContext* context;
+        llama_batch batch;
+        int32_t batchCapacity = 0;
+
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::vector<std::unique_ptr<AddonSchedulerRequest>> incomingRequests;
+        std::vector<AddonSchedulerRequest*> cancellableRequests;
+        uint32_t nextRequestId = 1;
+        bool stopping = false;
+
+        // used only by the scheduler thread
+        std::vector<std::unique_ptr<AddonSchedulerRequest>> requests;
+
+        std::thread thread;
+
+        void run();
+        void runCycle();
+        void finishRequest(size_t requestIndex, const std::string& finishReason, const std::string& error = "");
+        void pushToken(AddonSchedulerRequest& request, llama_token token);
+
+        // must be called while holding the lock of the stream
+        void queueStreamCall(AddonSchedulerRequest& request);
+};
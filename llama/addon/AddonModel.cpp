@@ -2,6 +2,7 @@
 #include "addonGlobals.h"
 #include "globals/addonLog.h"
 #include "globals/addonProgress.h"
+#include "globals/getNumaInfo.h"
 #include "common/common.h"
 #include "llama.h"
 #include "AddonModel.h"
@@ -92,7 +93,14 @@ class AddonModelLoadModelWorker : public Napi::AsyncWorker {
 
         void Execute() {
             try {
-                model->model = llama_model_load_from_file(model->modelPath.c_str(), model->model_params);
+                // memory-mapped weights are placed by the page cache, regardless of the memory policy of the loading thread
+                if (model->numaInterleave && !model->model_params.use_mmap) {
+                    ScopedNumaInterleave numaInterleave;
+                    model->model = llama_model_load_from_file(model->modelPath.c_str(), model->model_params);
+                } else {
+                    model->model = llama_model_load_from_file(model->modelPath.c_str(), model->model_params);
+                }
+
                 model->vocab = llama_model_get_vocab(model->model);
 
                 model->modelLoaded = model->model != nullptr && model->model != NULL;
@@ -252,6 +260,10 @@ AddonModel::AddonModel(const Napi::CallbackInfo& info) : Napi::ObjectWrap<AddonM
             model_params.use_mmap = options.Get("useMmap").As<Napi::Boolean>().Value();
         }
 
+        if (options.Has("numaInterleave")) {
+            numaInterleave = options.Get("numaInterleave").As<Napi::Boolean>().Value();
+        }
+
         if (options.Has("useMlock")) {
             model_params.use_mlock = options.Get("useMlock").As<Napi::Boolean>().Value();
         }
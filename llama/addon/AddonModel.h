@@ -25,6 +25,9 @@ class AddonModel : public Napi::ObjectWrap<AddonModel> {
         bool onLoadProgressEventCallbackSet = false;
         bool hasLoadAbortSignal = false;
 
+        // interleave the memory allocated while loading the model across all the NUMA nodes
+        bool numaInterleave = false;
+
         bool disposed = false;
 
         AddonModel(const Napi::CallbackInfo& info);
@@ -4,6 +4,7 @@
 
 #include "AddonGrammarEvaluationState.h"
 #include "AddonSampler.h"
+#include "samplingKernels.h"
 
 AddonSampler::AddonSampler(const Napi::CallbackInfo& info) : Napi::ObjectWrap<AddonSampler>(info) {
     model = Napi::ObjectWrap<AddonModel>::Unwrap(info[0].As<Napi::Object>());
@@ -135,6 +136,26 @@ void AddonSampler::rebuildChainIfNeeded() {
     }
 }
 
+bool AddonSampler::sample(const float * logits, llama_token_data_array & cur_p) {
+    rebuildChainIfNeeded();
+
+    const int n_vocab = llama_vocab_n_tokens(model->vocab);
+
+    auto & candidates = tokenCandidates;
+    getSamplingKernels().fillTokenCandidates(candidates.data(), logits, n_vocab);
+
+    cur_p = {
+        /* .data       = */ candidates.data(),
+        /* .size       = */ candidates.size(),
+        /* .selected   = */ -1,
+        /* .sorted     = */ false,
+    };
+
+    llama_sampler_apply(chain, &cur_p);
+
+    return cur_p.selected >= 0 && cur_p.selected < (int32_t)cur_p.size;
+}
+
 void AddonSampler::acceptToken(llama_token token) {
     if (repeatPenaltySampler != nullptr) {
         llama_sampler_accept(repeatPenaltySampler, token);
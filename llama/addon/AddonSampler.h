@@ -51,6 +51,7 @@ class AddonSampler : public Napi::ObjectWrap<AddonSampler> {
         void dispose();
         void freeChain();
         void rebuildChainIfNeeded();
+        bool sample(const float * logits, llama_token_data_array & cur_p);
         void acceptToken(llama_token token);
 
         Napi::Value Dispose(const Napi::CallbackInfo& info);
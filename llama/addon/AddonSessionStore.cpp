@@ -0,0 +1,434 @@
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include "AddonSessionStore.h"
+
+static std::string createRandomFilePrefix() {
+    std::random_device randomDevice;
+    const uint64_t value = (uint64_t(randomDevice()) << 32) | uint64_t(randomDevice());
+
+    char prefix[17];
+    snprintf(prefix, sizeof(prefix), "%016llx", (unsigned long long)value);
+    return std::string(prefix);
+}
+
+static bool writeStateFile(const std::string& filePath, const std::vector<uint8_t>& state) {
+    std::ofstream file(filePath, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        return false;
+    }
+
+    file.write(reinterpret_cast<const char*>(state.data()), state.size());
+    file.close();
+
+    if (!file) {
+        std::remove(filePath.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+static bool readStateFile(const std::string& filePath, std::vector<uint8_t>& state, uint64_t stateSize) {
+    std::ifstream file(filePath, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+
+    state.resize(stateSize);
+    file.read(reinterpret_cast<char*>(state.data()), stateSize);
+
+    return (uint64_t)file.gcount() == stateSize;
+}
+
+static void deleteFiles(const std::vector<std::string>& filePaths) {
+    for (const auto& filePath : filePaths) {
+        std::remove(filePath.c_str());
+    }
+}
+
+AddonSessionStore::AddonSessionStore(uint64_t maxMemorySize, uint64_t maxDiskSize, std::string directory)
+    : maxMemorySize(maxMemorySize),
+      maxDiskSize(maxDiskSize),
+      directory(std::move(directory)),
+      filePrefix(createRandomFilePrefix()) {
+}
+AddonSessionStore::~AddonSessionStore() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        pendingSpills.clear();
+    }
+
+    spillWriterCondition.notify_all();
+    if (spillWriterThread.joinable()) {
+        spillWriterThread.join();
+    }
+
+    clear();
+}
+
+void AddonSessionStore::save(const std::string& key, std::vector<uint8_t> state, std::vector<llama_token> tokens) {
+    const size_t writtenSize = state.size();
+    auto sharedState = std::make_shared<const std::vector<uint8_t>>(std::move(state));
+
+    std::vector<PendingSpill> spills;
+    std::vector<std::string> filesToDelete;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto existingEntry = entriesByKey.find(key);
+        if (existingEntry != entriesByKey.end()) {
+            eraseEntry(existingEntry->second, filesToDelete);
+        }
+
+        Entry entry;
+        entry.key = key;
+        entry.tokens = std::move(tokens);
+        entry.stateSize = writtenSize;
+        entry.state = std::move(sharedState);
+        entry.version = nextVersion++;
+
+        entries.push_front(std::move(entry));
+        entriesByKey[key] = entries.begin();
+        stats.memorySize += writtenSize;
+
+        enforceBudgets(spills, filesToDelete);
+        queueSpills(spills);
+    }
+
+    deleteFiles(filesToDelete);
+}
+
+bool AddonSessionStore::restore(
+    const std::string& key, std::vector<llama_token>& tokens, const std::function<size_t(const uint8_t*, size_t)>& restoreState
+) {
+    std::shared_ptr<const std::vector<uint8_t>> state;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto entry = entriesByKey.find(key);
+        if (entry == entriesByKey.end()) {
+            stats.misses++;
+            return false;
+        }
+
+        touch(entry->second);
+        state = entry->second->state;
+
+        if (state != nullptr) {
+            tokens = entry->second->tokens;
+            stats.memoryHits++;
+        }
+    }
+
+    if (state == nullptr) {
+        const bool loaded = loadToMemory(key, state, tokens);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!loaded) {
+            stats.misses++;
+            return false;
+        }
+
+        stats.diskHits++;
+    }
+
+    const size_t readSize = restoreState(state->data(), state->size());
+    if (readSize == 0) {
+        throw std::runtime_error("Failed to restore the sequence state from the session store");
+    }
+
+    return true;
+}
+
+bool AddonSessionStore::prefetch(const std::string& key) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto entry = entriesByKey.find(key);
+        if (entry == entriesByKey.end()) {
+            return false;
+        }
+
+        touch(entry->second);
+
+        if (entry->second->state != nullptr) {
+            return true;
+        }
+    }
+
+    std::shared_ptr<const std::vector<uint8_t>> state;
+    std::vector<llama_token> tokens;
+    return loadToMemory(key, state, tokens);
+}
+
+bool AddonSessionStore::has(const std::string& key) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return entriesByKey.find(key) != entriesByKey.end();
+}
+
+bool AddonSessionStore::remove(const std::string& key) {
+    std::vector<std::string> filesToDelete;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto entry = entriesByKey.find(key);
+        if (entry == entriesByKey.end()) {
+            return false;
+        }
+
+        eraseEntry(entry->second, filesToDelete);
+    }
+
+    deleteFiles(filesToDelete);
+    return true;
+}
+
+void AddonSessionStore::clear() {
+    std::vector<std::string> filesToDelete;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        while (!entries.empty()) {
+            eraseEntry(entries.begin(), filesToDelete);
+        }
+
+        pendingSpills.clear();
+    }
+
+    deleteFiles(filesToDelete);
+}
+
+AddonSessionStoreStats AddonSessionStore::getStats() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    AddonSessionStoreStats res = stats;
+    res.entries = entries.size();
+    res.memoryEntries = 0;
+    res.diskEntries = 0;
+
+    for (const auto& entry : entries) {
+        if (entry.state != nullptr && !entry.spilling) {
+            res.memoryEntries++;
+        }
+
+        if (!entry.filePath.empty() || entry.spilling) {
+            res.diskEntries++;
+        }
+    }
+
+    return res;
+}
+
+bool AddonSessionStore::canSpill() const {
+    return !directory.empty() && maxDiskSize > 0;
+}
+
+std::list<AddonSessionStore::Entry>::iterator AddonSessionStore::touch(std::list<Entry>::iterator entry) {
+    entries.splice(entries.begin(), entries, entry);
+    return entry;
+}
+
+void AddonSessionStore::enforceBudgets(std::vector<PendingSpill>& spills, std::vector<std::string>& filesToDelete) {
+    for (auto entry = entries.end(); entry != entries.begin() && stats.memorySize > maxMemorySize;) {
+        --entry;
+
+        if (entry->state == nullptr || entry->spilling) {
+            continue;
+        }
+
+        if (!entry->filePath.empty()) {
+            // the state is already on the disk, so there's no need to write it again
+            entry->state.reset();
+            stats.memorySize -= entry->stateSize;
+        } else if (canSpill() && entry->stateSize <= maxDiskSize) {
+            entry->spilling = true;
+            stats.memorySize -= entry->stateSize;
+            stats.diskSize += entry->stateSize; // reserved until the spill is done
+
+            spills.push_back(PendingSpill{
+                entry->key,
+                entry->version,
+                entry->state,
+                directory + "/session-" + filePrefix + "-" + std::to_string(nextFileId++) + ".bin"
+            });
+        } else {
+            entry = std::next(entry);
+            eraseEntry(std::prev(entry), filesToDelete);
+            stats.evictions++;
+        }
+    }
+
+    for (auto entry = entries.end(); entry != entries.begin() && stats.diskSize > maxDiskSize;) {
+        --entry;
+
+        if (entry->filePath.empty()) {
+            continue;
+        }
+
+        if (entry->state != nullptr) {
+            // the state is also in memory, so only the file is dropped
+            filesToDelete.push_back(entry->filePath);
+            entry->filePath.clear();
+            stats.diskSize -= entry->stateSize;
+        } else {
+            entry = std::next(entry);
+            eraseEntry(std::prev(entry), filesToDelete);
+            stats.evictions++;
+        }
+    }
+}
+
+void AddonSessionStore::eraseEntry(std::list<Entry>::iterator entry, std::vector<std::string>& filesToDelete) {
+    if (entry->spilling) {
+        stats.diskSize -= entry->stateSize;
+    } else if (entry->state != nullptr) {
+        stats.memorySize -= entry->stateSize;
+    }
+
+    if (!entry->filePath.empty()) {
+        stats.diskSize -= entry->stateSize;
+        filesToDelete.push_back(entry->filePath);
+    }
+
+    entriesByKey.erase(entry->key);
+    entries.erase(entry);
+}
+
+void AddonSessionStore::queueSpills(std::vector<PendingSpill>& spills) {
+    if (spills.empty()) {
+        return;
+    }
+
+    for (auto& spill : spills) {
+        pendingSpills.push_back(std::move(spill));
+    }
+    spills.clear();
+
+    if (!spillWriterThread.joinable()) {
+        spillWriterThread = std::thread(&AddonSessionStore::runSpillWriter, this);
+    }
+
+    spillWriterCondition.notify_one();
+}
+
+void AddonSessionStore::runSpillWriter() {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (true) {
+        spillWriterCondition.wait(lock, [this] {
+            return stopping || !pendingSpills.empty();
+        });
+
+        if (stopping) {
+            return;
+        }
+
+        PendingSpill spill = std::move(pendingSpills.front());
+        pendingSpills.pop_front();
+
+        lock.unlock();
+        writeSpill(spill);
+        lock.lock();
+    }
+}
+
+void AddonSessionStore::writeSpill(PendingSpill& spill) {
+    const bool written = writeStateFile(spill.filePath, *spill.state);
+    std::vector<std::string> filesToDelete;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto entry = entriesByKey.find(spill.key);
+        if (entry == entriesByKey.end() || entry->second->version != spill.version || !entry->second->spilling) {
+            // the entry was removed or replaced while it was written, so the file is no longer needed
+            if (written) {
+                filesToDelete.push_back(spill.filePath);
+            }
+        } else if (written) {
+            entry->second->spilling = false;
+            entry->second->state.reset();
+            entry->second->filePath = spill.filePath;
+            stats.spills++;
+        } else {
+            eraseEntry(entry->second, filesToDelete);
+            stats.evictions++;
+        }
+    }
+
+    deleteFiles(filesToDelete);
+    spill.state.reset();
+}
+
+bool AddonSessionStore::loadToMemory(
+    const std::string& key, std::shared_ptr<const std::vector<uint8_t>>& state, std::vector<llama_token>& tokens
+) {
+    std::string filePath;
+    uint64_t version;
+    uint64_t stateSize;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto entry = entriesByKey.find(key);
+        if (entry == entriesByKey.end()) {
+            return false;
+        }
+
+        if (entry->second->state != nullptr) {
+            state = entry->second->state;
+            tokens = entry->second->tokens;
+            return true;
+        }
+
+        filePath = entry->second->filePath;
+        version = entry->second->version;
+        stateSize = entry->second->stateSize;
+    }
+
+    auto loadedState = std::make_shared<std::vector<uint8_t>>();
+    const bool loaded = readStateFile(filePath, *loadedState, stateSize);
+
+    std::vector<PendingSpill> spills;
+    std::vector<std::string> filesToDelete;
+    bool res = false;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto entry = entriesByKey.find(key);
+        if (entry != entriesByKey.end() && entry->second->version == version) {
+            if (entry->second->state != nullptr) {
+                // another thread loaded it in the meantime
+                state = entry->second->state;
+                tokens = entry->second->tokens;
+                res = true;
+            } else if (loaded) {
+                // keep the file, so this state won't have to be written again when it's moved out of memory
+                entry->second->state = loadedState;
+                stats.memorySize += stateSize;
+
+                state = loadedState;
+                tokens = entry->second->tokens;
+                res = true;
+
+                enforceBudgets(spills, filesToDelete);
+                queueSpills(spills);
+            } else {
+                eraseEntry(entry->second, filesToDelete);
+                stats.evictions++;
+            }
+        }
+    }
+
+    deleteFiles(filesToDelete);
+
+    return res;
+}
@@ -0,0 +1,126 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "llama.h"
+
+struct AddonSessionStoreStats {
+    size_t entries = 0;
+    size_t memoryEntries = 0;
+    size_t diskEntries = 0;
+    uint64_t memorySize = 0;
+    uint64_t diskSize = 0;
+
+    uint64_t memoryHits = 0;
+    uint64_t diskHits = 0;
+    uint64_t misses = 0;
+    uint64_t spills = 0;
+    uint64_t evictions = 0;
+};
+
+// A store of sequence state snapshots, keyed by a session key.
+// Recently used snapshots are kept in memory up to `maxMemorySize` bytes, and colder ones are spilled to files
+// in `directory` up to `maxDiskSize` bytes. When both budgets are exhausted, the least recently used snapshots are evicted.
+//
+// All the functions are thread-safe, and the slow parts (copying states out of the store and file I/O)
+// are done without holding the store lock. Spilled snapshots are written to the disk by a background thread.
+// The store never accesses a context itself, so callers only have to lock their context while reading or restoring a state.
+class AddonSessionStore {
+    public:
+        AddonSessionStore(uint64_t maxMemorySize, uint64_t maxDiskSize, std::string directory);
+        ~AddonSessionStore();
+
+        // saves a sequence state that was read with `llama_state_seq_get_data` under `key`,
+        // replacing any existing snapshot of that key
+        void save(const std::string& key, std::vector<uint8_t> state, std::vector<llama_token> tokens);
+
+        // passes the snapshot of `key` to `restoreState` and sets `tokens` to its tokens.
+        // `restoreState` returns the number of bytes it read from the state, or `0` on failure.
+        // returns `false` when there's no snapshot for `key`, and throws when restoring the snapshot failed
+        bool restore(
+            const std::string& key, std::vector<llama_token>& tokens, const std::function<size_t(const uint8_t*, size_t)>& restoreState
+        );
+
+        // loads a spilled snapshot back into memory, so restoring it later won't have to wait for the disk.
+        // returns `false` when there's no snapshot for `key`
+        bool prefetch(const std::string& key);
+
+        bool has(const std::string& key);
+        bool remove(const std::string& key);
+
+        // removes all the snapshots and deletes all the spilled files
+        void clear();
+
+        AddonSessionStoreStats getStats();
+
+    private:
+        struct Entry {
+            std::string key;
+            std::vector<llama_token> tokens;
+            uint64_t stateSize = 0;
+
+            // `nullptr` when the state is only on the disk
+            std::shared_ptr<const std::vector<uint8_t>> state;
+
+            // empty when the state is not on the disk
+            std::string filePath;
+
+            // set while the state is being written to the disk
+            bool spilling = false;
+
+            // changes every time the entry is replaced, to detect whether the entry changed while the lock was released
+            uint64_t version = 0;
+        };
+
+        struct PendingSpill {
+            std::string key;
+            uint64_t version;
+            std::shared_ptr<const std::vector<uint8_t>> state;
+            std::string filePath;
+        };
+
+        uint64_t maxMemorySize;
+        uint64_t maxDiskSize;
+        std::string directory;
+        std::string filePrefix;
+
+        std::mutex mutex;
+
+        // ordered from the most recently used to the least recently used
+        std::list<Entry> entries;
+        std::unordered_map<std::string, std::list<Entry>::iterator> entriesByKey;
+        uint64_t nextVersion = 1;
+        uint64_t nextFileId = 1;
+
+        AddonSessionStoreStats stats;
+
+        // started on the first spill
+        std::thread spillWriterThread;
+        std::condition_variable spillWriterCondition;
+        std::deque<PendingSpill> pendingSpills;
+        bool stopping = false;
+
+        bool canSpill() const;
+        std::list<Entry>::iterator touch(std::list<Entry>::iterator entry);
+
+        // must be called while holding the lock.
+        // collects the snapshots that should be written to the disk and the files that should be deleted to stay within the budgets
+        void enforceBudgets(std::vector<PendingSpill>& spills, std::vector<std::string>& filesToDelete);
+        void eraseEntry(std::list<Entry>::iterator entry, std::vector<std::string>& filesToDelete);
+
+        // must be called while holding the lock
+        void queueSpills(std::vector<PendingSpill>& spills);
+
+        // must be called without holding the lock
+        void runSpillWriter();
+        void writeSpill(PendingSpill& spill);
+        bool loadToMemory(const std::string& key, std::shared_ptr<const std::vector<uint8_t>>& state, std::vector<llama_token>& tokens);
+};
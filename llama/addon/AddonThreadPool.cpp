@@ -0,0 +1,124 @@
+#include <algorithm>
+#include <stdexcept>
+#include "common/common.h"
+#include "AddonThreadPool.h"
+
+AddonThreadPool::AddonThreadPool(size_t threads) {
+    workers.reserve(threads);
+    for (size_t i = 0; i < threads; i++) {
+        workers.emplace_back([this]() { workerLoop(); });
+    }
+}
+AddonThreadPool::~AddonThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(jobsMutex);
+        stopping = true;
+    }
+    jobsCondition.notify_all();
+
+    for (auto & worker : workers) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+}
+
+size_t AddonThreadPool::size() const {
+    return workers.size() + 1; // the calling thread also processes tasks
+}
+
+void AddonThreadPool::run(size_t count, const std::function<void(size_t)>& task) {
+    if (count == 0) {
+        return;
+    }
+
+    auto job = std::make_shared<Job>();
+    job->task = &task;
+    job->count = count;
+
+    if (count > 1 && !workers.empty()) {
+        {
+            std::lock_guard<std::mutex> lock(jobsMutex);
+            jobs.push_back(job);
+        }
+        jobsCondition.notify_all();
+    }
+
+    processJob(*job);
+
+    {
+        std::unique_lock<std::mutex> lock(finishedMutex);
+        finishedCondition.wait(lock, [&job]() { return job->finished.load() == job->count; });
+    }
+
+    if (job->failed) {
+        throw std::runtime_error(job->errorMessage);
+    }
+}
+
+void AddonThreadPool::processJob(Job& job) {
+    while (true) {
+        const size_t index = job.nextIndex.fetch_add(1);
+        if (index >= job.count) {
+            return;
+        }
+
+        try {
+            (*job.task)(index);
+        } catch (const std::exception& e) {
+            std::lock_guard<std::mutex> lock(job.errorMutex);
+            if (!job.failed) {
+                job.failed = true;
+                job.errorMessage = e.what();
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(job.errorMutex);
+            if (!job.failed) {
+                job.failed = true;
+                job.errorMessage = "Unknown error in a thread pool task";
+            }
+        }
+
+        if (job.finished.fetch_add(1) + 1 == job.count) {
+            std::lock_guard<std::mutex> lock(finishedMutex);
+            finishedCondition.notify_all();
+        }
+    }
+}
+
+void AddonThreadPool::workerLoop() {
+    while (true) {
+        std::shared_ptr<Job> job;
+
+        {
+            std::unique_lock<std::mutex> lock(jobsMutex);
+            jobsCondition.wait(lock, [this]() { return stopping || !jobs.empty(); });
+
+            if (stopping) {
+                return;
+            }
+
+            job = jobs.front();
+
+            // all the tasks of this job have already been picked up, so other workers shouldn't wait on it
+            if (job->nextIndex.load() >= job->count) {
+                jobs.pop_front();
+                continue;
+            }
+        }
+
+        processJob(*job);
+
+        {
+            std::lock_guard<std::mutex> lock(jobsMutex);
+            if (!jobs.empty() && jobs.front() == job) {
+                jobs.pop_front();
+            }
+        }
+    }
+}
+
+AddonThreadPool& AddonThreadPool::shared() {
+    static AddonThreadPool pool(std::max(cpu_get_num_math(), 1) - 1);
+    return pool;
+}
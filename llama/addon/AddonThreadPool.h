@@ -0,0 +1,50 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A small pool of worker threads for running CPU-bound addon work (like sampling) in parallel,
+// without being limited by the size of the libuv thread pool.
+// The thread calling `run` also participates in processing the tasks, so it's safe to call it from a libuv worker thread.
+class AddonThreadPool {
+    public:
+        AddonThreadPool(size_t threads);
+        ~AddonThreadPool();
+
+        // runs `task(i)` for every `i` in `[0, count)` and returns when all of them have finished.
+        // throws a `std::runtime_error` with the message of the first task that failed
+        void run(size_t count, const std::function<void(size_t)>& task);
+
+        size_t size() const;
+
+        // a shared pool sized to the number of math CPU cores, created on first use
+        static AddonThreadPool& shared();
+
+    private:
+        struct Job {
+            const std::function<void(size_t)>* task;
+            size_t count;
+            std::atomic<size_t> nextIndex{0};
+            std::atomic<size_t> finished{0};
+            std::mutex errorMutex;
+            bool failed = false;
+            std::string errorMessage;
+        };
+
+        std::vector<std::thread> workers;
+        std::deque<std::shared_ptr<Job>> jobs;
+        std::mutex jobsMutex;
+        std::condition_variable jobsCondition;
+        std::mutex finishedMutex;
+        std::condition_variable finishedCondition;
+        bool stopping = false;
+
+        void workerLoop();
+        void processJob(Job& job);
+};
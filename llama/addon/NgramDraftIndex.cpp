@@ -0,0 +1,129 @@
+#include <algorithm>
+#include "NgramDraftIndex.h"
+
+static constexpr uint64_t hashBase = 0x100000001b3ULL;
+
+static inline uint64_t tokenHashValue(llama_token token) {
+    return static_cast<uint64_t>(static_cast<uint32_t>(token)) + 1;
+}
+
+NgramDraftIndex::NgramDraftIndex(uint32_t minNgramSize, uint32_t maxNgramSize)
+    : minNgramSize(std::max(minNgramSize, 1u)),
+      maxNgramSize(std::max(maxNgramSize, std::max(minNgramSize, 1u))) {
+    const size_t ngramSizes = this->maxNgramSize - this->minNgramSize + 1;
+    lastHashes.resize(ngramSizes, 0);
+    hashBasePowers.resize(ngramSizes, 1);
+    ngramEndPositions.resize(ngramSizes);
+
+    for (size_t i = 0; i < ngramSizes; i++) {
+        for (uint32_t p = 0; p < this->minNgramSize + i; p++) {
+            hashBasePowers[i] *= hashBase;
+        }
+    }
+}
+
+uint32_t NgramDraftIndex::getMinNgramSize() const {
+    return minNgramSize;
+}
+
+uint32_t NgramDraftIndex::getMaxNgramSize() const {
+    return maxNgramSize;
+}
+
+size_t NgramDraftIndex::size() const {
+    return tokens.size();
+}
+
+void NgramDraftIndex::push(llama_token token) {
+    tokens.push_back(token);
+    const size_t length = tokens.size();
+
+    for (size_t i = 0; i < lastHashes.size(); i++) {
+        const size_t ngramSize = minNgramSize + i;
+
+        lastHashes[i] = lastHashes[i] * hashBase + tokenHashValue(token);
+        if (length > ngramSize) {
+            lastHashes[i] -= tokenHashValue(tokens[length - 1 - ngramSize]) * hashBasePowers[i];
+        }
+
+        if (length >= ngramSize) {
+            ngramEndPositions[i][lastHashes[i]].push_back(static_cast<uint32_t>(length));
+        }
+    }
+}
+
+void NgramDraftIndex::clear() {
+    tokens.clear();
+    std::fill(lastHashes.begin(), lastHashes.end(), 0);
+
+    for (auto& positionsMap : ngramEndPositions) {
+        positionsMap.clear();
+    }
+}
+
+static bool isPrefixOf(const std::vector<llama_token>& prefix, const std::vector<llama_token>& tokens) {
+    return prefix.size() <= tokens.size() && std::equal(prefix.begin(), prefix.end(), tokens.begin());
+}
+
+void NgramDraftIndex::draft(uint32_t maxTokens, uint32_t maxDrafts, std::vector<std::vector<llama_token>>& drafts) const {
+    // bounds the lookup time of very frequent n-grams
+    constexpr size_t maxCheckedOccurrences = 64;
+
+    drafts.clear();
+
+    const size_t length = tokens.size();
+    if (maxTokens == 0 || maxDrafts == 0) {
+        return;
+    }
+
+    for (size_t i = lastHashes.size(); i > 0 && drafts.size() < maxDrafts; i--) {
+        const size_t ngramSize = minNgramSize + i - 1;
+        if (length <= ngramSize) {
+            continue;
+        }
+
+        const auto& positionsMap = ngramEndPositions[i - 1];
+        const auto positions = positionsMap.find(lastHashes[i - 1]);
+        if (positions == positionsMap.end()) {
+            continue;
+        }
+
+        size_t checkedOccurrences = 0;
+        for (
+            auto position = positions->second.rbegin();
+            position != positions->second.rend() && drafts.size() < maxDrafts && checkedOccurrences < maxCheckedOccurrences;
+            ++position
+        ) {
+            const size_t end = *position;
+            if (end >= length) {
+                continue;
+            }
+
+            checkedOccurrences++;
+
+            // the hashes can collide, so the n-gram itself is compared as well
+            if (!std::equal(tokens.begin() + (end - ngramSize), tokens.begin() + end, tokens.end() - ngramSize)) {
+                continue;
+            }
+
+            const size_t draftLength = std::min(static_cast<size_t>(maxTokens), length - end);
+            std::vector<llama_token> draft(tokens.begin() + end, tokens.begin() + end + draftLength);
+
+            bool isCovered = false;
+            for (auto& existingDraft : drafts) {
+                if (isPrefixOf(draft, existingDraft)) {
+                    isCovered = true;
+                    break;
+                } else if (isPrefixOf(existingDraft, draft)) {
+                    existingDraft = draft;
+                    isCovered = true;
+                    break;
+                }
+            }
+
+            if (!isCovered) {
+                drafts.push_back(std::move(draft));
+            }
+        }
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "llama.h"
+
+// An index of the n-grams of the tokens of a sequence, used to draft tokens for speculative decoding without a draft model.
+//
+// For each n-gram size in the configured range, a rolling hash of the last n tokens is updated on every pushed token,
+// and the end positions of all the n-grams are kept by their hash.
+// Drafting looks up the longest n-gram the tokens end with, and proposes the tokens that followed its most recent earlier occurrences,
+// which works well when the generated text copies spans of the prompt (like in code editing or RAG).
+class NgramDraftIndex {
+    public:
+        NgramDraftIndex(uint32_t minNgramSize, uint32_t maxNgramSize);
+
+        uint32_t getMinNgramSize() const;
+        uint32_t getMaxNgramSize() const;
+        size_t size() const;
+
+        void push(llama_token token);
+
+        // removes all the tokens, to build the index again from the first token
+        void clear();
+
+        // replaces `drafts` with up to `maxDrafts` distinct continuations of up to `maxTokens` tokens each,
+        // ordered from the one that follows the longest and most recent n-gram match.
+        // a continuation that is a prefix of another one is not included
+        void draft(uint32_t maxTokens, uint32_t maxDrafts, std::vector<std::vector<llama_token>>& drafts) const;
+
+    private:
+        uint32_t minNgramSize;
+        uint32_t maxNgramSize;
+        std::vector<llama_token> tokens;
+
+        // by n-gram size, starting from `minNgramSize`
+        std::vector<uint64_t> lastHashes;
+        std::vector<uint64_t> hashBasePowers;
+        std::vector<std::unordered_map<uint64_t, std::vector<uint32_t>>> ngramEndPositions;
+};
@@ -5,15 +5,25 @@
 #include "AddonGrammarEvaluationState.h"
 #include "AddonSampler.h"
 #include "AddonContext.h"
+#include "stateFileCompression.h"
 #include "globals/addonLog.h"
 #include "globals/addonProgress.h"
 #include "globals/getGpuInfo.h"
 #include "globals/getSwapInfo.h"
 #include "globals/getMemoryInfo.h"
+#include "globals/getNumaInfo.h"
+
+#ifdef NLC_DEV_BINDINGS
+#include "globals/benchmarkSampling.h"
+#include "globals/compareSamplingKernels.h"
+#endif
 
 bool backendInitialized = false;
 bool backendDisposed = false;
 
+// NUMA can only be initialized once per process, so the strategy the backend was initialized with is kept to validate later inits
+static ggml_numa_strategy backendNumaStrategy = GGML_NUMA_STRATEGY_DISABLED;
+
 Napi::Value systemInfo(const Napi::CallbackInfo& info) {
     return Napi::String::From(info.Env(), llama_print_system_info());
 }
@@ -45,6 +55,17 @@ Napi::Value addonGetSupportsMlock(const Napi::CallbackInfo& info) {
     return Napi::Boolean::New(info.Env(), llama_supports_mlock());
 }
 
+Napi::Value addonGetSupportedStateFileCompressions(const Napi::CallbackInfo& info) {
+    const std::vector<std::string> compressions = getSupportedStateFileCompressions();
+    Napi::Array result = Napi::Array::New(info.Env(), compressions.size());
+
+    for (size_t i = 0; i < compressions.size(); i++) {
+        result.Set(i, Napi::String::New(info.Env(), compressions[i]));
+    }
+
+    return result;
+}
+
 Napi::Value addonGetMathCores(const Napi::CallbackInfo& info) {
     return Napi::Number::New(info.Env(), cpu_get_num_math());
 }
@@ -98,10 +119,27 @@ Napi::Value addonGetConsts(const Napi::CallbackInfo& info) {
     return consts;
 }
 
+static bool parseNumaStrategy(const std::string& name, ggml_numa_strategy& strategy) {
+    if (name == "distribute") {
+        strategy = GGML_NUMA_STRATEGY_DISTRIBUTE;
+    } else if (name == "isolate") {
+        strategy = GGML_NUMA_STRATEGY_ISOLATE;
+    } else if (name == "numactl") {
+        strategy = GGML_NUMA_STRATEGY_NUMACTL;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
 class AddonBackendLoadWorker : public Napi::AsyncWorker {
     public:
-        AddonBackendLoadWorker(const Napi::Env& env)
+        ggml_numa_strategy numaStrategy;
+
+        AddonBackendLoadWorker(const Napi::Env& env, ggml_numa_strategy numaStrategy)
             : Napi::AsyncWorker(env, "AddonBackendLoadWorker"),
+              numaStrategy(numaStrategy),
               deferred(Napi::Promise::Deferred::New(env)) {
         }
         ~AddonBackendLoadWorker() {
@@ -118,10 +156,15 @@ class AddonBackendLoadWorker : public Napi::AsyncWorker {
             try {
                 llama_backend_init();
 
+                if (numaStrategy != GGML_NUMA_STRATEGY_DISABLED) {
+                    llama_numa_init(numaStrategy);
+                }
+
                 try {
                     if (backendDisposed) {
                         llama_backend_free();
                     } else {
+                        backendNumaStrategy = numaStrategy;
                         backendInitialized = true;
                     }
                 } catch (const std::exception& e) {
@@ -197,13 +240,33 @@ Napi::Value addonLoadBackends(const Napi::CallbackInfo& info) {
 }
 
 Napi::Value addonInit(const Napi::CallbackInfo& info) {
+    ggml_numa_strategy numaStrategy = GGML_NUMA_STRATEGY_DISABLED;
+    bool numaStrategyRequested = false;
+    if (info.Length() > 0 && info[0].IsObject()) {
+        Napi::Object options = info[0].As<Napi::Object>();
+
+        if (options.Has("numa") && options.Get("numa").IsString()) {
+            if (!parseNumaStrategy(options.Get("numa").As<Napi::String>().Utf8Value(), numaStrategy)) {
+                Napi::Error::New(info.Env(), "Unsupported NUMA strategy").ThrowAsJavaScriptException();
+                return info.Env().Undefined();
+            }
+
+            numaStrategyRequested = true;
+        }
+    }
+
     if (backendInitialized) {
+        if (numaStrategyRequested && numaStrategy != backendNumaStrategy) {
+            Napi::Error::New(info.Env(), "The NUMA strategy can't be changed after the backend is initialized").ThrowAsJavaScriptException();
+            return info.Env().Undefined();
+        }
+
         Napi::Promise::Deferred deferred = Napi::Promise::Deferred::New(info.Env());
         deferred.Resolve(info.Env().Undefined());
         return deferred.Promise();
     }
 
-    AddonBackendLoadWorker* worker = new AddonBackendLoadWorker(info.Env());
+    AddonBackendLoadWorker* worker = new AddonBackendLoadWorker(info.Env(), numaStrategy);
     worker->Queue();
     return worker->GetPromise();
 }
@@ -241,6 +304,7 @@ Napi::Object registerCallback(Napi::Env env, Napi::Object exports) {
         Napi::PropertyDescriptor::Function("getSupportsMmap", addonGetSupportsMmap),
         Napi::PropertyDescriptor::Function("getGpuSupportsMmap", addonGetGpuSupportsMmap),
         Napi::PropertyDescriptor::Function("getSupportsMlock", addonGetSupportsMlock),
+        Napi::PropertyDescriptor::Function("getSupportedStateFileCompressions", addonGetSupportedStateFileCompressions),
         Napi::PropertyDescriptor::Function("getMathCores", addonGetMathCores),
         Napi::PropertyDescriptor::Function("getBlockSizeForGgmlType", addonGetBlockSizeForGgmlType),
         Napi::PropertyDescriptor::Function("getTypeSizeForGgmlType", addonGetTypeSizeForGgmlType),
@@ -254,10 +318,20 @@ Napi::Object registerCallback(Napi::Env env, Napi::Object exports) {
         Napi::PropertyDescriptor::Function("ensureGpuDeviceIsSupported", ensureGpuDeviceIsSupported),
         Napi::PropertyDescriptor::Function("getSwapInfo", getSwapInfo),
         Napi::PropertyDescriptor::Function("getMemoryInfo", getMemoryInfo),
+        Napi::PropertyDescriptor::Function("getNumaInfo", getNumaInfo),
         Napi::PropertyDescriptor::Function("loadBackends", addonLoadBackends),
         Napi::PropertyDescriptor::Function("init", addonInit),
         Napi::PropertyDescriptor::Function("dispose", addonDispose),
     });
+
+#ifdef NLC_DEV_BINDINGS
+    // development only bindings, for benchmarking and testing internals that aren't otherwise exposed
+    exports.DefineProperties({
+        Napi::PropertyDescriptor::Function("benchmarkSampling", benchmarkSampling),
+        Napi::PropertyDescriptor::Function("compareSamplingKernels", compareSamplingKernels),
+    });
+#endif
+
     AddonModel::init(exports);
     AddonModelLora::init(exports);
     AddonGrammar::init(exports);
@@ -0,0 +1,88 @@
+#include <stdexcept>
+#include "ggml-backend.h"
+#include "ggml-cpu.h"
+#include "contextThreadpools.h"
+
+bool parseThreadpoolPriority(const std::string& name, ggml_sched_priority& priority) {
+    if (name == "low") {
+        priority = GGML_SCHED_PRIO_LOW;
+    } else if (name == "normal") {
+        priority = GGML_SCHED_PRIO_NORMAL;
+    } else if (name == "medium") {
+        priority = GGML_SCHED_PRIO_MEDIUM;
+    } else if (name == "high") {
+        priority = GGML_SCHED_PRIO_HIGH;
+    } else if (name == "realtime") {
+        priority = GGML_SCHED_PRIO_REALTIME;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+static ggml_threadpool_params createThreadpoolParams(int threads, const ContextThreadpoolOptions& options, bool paused) {
+    ggml_threadpool_params params;
+    ggml_threadpool_params_init(&params, threads);
+
+    for (const uint32_t cpu : options.cpuMask) {
+        if (cpu >= GGML_MAX_N_THREADS) {
+            throw std::runtime_error("CPU " + std::to_string(cpu) + " is out of the supported range for a threadpool CPU mask");
+        }
+
+        params.cpumask[cpu] = true;
+    }
+
+    params.strict_cpu = options.strictCpu;
+    params.prio = options.priority;
+    params.poll = options.poll;
+    params.paused = paused;
+
+    return params;
+}
+
+ContextThreadpools::ContextThreadpools(
+    int threads, const ContextThreadpoolOptions& options, const ContextThreadpoolOptions& batchOptions
+) {
+    // the CPU backend may be loaded dynamically, so its functions have to be resolved through the backend registry
+    ggml_backend_dev_t cpuDevice = ggml_backend_dev_by_type(GGML_BACKEND_DEVICE_TYPE_CPU);
+    if (cpuDevice == nullptr) {
+        throw std::runtime_error("The CPU backend is not available");
+    }
+
+    ggml_backend_reg_t cpuBackendRegistry = ggml_backend_dev_backend_reg(cpuDevice);
+    auto * newThreadpool = (decltype(ggml_threadpool_new) *) ggml_backend_reg_get_proc_address(cpuBackendRegistry, "ggml_threadpool_new");
+    freeThreadpool = (decltype(ggml_threadpool_free) *) ggml_backend_reg_get_proc_address(cpuBackendRegistry, "ggml_threadpool_free");
+
+    if (newThreadpool == nullptr || freeThreadpool == nullptr) {
+        throw std::runtime_error("The CPU backend doesn't support threadpools");
+    }
+
+    ggml_threadpool_params batchParams = createThreadpoolParams(threads, batchOptions, false);
+    batchThreadpool = newThreadpool(&batchParams);
+    if (batchThreadpool == nullptr) {
+        throw std::runtime_error("Failed to create a batch threadpool with " + std::to_string(threads) + " threads");
+    }
+
+    // the single-token pool starts paused, and is resumed by `ggml` when it's first used
+    ggml_threadpool_params params = createThreadpoolParams(threads, options, true);
+    threadpool = newThreadpool(&params);
+    if (threadpool == nullptr) {
+        freeThreadpool(batchThreadpool);
+        batchThreadpool = nullptr;
+
+        throw std::runtime_error("Failed to create a threadpool with " + std::to_string(threads) + " threads");
+    }
+}
+
+ContextThreadpools::~ContextThreadpools() {
+    if (threadpool != nullptr) {
+        freeThreadpool(threadpool);
+        threadpool = nullptr;
+    }
+
+    if (batchThreadpool != nullptr) {
+        freeThreadpool(batchThreadpool);
+        batchThreadpool = nullptr;
+    }
+}
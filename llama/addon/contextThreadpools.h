@@ -0,0 +1,40 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "ggml.h"
+
+struct ContextThreadpoolOptions {
+    // the CPUs the threads of the pool are allowed to run on. empty to not set any affinity
+    std::vector<uint32_t> cpuMask;
+
+    // pin each thread to a single CPU from `cpuMask`, instead of allowing each thread to run on any of them
+    bool strictCpu = false;
+
+    ggml_sched_priority priority = GGML_SCHED_PRIO_NORMAL;
+
+    // how aggressively the threads of the pool poll for new work before sleeping, from `0` (no polling) to `100`
+    uint32_t poll = 50;
+};
+
+bool parseThreadpoolPriority(const std::string& name, ggml_sched_priority& priority);
+
+// The `ggml` threadpools of a context.
+// A separate pool is used for batch evaluations and for single-token evaluations,
+// so each can be configured with a different affinity, priority and polling level.
+// The pools must outlive the `llama_context` they're attached to.
+class ContextThreadpools {
+    public:
+        // throws a `std::runtime_error` when the pools cannot be created
+        ContextThreadpools(int threads, const ContextThreadpoolOptions& options, const ContextThreadpoolOptions& batchOptions);
+        ~ContextThreadpools();
+
+        ContextThreadpools(const ContextThreadpools&) = delete;
+        ContextThreadpools& operator=(const ContextThreadpools&) = delete;
+
+        ggml_threadpool_t threadpool = nullptr;
+        ggml_threadpool_t batchThreadpool = nullptr;
+
+    private:
+        void (*freeThreadpool)(ggml_threadpool_t) = nullptr;
+};
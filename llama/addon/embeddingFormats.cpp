@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "ggml.h"
+#include "embeddingFormats.h"
+
+bool parseEmbeddingFormat(const std::string& name, EmbeddingFormat& format) {
+    if (name == "float32") {
+        format = EmbeddingFormat::float32;
+    } else if (name == "normalized") {
+        format = EmbeddingFormat::normalized;
+    } else if (name == "float16") {
+        format = EmbeddingFormat::float16;
+    } else if (name == "int8") {
+        format = EmbeddingFormat::int8;
+    } else if (name == "binary") {
+        format = EmbeddingFormat::binary;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+size_t getEmbeddingFormatVectorByteSize(EmbeddingFormat format, size_t size) {
+    switch (format) {
+        case EmbeddingFormat::float32:
+        case EmbeddingFormat::normalized:
+            return size * sizeof(float);
+        case EmbeddingFormat::float16:
+            return size * sizeof(ggml_fp16_t);
+        case EmbeddingFormat::int8:
+            return size * sizeof(int8_t);
+        case EmbeddingFormat::binary:
+            return (size + 7) / 8;
+    }
+
+    return 0;
+}
+
+float convertEmbedding(EmbeddingFormat format, const float* vector, size_t size, uint8_t* output) {
+    switch (format) {
+        case EmbeddingFormat::float32: {
+            std::memcpy(output, vector, size * sizeof(float));
+            return 1;
+        }
+        case EmbeddingFormat::normalized: {
+            double sum = 0;
+            for (size_t i = 0; i < size; i++) {
+                sum += (double)vector[i] * vector[i];
+            }
+
+            const float norm = (float)std::sqrt(sum);
+            const float factor = norm > 0 ? 1.0f / norm : 0.0f;
+
+            float* result = reinterpret_cast<float*>(output);
+            for (size_t i = 0; i < size; i++) {
+                result[i] = vector[i] * factor;
+            }
+            return 1;
+        }
+        case EmbeddingFormat::float16: {
+            ggml_fp32_to_fp16_row(vector, reinterpret_cast<ggml_fp16_t*>(output), (int64_t)size);
+            return 1;
+        }
+        case EmbeddingFormat::int8: {
+            float maxAbs = 0;
+            for (size_t i = 0; i < size; i++) {
+                maxAbs = std::max(maxAbs, std::fabs(vector[i]));
+            }
+
+            const float scale = maxAbs / 127.0f;
+            const float inverseScale = scale > 0 ? 1.0f / scale : 0.0f;
+
+            int8_t* result = reinterpret_cast<int8_t*>(output);
+            for (size_t i = 0; i < size; i++) {
+                result[i] = (int8_t)std::clamp(std::lround(vector[i] * inverseScale), -127L, 127L);
+            }
+            return scale;
+        }
+        case EmbeddingFormat::binary: {
+            std::memset(output, 0, (size + 7) / 8);
+            for (size_t i = 0; i < size; i++) {
+                if (vector[i] > 0) {
+                    output[i / 8] |= (uint8_t)(0x80 >> (i % 8));
+                }
+            }
+            return 1;
+        }
+    }
+
+    return 1;
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Output formats for embedding vectors, converted from the float32 embeddings of llama.cpp
+enum class EmbeddingFormat {
+    float32,
+    normalized, // L2-normalized float32
+    float16,
+    int8, // symmetric quantization with a per-vector scale factor
+    binary // sign bits, packed 8 per byte with the first value at the most significant bit
+};
+
+bool parseEmbeddingFormat(const std::string& name, EmbeddingFormat& format);
+
+// the number of bytes a vector of `size` values takes in the given format
+size_t getEmbeddingFormatVectorByteSize(EmbeddingFormat format, size_t size);
+
+// converts `vector` to the given format and writes it to `output`.
+// returns the scale factor for the `int8` format (`value = quantized * scale`), and `1` for the other formats
+float convertEmbedding(EmbeddingFormat format, const float* vector, size_t size, uint8_t* output);
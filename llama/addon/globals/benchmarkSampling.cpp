@@ -0,0 +1,123 @@
+#ifdef NLC_DEV_BINDINGS
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <vector>
+#include "benchmarkSampling.h"
+#include "../samplingKernels.h"
+
+struct SamplingBenchmarkResult {
+    double fill = 0;
+    double confidence = 0;
+    double probabilities = 0;
+    double topProbabilities = 0;
+};
+
+template<typename Fn>
+static double measureMicrosecondsPerIteration(int32_t iterations, Fn&& fn) {
+    const auto start = std::chrono::steady_clock::now();
+    for (int32_t i = 0; i < iterations; i++) {
+        fn();
+    }
+    const auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::micro>(end - start).count() / iterations;
+}
+
+static SamplingBenchmarkResult runSamplingBenchmark(
+    const SamplingKernels& kernels, bool usePartialSelection, const std::vector<float>& logits, int32_t iterations, size_t topN
+) {
+    const size_t size = logits.size();
+    std::vector<llama_token_data> candidates(size);
+    std::vector<float> probabilities(size);
+    SamplingBenchmarkResult result;
+
+    const auto selectTop = [&](size_t n) {
+        if (usePartialSelection) {
+            selectTopTokenCandidates(candidates.data(), size, n);
+        } else {
+            std::sort(candidates.begin(), candidates.end(), [](const llama_token_data & a, const llama_token_data & b) {
+                return a.logit > b.logit;
+            });
+        }
+    };
+
+    result.fill = measureMicrosecondsPerIteration(iterations, [&]() {
+        kernels.fillTokenCandidates(candidates.data(), logits.data(), size);
+    });
+
+    volatile float sink = 0;
+    result.confidence = measureMicrosecondsPerIteration(iterations, [&]() {
+        kernels.fillTokenCandidates(candidates.data(), logits.data(), size);
+        if (!usePartialSelection) {
+            selectTop(size);
+        }
+        sink = getTokenCandidatesSoftmax(kernels, candidates.data(), size).probabilityOf(candidates[0].logit);
+    });
+
+    result.probabilities = measureMicrosecondsPerIteration(iterations, [&]() {
+        kernels.fillTokenCandidates(candidates.data(), logits.data(), size);
+        selectTop(size);
+        computeTokenCandidatesProbabilities(kernels, candidates.data(), size, probabilities.data());
+    });
+
+    result.topProbabilities = measureMicrosecondsPerIteration(iterations, [&]() {
+        kernels.fillTokenCandidates(candidates.data(), logits.data(), size);
+        selectTop(topN);
+
+        if (usePartialSelection) {
+            const auto softmax = getTokenCandidatesSoftmax(kernels, candidates.data(), size);
+            for (size_t i = 0; i < topN && i < size; i++) {
+                probabilities[i] = softmax.probabilityOf(candidates[i].logit);
+            }
+        } else {
+            computeTokenCandidatesProbabilities(kernels, candidates.data(), size, probabilities.data());
+        }
+    });
+
+    (void)sink;
+    return result;
+}
+
+static Napi::Object samplingBenchmarkResultToObject(Napi::Env env, const SamplingBenchmarkResult& result) {
+    Napi::Object obj = Napi::Object::New(env);
+    obj.Set("fill", Napi::Number::New(env, result.fill));
+    obj.Set("confidence", Napi::Number::New(env, result.confidence));
+    obj.Set("probabilities", Napi::Number::New(env, result.probabilities));
+    obj.Set("topProbabilities", Napi::Number::New(env, result.topProbabilities));
+    return obj;
+}
+
+// Measures the per-token latency (in microseconds) of the sampling hot loops for a synthetic vocabulary of the given size,
+// comparing the previous scalar implementation (with a full sort) to the vectorized kernels with partial selection.
+// This runs synchronously and is meant to be used only for development
+Napi::Value benchmarkSampling(const Napi::CallbackInfo& info) {
+    const int32_t vocabSize = info[0].As<Napi::Number>().Int32Value();
+    const int32_t iterations = info.Length() > 1 && info[1].IsNumber() ? info[1].As<Napi::Number>().Int32Value() : 100;
+    const int32_t topN = info.Length() > 2 && info[2].IsNumber() ? info[2].As<Napi::Number>().Int32Value() : 10;
+
+    if (vocabSize <= 0 || iterations <= 0 || topN <= 0) {
+        Napi::Error::New(info.Env(), "Invalid benchmark options").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    std::vector<float> logits(vocabSize);
+    std::mt19937 generator(vocabSize);
+    std::normal_distribution<float> distribution(0.0f, 4.0f);
+    for (auto & logit : logits) {
+        logit = distribution(generator);
+    }
+
+    const auto & kernels = getSamplingKernels();
+    const auto scalarResult = runSamplingBenchmark(getScalarSamplingKernels(), false, logits, iterations, topN);
+    const auto vectorizedResult = runSamplingBenchmark(kernels, true, logits, iterations, topN);
+
+    Napi::Object result = Napi::Object::New(info.Env());
+    result.Set("kernels", Napi::String::New(info.Env(), kernels.name));
+    result.Set("scalar", samplingBenchmarkResultToObject(info.Env(), scalarResult));
+    result.Set("vectorized", samplingBenchmarkResultToObject(info.Env(), vectorizedResult));
+
+    return result;
+}
+#endif
@@ -0,0 +1,4 @@
+#pragma once
+#include "napi.h"
+
+Napi::Value benchmarkSampling(const Napi::CallbackInfo& info);
@@ -0,0 +1,145 @@
+#ifdef NLC_DEV_BINDINGS
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <random>
+#include <vector>
+#include "compareSamplingKernels.h"
+#include "../samplingKernels.h"
+
+static double relativeError(float value, float expected) {
+    if (value == expected) {
+        return 0;
+    }
+
+    return std::abs(double(value) - double(expected)) / std::abs(double(expected));
+}
+
+// Compares the results of the vectorized sampling kernels selected for the current CPU with the scalar kernels,
+// for a synthetic vocabulary of the given size that includes masked (-inf) logits and logits far below the max,
+// so the approximated exp is checked across its whole range, including where it's flushed to 0.
+// This runs synchronously and is meant to be used only for development and testing
+Napi::Value compareSamplingKernels(const Napi::CallbackInfo& info) {
+    const int32_t vocabSize = info[0].As<Napi::Number>().Int32Value();
+    const uint32_t seed = info.Length() > 1 && info[1].IsNumber() ? info[1].As<Napi::Number>().Uint32Value() : 0;
+
+    if (vocabSize <= 0) {
+        Napi::Error::New(info.Env(), "Invalid vocabulary size").ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+    }
+
+    const size_t size = vocabSize;
+    std::vector<float> logits(size);
+    std::mt19937 generator(seed);
+    std::normal_distribution<float> distribution(0.0f, 4.0f);
+    for (size_t i = 0; i < size; i++) {
+        if (i % 97 == 13) {
+            logits[i] = -INFINITY;
+        } else if (i % 89 == 7) {
+            logits[i] = distribution(generator) * 30.0f;
+        } else {
+            logits[i] = distribution(generator);
+        }
+    }
+
+    const SamplingKernels& scalar = getScalarSamplingKernels();
+    const SamplingKernels& kernels = getSamplingKernels();
+
+    std::vector<llama_token_data> scalarCandidates(size);
+    std::vector<llama_token_data> candidates(size);
+    scalar.fillTokenCandidates(scalarCandidates.data(), logits.data(), size);
+    kernels.fillTokenCandidates(candidates.data(), logits.data(), size);
+
+    bool fillMatches = true;
+    for (size_t i = 0; i < size; i++) {
+        if (candidates[i].id != scalarCandidates[i].id || candidates[i].logit != scalarCandidates[i].logit || candidates[i].p != 0.0f) {
+            fillMatches = false;
+            break;
+        }
+    }
+
+    std::vector<float> scalarValues(size);
+    std::vector<float> values(size);
+    scalar.extractLogits(scalarValues.data(), scalarCandidates.data(), size);
+    kernels.extractLogits(values.data(), candidates.data(), size);
+    const bool extractMatches = std::equal(values.begin(), values.end(), logits.begin());
+
+    const float scalarMax = scalar.max(scalarValues.data(), size);
+    const bool maxMatches = kernels.max(values.data(), size) == scalarMax;
+
+    const float scalarSum = scalar.expSubtractAndSum(scalarValues.data(), size, scalarMax);
+    const float sum = kernels.expSubtractAndSum(values.data(), size, scalarMax);
+
+    // below the smallest normal float the vectorized exp flushes to 0, so only the absolute error is meaningful there
+    double expMaxRelativeError = 0;
+    double expMaxAbsoluteError = 0;
+    for (size_t i = 0; i < size; i++) {
+        if (scalarValues[i] >= FLT_MIN) {
+            expMaxRelativeError = std::max(expMaxRelativeError, relativeError(values[i], scalarValues[i]));
+        } else {
+            expMaxAbsoluteError = std::max(expMaxAbsoluteError, std::abs(double(values[i]) - double(scalarValues[i])));
+        }
+    }
+
+    std::vector<float> scaledValues(values);
+    kernels.scale(scaledValues.data(), size, 1.0f / scalarSum);
+    bool scaleMatches = true;
+    for (size_t i = 0; i < size; i++) {
+        if (scaledValues[i] != values[i] * (1.0f / scalarSum)) {
+            scaleMatches = false;
+            break;
+        }
+    }
+
+    std::vector<float> scalarProbabilities(size);
+    std::vector<float> probabilities(size);
+    computeTokenCandidatesProbabilities(scalar, scalarCandidates.data(), size, scalarProbabilities.data());
+    computeTokenCandidatesProbabilities(kernels, candidates.data(), size, probabilities.data());
+
+    double probabilitiesMaxAbsoluteError = 0;
+    for (size_t i = 0; i < size; i++) {
+        probabilitiesMaxAbsoluteError = std::max(
+            probabilitiesMaxAbsoluteError,
+            std::abs(double(probabilities[i]) - double(scalarProbabilities[i]))
+        );
+    }
+
+    const auto softmax = getTokenCandidatesSoftmax(kernels, candidates.data(), size);
+    double softmaxMaxAbsoluteError = 0;
+    for (size_t i = 0; i < size; i++) {
+        softmaxMaxAbsoluteError = std::max(
+            softmaxMaxAbsoluteError,
+            std::abs(double(softmax.probabilityOf(candidates[i].logit)) - double(scalarProbabilities[i]))
+        );
+    }
+
+    // the partial selection must pick the same logits as a full sort, in the same order
+    const size_t topN = std::min<size_t>(size, 10);
+    selectTopTokenCandidates(candidates.data(), size, topN);
+    std::sort(scalarCandidates.begin(), scalarCandidates.end(), [](const llama_token_data & a, const llama_token_data & b) {
+        return a.logit > b.logit;
+    });
+    bool topSelectionMatches = true;
+    for (size_t i = 0; i < topN; i++) {
+        if (candidates[i].logit != scalarCandidates[i].logit) {
+            topSelectionMatches = false;
+            break;
+        }
+    }
+
+    Napi::Object result = Napi::Object::New(info.Env());
+    result.Set("kernels", Napi::String::New(info.Env(), kernels.name));
+    result.Set("fillMatches", Napi::Boolean::New(info.Env(), fillMatches));
+    result.Set("extractMatches", Napi::Boolean::New(info.Env(), extractMatches));
+    result.Set("maxMatches", Napi::Boolean::New(info.Env(), maxMatches));
+    result.Set("scaleMatches", Napi::Boolean::New(info.Env(), scaleMatches));
+    result.Set("expMaxRelativeError", Napi::Number::New(info.Env(), expMaxRelativeError));
+    result.Set("expMaxAbsoluteError", Napi::Number::New(info.Env(), expMaxAbsoluteError));
+    result.Set("sumRelativeError", Napi::Number::New(info.Env(), relativeError(sum, scalarSum)));
+    result.Set("probabilitiesMaxAbsoluteError", Napi::Number::New(info.Env(), probabilitiesMaxAbsoluteError));
+    result.Set("softmaxMaxAbsoluteError", Napi::Number::New(info.Env(), softmaxMaxAbsoluteError));
+    result.Set("topSelectionMatches", Napi::Boolean::New(info.Env(), topSelectionMatches));
+
+    return result;
+}
+#endif
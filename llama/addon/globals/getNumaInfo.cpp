@@ -0,0 +1,197 @@
+#include "getNumaInfo.h"
+#include "addonLog.h"
+
+#ifdef __linux__
+#include <cstdint>
+#include <dirent.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+// source: `linux/mempolicy.h`
+#define NLC_MPOL_DEFAULT 0
+#define NLC_MPOL_INTERLEAVE 3
+#endif
+
+#ifdef __linux__
+struct NumaNodeInfo {
+    uint32_t id = 0;
+    std::vector<uint32_t> cpus;
+    uint64_t totalMemory = 0;
+    uint64_t freeMemory = 0;
+};
+
+static const char * numaNodesPath = "/sys/devices/system/node";
+
+// parses a CPU or node list in the format of `0-3,8,10-11`
+static std::vector<uint32_t> parseIndexList(const std::string& cpuList) {
+    std::vector<uint32_t> cpus;
+    std::stringstream stream(cpuList);
+    std::string range;
+
+    while (std::getline(stream, range, ',')) {
+        if (range.empty() || range == "\n") {
+            continue;
+        }
+
+        try {
+            const size_t dashIndex = range.find('-');
+            if (dashIndex == std::string::npos) {
+                cpus.push_back((uint32_t)std::stoul(range));
+                continue;
+            }
+
+            const uint32_t start = (uint32_t)std::stoul(range.substr(0, dashIndex));
+            const uint32_t end = (uint32_t)std::stoul(range.substr(dashIndex + 1));
+            for (uint32_t cpu = start; cpu <= end; cpu++) {
+                cpus.push_back(cpu);
+            }
+        } catch (...) {
+            // ignore malformed ranges
+        }
+    }
+
+    return cpus;
+}
+
+// reads a value in kB from a node `meminfo` file line in the format of `Node 0 MemTotal:       32768 kB`
+static uint64_t readNodeMemInfoValue(const std::string& line) {
+    std::stringstream stream(line.substr(line.find(':') + 1));
+    uint64_t value = 0;
+    std::string unit;
+    stream >> value >> unit;
+
+    return unit == "kB"
+        ? value * 1024
+        : value;
+}
+
+static bool readNumaNode(const std::string& nodesPath, uint32_t id, NumaNodeInfo& node) {
+    const std::string nodePath = nodesPath + "/node" + std::to_string(id);
+
+    std::ifstream cpuListFile(nodePath + "/cpulist");
+    if (!cpuListFile.is_open()) {
+        return false;
+    }
+
+    std::string cpuList;
+    std::getline(cpuListFile, cpuList);
+
+    node.id = id;
+    node.cpus = parseIndexList(cpuList);
+
+    std::ifstream memInfoFile(nodePath + "/meminfo");
+    std::string line;
+    while (std::getline(memInfoFile, line)) {
+        if (line.find("MemTotal:") != std::string::npos) {
+            node.totalMemory = readNodeMemInfoValue(line);
+        } else if (line.find("MemFree:") != std::string::npos) {
+            node.freeMemory = readNodeMemInfoValue(line);
+        }
+    }
+
+    return true;
+}
+
+static std::vector<NumaNodeInfo> readNumaNodes(const std::string& nodesPath) {
+    std::vector<NumaNodeInfo> nodes;
+
+    DIR* dir = opendir(nodesPath.c_str());
+    if (dir == nullptr) {
+        return nodes;
+    }
+
+    const std::string nodePrefix = "node";
+    while (dirent* entry = readdir(dir)) {
+        const std::string name = entry->d_name;
+        if (name.size() <= nodePrefix.size() || name.compare(0, nodePrefix.size(), nodePrefix) != 0 ||
+            !std::all_of(name.begin() + nodePrefix.size(), name.end(), ::isdigit)
+        ) {
+            continue;
+        }
+
+        NumaNodeInfo node;
+        if (readNumaNode(nodesPath, (uint32_t)std::stoul(name.substr(nodePrefix.size())), node)) {
+            nodes.push_back(std::move(node));
+        }
+    }
+
+    closedir(dir);
+
+    std::sort(nodes.begin(), nodes.end(), [](const NumaNodeInfo& a, const NumaNodeInfo& b) {
+        return a.id < b.id;
+    });
+
+    return nodes;
+}
+#endif
+
+ScopedNumaInterleave::ScopedNumaInterleave() {
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+    std::ifstream nodesWithMemoryFile(std::string(numaNodesPath) + "/has_memory");
+    std::string nodesWithMemoryList;
+    std::getline(nodesWithMemoryFile, nodesWithMemoryList);
+
+    const std::vector<uint32_t> nodes = parseIndexList(nodesWithMemoryList);
+    if (nodes.size() <= 1) {
+        return;
+    }
+
+    const uint32_t maxNode = *std::max_element(nodes.begin(), nodes.end()) + 1;
+    const size_t bitsPerMaskItem = sizeof(unsigned long) * 8;
+    std::vector<unsigned long> nodeMask((maxNode + bitsPerMaskItem - 1) / bitsPerMaskItem, 0);
+    for (const uint32_t node : nodes) {
+        nodeMask[node / bitsPerMaskItem] |= 1UL << (node % bitsPerMaskItem);
+    }
+
+    // `maxnode` is the number of bits in the mask plus one, due to an off-by-one in the kernel implementation
+    if (syscall(SYS_set_mempolicy, NLC_MPOL_INTERLEAVE, nodeMask.data(), nodeMask.size() * bitsPerMaskItem + 1) == 0) {
+        applied = true;
+    } else {
+        addonLlamaCppLogCallback(GGML_LOG_LEVEL_WARN, "Failed to interleave the memory across the NUMA nodes\n", nullptr);
+    }
+#endif
+}
+
+ScopedNumaInterleave::~ScopedNumaInterleave() {
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+    if (applied) {
+        syscall(SYS_set_mempolicy, NLC_MPOL_DEFAULT, nullptr, 0);
+    }
+#endif
+}
+
+Napi::Value getNumaInfo(const Napi::CallbackInfo& info) {
+    Napi::Array nodesArray = Napi::Array::New(info.Env());
+
+#ifdef __linux__
+    // a different sysfs nodes directory can be passed for testing
+    const std::string nodesPath = info.Length() > 0 && info[0].IsString()
+        ? info[0].As<Napi::String>().Utf8Value()
+        : std::string(numaNodesPath);
+    const std::vector<NumaNodeInfo> nodes = readNumaNodes(nodesPath);
+
+    for (size_t i = 0; i < nodes.size(); i++) {
+        Napi::Array cpus = Napi::Array::New(info.Env(), nodes[i].cpus.size());
+        for (size_t j = 0; j < nodes[i].cpus.size(); j++) {
+            cpus[j] = Napi::Number::New(info.Env(), nodes[i].cpus[j]);
+        }
+
+        Napi::Object node = Napi::Object::New(info.Env());
+        node.Set("id", Napi::Number::New(info.Env(), nodes[i].id));
+        node.Set("cpus", cpus);
+        node.Set("totalMemory", Napi::Number::New(info.Env(), nodes[i].totalMemory));
+        node.Set("freeMemory", Napi::Number::New(info.Env(), nodes[i].freeMemory));
+
+        nodesArray[i] = node;
+    }
+#endif
+
+    Napi::Object result = Napi::Object::New(info.Env());
+    result.Set("nodes", nodesArray);
+    return result;
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include "napi.h"
+
+Napi::Value getNumaInfo(const Napi::CallbackInfo& info);
+
+// Interleaves the memory allocations of the calling thread across all the NUMA nodes that have memory,
+// until the instance is destroyed. Does nothing when the system has a single NUMA node or the memory policy cannot be set.
+// Only affects memory that is first touched by the calling thread while the instance is alive
+class ScopedNumaInterleave {
+    public:
+        ScopedNumaInterleave();
+        ~ScopedNumaInterleave();
+
+        ScopedNumaInterleave(const ScopedNumaInterleave&) = delete;
+        ScopedNumaInterleave& operator=(const ScopedNumaInterleave&) = delete;
+
+        bool applied = false;
+};
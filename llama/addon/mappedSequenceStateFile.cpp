@@ -0,0 +1,141 @@
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include "llama-mmap.h"
+#include "mappedSequenceStateFile.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+static const size_t prefaultChunkSize = 16 * 1024 * 1024;
+static const size_t prefaultPageStride = 4096;
+
+// the progress of faulting in the mapping, as the restore itself is a memory copy
+static const float prefaultProgressShare = 0.95f;
+
+static void adviseMappedRange(const uint8_t* start, size_t size, bool sequential) {
+#ifndef _WIN32
+    const uintptr_t pageSize = 4096;
+    const uintptr_t alignedStart = reinterpret_cast<uintptr_t>(start) & ~(pageSize - 1);
+    const size_t alignedSize = size + (reinterpret_cast<uintptr_t>(start) - alignedStart);
+
+    posix_madvise(reinterpret_cast<void*>(alignedStart), alignedSize, sequential ? POSIX_MADV_SEQUENTIAL : POSIX_MADV_WILLNEED);
+#else
+    (void)start;
+    (void)size;
+    (void)sequential;
+#endif
+}
+
+bool isMappedSequenceStateFileLoadSupported() {
+    return llama_mmap::SUPPORTED;
+}
+
+size_t saveSequenceStateFile(const char* filePath, const std::vector<llama_token>& tokens, const std::vector<uint8_t>& state) {
+    llama_file file(filePath, "wb");
+
+    file.write_u32(LLAMA_STATE_SEQ_MAGIC);
+    file.write_u32(LLAMA_STATE_SEQ_VERSION);
+    file.write_u32(static_cast<uint32_t>(tokens.size()));
+    file.write_raw(tokens.data(), tokens.size() * sizeof(llama_token));
+    file.write_raw(state.data(), state.size());
+
+    return file.tell();
+}
+
+// reads the header and the tokens of the state file, and returns the offset of the state in it
+static size_t readSequenceStateFileHeader(llama_file& file, size_t maxTokens, std::vector<llama_token>& tokens) {
+    const size_t fileSize = file.size();
+
+    const uint32_t magic = file.read_u32();
+    const uint32_t version = file.read_u32();
+    if (magic != LLAMA_STATE_SEQ_MAGIC || version != LLAMA_STATE_SEQ_VERSION) {
+        throw std::runtime_error("Unsupported state file format: magic " + std::to_string(magic) + ", version " + std::to_string(version));
+    }
+
+    const uint32_t tokenCount = file.read_u32();
+    if (tokenCount > maxTokens) {
+        throw std::runtime_error("Failed to load state from file. Current context sequence size may be smaller that the state of the file");
+    }
+
+    tokens.resize(tokenCount);
+    file.read_raw(tokens.data(), tokens.size() * sizeof(llama_token));
+
+    const size_t stateOffset = file.tell();
+    if (stateOffset >= fileSize) {
+        throw std::runtime_error("The state file is truncated");
+    }
+
+    return stateOffset;
+}
+
+size_t loadMappedSequenceStateFile(
+    const char* filePath, size_t maxTokens, std::vector<llama_token>& tokens, const std::function<bool(float)>& onProgress,
+    const std::function<size_t(const uint8_t*, size_t)>& restoreState
+) {
+    llama_file file(filePath, "rb");
+    const size_t fileSize = file.size();
+    const size_t stateOffset = readSequenceStateFileHeader(file, maxTokens, tokens);
+
+    llama_mmap mapping(&file, 0);
+    const uint8_t* state = static_cast<const uint8_t*>(mapping.addr()) + stateOffset;
+    const size_t stateSize = fileSize - stateOffset;
+
+    adviseMappedRange(state, stateSize, true);
+
+    volatile uint8_t pageSink = 0;
+    for (size_t chunkStart = 0; chunkStart < stateSize; chunkStart += prefaultChunkSize) {
+        const size_t chunkEnd = std::min(stateSize, chunkStart + prefaultChunkSize);
+
+        if (chunkEnd < stateSize) {
+            adviseMappedRange(state + chunkEnd, std::min(prefaultChunkSize, stateSize - chunkEnd), false);
+        }
+
+        for (size_t offset = chunkStart; offset < chunkEnd; offset += prefaultPageStride) {
+            pageSink = pageSink ^ state[offset];
+        }
+
+        if (!onProgress(prefaultProgressShare * float(chunkEnd) / float(stateSize))) {
+            throw std::runtime_error("The sequence state load was aborted");
+        }
+    }
+
+    const size_t readSize = restoreState(state, stateSize);
+    if (readSize == 0) {
+        throw std::runtime_error("Failed to load state from file. Current context sequence size may be smaller that the state of the file");
+    }
+
+    onProgress(1);
+
+    return fileSize;
+}
+
+size_t loadBufferedSequenceStateFile(
+    const char* filePath, size_t maxTokens, std::vector<llama_token>& tokens, const std::function<bool(float)>& onProgress,
+    const std::function<size_t(const uint8_t*, size_t)>& restoreState
+) {
+    llama_file file(filePath, "rb");
+    const size_t fileSize = file.size();
+    const size_t stateOffset = readSequenceStateFileHeader(file, maxTokens, tokens);
+
+    std::vector<uint8_t> state(fileSize - stateOffset);
+    for (size_t chunkStart = 0; chunkStart < state.size(); chunkStart += prefaultChunkSize) {
+        const size_t chunkEnd = std::min(state.size(), chunkStart + prefaultChunkSize);
+        file.read_raw(state.data() + chunkStart, chunkEnd - chunkStart);
+
+        if (!onProgress(prefaultProgressShare * float(chunkEnd) / float(state.size()))) {
+            throw std::runtime_error("The sequence state load was aborted");
+        }
+    }
+
+    const size_t readSize = restoreState(state.data(), state.size());
+    if (readSize == 0) {
+        throw std::runtime_error("Failed to load state from file. Current context sequence size may be smaller that the state of the file");
+    }
+
+    onProgress(1);
+
+    return fileSize;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "llama.h"
+
+bool isMappedSequenceStateFileLoadSupported();
+
+// writes a sequence state that was read with `llama_state_seq_get_data` in the format of `llama_state_seq_save_file`.
+// returns the size of the written file.
+// throws a `std::runtime_error` on failure
+size_t saveSequenceStateFile(const char* filePath, const std::vector<llama_token>& tokens, const std::vector<uint8_t>& state);
+
+// loads a sequence state file saved by `llama_state_seq_save_file` by memory-mapping it,
+// so the state is read from the page cache as it's restored instead of being copied into an intermediate buffer.
+// the mapping is faulted in ahead of the restore in chunks with readahead hints, calling `onProgress` after each chunk.
+// when `onProgress` returns `false`, the load is aborted before the sequence state is modified.
+// the state is passed to `restoreState`, which returns the number of bytes it read from it, or `0` on failure.
+// returns the size of the file and sets `tokens` to the tokens of the saved state.
+// throws a `std::runtime_error` on failure
+size_t loadMappedSequenceStateFile(
+    const char* filePath, size_t maxTokens, std::vector<llama_token>& tokens, const std::function<bool(float)>& onProgress,
+    const std::function<size_t(const uint8_t*, size_t)>& restoreState
+);
+
+// loads a sequence state file saved by `llama_state_seq_save_file` by reading it into memory in chunks,
+// calling `onProgress` after each chunk.
+// when `onProgress` returns `false`, the load is aborted before the sequence state is modified.
+// the state is passed to `restoreState`, which returns the number of bytes it read from it, or `0` on failure.
+// returns the size of the file and sets `tokens` to the tokens of the saved state.
+// throws a `std::runtime_error` on failure
+size_t loadBufferedSequenceStateFile(
+    const char* filePath, size_t maxTokens, std::vector<llama_token>& tokens, const std::function<bool(float)>& onProgress,
+    const std::function<size_t(const uint8_t*, size_t)>& restoreState
+);
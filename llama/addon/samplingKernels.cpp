@@ -0,0 +1,633 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include "samplingKernels.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#   define SAMPLING_KERNELS_X86
+#   include <immintrin.h>
+#   if defined(__GNUC__) || defined(__clang__)
+#       define SAMPLING_KERNELS_RUNTIME_DISPATCH
+#       define SAMPLING_KERNELS_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#       define SAMPLING_KERNELS_TARGET_AVX512 __attribute__((target("avx512f")))
+#       define SAMPLING_KERNELS_HAS_AVX2
+#       define SAMPLING_KERNELS_HAS_AVX512
+#   else
+#       define SAMPLING_KERNELS_TARGET_AVX2
+#       define SAMPLING_KERNELS_TARGET_AVX512
+#       if defined(__AVX2__)
+#           define SAMPLING_KERNELS_HAS_AVX2
+#       endif
+#       if defined(__AVX512F__)
+#           define SAMPLING_KERNELS_HAS_AVX512
+#       endif
+#   endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#   define SAMPLING_KERNELS_NEON
+#   include <arm_neon.h>
+#endif
+
+// the range in which the exp approximation is accurate. below it, the result is flushed to 0
+static constexpr float expInputMax = 88.3762626647949f;
+static constexpr float expInputMin = -87.3365447505531f; // log(FLT_MIN)
+
+// Cephes-style polynomial approximation of exp, used by the vectorized kernels
+static constexpr float expLog2e = 1.44269504088896341f;
+static constexpr float expC1 = 0.693359375f;
+static constexpr float expC2 = -2.12194440e-4f;
+static constexpr float expP0 = 1.9875691500e-4f;
+static constexpr float expP1 = 1.3981999507e-3f;
+static constexpr float expP2 = 8.3334519073e-3f;
+static constexpr float expP3 = 4.1665795894e-2f;
+static constexpr float expP4 = 1.6666665459e-1f;
+static constexpr float expP5 = 5.0000001201e-1f;
+
+// the token data struct is interleaved as {id, logit, p}, which the vectorized fill and extract kernels rely on
+static_assert(sizeof(llama_token_data) == 3 * sizeof(float), "unexpected llama_token_data layout");
+
+
+static void scalarFillTokenCandidates(llama_token_data* candidates, const float* logits, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        candidates[i] = llama_token_data{static_cast<llama_token>(i), logits[i], 0.0f};
+    }
+}
+static void scalarExtractLogits(float* logits, const llama_token_data* candidates, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        logits[i] = candidates[i].logit;
+    }
+}
+static float scalarMax(const float* values, size_t size) {
+    float res = -INFINITY;
+    for (size_t i = 0; i < size; i++) {
+        res = std::max(res, values[i]);
+    }
+
+    return res;
+}
+static float scalarExpSubtractAndSum(float* values, size_t size, float max) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < size; i++) {
+        values[i] = expf(values[i] - max);
+        sum += values[i];
+    }
+
+    return sum;
+}
+static void scalarScale(float* values, size_t size, float factor) {
+    for (size_t i = 0; i < size; i++) {
+        values[i] *= factor;
+    }
+}
+
+static const SamplingKernels scalarKernels = {
+    /* .name               = */ "scalar",
+    /* .fillTokenCandidates = */ scalarFillTokenCandidates,
+    /* .extractLogits      = */ scalarExtractLogits,
+    /* .max                = */ scalarMax,
+    /* .expSubtractAndSum  = */ scalarExpSubtractAndSum,
+    /* .scale              = */ scalarScale,
+};
+
+
+#ifdef SAMPLING_KERNELS_X86
+static void sse2FillTokenCandidates(llama_token_data* candidates, const float* logits, size_t size) {
+    const __m128 zero = _mm_setzero_ps();
+    const __m128i idsStep = _mm_set1_epi32(4);
+    __m128i ids = _mm_setr_epi32(0, 1, 2, 3);
+    float* out = reinterpret_cast<float*>(candidates);
+
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        const __m128 id = _mm_castsi128_ps(ids);
+        const __m128 logit = _mm_loadu_ps(logits + i);
+
+        // [id0 logit0 0 id1] [logit1 0 id2 logit2] [0 id3 logit3 0]
+        const __m128 idLogitLow = _mm_unpacklo_ps(id, logit);
+        const __m128 zeroIdLow = _mm_unpacklo_ps(zero, id);
+        const __m128 logitZeroLow = _mm_unpacklo_ps(logit, zero);
+        const __m128 idLogitHigh = _mm_unpackhi_ps(id, logit);
+        const __m128 zeroIdHigh = _mm_unpackhi_ps(zero, id);
+        const __m128 logitZeroHigh = _mm_unpackhi_ps(logit, zero);
+
+        _mm_storeu_ps(out + i * 3, _mm_shuffle_ps(idLogitLow, zeroIdLow, _MM_SHUFFLE(3, 0, 1, 0)));
+        _mm_storeu_ps(out + i * 3 + 4, _mm_shuffle_ps(logitZeroLow, idLogitHigh, _MM_SHUFFLE(1, 0, 3, 2)));
+        _mm_storeu_ps(out + i * 3 + 8, _mm_shuffle_ps(zeroIdHigh, logitZeroHigh, _MM_SHUFFLE(1, 2, 3, 0)));
+
+        ids = _mm_add_epi32(ids, idsStep);
+    }
+
+    for (; i < size; i++) {
+        candidates[i] = llama_token_data{static_cast<llama_token>(i), logits[i], 0.0f};
+    }
+}
+static void sse2ExtractLogits(float* logits, const llama_token_data* candidates, size_t size) {
+    const float* in = reinterpret_cast<const float*>(candidates);
+
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        const __m128 a = _mm_loadu_ps(in + i * 3);
+        const __m128 b = _mm_loadu_ps(in + i * 3 + 4);
+        const __m128 c = _mm_loadu_ps(in + i * 3 + 8);
+
+        const __m128 low = _mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)); // [logit0 logit0 logit1 logit1]
+        const __m128 high = _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)); // [logit2 logit2 logit3 logit3]
+        _mm_storeu_ps(logits + i, _mm_shuffle_ps(low, high, _MM_SHUFFLE(2, 0, 2, 0)));
+    }
+
+    for (; i < size; i++) {
+        logits[i] = candidates[i].logit;
+    }
+}
+static inline float sse2HorizontalMax(__m128 v) {
+    v = _mm_max_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_max_ss(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)));
+    return _mm_cvtss_f32(v);
+}
+static inline float sse2HorizontalSum(__m128 v) {
+    v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_add_ss(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)));
+    return _mm_cvtss_f32(v);
+}
+static float sse2Max(const float* values, size_t size) {
+    __m128 acc = _mm_set1_ps(-INFINITY);
+
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        acc = _mm_max_ps(acc, _mm_loadu_ps(values + i));
+    }
+
+    float res = sse2HorizontalMax(acc);
+    for (; i < size; i++) {
+        res = std::max(res, values[i]);
+    }
+
+    return res;
+}
+static inline __m128 sse2Exp(__m128 x) {
+    const __m128 underflowMask = _mm_cmplt_ps(x, _mm_set1_ps(expInputMin));
+    x = _mm_min_ps(x, _mm_set1_ps(expInputMax));
+    x = _mm_max_ps(x, _mm_set1_ps(expInputMin));
+
+    // n = floor(x * log2(e) + 0.5), using truncation since SSE2 has no floor instruction
+    __m128 fx = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(expLog2e)), _mm_set1_ps(0.5f));
+    const __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(fx));
+    fx = _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, fx), _mm_set1_ps(1.0f)));
+
+    x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(expC1)));
+    x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(expC2)));
+
+    const __m128 z = _mm_mul_ps(x, x);
+    __m128 y = _mm_set1_ps(expP0);
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(expP1));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(expP2));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(expP3));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(expP4));
+    y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(expP5));
+    y = _mm_add_ps(_mm_mul_ps(y, z), x);
+    y = _mm_add_ps(y, _mm_set1_ps(1.0f));
+
+    const __m128i pow2n = _mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(fx), _mm_set1_epi32(127)), 23);
+    return _mm_andnot_ps(underflowMask, _mm_mul_ps(y, _mm_castsi128_ps(pow2n)));
+}
+static float sse2ExpSubtractAndSum(float* values, size_t size, float max) {
+    const __m128 maxVec = _mm_set1_ps(max);
+    __m128 acc = _mm_setzero_ps();
+
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        const __m128 v = sse2Exp(_mm_sub_ps(_mm_loadu_ps(values + i), maxVec));
+        _mm_storeu_ps(values + i, v);
+        acc = _mm_add_ps(acc, v);
+    }
+
+    float sum = sse2HorizontalSum(acc);
+    for (; i < size; i++) {
+        values[i] = expf(values[i] - max);
+        sum += values[i];
+    }
+
+    return sum;
+}
+static void sse2Scale(float* values, size_t size, float factor) {
+    const __m128 factorVec = _mm_set1_ps(factor);
+
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        _mm_storeu_ps(values + i, _mm_mul_ps(_mm_loadu_ps(values + i), factorVec));
+    }
+
+    for (; i < size; i++) {
+        values[i] *= factor;
+    }
+}
+
+static const SamplingKernels sse2Kernels = {
+    /* .name               = */ "sse2",
+    /* .fillTokenCandidates = */ sse2FillTokenCandidates,
+    /* .extractLogits      = */ sse2ExtractLogits,
+    /* .max                = */ sse2Max,
+    /* .expSubtractAndSum  = */ sse2ExpSubtractAndSum,
+    /* .scale              = */ sse2Scale,
+};
+#endif
+
+
+#ifdef SAMPLING_KERNELS_HAS_AVX2
+SAMPLING_KERNELS_TARGET_AVX2
+static float avx2Max(const float* values, size_t size) {
+    __m256 acc = _mm256_set1_ps(-INFINITY);
+
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        acc = _mm256_max_ps(acc, _mm256_loadu_ps(values + i));
+    }
+
+    __m128 acc128 = _mm_max_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    acc128 = _mm_max_ps(acc128, _mm_movehl_ps(acc128, acc128));
+    acc128 = _mm_max_ss(acc128, _mm_shuffle_ps(acc128, acc128, _MM_SHUFFLE(1, 1, 1, 1)));
+
+    float res = _mm_cvtss_f32(acc128);
+    for (; i < size; i++) {
+        res = std::max(res, values[i]);
+    }
+
+    return res;
+}
+SAMPLING_KERNELS_TARGET_AVX2
+static inline __m256 avx2Exp(__m256 x) {
+    const __m256 underflowMask = _mm256_cmp_ps(x, _mm256_set1_ps(expInputMin), _CMP_LT_OQ);
+    x = _mm256_min_ps(x, _mm256_set1_ps(expInputMax));
+    x = _mm256_max_ps(x, _mm256_set1_ps(expInputMin));
+
+    const __m256 fx = _mm256_floor_ps(_mm256_fmadd_ps(x, _mm256_set1_ps(expLog2e), _mm256_set1_ps(0.5f)));
+
+    x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(expC1), x);
+    x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(expC2), x);
+
+    const __m256 z = _mm256_mul_ps(x, x);
+    __m256 y = _mm256_set1_ps(expP0);
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(expP1));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(expP2));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(expP3));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(expP4));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(expP5));
+    y = _mm256_fmadd_ps(y, z, x);
+    y = _mm256_add_ps(y, _mm256_set1_ps(1.0f));
+
+    const __m256i pow2n = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(fx), _mm256_set1_epi32(127)), 23);
+    return _mm256_andnot_ps(underflowMask, _mm256_mul_ps(y, _mm256_castsi256_ps(pow2n)));
+}
+SAMPLING_KERNELS_TARGET_AVX2
+static float avx2ExpSubtractAndSum(float* values, size_t size, float max) {
+    const __m256 maxVec = _mm256_set1_ps(max);
+    __m256 acc = _mm256_setzero_ps();
+
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        const __m256 v = avx2Exp(_mm256_sub_ps(_mm256_loadu_ps(values + i), maxVec));
+        _mm256_storeu_ps(values + i, v);
+        acc = _mm256_add_ps(acc, v);
+    }
+
+    __m128 acc128 = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    acc128 = _mm_add_ps(acc128, _mm_movehl_ps(acc128, acc128));
+    acc128 = _mm_add_ss(acc128, _mm_shuffle_ps(acc128, acc128, _MM_SHUFFLE(1, 1, 1, 1)));
+
+    float sum = _mm_cvtss_f32(acc128);
+    for (; i < size; i++) {
+        values[i] = expf(values[i] - max);
+        sum += values[i];
+    }
+
+    return sum;
+}
+SAMPLING_KERNELS_TARGET_AVX2
+static void avx2Scale(float* values, size_t size, float factor) {
+    const __m256 factorVec = _mm256_set1_ps(factor);
+
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        _mm256_storeu_ps(values + i, _mm256_mul_ps(_mm256_loadu_ps(values + i), factorVec));
+    }
+
+    for (; i < size; i++) {
+        values[i] *= factor;
+    }
+}
+
+// the interleaved fill and extract kernels are bound by memory bandwidth, so the SSE2 versions are used for them
+static const SamplingKernels avx2Kernels = {
+    /* .name               = */ "avx2",
+    /* .fillTokenCandidates = */ sse2FillTokenCandidates,
+    /* .extractLogits      = */ sse2ExtractLogits,
+    /* .max                = */ avx2Max,
+    /* .expSubtractAndSum  = */ avx2ExpSubtractAndSum,
+    /* .scale              = */ avx2Scale,
+};
+#endif
+
+
+#ifdef SAMPLING_KERNELS_HAS_AVX512
+SAMPLING_KERNELS_TARGET_AVX512
+static float avx512Max(const float* values, size_t size) {
+    __m512 acc = _mm512_set1_ps(-INFINITY);
+
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        acc = _mm512_max_ps(acc, _mm512_loadu_ps(values + i));
+    }
+
+    if (i < size) {
+        const __mmask16 mask = static_cast<__mmask16>((1u << (size - i)) - 1);
+        acc = _mm512_mask_max_ps(acc, mask, acc, _mm512_maskz_loadu_ps(mask, values + i));
+    }
+
+    return _mm512_reduce_max_ps(acc);
+}
+SAMPLING_KERNELS_TARGET_AVX512
+static inline __m512 avx512Exp(__m512 x) {
+    const __mmask16 underflowMask = _mm512_cmp_ps_mask(x, _mm512_set1_ps(expInputMin), _CMP_LT_OQ);
+    x = _mm512_min_ps(x, _mm512_set1_ps(expInputMax));
+    x = _mm512_max_ps(x, _mm512_set1_ps(expInputMin));
+
+    const __m512 fx = _mm512_roundscale_ps(
+        _mm512_fmadd_ps(x, _mm512_set1_ps(expLog2e), _mm512_set1_ps(0.5f)),
+        _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC
+    );
+
+    x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(expC1), x);
+    x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(expC2), x);
+
+    const __m512 z = _mm512_mul_ps(x, x);
+    __m512 y = _mm512_set1_ps(expP0);
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(expP1));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(expP2));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(expP3));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(expP4));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(expP5));
+    y = _mm512_fmadd_ps(y, z, x);
+    y = _mm512_add_ps(y, _mm512_set1_ps(1.0f));
+
+    const __m512i pow2n = _mm512_slli_epi32(_mm512_add_epi32(_mm512_cvttps_epi32(fx), _mm512_set1_epi32(127)), 23);
+    return _mm512_maskz_mul_ps(static_cast<__mmask16>(~underflowMask), y, _mm512_castsi512_ps(pow2n));
+}
+SAMPLING_KERNELS_TARGET_AVX512
+static float avx512ExpSubtractAndSum(float* values, size_t size, float max) {
+    const __m512 maxVec = _mm512_set1_ps(max);
+    __m512 acc = _mm512_setzero_ps();
+
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        const __m512 v = avx512Exp(_mm512_sub_ps(_mm512_loadu_ps(values + i), maxVec));
+        _mm512_storeu_ps(values + i, v);
+        acc = _mm512_add_ps(acc, v);
+    }
+
+    if (i < size) {
+        const __mmask16 mask = static_cast<__mmask16>((1u << (size - i)) - 1);
+        const __m512 v = avx512Exp(_mm512_sub_ps(_mm512_maskz_loadu_ps(mask, values + i), maxVec));
+        _mm512_mask_storeu_ps(values + i, mask, v);
+        acc = _mm512_mask_add_ps(acc, mask, acc, v);
+    }
+
+    return _mm512_reduce_add_ps(acc);
+}
+SAMPLING_KERNELS_TARGET_AVX512
+static void avx512Scale(float* values, size_t size, float factor) {
+    const __m512 factorVec = _mm512_set1_ps(factor);
+
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        _mm512_storeu_ps(values + i, _mm512_mul_ps(_mm512_loadu_ps(values + i), factorVec));
+    }
+
+    if (i < size) {
+        const __mmask16 mask = static_cast<__mmask16>((1u << (size - i)) - 1);
+        _mm512_mask_storeu_ps(values + i, mask, _mm512_mul_ps(_mm512_maskz_loadu_ps(mask, values + i), factorVec));
+    }
+}
+
+static const SamplingKernels avx512Kernels = {
+    /* .name               = */ "avx512",
+    /* .fillTokenCandidates = */ sse2FillTokenCandidates,
+    /* .extractLogits      = */ sse2ExtractLogits,
+    /* .max                = */ avx512Max,
+    /* .expSubtractAndSum  = */ avx512ExpSubtractAndSum,
+    /* .scale              = */ avx512Scale,
+};
+#endif
+
+
+#ifdef SAMPLING_KERNELS_NEON
+static void neonFillTokenCandidates(llama_token_data* candidates, const float* logits, size_t size) {
+    const uint32x4_t idsStep = vdupq_n_u32(4);
+    const uint32_t initialIds[4] = {0, 1, 2, 3};
+    uint32x4_t ids = vld1q_u32(initialIds);
+    float* out = reinterpret_cast<float*>(candidates);
+
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        float32x4x3_t interleaved;
+        interleaved.val[0] = vreinterpretq_f32_u32(ids);
+        interleaved.val[1] = vld1q_f32(logits + i);
+        interleaved.val[2] = vdupq_n_f32(0.0f);
+        vst3q_f32(out + i * 3, interleaved);
+
+        ids = vaddq_u32(ids, idsStep);
+    }
+
+    for (; i < size; i++) {
+        candidates[i] = llama_token_data{static_cast<llama_token>(i), logits[i], 0.0f};
+    }
+}
+static void neonExtractLogits(float* logits, const llama_token_data* candidates, size_t size) {
+    const float* in = reinterpret_cast<const float*>(candidates);
+
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        vst1q_f32(logits + i, vld3q_f32(in + i * 3).val[1]);
+    }
+
+    for (; i < size; i++) {
+        logits[i] = candidates[i].logit;
+    }
+}
+static float neonMax(const float* values, size_t size) {
+    float32x4_t acc = vdupq_n_f32(-INFINITY);
+
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        acc = vmaxq_f32(acc, vld1q_f32(values + i));
+    }
+
+    float res = vmaxvq_f32(acc);
+    for (; i < size; i++) {
+        res = std::max(res, values[i]);
+    }
+
+    return res;
+}
+static inline float32x4_t neonExp(float32x4_t x) {
+    const uint32x4_t underflowMask = vcltq_f32(x, vdupq_n_f32(expInputMin));
+    x = vminq_f32(x, vdupq_n_f32(expInputMax));
+    x = vmaxq_f32(x, vdupq_n_f32(expInputMin));
+
+    const float32x4_t fx = vrndmq_f32(vfmaq_f32(vdupq_n_f32(0.5f), x, vdupq_n_f32(expLog2e)));
+
+    x = vfmsq_f32(x, fx, vdupq_n_f32(expC1));
+    x = vfmsq_f32(x, fx, vdupq_n_f32(expC2));
+
+    const float32x4_t z = vmulq_f32(x, x);
+    float32x4_t y = vdupq_n_f32(expP0);
+    y = vfmaq_f32(vdupq_n_f32(expP1), y, x);
+    y = vfmaq_f32(vdupq_n_f32(expP2), y, x);
+    y = vfmaq_f32(vdupq_n_f32(expP3), y, x);
+    y = vfmaq_f32(vdupq_n_f32(expP4), y, x);
+    y = vfmaq_f32(vdupq_n_f32(expP5), y, x);
+    y = vfmaq_f32(x, y, z);
+    y = vaddq_f32(y, vdupq_n_f32(1.0f));
+
+    const int32x4_t pow2n = vshlq_n_s32(vaddq_s32(vcvtq_s32_f32(fx), vdupq_n_s32(127)), 23);
+    const float32x4_t res = vmulq_f32(y, vreinterpretq_f32_s32(pow2n));
+    return vreinterpretq_f32_u32(vbicq_u32(vreinterpretq_u32_f32(res), underflowMask));
+}
+static float neonExpSubtractAndSum(float* values, size_t size, float max) {
+    const float32x4_t maxVec = vdupq_n_f32(max);
+    float32x4_t acc = vdupq_n_f32(0.0f);
+
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        const float32x4_t v = neonExp(vsubq_f32(vld1q_f32(values + i), maxVec));
+        vst1q_f32(values + i, v);
+        acc = vaddq_f32(acc, v);
+    }
+
+    float sum = vaddvq_f32(acc);
+    for (; i < size; i++) {
+        values[i] = expf(values[i] - max);
+        sum += values[i];
+    }
+
+    return sum;
+}
+static void neonScale(float* values, size_t size, float factor) {
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        vst1q_f32(values + i, vmulq_n_f32(vld1q_f32(values + i), factor));
+    }
+
+    for (; i < size; i++) {
+        values[i] *= factor;
+    }
+}
+
+static const SamplingKernels neonKernels = {
+    /* .name               = */ "neon",
+    /* .fillTokenCandidates = */ neonFillTokenCandidates,
+    /* .extractLogits      = */ neonExtractLogits,
+    /* .max                = */ neonMax,
+    /* .expSubtractAndSum  = */ neonExpSubtractAndSum,
+    /* .scale              = */ neonScale,
+};
+#endif
+
+
+static const SamplingKernels& resolveSamplingKernels() {
+#if defined(SAMPLING_KERNELS_X86)
+#   if defined(SAMPLING_KERNELS_RUNTIME_DISPATCH)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512f")) {
+        return avx512Kernels;
+    }
+
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return avx2Kernels;
+    }
+#   elif defined(SAMPLING_KERNELS_HAS_AVX512)
+    return avx512Kernels;
+#   elif defined(SAMPLING_KERNELS_HAS_AVX2)
+    return avx2Kernels;
+#   endif
+
+    return sse2Kernels;
+#elif defined(SAMPLING_KERNELS_NEON)
+    return neonKernels;
+#else
+    return scalarKernels;
+#endif
+}
+
+const SamplingKernels& getSamplingKernels() {
+    static const SamplingKernels& kernels = resolveSamplingKernels();
+    return kernels;
+}
+
+const SamplingKernels& getScalarSamplingKernels() {
+    return scalarKernels;
+}
+
+void computeTokenCandidatesProbabilities(
+    const SamplingKernels& kernels, const llama_token_data* candidates, size_t size, float* probabilities
+) {
+    kernels.extractLogits(probabilities, candidates, size);
+
+    const float maxLogit = kernels.max(probabilities, size);
+    if (size == 0 || maxLogit == -INFINITY) {
+        return;
+    }
+
+    const float sum = kernels.expSubtractAndSum(probabilities, size, maxLogit);
+    kernels.scale(probabilities, size, 1.0f / sum);
+}
+
+float TokenCandidatesSoftmax::probabilityOf(float logit) const {
+    if (maxLogit == -INFINITY || sum == 0.0f) {
+        return 0.0f;
+    }
+
+    return expf(logit - maxLogit) / sum;
+}
+
+TokenCandidatesSoftmax getTokenCandidatesSoftmax(const SamplingKernels& kernels, const llama_token_data* candidates, size_t size) {
+    // process the candidates in chunks that fit in the stack to avoid allocating a buffer for the entire vocabulary
+    constexpr size_t chunkSize = 1024;
+    float chunk[chunkSize];
+
+    TokenCandidatesSoftmax res = {-INFINITY, 0.0f};
+    for (size_t offset = 0; offset < size; offset += chunkSize) {
+        const size_t length = std::min(chunkSize, size - offset);
+        kernels.extractLogits(chunk, candidates + offset, length);
+        res.maxLogit = std::max(res.maxLogit, kernels.max(chunk, length));
+    }
+
+    if (res.maxLogit == -INFINITY) {
+        return res;
+    }
+
+    for (size_t offset = 0; offset < size; offset += chunkSize) {
+        const size_t length = std::min(chunkSize, size - offset);
+        kernels.extractLogits(chunk, candidates + offset, length);
+        res.sum += kernels.expSubtractAndSum(chunk, length, res.maxLogit);
+    }
+
+    return res;
+}
+
+void selectTopTokenCandidates(llama_token_data* candidates, size_t size, size_t n) {
+    const auto compare = [](const llama_token_data & a, const llama_token_data & b) {
+        return a.logit > b.logit;
+    };
+
+    if (n >= size) {
+        std::sort(candidates, candidates + size, compare);
+        return;
+    }
+
+    if (n == 0) {
+        return;
+    }
+
+    std::nth_element(candidates, candidates + (n - 1), candidates + size, compare);
+    std::sort(candidates, candidates + (n - 1), compare);
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <cstddef>
+#include "llama.h"
+
+// Vectorized kernels for the hot loops of sampling over the full vocabulary.
+// The best implementation for the current CPU is selected at runtime (AVX-512, AVX2, SSE2 or NEON),
+// with a scalar fallback for other architectures.
+struct SamplingKernels {
+    const char* name;
+
+    // candidates[i] = {i, logits[i], 0.0f}
+    void (*fillTokenCandidates)(llama_token_data* candidates, const float* logits, size_t size);
+
+    // logits[i] = candidates[i].logit
+    void (*extractLogits)(float* logits, const llama_token_data* candidates, size_t size);
+
+    float (*max)(const float* values, size_t size);
+
+    // values[i] = exp(values[i] - max), returns the sum of the new values
+    float (*expSubtractAndSum)(float* values, size_t size, float max);
+
+    // values[i] *= factor
+    void (*scale)(float* values, size_t size, float factor);
+};
+
+const SamplingKernels& getSamplingKernels();
+const SamplingKernels& getScalarSamplingKernels();
+
+// writes the softmax of the candidates logits to `probabilities`
+void computeTokenCandidatesProbabilities(
+    const SamplingKernels& kernels, const llama_token_data* candidates, size_t size, float* probabilities
+);
+
+struct TokenCandidatesSoftmax {
+    float maxLogit;
+    float sum;
+
+    float probabilityOf(float logit) const;
+};
+
+// the softmax normalization terms of the candidates logits, without allocating a buffer for all the probabilities
+TokenCandidatesSoftmax getTokenCandidatesSoftmax(const SamplingKernels& kernels, const llama_token_data* candidates, size_t size);
+
+// reorders the candidates so the first `n` are the ones with the highest logits, sorted in descending order.
+// the order of the rest of the candidates is unspecified
+void selectTopTokenCandidates(llama_token_data* candidates, size_t size, size_t n);
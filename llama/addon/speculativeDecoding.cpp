@@ -0,0 +1,283 @@
+#include <algorithm>
+#include <mutex>
+#include <stdexcept>
+#include "common/common.h"
+#include "AddonContext.h"
+#include "AddonSampler.h"
+#include "NgramDraftIndex.h"
+#include "speculativeDecoding.h"
+
+static void decodeOrThrow(llama_context* ctx, llama_batch& batch) {
+    const int result = llama_decode(ctx, batch);
+    if (result == 1) {
+        throw std::runtime_error("could not find a KV slot for the batch (try reducing the size of the batch or increase the context)");
+    } else if (result != 0) {
+        throw std::runtime_error("Eval has failed");
+    }
+}
+
+static bool sampleToken(AddonContext* context, AddonSampler* sampler, int32_t batchIndex, llama_token& token) {
+    const auto * logits = llama_get_logits_ith(context->ctx, batchIndex);
+
+    llama_token_data_array cur_p;
+    if (!sampler->sample(logits, cur_p)) {
+        return false;
+    }
+
+    token = cur_p.data[cur_p.selected].id;
+    sampler->acceptToken(token);
+
+    return true;
+}
+
+class ScopedBatch {
+    public:
+        llama_batch batch;
+
+        ScopedBatch(int32_t size, int32_t maxSequencesPerToken = 1)
+            : batch(llama_batch_init(size, 0, maxSequencesPerToken)) {
+        }
+        ~ScopedBatch() {
+            llama_batch_free(batch);
+        }
+};
+
+struct DraftTreeNode {
+    llama_token token;
+    int32_t parent;
+    uint32_t depth;
+    std::vector<size_t> children;
+
+    // the sequences of the branches that go through this node
+    std::vector<llama_seq_id> sequenceIds;
+};
+
+// merges the drafts into a tree rooted at `token`, where drafts that share a prefix share its nodes.
+// the tree is limited to `maxNodes` nodes (including the root), so the last drafts may be truncated
+static void buildDraftTree(
+    llama_token token, const std::vector<std::vector<llama_token>>& drafts, size_t maxNodes, std::vector<DraftTreeNode>& tree
+) {
+    tree.clear();
+    tree.push_back(DraftTreeNode { token, -1, 0, {}, {} });
+
+    for (const auto& draft : drafts) {
+        size_t current = 0;
+
+        for (const llama_token draftToken : draft) {
+            const auto& children = tree[current].children;
+            const auto child = std::find_if(children.begin(), children.end(), [&](size_t child) {
+                return tree[child].token == draftToken;
+            });
+
+            if (child != children.end()) {
+                current = *child;
+                continue;
+            }
+
+            if (tree.size() >= maxNodes) {
+                break;
+            }
+
+            tree.push_back(DraftTreeNode { draftToken, static_cast<int32_t>(current), tree[current].depth + 1, {}, {} });
+            tree[current].children.push_back(tree.size() - 1);
+            current = tree.size() - 1;
+        }
+    }
+}
+
+static void draftWithContext(
+    AddonContext* draftContext, const SpeculativeStepParams& params, uint32_t maxDraftTokens,
+    std::vector<llama_token>& draft, uint32_t& decodedDraftTokens
+) {
+    const int32_t draftBatchSize = static_cast<int32_t>(draftContext->context_params.n_batch);
+    if (params.draftTokens.size() > static_cast<size_t>(draftBatchSize)) {
+        throw std::runtime_error("The draft tokens don't fit in a single batch of the draft context");
+    }
+
+    ScopedBatch draftBatch(std::max(static_cast<int32_t>(params.draftTokens.size()), 1));
+    llama_pos draftPosition = params.draftNextPosition;
+
+    AddonContextDecodeLock lock(draftContext);
+
+    for (size_t i = 0; i < params.draftTokens.size(); i++) {
+        common_batch_add(draftBatch.batch, params.draftTokens[i], draftPosition + i, { params.draftSequenceId }, i == params.draftTokens.size() - 1);
+    }
+    decodeOrThrow(draftContext->ctx, draftBatch.batch);
+    draftPosition += static_cast<llama_pos>(params.draftTokens.size());
+
+    while (draft.size() < maxDraftTokens) {
+        llama_token draftToken;
+        if (!sampleToken(draftContext, params.draftSampler, draftBatch.batch.n_tokens - 1, draftToken)) {
+            break;
+        }
+
+        draft.push_back(draftToken);
+
+        // the last draft token doesn't have to be evaluated on the draft sequence to be verified
+        if (draft.size() == maxDraftTokens || llama_vocab_is_eog(draftContext->model->vocab, draftToken)) {
+            break;
+        }
+
+        common_batch_clear(draftBatch.batch);
+        common_batch_add(draftBatch.batch, draftToken, draftPosition, { params.draftSequenceId }, true);
+        decodeOrThrow(draftContext->ctx, draftBatch.batch);
+        draftPosition++;
+        decodedDraftTokens++;
+    }
+}
+
+static void draftWithNgramIndex(
+    const SpeculativeStepParams& params, uint32_t maxDraftTokens, uint32_t maxDrafts, std::vector<std::vector<llama_token>>& drafts
+) {
+    NgramDraftIndex* index = params.ngramIndex;
+
+    // the index continues from where the previous step left it, or is built again from the first token
+    if (params.draftNextPosition == 0) {
+        index->clear();
+    } else if (index->size() != static_cast<size_t>(params.draftNextPosition)) {
+        throw std::runtime_error("The n-gram index doesn't have the tokens the draft tokens follow");
+    }
+
+    for (const llama_token token : params.draftTokens) {
+        index->push(token);
+    }
+
+    index->draft(maxDraftTokens, maxDrafts, drafts);
+}
+
+static void removeBranchSequences(AddonContext* context, const std::vector<llama_seq_id>& branchSequenceIds) {
+    for (const llama_seq_id branchSequenceId : branchSequenceIds) {
+        llama_memory_seq_rm(llama_get_memory(context->ctx), branchSequenceId, -1, -1);
+    }
+}
+
+void runSpeculativeStep(
+    AddonContext* context, AddonContext* draftContext, const SpeculativeStepParams& params, SpeculativeStepResult& result
+) {
+    if (params.draftTokens.empty() || params.draftTokens.back() != params.token) {
+        throw std::runtime_error("The draft tokens must end with the last token of the target sequence");
+    }
+
+    const uint32_t maxDraftTokens = std::min(params.maxDraftTokens, context->context_params.n_batch - 1);
+
+    std::vector<std::vector<llama_token>> drafts;
+    uint32_t decodedDraftTokens = 0;
+
+    if (params.ngramIndex != nullptr) {
+        draftWithNgramIndex(params, maxDraftTokens, static_cast<uint32_t>(params.branchSequenceIds.size()) + 1, drafts);
+    } else {
+        drafts.emplace_back();
+        draftWithContext(draftContext, params, maxDraftTokens, drafts[0], decodedDraftTokens);
+    }
+
+    std::vector<DraftTreeNode> tree;
+    buildDraftTree(params.token, drafts, static_cast<size_t>(context->context_params.n_batch), tree);
+
+    // each leaf of the tree is a branch with its own sequence, where the first one uses the target sequence itself
+    // and the others use the given branch sequences, which start as a copy of the target sequence
+    std::vector<llama_seq_id> usedBranchSequenceIds;
+    for (size_t i = 0; i < tree.size(); i++) {
+        if (!tree[i].children.empty()) {
+            continue;
+        }
+
+        const bool isFirstBranch = tree[0].sequenceIds.empty();
+        const llama_seq_id branchSequenceId = isFirstBranch
+            ? params.sequenceId
+            : params.branchSequenceIds[usedBranchSequenceIds.size()];
+
+        if (!isFirstBranch) {
+            usedBranchSequenceIds.push_back(branchSequenceId);
+        }
+
+        for (int32_t node = static_cast<int32_t>(i); node >= 0; node = tree[node].parent) {
+            tree[node].sequenceIds.push_back(branchSequenceId);
+        }
+    }
+
+    uint32_t draftedTokens = static_cast<uint32_t>(tree.size() - 1);
+    uint32_t acceptedDraftTokens = 0;
+    {
+        AddonContextDecodeLock lock(context);
+
+        try {
+            for (const llama_seq_id branchSequenceId : usedBranchSequenceIds) {
+                llama_memory_seq_rm(llama_get_memory(context->ctx), branchSequenceId, -1, -1);
+                llama_memory_seq_cp(llama_get_memory(context->ctx), params.sequenceId, branchSequenceId, -1, -1);
+            }
+
+            ScopedBatch targetBatch(static_cast<int32_t>(tree.size()), static_cast<int32_t>(usedBranchSequenceIds.size()) + 1);
+            for (const auto& node : tree) {
+                common_batch_add(targetBatch.batch, node.token, params.nextPosition + node.depth, node.sequenceIds, true);
+            }
+            decodeOrThrow(context->ctx, targetBatch.batch);
+
+            // the batch index of each node is its index in the tree
+            std::vector<size_t> acceptedPath = { 0 };
+            while (true) {
+                const size_t current = acceptedPath.back();
+
+                llama_token token;
+                if (!sampleToken(context, params.sampler, static_cast<int32_t>(current), token)) {
+                    if (result.tokens.empty()) {
+                        throw std::runtime_error("Failed to sample next token");
+                    }
+
+                    // the previous token becomes the last token, which is not evaluated
+                    acceptedPath.pop_back();
+                    break;
+                }
+
+                result.tokens.push_back(token);
+
+                const auto& children = tree[current].children;
+                const auto child = std::find_if(children.begin(), children.end(), [&](size_t child) {
+                    return tree[child].token == token;
+                });
+                if (child == children.end() || llama_vocab_is_eog(context->model->vocab, token)) {
+                    break;
+                }
+
+                acceptedPath.push_back(*child);
+            }
+
+            acceptedDraftTokens = static_cast<uint32_t>(acceptedPath.size() - 1);
+            result.nextPosition = params.nextPosition + 1 + static_cast<llama_pos>(acceptedDraftTokens);
+
+            // keep the cells of the accepted branch on the target sequence.
+            // whole sequences are copied, since partial copies between sequences aren't supported by all memory types
+            const auto& acceptedNodeSequenceIds = tree[acceptedPath.back()].sequenceIds;
+            const bool targetHasAcceptedBranch = std::find(
+                acceptedNodeSequenceIds.begin(), acceptedNodeSequenceIds.end(), params.sequenceId
+            ) != acceptedNodeSequenceIds.end();
+            if (!targetHasAcceptedBranch) {
+                llama_memory_seq_rm(llama_get_memory(context->ctx), params.sequenceId, -1, -1);
+                llama_memory_seq_cp(llama_get_memory(context->ctx), acceptedNodeSequenceIds[0], params.sequenceId, -1, -1);
+            }
+
+            llama_memory_seq_rm(llama_get_memory(context->ctx), params.sequenceId, result.nextPosition, -1);
+            removeBranchSequences(context, usedBranchSequenceIds);
+        } catch (...) {
+            removeBranchSequences(context, usedBranchSequenceIds);
+            throw;
+        }
+    }
+
+    if (params.ngramIndex != nullptr) {
+        for (uint32_t i = 0; i < acceptedDraftTokens; i++) {
+            params.ngramIndex->push(result.tokens[i]);
+        }
+
+        result.draftNextPosition = static_cast<llama_pos>(params.ngramIndex->size());
+    } else {
+        AddonContextDecodeLock lock(draftContext);
+
+        result.draftNextPosition = params.draftNextPosition + static_cast<llama_pos>(params.draftTokens.size()) +
+            static_cast<llama_pos>(std::min(acceptedDraftTokens, decodedDraftTokens));
+        llama_memory_seq_rm(llama_get_memory(draftContext->ctx), params.draftSequenceId, result.draftNextPosition, -1);
+    }
+
+    result.draftedTokens = draftedTokens;
+    result.draftBranches = static_cast<uint32_t>(usedBranchSequenceIds.size()) + 1;
+    result.acceptedDraftTokens = acceptedDraftTokens;
+}
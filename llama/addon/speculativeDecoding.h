@@ -0,0 +1,63 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "llama.h"
+
+class AddonContext;
+class AddonSampler;
+class NgramDraftIndex;
+
+struct SpeculativeStepParams {
+    public:
+        // the target sequence, and its last sampled token that is not evaluated yet
+        llama_seq_id sequenceId = 0;
+        llama_pos nextPosition = 0;
+        llama_token token = 0;
+        AddonSampler* sampler = nullptr;
+
+        // the draft sequence has to have the same tokens as the target sequence up to `draftNextPosition`.
+        // `draftTokens` are the tokens to evaluate on the draft sequence before drafting, and must end with `token`
+        llama_seq_id draftSequenceId = 0;
+        llama_pos draftNextPosition = 0;
+        std::vector<llama_token> draftTokens;
+        AddonSampler* draftSampler = nullptr;
+
+        // when set, the tokens are drafted by looking them up in this index instead of with the draft context.
+        // the index is truncated to `draftNextPosition` before `draftTokens` are pushed to it
+        NgramDraftIndex* ngramIndex = nullptr;
+
+        // unused sequences to lay out the other branches of the draft tree on, which are cleared after the step.
+        // the draft tree has at most one more branch than the number of these sequences
+        std::vector<llama_seq_id> branchSequenceIds;
+
+        uint32_t maxDraftTokens = 0;
+};
+
+struct SpeculativeStepResult {
+    public:
+        // the accepted draft tokens followed by the token the target model sampled after them.
+        // the last token is not evaluated into any of the sequences
+        std::vector<llama_token> tokens;
+
+        uint32_t draftedTokens = 0;
+        uint32_t draftBranches = 0;
+        uint32_t acceptedDraftTokens = 0;
+
+        llama_pos nextPosition = 0;
+        llama_pos draftNextPosition = 0;
+};
+
+// Drafts up to `maxDraftTokens` tokens on the draft context (or with the n-gram index), decodes them together with `token`
+// on the target context, and accepts the longest prefix of the draft that matches the tokens the target sampler selects.
+// The cells of the rejected draft tokens are removed from both sequences, and the accepted ones are pushed to the n-gram index.
+//
+// The n-gram index can draft multiple continuations, which are merged into a token tree where continuations that share a prefix
+// share its nodes. Each branch of the tree is laid out on its own sequence (which starts as a copy of the target sequence)
+// so the whole tree is verified in a single decode, and the cells of the longest accepted branch are kept on the target sequence.
+//
+// Each context is locked only while it's used, so the draft and the target can be the same context.
+// `draftContext` is not used when drafting with an n-gram index.
+// Throws a `std::runtime_error` on failure
+void runSpeculativeStep(
+    AddonContext* context, AddonContext* draftContext, const SpeculativeStepParams& params, SpeculativeStepResult& result
+);
@@ -0,0 +1,410 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include "stateFileCompression.h"
+
+#ifdef NLC_STATE_FILE_COMPRESSION_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef NLC_STATE_FILE_COMPRESSION_LZ4
+#include <lz4frame.h>
+#endif
+
+static const char compressedStateFileMagic[4] = {'N', 'L', 'C', 'S'};
+static const uint32_t compressedStateFileVersion = 1;
+static const size_t streamChunkSize = 1024 * 1024;
+
+// the progress of reading and decompressing the state, as the restore itself is a memory copy
+static const float decompressionProgressShare = 0.95f;
+
+struct CompressedStateFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t compression;
+    uint32_t reserved;
+    uint64_t tokenCount;
+    uint64_t stateSize;
+};
+
+struct FileCloser {
+    void operator()(FILE* file) const {
+        fclose(file);
+    }
+};
+using FileHandle = std::unique_ptr<FILE, FileCloser>;
+
+static FileHandle openFile(const char* filePath, const char* mode) {
+    FileHandle file(fopen(filePath, mode));
+    if (file == nullptr) {
+        throw std::runtime_error(std::string("Failed to open the state file: ") + filePath);
+    }
+
+    return file;
+}
+
+static void writeToFile(FILE* file, const void* data, size_t size) {
+    if (size > 0 && fwrite(data, 1, size, file) != size) {
+        throw std::runtime_error("Failed to write to the state file");
+    }
+}
+
+static void readFromFile(FILE* file, void* data, size_t size) {
+    if (size > 0 && fread(data, 1, size, file) != size) {
+        throw std::runtime_error("Failed to read the state file");
+    }
+}
+
+bool parseStateFileCompression(const std::string& name, StateFileCompression& compression) {
+    if (name == "none") {
+        compression = StateFileCompression::none;
+    } else if (name == "zstd") {
+        compression = StateFileCompression::zstd;
+    } else if (name == "lz4") {
+        compression = StateFileCompression::lz4;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+bool isStateFileCompressionSupported(StateFileCompression compression) {
+    switch (compression) {
+        case StateFileCompression::none:
+            return true;
+        case StateFileCompression::zstd:
+#ifdef NLC_STATE_FILE_COMPRESSION_ZSTD
+            return true;
+#else
+            return false;
+#endif
+        case StateFileCompression::lz4:
+#ifdef NLC_STATE_FILE_COMPRESSION_LZ4
+            return true;
+#else
+            return false;
+#endif
+    }
+
+    return false;
+}
+
+std::vector<std::string> getSupportedStateFileCompressions() {
+    std::vector<std::string> res;
+
+    if (isStateFileCompressionSupported(StateFileCompression::zstd)) {
+        res.push_back("zstd");
+    }
+
+    if (isStateFileCompressionSupported(StateFileCompression::lz4)) {
+        res.push_back("lz4");
+    }
+
+    return res;
+}
+
+bool isCompressedSequenceStateFile(const char* filePath) {
+    FileHandle file(fopen(filePath, "rb"));
+    if (file == nullptr) {
+        return false;
+    }
+
+    char magic[sizeof(compressedStateFileMagic)];
+    if (fread(magic, 1, sizeof(magic), file.get()) != sizeof(magic)) {
+        return false;
+    }
+
+    return std::memcmp(magic, compressedStateFileMagic, sizeof(magic)) == 0;
+}
+
+static void compressStream(FILE* file, const uint8_t* data, size_t size, StateFileCompression compression) {
+#ifdef NLC_STATE_FILE_COMPRESSION_ZSTD
+    if (compression == StateFileCompression::zstd) {
+        std::unique_ptr<ZSTD_CCtx, size_t (*)(ZSTD_CCtx*)> cctx(ZSTD_createCCtx(), ZSTD_freeCCtx);
+        if (cctx == nullptr) {
+            throw std::runtime_error("Failed to create a zstd compression context");
+        }
+
+        ZSTD_CCtx_setParameter(cctx.get(), ZSTD_c_compressionLevel, 3);
+        ZSTD_CCtx_setParameter(cctx.get(), ZSTD_c_checksumFlag, 1);
+
+        ZSTD_CCtx_setPledgedSrcSize(cctx.get(), size);
+
+        std::vector<uint8_t> output(ZSTD_CStreamOutSize());
+
+        // the state is fed to the compressor in chunks, and each chunk is flushed to the file before the next one is read
+        size_t offset = 0;
+        do {
+            const size_t chunkSize = std::min(streamChunkSize, size - offset);
+            const ZSTD_EndDirective mode = offset + chunkSize == size ? ZSTD_e_end : ZSTD_e_continue;
+            ZSTD_inBuffer input = {data + offset, chunkSize, 0};
+
+            while (true) {
+                ZSTD_outBuffer outputBuffer = {output.data(), output.size(), 0};
+                const size_t remaining = ZSTD_compressStream2(cctx.get(), &outputBuffer, &input, mode);
+                if (ZSTD_isError(remaining)) {
+                    throw std::runtime_error(std::string("Failed to compress the state: ") + ZSTD_getErrorName(remaining));
+                }
+
+                writeToFile(file, output.data(), outputBuffer.pos);
+
+                if (mode == ZSTD_e_end ? remaining == 0 : input.pos == input.size) {
+                    break;
+                }
+            }
+
+            offset += chunkSize;
+        } while (offset < size);
+
+        return;
+    }
+#endif
+
+#ifdef NLC_STATE_FILE_COMPRESSION_LZ4
+    if (compression == StateFileCompression::lz4) {
+        LZ4F_cctx* rawCctx = nullptr;
+        if (LZ4F_isError(LZ4F_createCompressionContext(&rawCctx, LZ4F_VERSION))) {
+            throw std::runtime_error("Failed to create an lz4 compression context");
+        }
+        std::unique_ptr<LZ4F_cctx, LZ4F_errorCode_t (*)(LZ4F_cctx*)> cctx(rawCctx, LZ4F_freeCompressionContext);
+
+        LZ4F_preferences_t preferences;
+        std::memset(&preferences, 0, sizeof(preferences));
+        preferences.frameInfo.blockSizeID = LZ4F_max4MB;
+        preferences.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+        preferences.frameInfo.contentSize = size;
+
+        std::vector<uint8_t> output(LZ4F_compressBound(streamChunkSize, &preferences) + LZ4F_HEADER_SIZE_MAX);
+
+        size_t written = LZ4F_compressBegin(cctx.get(), output.data(), output.size(), &preferences);
+        if (LZ4F_isError(written)) {
+            throw std::runtime_error(std::string("Failed to compress the state: ") + LZ4F_getErrorName(written));
+        }
+        writeToFile(file, output.data(), written);
+
+        for (size_t offset = 0; offset < size; offset += streamChunkSize) {
+            const size_t chunkSize = std::min(streamChunkSize, size - offset);
+
+            written = LZ4F_compressUpdate(cctx.get(), output.data(), output.size(), data + offset, chunkSize, nullptr);
+            if (LZ4F_isError(written)) {
+                throw std::runtime_error(std::string("Failed to compress the state: ") + LZ4F_getErrorName(written));
+            }
+            writeToFile(file, output.data(), written);
+        }
+
+        written = LZ4F_compressEnd(cctx.get(), output.data(), output.size(), nullptr);
+        if (LZ4F_isError(written)) {
+            throw std::runtime_error(std::string("Failed to compress the state: ") + LZ4F_getErrorName(written));
+        }
+        writeToFile(file, output.data(), written);
+        return;
+    }
+#endif
+
+    throw std::runtime_error("The requested state file compression is not supported by this build");
+}
+
+static void decompressStream(
+    FILE* file, uint8_t* data, size_t size, StateFileCompression compression, const std::function<bool(float)>& onProgress
+) {
+    std::vector<uint8_t> input(streamChunkSize);
+    size_t outputOffset = 0;
+
+    // called after each chunk of the file is decompressed
+    const auto reportProgress = [&]() {
+        if (!onProgress(size == 0 ? decompressionProgressShare : decompressionProgressShare * float(outputOffset) / float(size))) {
+            throw std::runtime_error("The sequence state load was aborted");
+        }
+    };
+
+#ifdef NLC_STATE_FILE_COMPRESSION_ZSTD
+    if (compression == StateFileCompression::zstd) {
+        std::unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx*)> dctx(ZSTD_createDCtx(), ZSTD_freeDCtx);
+        if (dctx == nullptr) {
+            throw std::runtime_error("Failed to create a zstd decompression context");
+        }
+
+        bool frameEnded = false;
+        while (!frameEnded) {
+            const size_t readSize = fread(input.data(), 1, input.size(), file);
+            if (readSize == 0) {
+                break;
+            }
+
+            ZSTD_inBuffer inputBuffer = {input.data(), readSize, 0};
+            while (inputBuffer.pos < inputBuffer.size) {
+                ZSTD_outBuffer outputBuffer = {data, size, outputOffset};
+                const size_t res = ZSTD_decompressStream(dctx.get(), &outputBuffer, &inputBuffer);
+                if (ZSTD_isError(res)) {
+                    throw std::runtime_error(std::string("Failed to decompress the state: ") + ZSTD_getErrorName(res));
+                }
+
+                const bool madeProgress = outputBuffer.pos != outputOffset;
+                outputOffset = outputBuffer.pos;
+
+                if (res == 0) {
+                    frameEnded = true;
+                    break;
+                } else if (!madeProgress && outputOffset == size) {
+                    throw std::runtime_error("The state file is larger than its declared state size");
+                }
+            }
+
+            reportProgress();
+        }
+
+        if (!frameEnded || outputOffset != size) {
+            throw std::runtime_error("The state file is truncated");
+        }
+
+        return;
+    }
+#endif
+
+#ifdef NLC_STATE_FILE_COMPRESSION_LZ4
+    if (compression == StateFileCompression::lz4) {
+        LZ4F_dctx* rawDctx = nullptr;
+        if (LZ4F_isError(LZ4F_createDecompressionContext(&rawDctx, LZ4F_VERSION))) {
+            throw std::runtime_error("Failed to create an lz4 decompression context");
+        }
+        std::unique_ptr<LZ4F_dctx, LZ4F_errorCode_t (*)(LZ4F_dctx*)> dctx(rawDctx, LZ4F_freeDecompressionContext);
+
+        bool frameEnded = false;
+        while (!frameEnded) {
+            const size_t readSize = fread(input.data(), 1, input.size(), file);
+            if (readSize == 0) {
+                break;
+            }
+
+            size_t inputOffset = 0;
+            while (inputOffset < readSize) {
+                size_t outputSize = size - outputOffset;
+                size_t inputSize = readSize - inputOffset;
+
+                const size_t res = LZ4F_decompress(dctx.get(), data + outputOffset, &outputSize, input.data() + inputOffset, &inputSize, nullptr);
+                if (LZ4F_isError(res)) {
+                    throw std::runtime_error(std::string("Failed to decompress the state: ") + LZ4F_getErrorName(res));
+                }
+
+                outputOffset += outputSize;
+                inputOffset += inputSize;
+
+                if (res == 0) {
+                    frameEnded = true;
+                    break;
+                } else if (outputSize == 0 && inputSize == 0) {
+                    throw std::runtime_error("The state file is larger than its declared state size");
+                }
+            }
+
+            reportProgress();
+        }
+
+        if (!frameEnded || outputOffset != size) {
+            throw std::runtime_error("The state file is truncated");
+        }
+
+        return;
+    }
+#endif
+
+    (void)reportProgress;
+    throw std::runtime_error("The compression of the state file is not supported by this build");
+}
+
+size_t saveCompressedSequenceStateFile(
+    const char* filePath, const std::vector<llama_token>& tokens, const std::vector<uint8_t>& state, StateFileCompression compression
+) {
+    if (!isStateFileCompressionSupported(compression) || compression == StateFileCompression::none) {
+        throw std::runtime_error("The requested state file compression is not supported by this build");
+    }
+
+    const size_t stateSize = state.size();
+
+    CompressedStateFileHeader header;
+    std::memcpy(header.magic, compressedStateFileMagic, sizeof(header.magic));
+    header.version = compressedStateFileVersion;
+    header.compression = static_cast<uint32_t>(compression);
+    header.reserved = 0;
+    header.tokenCount = tokens.size();
+    header.stateSize = stateSize;
+
+    // the file is written next to the target and only replaces it once it's complete,
+    // so a failed save doesn't leave a partial file or destroy an existing one
+    const std::string partialFilePath = std::string(filePath) + ".partial";
+    long fileSize = 0;
+
+    try {
+        FileHandle file = openFile(partialFilePath.c_str(), "wb");
+        writeToFile(file.get(), &header, sizeof(header));
+        writeToFile(file.get(), tokens.data(), tokens.size() * sizeof(llama_token));
+        compressStream(file.get(), state.data(), stateSize, compression);
+
+        if (fflush(file.get()) != 0) {
+            throw std::runtime_error("Failed to write to the state file");
+        }
+
+        fileSize = ftell(file.get());
+        if (fclose(file.release()) != 0) {
+            throw std::runtime_error("Failed to write to the state file");
+        }
+
+        // renaming over an existing file fails on Windows
+        if (std::rename(partialFilePath.c_str(), filePath) != 0 &&
+            (std::remove(filePath) != 0 || std::rename(partialFilePath.c_str(), filePath) != 0)
+        ) {
+            throw std::runtime_error(std::string("Failed to replace the state file: ") + filePath);
+        }
+    } catch (...) {
+        std::remove(partialFilePath.c_str());
+        throw;
+    }
+
+    return fileSize < 0 ? 0 : size_t(fileSize);
+}
+
+size_t loadCompressedSequenceStateFile(
+    const char* filePath, size_t maxTokens, std::vector<llama_token>& tokens, const std::function<bool(float)>& onProgress,
+    const std::function<size_t(const uint8_t*, size_t)>& restoreState
+) {
+    FileHandle file = openFile(filePath, "rb");
+
+    CompressedStateFileHeader header;
+    readFromFile(file.get(), &header, sizeof(header));
+
+    if (std::memcmp(header.magic, compressedStateFileMagic, sizeof(header.magic)) != 0) {
+        throw std::runtime_error("The file is not a compressed state file");
+    } else if (header.version != compressedStateFileVersion) {
+        throw std::runtime_error("Unsupported compressed state file version: " + std::to_string(header.version));
+    }
+
+    StateFileCompression compression = static_cast<StateFileCompression>(header.compression);
+    if (header.compression > static_cast<uint32_t>(StateFileCompression::lz4) || !isStateFileCompressionSupported(compression)) {
+        throw std::runtime_error("The compression of the state file is not supported by this build");
+    }
+
+    if (header.tokenCount > maxTokens) {
+        throw std::runtime_error("Failed to load state from file. Current context sequence size may be smaller that the state of the file");
+    }
+
+    tokens.resize(header.tokenCount);
+    readFromFile(file.get(), tokens.data(), tokens.size() * sizeof(llama_token));
+
+    std::vector<uint8_t> state(header.stateSize);
+    decompressStream(file.get(), state.data(), state.size(), compression, onProgress);
+
+    const size_t readSize = restoreState(state.data(), state.size());
+    if (readSize == 0) {
+        throw std::runtime_error("Failed to load state from file. Current context sequence size may be smaller that the state of the file");
+    }
+
+    onProgress(1);
+
+    const long fileSize = ftell(file.get());
+    return fileSize < 0 ? 0 : size_t(fileSize);
+}
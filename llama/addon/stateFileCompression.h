@@ -0,0 +1,41 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "llama.h"
+
+// Sequence state files can optionally be compressed with zstd or lz4 when the addon is built with support for them
+// (`NLC_STATE_FILE_COMPRESSION_ZSTD` / `NLC_STATE_FILE_COMPRESSION_LZ4`).
+// Compressed files use their own container format, which is detected automatically when loading a state file,
+// so uncompressed files are still saved and loaded using the `llama.cpp` state file format.
+enum class StateFileCompression {
+    none,
+    zstd,
+    lz4
+};
+
+bool parseStateFileCompression(const std::string& name, StateFileCompression& compression);
+bool isStateFileCompressionSupported(StateFileCompression compression);
+std::vector<std::string> getSupportedStateFileCompressions();
+
+bool isCompressedSequenceStateFile(const char* filePath);
+
+// writes a sequence state that was read with `llama_state_seq_get_data`.
+// returns the size of the written file.
+// throws a `std::runtime_error` on failure
+size_t saveCompressedSequenceStateFile(
+    const char* filePath, const std::vector<llama_token>& tokens, const std::vector<uint8_t>& state, StateFileCompression compression
+);
+
+// calls `onProgress` after each decompressed chunk of the file.
+// when `onProgress` returns `false`, the load is aborted before the sequence state is modified.
+// the decompressed state is passed to `restoreState`, which returns the number of bytes it read from it, or `0` on failure,
+// so only the restore itself has to hold the context.
+// returns the size of the read file and sets `tokens` to the tokens of the saved state.
+// throws a `std::runtime_error` on failure
+size_t loadCompressedSequenceStateFile(
+    const char* filePath, size_t maxTokens, std::vector<llama_token>& tokens, const std::function<bool(float)>& onProgress,
+    const std::function<size_t(const uint8_t*, size_t)>& restoreState
+);
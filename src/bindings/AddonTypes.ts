@@ -1,4 +1,5 @@
 import {Token} from "../types.js";
+import type {LlamaNuma} from "./types.js";
 
 
 export type BindingModule = {
@@ -8,6 +9,7 @@ export type BindingModule = {
             gpuLayers?: number,
             vocabOnly?: boolean,
             useMmap?: boolean,
+            numaInterleave?: boolean,
             useMlock?: boolean,
             checkTensors?: boolean,
             onLoadProgress?(loadPercentage: number): void,
@@ -22,6 +24,7 @@ export type BindingModule = {
         new (model: AddonModel, params: {
             contextSize?: number,
             batchSize?: number,
+            microBatchSize?: number,
             sequences?: number,
             flashAttention?: boolean,
             logitsAll?: boolean,
@@ -29,7 +32,18 @@ export type BindingModule = {
             ranking?: boolean,
             threads?: number,
             performanceTracking?: boolean,
-            swaFullCache?: boolean
+            swaFullCache?: boolean,
+            nativeScheduler?: boolean,
+            unifiedKvCache?: boolean,
+            kvCacheKeyType?: number,
+            kvCacheValueType?: number,
+            threadpool?: AddonContextThreadpoolOptions,
+            batchThreadpool?: AddonContextThreadpoolOptions,
+            sessionStore?: {
+                memorySize?: number,
+                diskSize?: number,
+                directory?: string
+            }
         }): AddonContext
     },
     AddonGrammar: {
@@ -52,6 +66,7 @@ export type BindingModule = {
     getSupportsMmap(): boolean,
     getGpuSupportsMmap(): boolean,
     getSupportsMlock(): boolean,
+    getSupportedStateFileCompressions(): AddonStateFileCompression[],
     getMathCores(): number,
     getBlockSizeForGgmlType(ggmlType: number): number | undefined,
     getTypeSizeForGgmlType(ggmlType: number): number | undefined,
@@ -84,7 +99,39 @@ export type BindingModule = {
     getMemoryInfo(): {
         total: number
     },
-    init(): Promise<void>,
+    getNumaInfo(nodesPath?: string): {
+        nodes: Array<{
+            id: number,
+            cpus: number[],
+            totalMemory: number,
+            freeMemory: number
+        }>
+    },
+
+    // development only (`NLC_DEV_BINDINGS` builds): per-token latency (in microseconds) of the sampling hot loops
+    benchmarkSampling?(vocabSize: number, iterations?: number, topN?: number): {
+        kernels: string,
+        scalar: AddonSamplingBenchmarkResult,
+        vectorized: AddonSamplingBenchmarkResult
+    },
+
+    // development only (`NLC_DEV_BINDINGS` builds): the differences between the vectorized and the scalar sampling kernels
+    compareSamplingKernels?(vocabSize: number, seed?: number): {
+        kernels: string,
+        fillMatches: boolean,
+        extractMatches: boolean,
+        maxMatches: boolean,
+        scaleMatches: boolean,
+        expMaxRelativeError: number,
+        expMaxAbsoluteError: number,
+        sumRelativeError: number,
+        probabilitiesMaxAbsoluteError: number,
+        softmaxMaxAbsoluteError: number,
+        topSelectionMatches: boolean
+    },
+    init(options?: {
+        numa?: Exclude<LlamaNuma, false>
+    }): Promise<void>,
     loadBackends(forceLoadLibrariesSearchPath?: string): void,
     dispose(): Promise<void>
 };
@@ -123,6 +170,13 @@ export type AddonContext = {
     dispose(): Promise<void>,
     getContextSize(): number,
     initBatch(size: number): void, // size must be less or equal to batchSize
+    getBatchAllocations(): number, // the number of times the native batch was allocated
+
+    // appends tokens of any number of sequences to the batch. all the arrays must have the same length
+    fillBatch(tokens: Uint32Array, positions: Int32Array, sequenceIds: Int32Array, logits: Uint8Array): void,
+
+    // marks the end of the usage of the batch initialized by `initBatch` and of its logits, so the native scheduler can decode again
+    releaseBatch(): void,
     addToBatch(
         sequenceId: number,
         firstTokenSequenceIndex: number,
@@ -130,32 +184,176 @@ export type AddonContext = {
         logitIndexes: Uint32Array,
     ): Uint32Array, // returns an array with batchLogitIndex for each item in the logitIndexes array
     decodeBatch(): Promise<void>,
+
+    // decodes the batch and then samples a token for each of the given batch logit indexes using the matching sampler.
+    // resolves with the sampled token for each item, or `-1` when the sampler didn't select a token
+    decodeBatchAndSample(batchLogitIndexes: Uint32Array, samplers: AddonSampler[]): Promise<Int32Array>,
     sampleToken(batchLogitIndex: BatchLogitIndex, sampler: AddonSampler): Promise<Token | -1>,
     sampleToken(
         batchLogitIndex: BatchLogitIndex,
         sampler: AddonSampler,
         probabilities: boolean,
-        confidence?: boolean
-    ): Promise<[token: Token | -1, probabilities: (Token | number)[] | undefined, confidence: number | undefined]>,
-    disposeSequence(sequenceId: number): void,
+        confidence?: boolean,
+        maxProbabilities?: number, // 0 = no limit
+        minProbability?: number
+    ): Promise<[
+        token: Token | -1,
+        probabilities: [tokens: Uint32Array, probabilities: Float32Array] | undefined, // sorted by probability in descending order
+        confidence: number | undefined
+    ]>,
+
+    // a copy of the logits of the given batch logit index.
+    // the logits memory is overwritten by decodes that can run on other threads, which can't detach JS buffers,
+    // so instead of an external view over it, the logits are copied on a worker thread under the decode lock
+    // and the copy is handed over without copying it again when the runtime supports external buffers
+    getLogits(batchLogitIndex: BatchLogitIndex): Promise<Float32Array>,
+
+    // same as `getLogits`, but for all the outputs of the last decoded batch, as an `[outputs × vocabularySize]` array
+    getAllLogits(): Promise<Float32Array>,
+
+    // the memory operations run on a worker thread, since they wait for any decode that's in progress
+    disposeSequence(sequenceId: number): Promise<void>,
 
     // startPos in inclusive, endPos is exclusive
-    removeTokenCellsFromSequence(sequenceId: number, startPos: number, endPos: number): boolean,
+    removeTokenCellsFromSequence(sequenceId: number, startPos: number, endPos: number): Promise<boolean>,
 
     // startPos in inclusive, endPos is exclusive
-    shiftSequenceTokenCells(sequenceId: number, startPos: number, endPos: number, shiftDelta: number): void,
+    shiftSequenceTokenCells(sequenceId: number, startPos: number, endPos: number, shiftDelta: number): Promise<void>,
+
+    // startPos in inclusive, endPos is exclusive.
+    // the copied cells are shared with the source sequence when the KV cache is unified
+    copySequenceTokenCells(sourceSequenceId: number, destinationSequenceId: number, startPos: number, endPos: number): Promise<void>,
+
+    // removes the cells of all the other sequences
+    keepOnlySequence(sequenceId: number): Promise<void>,
 
+    // the positions as of the last completed decode or memory operation
     getSequenceKvCacheMinPosition(sequenceId: number): number,
     getSequenceKvCacheMaxPosition(sequenceId: number): number,
-    getEmbedding(inputTokensLength: number, maxVectorSize?: number): Float64Array,
+    getEmbedding(inputTokensLength: number, maxVectorSize?: number): Float32Array,
+
+    // the pooled embedding vectors of the given sequences from the last decoded batch, as a contiguous `[sequences × vectorSize]` array
+    // converted to the given format.
+    // when the context has no pooling, the embedding of the last output token of each sequence in the batch is used
+    getEmbeddings<const Format extends AddonEmbeddingFormat = "float32">(
+        sequenceIds: Uint32Array,
+        format?: Format,
+        maxVectorSize?: number
+    ): Promise<AddonEmbeddingFormatOutput[Format]>,
+
+    // decodes the given token sequences together in a single batch and resolves with the ranking score logit of each of them.
+    // `tokens` are the tokens of all the sequences one after the other, and `tokensLengths` is the number of tokens of each sequence.
+    // the cells of the given sequences are cleared before and after the decode
+    rankBatch(sequenceIds: Uint32Array, tokens: Uint32Array, tokensLengths: Uint32Array): Promise<Float32Array>,
+
+    // may be the size from before a decode that is in progress, so it doesn't wait for it
     getStateSize(): number,
     getThreads(): number,
+
+    // applied before the next decode when a decode is in progress
     setThreads(threads: number): void,
     printTimings(): void,
     ensureDraftContextIsCompatibleForSpeculative(draftContext: AddonContext): void,
-    saveSequenceStateToFile(filePath: string, sequenceId: number, tokens: Uint32Array): Promise<number>,
-    loadSequenceStateFromFile(filePath: string, sequenceId: number, maxContextSize: number): Promise<Uint32Array>,
-    setLora(lora: AddonModelLora, scale: number): void
+
+    // drafts up to `maxDraftTokens` tokens on the draft sequence, verifies them together with `token` in a single decode of
+    // the target sequence, and removes the cells of the rejected draft tokens from both sequences.
+    // `draftTokens` are the tokens the draft sequence is missing, and must end with `token`.
+    // when `draftContext` is `null`, the tokens are drafted with the native n-gram index of the target sequence instead,
+    // where `draftNextTokenIndex` is the number of tokens of the index to keep before `draftTokens` are pushed to it.
+    // the n-gram index can draft a token tree with a branch for each of the `branchSequenceIds` (which must be unused sequences)
+    // in addition to the target sequence, and the cells of the longest accepted branch are kept on the target sequence.
+    // resolves with the accepted draft tokens followed by the token the target sampler selected after them (which is not evaluated)
+    speculativeStep(draftContext: AddonContext | null, options: {
+        sequenceId: number,
+        nextTokenIndex: number,
+        token: Token,
+        sampler: AddonSampler,
+        draftNextTokenIndex: number,
+        draftTokens: Uint32Array,
+        maxDraftTokens: number,
+        draftSequenceId?: number,
+        draftSampler?: AddonSampler,
+        ngram?: {
+            minNgramSize: number,
+            maxNgramSize: number
+        },
+        branchSequenceIds?: Uint32Array
+    }): Promise<[
+        tokens: Uint32Array,
+        draftedTokens: number,
+        acceptedDraftTokens: number,
+        nextTokenIndex: number,
+        draftNextTokenIndex: number,
+        draftBranches: number
+    ]>,
+    saveSequenceStateToFile(filePath: string, sequenceId: number, tokens: Uint32Array, compression?: AddonStateFileCompression): Promise<number>,
+    loadSequenceStateFromFile(filePath: string, sequenceId: number, maxContextSize: number, options?: {
+        useMmap?: boolean,
+        onProgress?(progress: number): void
+    }): Promise<Uint32Array>,
+    abortSequenceStateLoad(sequenceId: number): void,
+    getSequenceState(sequenceId: number): Promise<ArrayBuffer>,
+    setSequenceState(sequenceId: number, state: ArrayBuffer | Uint8Array): Promise<void>,
+    sessionStoreSave(key: string, sequenceId: number, tokens: Uint32Array): Promise<void>,
+    sessionStoreRestore(key: string, sequenceId: number): Promise<Uint32Array | null>, // resolves with `null` when the key is not in the store
+    sessionStorePrefetch(key: string): Promise<boolean>,
+    sessionStoreHas(key: string): boolean,
+    sessionStoreRemove(key: string): boolean,
+    sessionStoreGetStats(): {
+        entries: number,
+        memoryEntries: number,
+        diskEntries: number,
+        memorySize: number,
+        diskSize: number,
+        memoryHits: number,
+        diskHits: number,
+        misses: number,
+        spills: number,
+        evictions: number
+    },
+    setLora(lora: AddonModelLora, scale: number): void,
+
+    // submits tokens to evaluate to the native scheduler, which then keeps generating tokens using the given sampler.
+    // the callback is called with the tokens sampled since the last call (multiple tokens are coalesced into a single call
+    // when JS falls behind), and is called a last time with a `finishReason`.
+    // returns the request id
+    schedulerSubmit(
+        sequenceId: number,
+        firstTokenSequenceIndex: number,
+        tokens: Uint32Array,
+        sampler: AddonSampler,
+        options: {
+            contextSize: number,
+            maxTokens?: number,
+            priority?: number,
+            stopSequences?: Uint32Array[]
+        },
+        callback: (
+            tokens: Uint32Array,
+            nextTokenIndex: number,
+            finishReason?: AddonSchedulerFinishReason,
+            error?: string
+        ) => void
+    ): number,
+    schedulerCancel(requestId: number): boolean // returns `false` when the request has already finished
+};
+
+export type AddonSchedulerFinishReason = "eogToken" | "maxTokens" | "stopSequence" | "contextFull" | "cancelled" | "error";
+
+export type AddonEmbeddingFormat = "float32" | "normalized" | "float16" | "int8" | "binary";
+export type AddonStateFileCompression = "zstd" | "lz4";
+export type AddonContextThreadpoolOptions = {
+    cpuMask?: number[],
+    strictCpu?: boolean,
+    priority?: "low" | "normal" | "medium" | "high" | "realtime",
+    poll?: number
+};
+export type AddonEmbeddingFormatOutput = {
+    float32: Float32Array,
+    normalized: Float32Array, // L2-normalized
+    float16: Uint16Array, // IEEE 754 half precision bits
+    int8: [values: Int8Array, scales: Float32Array], // value = quantized * scales[vectorIndex]
+    binary: Uint8Array // sign bits, packed 8 per byte with the first value at the most significant bit
 };
 
 export type BatchLogitIndex = number & {
@@ -196,6 +394,13 @@ export type AddonModelLora = {
     dispose(): Promise<void>
 };
 
+export type AddonSamplingBenchmarkResult = {
+    fill: number,
+    confidence: number,
+    probabilities: number,
+    topProbabilities: number
+};
+
 export type ModelTypeDescription = `${AddonModelArchName} ${AddonModelTypeName} ${AddonModelFileTypeName}`;
 export type AddonModelArchName = "unknown" | "llama" | "falcon" | "gpt2" | "gptj" | "gptneox" | "mpt" | "baichuan" | "starcoder" | "persimmon" |
     "refact" | "bloom" | "stablelm";
@@ -10,8 +10,10 @@ import {LlamaJsonSchemaGrammar} from "../evaluator/LlamaJsonSchemaGrammar.js";
 import {LlamaGrammar, LlamaGrammarOptions} from "../evaluator/LlamaGrammar.js";
 import {ThreadsSplitter} from "../utils/ThreadsSplitter.js";
 import {getLlamaClasses, LlamaClasses} from "../utils/getLlamaClasses.js";
-import {BindingModule} from "./AddonTypes.js";
-import {BuildGpu, BuildMetadataFile, LlamaGpuType, LlamaLocks, LlamaLogLevel, LlamaLogLevelGreaterThanOrEqual} from "./types.js";
+import {AddonStateFileCompression, BindingModule} from "./AddonTypes.js";
+import {
+    BuildGpu, BuildMetadataFile, LlamaGpuType, LlamaLocks, LlamaLogLevel, LlamaLogLevelGreaterThanOrEqual, LlamaNuma
+} from "./types.js";
 import {MemoryOrchestrator, MemoryReservation} from "./utils/MemoryOrchestrator.js";
 
 export const LlamaLogLevelToAddonLogLevel: ReadonlyMap<LlamaLogLevel, number> = new Map([
@@ -48,7 +50,9 @@ export class Llama {
     /** @internal */ private readonly _supportsMmap: boolean;
     /** @internal */ private readonly _gpuSupportsMmap: boolean;
     /** @internal */ private readonly _supportsMlock: boolean;
+    /** @internal */ private readonly _supportedStateFileCompressions: readonly AddonStateFileCompression[];
     /** @internal */ private readonly _mathCores: number;
+    /** @internal */ private readonly _numa: LlamaNuma;
     /** @internal */ private readonly _llamaCppRelease: {
         readonly repo: string,
         readonly release: string
@@ -67,7 +71,7 @@ export class Llama {
     public readonly onDispose = new EventRelay<void>();
 
     private constructor({
-        bindings, bindingPath, logLevel, logger, buildType, cmakeOptions, llamaCppRelease, debug, buildGpu, maxThreads, vramOrchestrator,
+        bindings, bindingPath, logLevel, logger, buildType, cmakeOptions, llamaCppRelease, debug, buildGpu, maxThreads, numa, vramOrchestrator,
         vramPadding, ramOrchestrator, ramPadding, swapOrchestrator
     }: {
         bindings: BindingModule,
@@ -83,6 +87,7 @@ export class Llama {
         debug: boolean,
         buildGpu: BuildGpu,
         maxThreads?: number,
+        numa?: LlamaNuma,
         vramOrchestrator: MemoryOrchestrator,
         vramPadding: MemoryReservation,
         ramOrchestrator: MemoryOrchestrator,
@@ -115,7 +120,9 @@ export class Llama {
         this._supportsMmap = bindings.getSupportsMmap();
         this._gpuSupportsMmap = bindings.getGpuSupportsMmap();
         this._supportsMlock = bindings.getSupportsMlock();
+        this._supportedStateFileCompressions = bindings.getSupportedStateFileCompressions();
         this._mathCores = bindings.getMathCores();
+        this._numa = numa ?? false;
         this._consts = bindings.getConsts();
         this._vramOrchestrator = vramOrchestrator;
         this._vramPadding = vramPadding;
@@ -187,6 +194,16 @@ export class Llama {
         return this._supportsMlock;
     }
 
+    /**
+     * The compressions that can be used when saving a context sequence state to a file.
+     *
+     * Compressions are only available when the matching libraries (`zstd` and `lz4`) were found when building the bindings.
+     * The `NLC_STATE_FILE_COMPRESSION` CMake option that controls this is enabled by default.
+     */
+    public get supportedStateFileCompressions() {
+        return this._supportedStateFileCompressions;
+    }
+
     /** The number of CPU cores that are useful for math */
     public get cpuMathCores() {
         return this._mathCores;
@@ -225,6 +242,15 @@ export class Llama {
         return this._logger;
     }
 
+    /**
+     * The NUMA strategy used for the CPU computations.
+     *
+     * See the `numa` option of `getLlama` for more information.
+     */
+    public get numa() {
+        return this._numa;
+    }
+
     public set logger(value: (level: LlamaLogLevel, message: string) => void) {
         this._logger = value;
 
@@ -317,6 +343,40 @@ export class Llama {
         };
     }
 
+    /**
+     * Get the NUMA topology of the system.
+     *
+     * Each node includes the indexes of its CPUs and the size of its memory,
+     * which can be used to pin contexts to the CPUs of a specific node using the `threadpool` option of `createContext`.
+     *
+     * Only supported on Linux. On other platforms, `nodes` will be empty.
+     */
+    public async getNumaState(): Promise<{
+        /** Whether the system has more than one NUMA node */
+        isNuma: boolean,
+        nodes: Array<{
+            id: number,
+
+            /** The indexes of the CPUs of the node */
+            cpus: number[],
+
+            /** The total size of the memory of the node */
+            totalMemory: number,
+
+            /** The size of the memory of the node that is currently free */
+            freeMemory: number
+        }>
+    }> {
+        this._ensureNotDisposed();
+
+        const {nodes} = this._bindings.getNumaInfo();
+
+        return {
+            isNuma: nodes.length > 1,
+            nodes
+        };
+    }
+
     public async getGpuDeviceNames() {
         this._ensureNotDisposed();
 
@@ -366,7 +426,11 @@ export class Llama {
 
     /** @internal */
     public async _init() {
-        await this._bindings.init();
+        await this._bindings.init(
+            this._numa === false
+                ? undefined
+                : {numa: this._numa}
+        );
     }
 
     /**
@@ -467,7 +531,7 @@ export class Llama {
 
     /** @internal */
     public static async _create({
-        bindings, bindingPath, buildType, buildMetadata, logLevel, logger, vramPadding, ramPadding, maxThreads, skipLlamaInit = false,
+        bindings, bindingPath, buildType, buildMetadata, logLevel, logger, vramPadding, ramPadding, maxThreads, numa, skipLlamaInit = false,
         debug
     }: {
         bindings: BindingModule,
@@ -477,6 +541,7 @@ export class Llama {
         logLevel: LlamaLogLevel,
         logger: (level: LlamaLogLevel, message: string) => void,
         maxThreads?: number,
+        numa?: LlamaNuma,
         vramPadding: number | ((totalVram: number) => number),
         ramPadding: number | ((totalRam: number) => number),
         skipLlamaInit?: boolean,
@@ -540,6 +605,7 @@ export class Llama {
             buildGpu: buildMetadata.buildOptions.gpu,
             vramOrchestrator,
             maxThreads,
+            numa,
             vramPadding: vramOrchestrator.reserveMemory(0),
             ramOrchestrator,
             ramPadding: resolvedRamPadding,
@@ -16,7 +16,7 @@ import {
 } from "./utils/compileLLamaCpp.js";
 import {getLastBuildInfo} from "./utils/lastBuildInfo.js";
 import {getClonedLlamaCppRepoReleaseInfo, isLlamaCppRepoCloned} from "./utils/cloneLlamaCppRepo.js";
-import {BuildGpu, BuildMetadataFile, BuildOptions, LlamaGpuType, LlamaLogLevel} from "./types.js";
+import {BuildGpu, BuildMetadataFile, BuildOptions, LlamaGpuType, LlamaLogLevel, LlamaNuma} from "./types.js";
 import {BinaryPlatform, getPlatform} from "./utils/getPlatform.js";
 import {getBuildFolderNameForBuildOptions} from "./utils/getBuildFolderNameForBuildOptions.js";
 import {resolveCustomCmakeOptions} from "./utils/resolveCustomCmakeOptions.js";
@@ -127,6 +127,23 @@ export type LlamaOptions = {
      */
     maxThreads?: number,
 
+    /**
+     * The NUMA strategy to use for the CPU computations.
+     * - **`false`** - don't apply any NUMA optimizations.
+     * - **`"distribute"`** - spread the execution evenly over all the NUMA nodes.
+     * - **`"isolate"`** - only spawn threads on the CPUs of the NUMA node the process started on.
+     * - **`"numactl"`** - use the CPU map provided by `numactl`.
+     *
+     * When using a NUMA strategy, it's recommended to drop the system page cache before loading a model for the first time,
+     * so the model memory is placed according to the strategy.
+     *
+     * The NUMA strategy is applied once per process, so only the first `Llama` instance to be initialized determines it,
+     * and initializing a later instance with a different NUMA strategy throws an error.
+     *
+     * Defaults to `false`.
+     */
+    numa?: LlamaNuma,
+
     /**
      * Pad the available VRAM for the memory size calculations, as these calculations are not always accurate.
      * Recommended to ensure stability.
@@ -217,6 +234,23 @@ export type LastBuildOptions = {
      */
     maxThreads?: number,
 
+    /**
+     * The NUMA strategy to use for the CPU computations.
+     * - **`false`** - don't apply any NUMA optimizations.
+     * - **`"distribute"`** - spread the execution evenly over all the NUMA nodes.
+     * - **`"isolate"`** - only spawn threads on the CPUs of the NUMA node the process started on.
+     * - **`"numactl"`** - use the CPU map provided by `numactl`.
+     *
+     * When using a NUMA strategy, it's recommended to drop the system page cache before loading a model for the first time,
+     * so the model memory is placed according to the strategy.
+     *
+     * The NUMA strategy is applied once per process, so only the first `Llama` instance to be initialized determines it,
+     * and initializing a later instance with a different NUMA strategy throws an error.
+     *
+     * Defaults to `false`.
+     */
+    numa?: LlamaNuma,
+
     /**
      * Pad the available VRAM for the memory size calculations, as these calculations are not always accurate.
      * Recommended to ensure stability.
@@ -316,6 +350,7 @@ export async function getLlama(options?: LlamaOptions | "lastBuild", lastBuildOp
             progressLogs: lastBuildOptions?.progressLogs ?? true,
             skipDownload: lastBuildOptions?.skipDownload ?? defaultSkipDownload,
             maxThreads: lastBuildOptions?.maxThreads,
+            numa: lastBuildOptions?.numa,
             vramPadding: lastBuildOptions?.vramPadding ?? defaultLlamaVramPadding,
             ramPadding: lastBuildOptions?.ramPadding ?? defaultLlamaRamPadding,
             debug: lastBuildOptions?.debug ?? defaultLlamaCppDebugMode,
@@ -343,6 +378,7 @@ export async function getLlama(options?: LlamaOptions | "lastBuild", lastBuildOp
                     logger: lastBuildOptions?.logger ?? Llama.defaultConsoleLogger,
                     logLevel: lastBuildOptions?.logLevel ?? defaultLlamaCppLogLevel,
                     maxThreads: lastBuildOptions?.maxThreads,
+                    numa: lastBuildOptions?.numa,
                     vramPadding: lastBuildOptions?.vramPadding ?? defaultLlamaVramPadding,
                     ramPadding: lastBuildOptions?.ramPadding ?? defaultLlamaRamPadding,
                     debug: lastBuildOptions?.debug ?? defaultLlamaCppDebugMode,
@@ -377,6 +413,7 @@ export async function getLlamaForOptions({
     progressLogs = true,
     skipDownload = defaultSkipDownload,
     maxThreads,
+    numa,
     vramPadding = defaultLlamaVramPadding,
     ramPadding = defaultLlamaRamPadding,
     debug = defaultLlamaCppDebugMode,
@@ -450,6 +487,7 @@ export async function getLlamaForOptions({
                     progressLogs,
                     skipDownload,
                     maxThreads,
+                    numa,
                     vramPadding,
                     ramPadding,
                     debug,
@@ -467,6 +505,7 @@ export async function getLlamaForOptions({
                     progressLogs,
                     skipDownload,
                     maxThreads,
+                    numa,
                     vramPadding,
                     ramPadding,
                     debug,
@@ -506,6 +545,7 @@ export async function getLlamaForOptions({
                 platformInfo,
                 skipLlamaInit,
                 maxThreads,
+                numa,
                 vramPadding,
                 ramPadding,
                 fallbackMessage: !isLastItem
@@ -574,6 +614,7 @@ export async function getLlamaForOptions({
                 logger,
                 updateLastBuildInfoOnCompile,
                 maxThreads,
+                numa,
                 vramPadding,
                 ramPadding,
                 skipLlamaInit,
@@ -618,6 +659,7 @@ async function loadExistingLlamaBinary({
     platformInfo,
     skipLlamaInit,
     maxThreads,
+    numa,
     vramPadding,
     ramPadding,
     fallbackMessage,
@@ -634,6 +676,7 @@ async function loadExistingLlamaBinary({
     platformInfo: BinaryPlatformInfo,
     skipLlamaInit: boolean,
     maxThreads: number | undefined,
+    numa: LlamaNuma | undefined,
     vramPadding: Required<LlamaOptions>["vramPadding"],
     ramPadding: Required<LlamaOptions>["ramPadding"],
     fallbackMessage: string | null,
@@ -671,6 +714,7 @@ async function loadExistingLlamaBinary({
                     logLevel,
                     logger,
                     maxThreads,
+                    numa,
                     vramPadding,
                     ramPadding,
                     skipLlamaInit,
@@ -730,6 +774,7 @@ async function loadExistingLlamaBinary({
                         logLevel,
                         logger,
                         maxThreads,
+                        numa,
                         vramPadding,
                         ramPadding,
                         skipLlamaInit,
@@ -785,6 +830,7 @@ async function buildAndLoadLlamaBinary({
     logger,
     updateLastBuildInfoOnCompile,
     maxThreads,
+    numa,
     vramPadding,
     ramPadding,
     skipLlamaInit,
@@ -796,6 +842,7 @@ async function buildAndLoadLlamaBinary({
     logger: Required<LlamaOptions>["logger"],
     updateLastBuildInfoOnCompile: boolean,
     maxThreads: number | undefined,
+    numa: LlamaNuma | undefined,
     vramPadding: Required<LlamaOptions>["vramPadding"],
     ramPadding: Required<LlamaOptions>["ramPadding"],
     skipLlamaInit: boolean,
@@ -830,6 +877,7 @@ async function buildAndLoadLlamaBinary({
         logLevel,
         logger,
         maxThreads,
+        numa,
         vramPadding,
         ramPadding,
         skipLlamaInit,
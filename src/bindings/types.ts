@@ -4,6 +4,7 @@ import {BinaryPlatformInfo} from "./utils/getPlatformInfo.js";
 
 export const buildGpuOptions = ["metal", "cuda", "vulkan", false] as const;
 export type LlamaGpuType = "metal" | "cuda" | "vulkan" | false;
+export type LlamaNuma = false | "distribute" | "isolate" | "numactl";
 export const nodeLlamaCppGpuOptions = [
     "auto",
     ...buildGpuOptions
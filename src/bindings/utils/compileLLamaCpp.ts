@@ -133,6 +133,10 @@ export async function compileLlamaCpp(buildOptions: BuildOptions, compileOptions
                 if (!cmakeCustomOptions.has("LLAMA_CURL"))
                     cmakeCustomOptions.set("LLAMA_CURL", "OFF");
 
+                // compression is only enabled for the formats whose libraries are found on the system
+                if (!cmakeCustomOptions.has("NLC_STATE_FILE_COMPRESSION"))
+                    cmakeCustomOptions.set("NLC_STATE_FILE_COMPRESSION", "ON");
+
                 if (buildOptions.platform === "win" && buildOptions.arch === "arm64" && !cmakeCustomOptions.has("GGML_OPENMP"))
                     cmakeCustomOptions.set("GGML_OPENMP", "OFF");
 
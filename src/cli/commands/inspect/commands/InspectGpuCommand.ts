@@ -158,6 +158,7 @@ export const InspectGpuCommand: CommandModule<object, InspectGpuCommand> = {
 
         if (lastLlama != null) {
             await logSwapUsage(lastLlama);
+            await logNumaTopology(lastLlama);
             console.info(`${chalk.yellow("mmap:")} ${lastLlama.supportsMmap ? "supported" : "unsupported"}`);
         }
     }
@@ -227,6 +228,38 @@ async function logSwapUsage(llama: Llama) {
     console.info(`${chalk.yellow("Max swap size:")} ${swapState.maxSize === Infinity ? "dynamic" : toBytes(swapState.maxSize)}`);
 }
 
+async function logNumaTopology(llama: Llama) {
+    const numaState = await llama.getNumaState();
+
+    if (!numaState.isNuma)
+        return;
+
+    console.info(`${chalk.yellow("NUMA nodes:")} ${numaState.nodes.length}`);
+    for (const node of numaState.nodes) {
+        const usedMemory = node.totalMemory - node.freeMemory;
+
+        console.info(
+            `${chalk.yellow(`NUMA node ${node.id}:`)} ${node.cpus.length} CPUs ${chalk.gray("(" + formatCpuList(node.cpus) + ")")}, ` +
+            `${getPercentageString(usedMemory, node.totalMemory)}% used RAM ` +
+            chalk.gray("(" + toBytes(usedMemory) + "/" + toBytes(node.totalMemory) + ")")
+        );
+    }
+}
+
+function formatCpuList(cpus: number[]) {
+    const ranges: string[] = [];
+
+    for (let i = 0; i < cpus.length; i++) {
+        const start = cpus[i]!;
+        while (i + 1 < cpus.length && cpus[i + 1] === cpus[i]! + 1)
+            i++;
+
+        ranges.push(start === cpus[i] ? String(start) : `${start}-${cpus[i]}`);
+    }
+
+    return ranges.join(",");
+}
+
 function getPercentageString(amount: number, total: number) {
     if (total === 0)
         return "0";
@@ -1,8 +1,12 @@
 import path from "path";
+import fs from "fs-extra";
 import {acquireLock, AsyncDisposeAggregator, DisposeAggregator, DisposedError, EventRelay, Lock, withLock} from "lifecycle-utils";
 import {removeNullFields} from "../../utils/removeNullFields.js";
 import {Token} from "../../types.js";
-import {AddonContext, AddonModelLora, BatchLogitIndex} from "../../bindings/AddonTypes.js";
+import {
+    AddonContext, AddonContextThreadpoolOptions, AddonEmbeddingFormat, AddonEmbeddingFormatOutput, AddonModelLora, AddonSampler,
+    AddonSchedulerFinishReason, BatchLogitIndex
+} from "../../bindings/AddonTypes.js";
 import {LlamaGrammarEvaluationState} from "../LlamaGrammarEvaluationState.js";
 import {compareTokens} from "../../utils/compareTokens.js";
 import {DisposalPreventionHandle, DisposeGuard} from "../../utils/DisposeGuard.js";
@@ -16,10 +20,14 @@ import {safeEventCallback} from "../../utils/safeEventCallback.js";
 import {GgufArchitectureType} from "../../gguf/types/GgufMetadataTypes.js";
 import {
     BatchingOptions, BatchItem, ContextShiftOptions, ContextTokensDeleteRange, ControlledEvaluateIndexOutput, ControlledEvaluateInputItem,
-    EvaluationPriority, LlamaContextOptions, LlamaContextSequenceRepeatPenalty, PrioritizedBatchItem, SequenceEvaluateMetadataOptions,
-    SequenceEvaluateOptions, SequenceEvaluateOutput
+    EvaluationPriority, LlamaContextOptions, LlamaContextPrefixCacheStats, LlamaContextSequenceRepeatPenalty,
+    LlamaContextSequenceStateSnapshot, LlamaContextKvCacheType, LlamaContextSessionStoreStats, LlamaContextThreadpoolOptions,
+    LlamaStateFileCompression, PrioritizedBatchItem, SequenceEvaluateMetadataOptions, SequenceEvaluateOptions, SequenceEvaluateOutput,
+    SequenceGenerateFinishReason, SequenceGenerateOptions
 } from "./types.js";
 import {resolveBatchItemsPrioritizationStrategy} from "./utils/resolveBatchItemsPrioritizationStrategy.js";
+import {TokenPrefixIndex} from "./utils/TokenPrefixIndex.js";
+import {defaultKvCacheType, isQuantizedKvCacheType, kvCacheTypeToGgmlType} from "./utils/kvCacheTypes.js";
 import {LlamaSampler} from "./LlamaSampler.js";
 import {TokenPredictor} from "./TokenPredictor.js";
 import type {Llama} from "../../bindings/Llama.js";
@@ -27,11 +35,16 @@ import type {Llama} from "../../bindings/Llama.js";
 const defaultLoraScale = 1;
 const shrinkRetriesMinContextSize = 4096;
 const defaultMaxPunishTokens = 64;
+const defaultSessionStoreMemorySize = 1024 * 1024 * 1024; // 1GiB
+const defaultSessionStoreDiskSize = 8 * 1024 * 1024 * 1024; // 8GiB
 const defaultFailedCreationRemedy = {
     retries: 6,
     autoContextSizeShrink: 0.16
 } as const satisfies Required<LlamaContextOptions["failedCreationRemedy"]>;
 const defaultEvaluationPriority: EvaluationPriority = 5;
+const defaultSpeculativeDraftTokens = 8;
+const defaultMinNgramDraftSize = 2;
+const defaultMaxNgramDraftSize = 4;
 
 const decodeSyncWorkaround = {
     vulkanLock: {}
@@ -46,6 +59,7 @@ export class LlamaContext {
     /** @internal */ private readonly _model: LlamaModel;
     /** @internal */ private readonly _contextSize: number;
     /** @internal */ private readonly _batchSize: number;
+    /** @internal */ private readonly _microBatchSize: number;
     /** @internal */ private readonly _flashAttention: boolean;
     /** @internal */ private readonly _idealThreads: number;
     /** @internal */ private readonly _minThreads: number;
@@ -54,12 +68,22 @@ export class LlamaContext {
     /** @internal */ private readonly _unusedSequenceIds: number[] = [];
     /** @internal */ private readonly _batchingOptions: Required<BatchingOptions>;
     /** @internal */ private readonly _swaFullCache: boolean = false;
+    /** @internal */ private readonly _kvCacheKeyType: LlamaContextKvCacheType;
+    /** @internal */ private readonly _kvCacheValueType: LlamaContextKvCacheType;
     /** @internal */ private readonly _queuedDecodeSequenceIds = new Set<number>();
     /** @internal */ private readonly _queuedDecodes: InternalQueuedDecode[] = [];
     /** @internal */ private readonly _disposeAggregator = new AsyncDisposeAggregator();
     /** @internal */ private readonly _modelPreventDisposalHandle: DisposalPreventionHandle;
     /** @internal */ private readonly _loraAdapters = new Set<AddonModelLora>();
     /** @internal */ private readonly _gcRegistry: FinalizationRegistry<Set<AddonModelLora>>;
+    /** @internal */ private readonly _prefixIndex?: TokenPrefixIndex;
+    /** @internal */ private readonly _prefixIndexChangedSequences = new Set<LlamaContextSequence>();
+    /** @internal */ private readonly _prefixCacheStats = {lookups: 0, hits: 0, savedTokens: 0, evictedTokens: 0, truncatedTokens: 0};
+    /** @internal */ private _kvCacheBytesPerToken?: number;
+    /** @internal */ private _batchFillBuffers?: BatchFillBuffers;
+    /** @internal */ private readonly _sessionStoreEnabled: boolean;
+    /** @internal */ public readonly _nativeScheduler: boolean;
+    /** @internal */ public readonly _unifiedKvCache: boolean;
     /** @internal */ private _nextGeneratedSequenceId = 0;
     /** @internal */ private _dispatchDecodeScheduled = false;
     /** @internal */ private _batchDispatchPending = false;
@@ -79,6 +103,7 @@ export class LlamaContext {
         sequences,
         contextSize,
         batchSize,
+        microBatchSize,
         flashAttention = _model.defaultContextFlashAttention,
         threads,
         batching: {
@@ -86,7 +111,14 @@ export class LlamaContext {
             itemPrioritizationStrategy: batchingItemsPrioritizationStrategy = "maximumParallelism"
         } = {},
         swaFullCache = _model.defaultContextSwaFullCache,
+        kvCacheKeyType = defaultKvCacheType,
+        kvCacheValueType = defaultKvCacheType,
         performanceTracking = false,
+        prefixCache = false,
+        sessionStore = false,
+        threadpool = false,
+        nativeScheduler = false,
+        unifiedKvCache = false,
         _embeddings,
         _ranking
     }: LlamaContextOptions & {
@@ -105,6 +137,7 @@ export class LlamaContext {
         this._totalSequences = Math.max(1, Math.floor(sequences));
         this._contextSize = Math.max(2, contextSize);
         this._batchSize = Math.max(batchSize, this._totalSequences);
+        this._microBatchSize = Math.max(1, Math.min(Math.floor(microBatchSize ?? this._batchSize), this._batchSize));
         this._flashAttention = flashAttention;
         this._idealThreads = typeof threads === "number"
             ? this._llama._threadsSplitter.normalizeThreadsValue(threads)
@@ -123,6 +156,15 @@ export class LlamaContext {
         );
         this._performanceTracking = !!performanceTracking;
         this._swaFullCache = !!swaFullCache;
+        this._kvCacheKeyType = kvCacheKeyType;
+        this._kvCacheValueType = kvCacheValueType;
+        this._prefixIndex = prefixCache
+            ? new TokenPrefixIndex()
+            : undefined;
+        this._sessionStoreEnabled = sessionStore !== false;
+        this._nativeScheduler = !!nativeScheduler;
+        this._unifiedKvCache = !!unifiedKvCache;
+
         this._ctx = new this._llama._bindings.AddonContext(this._model._model, removeNullFields({
             contextSize: this._contextSize * this._totalSequences, // each sequence needs its own <contextSize> of cells
             batchSize: this._batchSize + (
@@ -130,13 +172,36 @@ export class LlamaContext {
                     ? 1 // +1 to handle edge cases with SWA KV cache
                     : 0
             ),
+            microBatchSize: this._microBatchSize === this._batchSize
+                ? undefined
+                : this._microBatchSize,
             sequences: this._totalSequences,
             flashAttention: this._flashAttention,
             threads: this._idealThreads,
             embeddings: _embeddings,
             ranking: _ranking,
             performanceTracking: this._performanceTracking,
-            swaFullCache: this._swaFullCache
+            swaFullCache: this._swaFullCache,
+            nativeScheduler: this._nativeScheduler,
+            unifiedKvCache: this._unifiedKvCache,
+            kvCacheKeyType: this._kvCacheKeyType === defaultKvCacheType
+                ? undefined
+                : kvCacheTypeToGgmlType(this._kvCacheKeyType),
+            kvCacheValueType: this._kvCacheValueType === defaultKvCacheType
+                ? undefined
+                : kvCacheTypeToGgmlType(this._kvCacheValueType),
+            sessionStore: sessionStore === false
+                ? undefined
+                : resolveSessionStoreOptions(sessionStore),
+            threadpool: threadpool === false
+                ? undefined
+                : resolveThreadpoolOptions(threadpool === true ? {} : threadpool),
+            batchThreadpool: threadpool === false
+                ? undefined
+                : resolveThreadpoolOptions({
+                    ...(threadpool === true ? {} : threadpool),
+                    ...(threadpool === true ? {} : threadpool.batch)
+                })
         }));
         this._batchingOptions = {
             dispatchSchedule: batchingDispatchSchedule,
@@ -204,13 +269,36 @@ export class LlamaContext {
         return this._batchSize;
     }
 
+    /**
+     * The number of tokens that are physically processed at once by the backend
+     */
+    public get microBatchSize(): number {
+        return this._microBatchSize;
+    }
+
     public get flashAttention(): boolean {
         return this._flashAttention;
     }
 
+    /**
+     * The data type of the keys in the KV cache
+     */
+    public get kvCacheKeyType(): LlamaContextKvCacheType {
+        return this._kvCacheKeyType;
+    }
+
+    /**
+     * The data type of the values in the KV cache
+     */
+    public get kvCacheValueType(): LlamaContextKvCacheType {
+        return this._kvCacheValueType;
+    }
+
     /**
      * The actual size of the state in the memory in bytes.
      * This value is provided by `llama.cpp` and doesn't include all the memory overhead of the context.
+     *
+     * While an evaluation is running, this may be the size from before it, so reading it doesn't wait for the evaluation.
      */
     public get stateSize() {
         this._ensureNotDisposed();
@@ -234,6 +322,88 @@ export class LlamaContext {
         return this._idealThreads;
     }
 
+    /**
+     * Statistics of the session store of the context.
+     *
+     * Only available when the `sessionStore` option is enabled.
+     */
+    public get sessionStoreStats(): LlamaContextSessionStoreStats | undefined {
+        if (!this._sessionStoreEnabled || this._disposed)
+            return undefined;
+
+        return this._ctx.sessionStoreGetStats();
+    }
+
+    /**
+     * Check whether the session store holds a snapshot for the given key.
+     *
+     * Only available when the `sessionStore` option is enabled.
+     */
+    public hasSessionState(key: string) {
+        this._ensureSessionStoreEnabled();
+
+        return this._ctx.sessionStoreHas(key);
+    }
+
+    /**
+     * Load a snapshot that was spilled to the disk back into memory,
+     * so restoring it later using `sequence.loadStateFromSessionStore(key)` won't have to wait for the disk.
+     *
+     * Only available when the `sessionStore` option is enabled.
+     * @returns `false` when the session store has no snapshot for the given key
+     */
+    public async prefetchSessionState(key: string) {
+        this._ensureSessionStoreEnabled();
+
+        return await this._ctx.sessionStorePrefetch(key);
+    }
+
+    /**
+     * Remove the snapshot of the given key from the session store.
+     *
+     * Only available when the `sessionStore` option is enabled.
+     * @returns `false` when the session store has no snapshot for the given key
+     */
+    public deleteSessionState(key: string) {
+        this._ensureSessionStoreEnabled();
+
+        return this._ctx.sessionStoreRemove(key);
+    }
+
+    /**
+     * Statistics of the prefix cache of the context.
+     *
+     * Only available when the `prefixCache` option is enabled.
+     */
+    public get prefixCacheStats(): LlamaContextPrefixCacheStats | undefined {
+        if (this._prefixIndex == null)
+            return undefined;
+
+        this._updatePrefixIndex();
+
+        const {lookups, hits, savedTokens, evictedTokens, truncatedTokens} = this._prefixCacheStats;
+
+        if (this._kvCacheBytesPerToken == null) {
+            const fileInsights = this._model.fileInsights;
+            this._kvCacheBytesPerToken = fileInsights._estimateKvMemorySizeInBytes(1, fileInsights._getFileLayers(), {
+                kvCacheKeyType: this._kvCacheKeyType,
+                kvCacheValueType: this._kvCacheValueType
+            });
+        }
+
+        return {
+            lookups,
+            hits,
+            hitRate: lookups === 0
+                ? 0
+                : hits / lookups,
+            savedTokens,
+            evictedTokens,
+            evictedBytes: evictedTokens * this._kvCacheBytesPerToken,
+            truncatedTokens
+        };
+    }
+
     public getAllocatedContextSize(): number {
         this._ensureNotDisposed();
 
@@ -415,6 +585,8 @@ export class LlamaContext {
                     batchLogitIndexes: Uint32Array,
                     batchLogitTokenIndexes: number[],
                     firstTokenIndex: number,
+                    fusedSampleResultIndexes?: (number | undefined)[],
+                    failed?: true,
                     returnResults?: true
                 }> = [];
                 const queuedDecodesToDelete = new Set<InternalQueuedDecode>();
@@ -423,28 +595,93 @@ export class LlamaContext {
                 if (currentBatchSize !== 0)
                     this._ctx.initBatch(currentBatchSize);
 
+                const batchFillBuffers = this._getBatchFillBuffers(currentBatchSize);
+                const batchItemsLogitIndexes: {
+                    tokenIndexesWithLogitsToProcess: number[],
+                    batchLogitIndexes: Uint32Array,
+                    batchStart: number,
+                    failed?: true
+                }[] = [];
+                let batchTokens = 0;
                 for (const {queuedDecode, processAmount} of batchItems) {
-                    let batchLogitIndexes: ReturnType<typeof this._ctx.addToBatch>;
-                    const tokensToProcess = queuedDecode.tokens.slice(0, processAmount);
-                    const tokenIndexesWithLogitsToProcess = queuedDecode.logits.slice(0, processAmount)
-                        .map((logit, index) => (logit ? index : undefined))
-                        .filter((index) => index != undefined);
+                    const batchStart = batchTokens;
+                    const tokenIndexesWithLogitsToProcess: number[] = [];
+                    const batchLogitIndexes: number[] = [];
 
-                    const numberOfOutputTokens = tokenIndexesWithLogitsToProcess.length;
-                    TokenMeter.useTokens(queuedDecode.tokenMeter, Math.max(0, tokensToProcess.length - numberOfOutputTokens), "input");
-                    TokenMeter.useTokens(queuedDecode.tokenMeter, numberOfOutputTokens, "output");
+                    for (let i = 0; i < processAmount; i++) {
+                        const hasLogit = queuedDecode.logits[i] === true;
+
+                        batchFillBuffers.tokens[batchTokens] = queuedDecode.tokens[i]!;
+                        batchFillBuffers.positions[batchTokens] = queuedDecode.firstTokenSequenceIndex + i;
+                        batchFillBuffers.sequenceIds[batchTokens] = queuedDecode.sequenceId;
+                        batchFillBuffers.logits[batchTokens] = hasLogit ? 1 : 0;
+
+                        if (hasLogit) {
+                            tokenIndexesWithLogitsToProcess.push(i);
+                            batchLogitIndexes.push(batchTokens);
+                        }
+
+                        batchTokens++;
+                    }
+
+                    batchItemsLogitIndexes.push({
+                        tokenIndexesWithLogitsToProcess,
+                        batchLogitIndexes: Uint32Array.from(batchLogitIndexes),
+                        batchStart
+                    });
+                }
+
+                const fillBatchRange = (start: number, end: number) => {
+                    this._ctx.fillBatch(
+                        batchFillBuffers.tokens.subarray(start, end),
+                        batchFillBuffers.positions.subarray(start, end),
+                        batchFillBuffers.sequenceIds.subarray(start, end),
+                        batchFillBuffers.logits.subarray(start, end)
+                    );
+                };
 
+                if (batchTokens !== 0) {
                     try {
-                        batchLogitIndexes = this._ctx.addToBatch(
-                            queuedDecode.sequenceId,
-                            queuedDecode.firstTokenSequenceIndex,
-                            Uint32Array.from(tokensToProcess),
-                            Uint32Array.from(tokenIndexesWithLogitsToProcess)
-                        );
-                    } catch (err) {
-                        this._dispatchErrorForQueuedDecodesAndDequeue(new Set([queuedDecode]), err);
-                        continue;
+                        fillBatchRange(0, batchTokens);
+                    } catch {
+                        // the batch is filled again item by item, so only the items that fail to be added are failed
+                        this._ctx.initBatch(currentBatchSize);
+
+                        let filledTokens = 0;
+                        for (let itemIndex = 0; itemIndex < batchItems.length; itemIndex++) {
+                            const {queuedDecode, processAmount} = batchItems[itemIndex]!;
+                            const itemLogitIndexes = batchItemsLogitIndexes[itemIndex]!;
+                            const {batchStart} = itemLogitIndexes;
+
+                            try {
+                                fillBatchRange(batchStart, batchStart + processAmount);
+                            } catch (err) {
+                                itemLogitIndexes.failed = true;
+                                this._dispatchErrorForQueuedDecodesAndDequeue(new Set([queuedDecode]), err);
+                                continue;
+                            }
+
+                            for (let i = 0; i < itemLogitIndexes.batchLogitIndexes.length; i++)
+                                itemLogitIndexes.batchLogitIndexes[i] = itemLogitIndexes.batchLogitIndexes[i]! - batchStart + filledTokens;
+
+                            filledTokens += processAmount;
+                        }
+
+                        currentBatchSize = filledTokens;
                     }
+                }
+
+                for (let itemIndex = 0; itemIndex < batchItems.length; itemIndex++) {
+                    const {queuedDecode, processAmount} = batchItems[itemIndex]!;
+                    const {tokenIndexesWithLogitsToProcess, batchLogitIndexes, failed} = batchItemsLogitIndexes[itemIndex]!;
+
+                    if (failed)
+                        continue;
+
+                    const numberOfOutputTokens = tokenIndexesWithLogitsToProcess.length;
+                    TokenMeter.useTokens(queuedDecode.tokenMeter, Math.max(0, processAmount - numberOfOutputTokens), "input");
+                    TokenMeter.useTokens(queuedDecode.tokenMeter, numberOfOutputTokens, "output");
+
                     currentQueuedDecodeItems.add(queuedDecode);
 
                     if (queuedDecode.tokens.length === processAmount) {
@@ -480,23 +717,91 @@ export class LlamaContext {
                     }
                 }
 
-                if (currentBatchSize !== 0) {
-                    const allocationResult = this._threadSplitterConsumer?.getAllocationToConsume();
-                    const [threadsToUse, consumerHandle] = allocationResult instanceof Promise
-                        ? await allocationResult ?? []
-                        : allocationResult ?? [];
+                const failAfterDecodeAction = (action: typeof afterDecodeActions[number], err: unknown) => {
+                    action.failed = true;
+                    this._dispatchErrorForQueuedDecodesAndDequeue(new Set([action.queuedDecode]), err);
+                };
 
-                    try {
-                        if (threadsToUse != null)
-                            this._ctx.setThreads(threadsToUse);
+                const fusedSampleItems: Array<{
+                    action: typeof afterDecodeActions[number],
+                    logitIndex: number,
+                    fusedSampler: FusedSampler
+                }> = [];
+                for (const action of afterDecodeActions) {
+                    const resolveFusedSampler = action.queuedDecode.resolveFusedSampler;
+                    if (resolveFusedSampler == null)
+                        continue;
 
-                        await this._ctx.decodeBatch();
-                        consumerHandle?.dispose();
-                    } catch (err) {
-                        consumerHandle?.dispose();
-                        this._dispatchErrorForQueuedDecodesAndDequeue(currentQueuedDecodeItems, err);
-                        return;
+                    for (let i = 0; i < action.batchLogitIndexes.length && action.failed == null; i++) {
+                        try {
+                            const fusedSampler = resolveFusedSampler(action.batchLogitTokenIndexes[i]! + action.firstTokenIndex);
+
+                            // a sampler can only be configured for a single logit of a batch
+                            const isSamplerUsed = fusedSampleItems.some((item) => item.fusedSampler.sampler === fusedSampler?.sampler);
+                            if (fusedSampler != null && !isSamplerUsed)
+                                fusedSampleItems.push({action, logitIndex: i, fusedSampler});
+                        } catch (err) {
+                            failAfterDecodeAction(action, err);
+                        }
+                    }
+                }
+
+                // the samplers are configured while holding their lock, like the logit data mappers do,
+                // so a sampler isn't reconfigured while it's still in use
+                const fusedSamplerLocks = fusedSampleItems.length === 0
+                    ? []
+                    : await Promise.all(fusedSampleItems.map((item) => acquireLock(item.fusedSampler.sampler, "sample")));
+
+                let fusedSampleResults: Int32Array | undefined;
+                try {
+                    const fusedSampleBatchLogitIndexes: number[] = [];
+                    const fusedSamplers: AddonSampler[] = [];
+                    for (const {action, logitIndex, fusedSampler} of fusedSampleItems) {
+                        // the logit data mapper handles disposed samplers
+                        if (action.failed != null || fusedSampler.sampler.disposed)
+                            continue;
+
+                        try {
+                            fusedSampler.sampler.applyConfig(fusedSampler.resolveConfig());
+                        } catch (err) {
+                            failAfterDecodeAction(action, err);
+                            continue;
+                        }
+
+                        action.fusedSampleResultIndexes ??= [];
+                        action.fusedSampleResultIndexes[logitIndex] = fusedSamplers.length;
+                        fusedSampleBatchLogitIndexes.push(action.batchLogitIndexes[logitIndex]!);
+                        fusedSamplers.push(fusedSampler.sampler._sampler);
+                    }
+
+                    if (currentBatchSize !== 0) {
+                        const allocationResult = this._threadSplitterConsumer?.getAllocationToConsume();
+                        const [threadsToUse, consumerHandle] = allocationResult instanceof Promise
+                            ? await allocationResult ?? []
+                            : allocationResult ?? [];
+
+                        try {
+                            if (threadsToUse != null)
+                                this._ctx.setThreads(threadsToUse);
+
+                            if (fusedSamplers.length > 0)
+                                fusedSampleResults = await this._ctx.decodeBatchAndSample(
+                                    Uint32Array.from(fusedSampleBatchLogitIndexes),
+                                    fusedSamplers
+                                );
+                            else
+                                await this._ctx.decodeBatch();
+
+                            consumerHandle?.dispose();
+                        } catch (err) {
+                            consumerHandle?.dispose();
+                            this._dispatchErrorForQueuedDecodesAndDequeue(currentQueuedDecodeItems, err);
+                            return;
+                        }
                     }
+                } finally {
+                    for (const lock of fusedSamplerLocks)
+                        lock.dispose();
                 }
 
                 function finishAfterDecodeAction(
@@ -519,6 +824,9 @@ export class LlamaContext {
                 }
 
                 const afterDecodeActionResults = afterDecodeActions.map((action): Promise<void> | void => {
+                    if (action.failed != null)
+                        return undefined;
+
                     if (action.batchLogitIndexes.length === 0) {
                         finishAfterDecodeAction(action);
                         return undefined;
@@ -532,6 +840,21 @@ export class LlamaContext {
                     for (let i = 0; i < batchLogitIndexes.length; i++) {
                         const tokenIndex = batchLogitTokenIndexes[i]!;
 
+                        const fusedSampleResultIndex = action.fusedSampleResultIndexes?.[i];
+                        if (fusedSampleResultIndex != null && fusedSampleResults != null) {
+                            const sampledToken = fusedSampleResults[fusedSampleResultIndex]! as Token | -1;
+
+                            if (promiseChain != null)
+                                mappedLogitValues.push(
+                                    promiseChain
+                                        .then(() => [tokenIndex + action.firstTokenIndex, sampledToken])
+                                );
+                            else
+                                mappedLogitValues.push([tokenIndex + action.firstTokenIndex, sampledToken]);
+
+                            continue;
+                        }
+
                         const mappedValue: Promise<any> | any = promiseChain != null
                             ? promiseChain
                                 .then(() => action.queuedDecode.logitDataMapper(
@@ -596,6 +919,9 @@ export class LlamaContext {
 
                         shouldHaveAnotherLoop = this._queuedDecodes.length > 0;
                     } finally {
+                        if (!this._disposed)
+                            this._ctx.releaseBatch();
+
                         decodeLock?.dispose();
                         preventDisposalHandle.dispose();
                     }
@@ -630,7 +956,10 @@ export class LlamaContext {
     }: {
         sequenceId: number, firstTokenSequenceIndex: number, tokens: Token[], logits: (true | undefined)[],
         evaluationPriority?: EvaluationPriority, tokenMeter: TokenMeter
-    }, logitDataMapper: ((batchLogitIndex: BatchLogitIndex, tokenIndex: number) => T | Promise<T>)): Promise<[index: number, value: T][]> {
+    },
+    logitDataMapper: ((batchLogitIndex: BatchLogitIndex, tokenIndex: number) => T | Promise<T>),
+    resolveFusedSampler?: FusedSamplerResolver
+    ): Promise<[index: number, value: T | Token | -1][]> {
         return await new Promise((accept, reject) => {
             this._queuedDecodes.push({
                 sequenceId,
@@ -640,7 +969,8 @@ export class LlamaContext {
                 evaluationPriority,
                 tokenMeter,
                 response: [accept, reject],
-                logitDataMapper
+                logitDataMapper,
+                resolveFusedSampler
             });
             this._queuedDecodeSequenceIds.add(sequenceId);
 
@@ -648,6 +978,189 @@ export class LlamaContext {
         });
     }
 
+    /**
+     * Decode the given token sequences together in a single batch and return their embedding vectors
+     * as a contiguous `[items × vectorSize]` array in the given format.
+     *
+     * The tokens of all the items must fit in a single batch, and the used sequences are cleared before and after the decode.
+     * @internal
+     */
+    public async _evaluateEmbeddings<const Format extends AddonEmbeddingFormat = "float32">(
+        items: {sequenceId: number, tokens: Token[], tokenMeter: TokenMeter}[],
+        {format, maxVectorSize}: {format?: Format, maxVectorSize?: number} = {}
+    ): Promise<AddonEmbeddingFormatOutput[Format]> {
+        const totalTokens = validateStandaloneBatchItems(items, this._batchSize);
+
+        return await this._runStandaloneDecode(async () => {
+            try {
+                for (const {sequenceId} of items)
+                    await this._ctx.disposeSequence(sequenceId);
+
+                this._ctx.initBatch(totalTokens);
+                for (const {sequenceId, tokens, tokenMeter} of items) {
+                    this._ctx.addToBatch(sequenceId, 0, Uint32Array.from(tokens), Uint32Array.from([tokens.length - 1]));
+
+                    TokenMeter.useTokens(tokenMeter, tokens.length, "input");
+                }
+
+                await this._ctx.decodeBatch();
+
+                return await this._ctx.getEmbeddings(Uint32Array.from(items.map((item) => item.sequenceId)), format, maxVectorSize);
+            } finally {
+                for (const {sequenceId} of items)
+                    await this._ctx.disposeSequence(sequenceId);
+            }
+        });
+    }
+
+    /**
+     * Decode the given token sequences together in a single batch and return the ranking score logit of each of them.
+     *
+     * The tokens of all the items must fit in a single batch, and the used sequences are cleared before and after the decode.
+     * @internal
+     */
+    public async _evaluateRankings(items: {sequenceId: number, tokens: Token[], tokenMeter: TokenMeter}[]) {
+        validateStandaloneBatchItems(items, this._batchSize);
+
+        return await this._runStandaloneDecode(async () => {
+            for (const {tokens, tokenMeter} of items)
+                TokenMeter.useTokens(tokenMeter, tokens.length, "input");
+
+            return await this._ctx.rankBatch(
+                Uint32Array.from(items.map((item) => item.sequenceId)),
+                Uint32Array.from(items.flatMap((item) => item.tokens)),
+                Uint32Array.from(items.map((item) => item.tokens.length))
+            );
+        });
+    }
+
+    /**
+     * Run a decode that doesn't go through the batch queue, with exclusive access to the context
+     * @internal
+     */
+    private async _runStandaloneDecode<T>(decode: () => Promise<T>): Promise<T> {
+        return await withLock(this, "context", async () => {
+            this._ensureNotDisposed();
+
+            const preventDisposalHandle = this._backendContextDisposeGuard.createPreventDisposalHandle();
+            let decodeLock: Lock | undefined;
+            // this is a workaround to prevent Vulkan from crashing the process when decoding on multiple contexts in parallel
+            if (this._llama.gpu === "vulkan")
+                decodeLock = await acquireLock(decodeSyncWorkaround.vulkanLock, "decode");
+
+            this._reserveThreads();
+            try {
+                const allocationResult = this._threadSplitterConsumer?.getAllocationToConsume();
+                const [threadsToUse, consumerHandle] = allocationResult instanceof Promise
+                    ? await allocationResult ?? []
+                    : allocationResult ?? [];
+
+                try {
+                    if (threadsToUse != null)
+                        this._ctx.setThreads(threadsToUse);
+
+                    return await decode();
+                } finally {
+                    consumerHandle?.dispose();
+
+                    if (!this._disposed)
+                        this._ctx.releaseBatch();
+                }
+            } finally {
+                this._scheduleToFreeReservedThreads();
+                decodeLock?.dispose();
+                preventDisposalHandle.dispose();
+            }
+        });
+    }
+
+    /** @internal */
+    public _onSequenceTokensChange(sequence: LlamaContextSequence) {
+        if (this._prefixIndex == null)
+            return;
+
+        this._prefixIndexChangedSequences.add(sequence);
+    }
+
+    /**
+     * Copy the KV cache cells of the longest prefix of the given tokens that is held by another sequence to the given sequence,
+     * which must have an empty state.
+     * @returns the length of the copied prefix
+     * @internal
+     */
+    public async _reusePrefixFromOtherSequences(sequence: LlamaContextSequence, tokens: Token[], maxLength: number) {
+        if (this._prefixIndex == null || maxLength <= 0)
+            return 0;
+
+        // the context lock is only needed to copy a matched prefix, so it isn't taken when there's nothing to match
+        this._updatePrefixIndex();
+        if (this._prefixIndex.size === 0) {
+            this._prefixCacheStats.lookups++;
+            return 0;
+        }
+
+        return await withLock(this, "context", async () => {
+            if (this._disposed || this._prefixIndex == null)
+                return 0;
+
+            this._updatePrefixIndex();
+            this._prefixCacheStats.lookups++;
+
+            const match = this._prefixIndex.findLongestPrefix(tokens.slice(0, maxLength), sequence._sequenceId);
+            if (match == null)
+                return 0;
+
+            // the source sequence must still hold all the cells of the prefix, which isn't the case after a sliding window moved
+            if (this._ctx.getSequenceKvCacheMinPosition(match.sequenceId) !== 0 ||
+                this._ctx.getSequenceKvCacheMaxPosition(match.sequenceId) < match.length - 1
+            )
+                return 0;
+
+            await this._ctx.disposeSequence(sequence._sequenceId);
+            await this._ctx.copySequenceTokenCells(match.sequenceId, sequence._sequenceId, 0, match.length);
+
+            // some memory types (like recurrent state) can only be copied as a whole
+            if (this._ctx.getSequenceKvCacheMaxPosition(sequence._sequenceId) !== match.length - 1) {
+                await this._ctx.disposeSequence(sequence._sequenceId);
+                return 0;
+            }
+
+            this._prefixCacheStats.hits++;
+            this._prefixCacheStats.savedTokens += match.length;
+
+            return match.length;
+        });
+    }
+
+    /** @internal */
+    private _updatePrefixIndex() {
+        if (this._prefixIndex == null || this._prefixIndexChangedSequences.size === 0)
+            return;
+
+        const changedSequences = [...this._prefixIndexChangedSequences];
+        this._prefixIndexChangedSequences.clear();
+
+        // remove disposed sequences first, since their IDs may have been reused by new sequences
+        for (const sequence of changedSequences) {
+            if (sequence.disposed)
+                this._prefixCacheStats.evictedTokens += this._prefixIndex.delete(sequence._sequenceId);
+        }
+
+        // a sequence that was cleared had all of its tokens evicted, while a sequence that still holds some of its tokens was truncated
+        for (const sequence of changedSequences) {
+            if (sequence.disposed)
+                continue;
+
+            const tokens = sequence.contextTokens.slice(0, sequence.nextTokenIndex);
+            const removedTokens = this._prefixIndex.set(sequence._sequenceId, tokens);
+
+            if (tokens.length === 0)
+                this._prefixCacheStats.evictedTokens += removedTokens;
+            else
+                this._prefixCacheStats.truncatedTokens += removedTokens;
+        }
+    }
+
     /** @internal */
     public _reclaimUnusedSequenceId(sequenceId: number) {
         if (this._disposed)
@@ -657,12 +1170,30 @@ export class LlamaContext {
             if (this._disposed)
                 return;
 
-            this._ctx.disposeSequence(sequenceId);
+            await this._ctx.disposeSequence(sequenceId);
             this._unusedSequenceIds.push(sequenceId);
             this._onReclaimUnusedSequenceId.dispatchEvent();
         });
     }
 
+    /**
+     * Take up to `maxCount` unused sequence ids without creating sequences for them,
+     * to be returned using `_reclaimUnusedSequenceId` when they're no longer used.
+     * @internal
+     */
+    public _takeUnusedSequenceIds(maxCount: number) {
+        const sequenceIds: number[] = [];
+        while (sequenceIds.length < maxCount) {
+            const sequenceId = this._popSequenceId();
+            if (sequenceId == null)
+                break;
+
+            sequenceIds.push(sequenceId);
+        }
+
+        return sequenceIds;
+    }
+
     /** @internal */
     private _popSequenceId(): number | null {
         if (this._unusedSequenceIds.length > 0)
@@ -736,6 +1267,33 @@ export class LlamaContext {
             throw new DisposedError();
     }
 
+    /**
+     * The buffers used to fill the native batch, reused across dispatch cycles and grown as needed
+     * @internal
+     */
+    private _getBatchFillBuffers(size: number): BatchFillBuffers {
+        if (this._batchFillBuffers != null && this._batchFillBuffers.tokens.length >= size)
+            return this._batchFillBuffers;
+
+        const capacity = Math.max(size, Math.min((this._batchFillBuffers?.tokens.length ?? 0) * 2, this._batchSize));
+        this._batchFillBuffers = {
+            tokens: new Uint32Array(capacity),
+            positions: new Int32Array(capacity),
+            sequenceIds: new Int32Array(capacity),
+            logits: new Uint8Array(capacity)
+        };
+
+        return this._batchFillBuffers;
+    }
+
+    /** @internal */
+    public _ensureSessionStoreEnabled() {
+        this._ensureNotDisposed();
+
+        if (!this._sessionStoreEnabled)
+            throw new Error("The session store is not enabled for this context. Use the `sessionStore` option to enable it");
+    }
+
     /** @internal */
     private async _setLora({
         filePath, scale
@@ -787,11 +1345,27 @@ export class LlamaContext {
     public static async _create(options: LlamaContextOptions, {_model}: {
         _model: LlamaModel
     }): Promise<LlamaContext> {
+        if (typeof options.sessionStore === "object" && options.sessionStore.directory != null)
+            await fs.ensureDir(path.resolve(process.cwd(), options.sessionStore.directory));
+
         const sequences = options.sequences ?? getDefaultContextSequences();
         const flashAttention = _model.flashAttentionSupported
             ? Boolean(options.flashAttention ?? _model.defaultContextFlashAttention)
             : false;
         const swaFullCache = options.swaFullCache ?? _model.defaultContextSwaFullCache;
+        const kvCacheKeyType = options.kvCacheKeyType ?? defaultKvCacheType;
+        const kvCacheValueType = options.kvCacheValueType ?? defaultKvCacheType;
+
+        // source: `llama_init_from_model` in `llama.cpp`
+        if (isQuantizedKvCacheType(kvCacheValueType) && !flashAttention)
+            throw new Error(
+                `A quantized KV cache value type ("${kvCacheValueType}") requires flash attention to be enabled` + (
+                    _model.flashAttentionSupported
+                        ? ""
+                        : ", but flash attention is not supported for this model"
+                )
+            );
+
         const loraOptions = typeof options.lora === "string"
             ? {adapters: [{filePath: options.lora}]} satisfies LlamaContextOptions["lora"]
             : options.lora satisfies LlamaContextOptions["lora"];
@@ -804,11 +1378,14 @@ export class LlamaContext {
 
         let contextSize = await _model.fileInsights.configurationResolver.resolveContextContextSize(options.contextSize, {
             batchSize: options.batchSize,
+            microBatchSize: options.microBatchSize,
             sequences: sequences,
             modelGpuLayers: _model.gpuLayers,
             modelTrainContextSize: _model.trainContextSize,
             flashAttention,
             swaFullCache,
+            kvCacheKeyType,
+            kvCacheValueType,
             getVramState: () => _model._llama._vramOrchestrator.getMemoryState(),
             llamaGpu: _model._llama.gpu,
             ignoreMemorySafetyChecks: options.ignoreMemorySafetyChecks,
@@ -831,11 +1408,16 @@ export class LlamaContext {
                 isEmbeddingContext: options._embeddings,
                 modelGpuLayers: _model.gpuLayers,
                 batchSize,
+                microBatchSize: options.microBatchSize,
                 flashAttention,
-                swaFullCache
+                swaFullCache,
+                kvCacheKeyType,
+                kvCacheValueType
             });
 
-            const context = new LlamaContext({_model}, {...options, contextSize, batchSize, sequences, flashAttention, swaFullCache});
+            const context = new LlamaContext({_model}, {
+                ...options, contextSize, batchSize, sequences, flashAttention, swaFullCache, kvCacheKeyType, kvCacheValueType
+            });
             const contextCreationVramReservation = options.ignoreMemorySafetyChecks
                 ? null
                 : _model._llama._vramOrchestrator.reserveMemory(resourceRequirementsEstimation.gpuVram);
@@ -931,7 +1513,7 @@ export class LlamaContext {
 }
 
 export class LlamaContextSequence {
-    /** @internal */ private readonly _sequenceId: number;
+    /** @internal */ public readonly _sequenceId: number;
     /** @internal */ private readonly _gcRegistry: FinalizationRegistry<number>;
     /** @internal */ private readonly _context: LlamaContext;
     /** @internal */ private readonly _contextShift: Required<ContextShiftOptions>;
@@ -951,6 +1533,7 @@ export class LlamaContextSequence {
     /** @internal */ private _unusedTokenPredictions: number = 0;
     /** @internal */ private _validatedTokenPredictions: number = 0;
     /** @internal */ private _refutedTokenPredictions: number = 0;
+    /** @internal */ private _maxVerifiedDraftBranches: number = 0;
     /** @internal */ private _disposed = false;
 
     public readonly onDispose = new EventRelay<void>();
@@ -998,6 +1581,7 @@ export class LlamaContextSequence {
         this._contextTokens.length = 0;
 
         this._disposed = true;
+        this._context._onSequenceTokensChange(this);
     }
 
     /** @hidden */
@@ -1091,13 +1675,20 @@ export class LlamaContextSequence {
         validated: number,
 
         /** Number of token predictions that were refuted */
-        refuted: number
+        refuted: number,
+
+        /**
+         * The largest number of draft branches that were verified together in a single decode
+         * when generating with the `ngramDrafting` option
+         */
+        maxVerifiedBranches: number
     } {
         return {
             used: this._usedTokenPredictions,
             unused: this._unusedTokenPredictions,
             validated: this._validatedTokenPredictions,
-            refuted: this._refutedTokenPredictions
+            refuted: this._refutedTokenPredictions,
+            maxVerifiedBranches: this._maxVerifiedDraftBranches
         };
     }
 
@@ -1283,10 +1874,10 @@ export class LlamaContextSequence {
             for (const range of resolvedRanges) {
                 this._contextTokens.splice(range.start - removedTokens, range.end - range.start);
                 if (deletionSuccessful)
-                    deletionSuccessful &&= this._context._ctx.removeTokenCellsFromSequence(this._sequenceId, range.start, range.end);
+                    deletionSuccessful &&= await this._context._ctx.removeTokenCellsFromSequence(this._sequenceId, range.start, range.end);
 
                 if (deletionSuccessful && lastDeleteRangeEndPos != null && removedTokens > 0 && lastDeleteRangeEndPos !== range.start) {
-                    this._context._ctx.shiftSequenceTokenCells(this._sequenceId, lastDeleteRangeEndPos, range.start, -removedTokens);
+                    await this._context._ctx.shiftSequenceTokenCells(this._sequenceId, lastDeleteRangeEndPos, range.start, -removedTokens);
                     const shiftedTokens = range.start - lastDeleteRangeEndPos;
                     this._tokenMeter.useTokens(shiftedTokens, "input");
                 }
@@ -1301,12 +1892,13 @@ export class LlamaContextSequence {
             if (deletionSuccessful && lastDeleteRangeEndPos != null && removedTokens > 0 &&
                 lastDeleteRangeEndPos !== this._nextTokenIndex
             ) {
-                this._context._ctx.shiftSequenceTokenCells(this._sequenceId, lastDeleteRangeEndPos, this._nextTokenIndex, -removedTokens);
+                await this._context._ctx.shiftSequenceTokenCells(this._sequenceId, lastDeleteRangeEndPos, this._nextTokenIndex, -removedTokens);
                 const shiftedTokens = this._nextTokenIndex - lastDeleteRangeEndPos;
                 this._tokenMeter.useTokens(shiftedTokens, "input");
             }
 
             this._nextTokenIndex -= removedTokens;
+            this._context._onSequenceTokensChange(this);
 
             if (canResetTokenPredictor && removedTokens > 0)
                 await this._abortTokenPredictor(true);
@@ -1316,7 +1908,7 @@ export class LlamaContextSequence {
 
             const newSequenceTokens = this._contextTokens.slice();
             this._nextTokenIndex = 0;
-            this._context._ctx.disposeSequence(this._sequenceId);
+            await this._context._ctx.disposeSequence(this._sequenceId);
 
             // wait for the evaluation outside the "context" lock to avoid deadlocks
             awaitPromise = this.evaluateWithoutGeneratingNewTokens(newSequenceTokens, {_skipLock: skipLock});
@@ -1417,28 +2009,469 @@ export class LlamaContextSequence {
     }
 
     /**
-     * Evaluate the provided tokens into the context sequence without generating new tokens.
+     * Evaluate the provided tokens into the context sequence, and keep generating new tokens until an EOG token is generated,
+     * `maxTokens` tokens are generated, the generated tokens end with one of the `stopSequences`, or the context sequence is full.
+     *
+     * When the context is created with the `nativeScheduler` option, the generation runs on the native scheduler thread
+     * and the generated tokens are streamed back in chunks as they're generated, so the generation doesn't wait for the iteration
+     * of the returned generator.
+     * The sampling options are resolved once when the generation starts, and context shift is not applied.
+     *
+     * Otherwise, this method uses {@link evaluate `.evaluate(...)`}.
+     *
+     * When a `draftSequence` or `ngramDrafting` is provided, the generation uses speculative decoding instead,
+     * where each step of drafting and verification runs in a single native call.
+     *
+     * The returned generator returns the reason the generation finished,
+     * or `undefined` when the generation stopped without any of these reasons.
      */
-    public async evaluateWithoutGeneratingNewTokens(tokens: Token[], options: {
-        /**
-         * When a lot of tokens are queued for the next batch, more than the configured `batchSize`, the tokens for each sequence will be
-         * evaluated based on the strategy chosen for the context.
-         * By default, the `"maximumParallelism"` strategy is used, which will try to evaluate as many sequences in parallel as possible,
-         * but at some point, it'll have to choose which sequences to evaluate more tokens of, so it'll prioritize the sequences with the
-         * highest evaluation priority.
-         * Also, a custom strategy can be used to prioritize the sequences differently, but generally, the higher the evaluation priority
-         * is, the more likely and more tokens will be evaluated for that sequence in the next queued batch.
-         */
-        evaluationPriority?: EvaluationPriority,
-
-        /** Override the sequence context shift options for this evaluation */
-        contextShift?: ContextShiftOptions,
-
-        /** @internal */
-        _skipLock?: boolean
-    } = {}): Promise<void> {
+    public async *generate(
+        tokens: Token[],
+        options: SequenceGenerateOptions = {}
+    ): AsyncGenerator<Token, SequenceGenerateFinishReason | undefined, void> {
         const {
-            evaluationPriority = defaultEvaluationPriority,
+            temperature = 0,
+            minP = 0,
+            topK = 40,
+            topP = 0.95,
+            seed,
+            grammarEvaluationState,
+            repeatPenalty,
+            tokenBias,
+            evaluationPriority = defaultEvaluationPriority,
+            maxTokens,
+            stopSequences = [],
+            yieldEogToken = false,
+            draftSequence,
+            ngramDrafting = false,
+            draftTokens = defaultSpeculativeDraftTokens
+        } = options;
+
+        this._ensureNotDisposed();
+
+        if (tokens.length === 0 || (maxTokens != null && maxTokens <= 0))
+            return undefined;
+
+        const nonEmptyStopSequences = stopSequences.filter((stopSequence) => stopSequence.length > 0);
+
+        if (draftSequence != null && ngramDrafting !== false)
+            throw new Error("The draftSequence and ngramDrafting options cannot be used together");
+
+        if (draftSequence != null || ngramDrafting !== false) {
+            const {
+                minNgramSize = defaultMinNgramDraftSize,
+                maxNgramSize = defaultMaxNgramDraftSize,
+                branches = 1
+            } = ngramDrafting === true || ngramDrafting === false
+                ? {}
+                : ngramDrafting;
+            const resolvedMinNgramSize = Math.max(1, Math.floor(minNgramSize));
+
+            return yield* this._generateSpeculatively(
+                tokens,
+                draftSequence != null
+                    ? {draftSequence}
+                    : {
+                        ngram: {minNgramSize: resolvedMinNgramSize, maxNgramSize: Math.max(resolvedMinNgramSize, Math.floor(maxNgramSize))},
+                        branches: Math.max(1, Math.floor(branches))
+                    },
+                {
+                    samplerOptions: {temperature, minP, topK, topP, seed, grammarEvaluationState, repeatPenalty, tokenBias},
+                    evaluationPriority,
+                    maxTokens,
+                    stopSequences: nonEmptyStopSequences,
+                    yieldEogToken,
+                    maxDraftTokens: Math.max(0, Math.floor(draftTokens))
+                }
+            );
+        }
+
+        const useNativeScheduler = this._context._nativeScheduler && this._tokenPredictor == null &&
+            this._nextTokenIndex + tokens.length < this._context.contextSize - 1;
+
+        if (!useNativeScheduler) {
+            const generatedTokens: Token[] = [];
+            for await (const token of this.evaluate(tokens, {
+                temperature,
+                minP,
+                topK,
+                topP,
+                seed,
+                grammarEvaluationState,
+                repeatPenalty,
+                tokenBias,
+                evaluationPriority,
+
+                // the EOG token is always requested so it can be told apart from other reasons for the evaluation to end
+                yieldEogToken: true
+            })) {
+                const isEogToken = this.model.isEogToken(token);
+                if (!isEogToken || yieldEogToken)
+                    yield token;
+
+                generatedTokens.push(token);
+
+                if (isEogToken)
+                    return "eogToken";
+                else if (endsWithStopSequence(generatedTokens, nonEmptyStopSequences))
+                    return "stopSequence";
+                else if (maxTokens != null && generatedTokens.length >= maxTokens)
+                    return "maxTokens";
+            }
+
+            // the evaluation stopped without generating an EOG token, so it was either aborted or ran out of context space
+            this._ensureNotDisposed();
+
+            if (this._nextTokenIndex >= this._context.contextSize - 1)
+                return "contextFull";
+
+            return undefined;
+        }
+
+        const evaluatorLock = await acquireLock(this._lock, "evaluate");
+        const sampler = new LlamaSampler(this.model);
+        try {
+            this._ensureNotDisposed();
+            await this._abortTokenPredictor(false, true);
+
+            sampler.applyConfig(this._resolveSamplerConfig({
+                temperature,
+                minP,
+                topK,
+                topP,
+                seed,
+                grammarEvaluationState,
+                repeatPenalty,
+                tokenBias
+            }));
+
+            const firstTokenIndex = this._nextTokenIndex;
+            const stream: {
+                generatedTokens: Token[],
+                nextTokenIndex: number,
+                finishReason?: AddonSchedulerFinishReason,
+                error?: string,
+                onUpdate?(): void
+            } = {
+                generatedTokens: [],
+                nextTokenIndex: firstTokenIndex
+            };
+
+            const requestId = this._context._ctx.schedulerSubmit(
+                this._sequenceId,
+                firstTokenIndex,
+                Uint32Array.from(tokens),
+                sampler._sampler,
+                removeNullFields({
+                    contextSize: this._context.contextSize,
+                    maxTokens,
+                    priority: evaluationPriority,
+                    stopSequences: nonEmptyStopSequences.length === 0
+                        ? undefined
+                        : nonEmptyStopSequences.map((stopSequence) => Uint32Array.from(stopSequence))
+                }),
+                (newTokens, nextTokenIndex, finishReason, error) => {
+                    pushAll(stream.generatedTokens, Array.from(newTokens) as Token[]);
+
+                    // the last generated token is not evaluated into the context sequence
+                    if (nextTokenIndex > stream.nextTokenIndex && !this._disposed) {
+                        const evaluatedTokens = tokens.concat(stream.generatedTokens)
+                            .slice(stream.nextTokenIndex - firstTokenIndex, nextTokenIndex - firstTokenIndex);
+
+                        this._contextTokens = this._contextTokens.concat(evaluatedTokens);
+                        this._nextTokenIndex = nextTokenIndex;
+                        this._context._onSequenceTokensChange(this);
+                    }
+
+                    stream.nextTokenIndex = nextTokenIndex;
+
+                    if (finishReason != null) {
+                        stream.finishReason = finishReason;
+                        stream.error = error;
+                    }
+
+                    stream.onUpdate?.();
+                }
+            );
+
+            const waitForUpdate = () => new Promise<void>((accept) => {
+                stream.onUpdate = () => {
+                    stream.onUpdate = undefined;
+                    accept();
+                };
+            });
+
+            try {
+                let nextYieldIndex = 0;
+                while (true) {
+                    // the tokens arrive in chunks, so all the tokens of a chunk are yielded without waiting for the native side
+                    while (nextYieldIndex < stream.generatedTokens.length) {
+                        const token = stream.generatedTokens[nextYieldIndex++]!;
+
+                        if (!yieldEogToken && this.model.isEogToken(token))
+                            continue;
+
+                        yield token;
+                    }
+
+                    if (stream.finishReason != null)
+                        break;
+
+                    await waitForUpdate();
+                }
+
+                if (stream.finishReason === "error")
+                    throw new Error(stream.error ?? "Failed to generate tokens");
+                else if (stream.finishReason === "cancelled")
+                    throw new DisposedError();
+
+                return stream.finishReason;
+            } finally {
+                if (stream.finishReason == null) {
+                    this._context._ctx.schedulerCancel(requestId);
+
+                    while (stream.finishReason == null)
+                        await waitForUpdate();
+                }
+
+                const evaluatedTokensCount = stream.nextTokenIndex - firstTokenIndex;
+                TokenMeter.useTokens(this._tokenMeter, Math.max(0, evaluatedTokensCount - stream.generatedTokens.length), "input");
+                TokenMeter.useTokens(this._tokenMeter, stream.generatedTokens.length, "output");
+            }
+        } finally {
+            void withLock(sampler, "sample", sampler.asyncDispose);
+            evaluatorLock.dispose();
+        }
+    }
+
+    /** @internal */
+    private async *_generateSpeculatively(
+        tokens: Token[],
+        drafter: {draftSequence: LlamaContextSequence} | {ngram: {minNgramSize: number, maxNgramSize: number}, branches: number},
+        {
+            samplerOptions, evaluationPriority, maxTokens, stopSequences, yieldEogToken, maxDraftTokens
+        }: {
+            samplerOptions: Pick<
+                SequenceGenerateOptions,
+                "temperature" | "minP" | "topK" | "topP" | "seed" | "grammarEvaluationState" | "repeatPenalty" | "tokenBias"
+            >,
+            evaluationPriority: EvaluationPriority,
+            maxTokens?: number,
+            stopSequences: readonly (readonly Token[])[],
+            yieldEogToken: boolean,
+            maxDraftTokens: number
+        }
+    ): AsyncGenerator<Token, SequenceGenerateFinishReason, void> {
+        const draftSequence = "draftSequence" in drafter
+            ? drafter.draftSequence
+            : undefined;
+        const ngram = "ngram" in drafter
+            ? drafter.ngram
+            : undefined;
+
+        if (draftSequence === this)
+            throw new Error("The draft sequence cannot be the same as the target sequence");
+
+        if (draftSequence != null) {
+            draftSequence._ensureNotDisposed();
+            this._context._ctx.ensureDraftContextIsCompatibleForSpeculative(draftSequence._context._ctx);
+        }
+
+        const evaluatorLock = await acquireLock(this._lock, "evaluate");
+        const draftEvaluatorLock = draftSequence == null
+            ? undefined
+            : await acquireLock(draftSequence._lock, "evaluate");
+        const sampler = new LlamaSampler(this.model);
+        const draftSampler = draftSequence == null
+            ? undefined
+            : new LlamaSampler(draftSequence.model);
+
+        // the extra branches of the draft tree are laid out on unused sequences of the context.
+        // the nodes shared by several branches belong to multiple sequences, which llama.cpp only supports with a unified KV cache
+        const branchSequenceIds = ("branches" in drafter && this._context._unifiedKvCache)
+            ? this._context._takeUnusedSequenceIds(drafter.branches - 1)
+            : [];
+        try {
+            this._ensureNotDisposed();
+            draftSequence?._ensureNotDisposed();
+            await this._abortTokenPredictor(false, true);
+            await draftSequence?._abortTokenPredictor(false, true);
+
+            sampler.applyConfig(this._resolveSamplerConfig(samplerOptions));
+
+            // drafting is greedy, so the draft sequence proposes the tokens the target model is most likely to select
+            if (draftSequence != null && draftSampler != null)
+                draftSampler.applyConfig(draftSequence._resolveSamplerConfig({
+                    temperature: 0,
+                    tokenBias: samplerOptions.tokenBias
+                }));
+
+            // the last token is evaluated together with the first draft
+            if (tokens.length > 1)
+                await this.evaluateWithoutGeneratingNewTokens(tokens.slice(0, -1), {evaluationPriority, _skipLock: true});
+
+            if (draftSequence != null) {
+                const {firstDifferentIndex} = draftSequence.compareContextTokens(this._contextTokens);
+                if (firstDifferentIndex < draftSequence._nextTokenIndex)
+                    await draftSequence._eraseContextTokenRanges([{
+                        start: firstDifferentIndex,
+                        end: draftSequence._nextTokenIndex
+                    }], {skipLock: true});
+
+                if (draftSequence._nextTokenIndex < this._nextTokenIndex)
+                    await draftSequence.evaluateWithoutGeneratingNewTokens(
+                        this._contextTokens.slice(draftSequence._nextTokenIndex),
+                        {evaluationPriority, _skipLock: true}
+                    );
+            }
+
+            // the number of tokens of the draft sequence, or of the n-gram index (which is built again from the first token)
+            let draftNextTokenIndex = draftSequence?._nextTokenIndex ?? 0;
+            const generatedTokens: Token[] = [];
+            let token = tokens[tokens.length - 1]!;
+
+            while (true) {
+                this._ensureNotDisposed();
+                draftSequence?._ensureNotDisposed();
+
+                const draftInputTokens = this._contextTokens.slice(draftNextTokenIndex).concat([token]);
+                const remainingTokens = maxTokens == null
+                    ? Infinity
+                    : maxTokens - generatedTokens.length;
+
+                if (this._nextTokenIndex >= this.contextSize - 1 || (
+                    draftSequence != null && draftNextTokenIndex + draftInputTokens.length > draftSequence.contextSize
+                ))
+                    return "contextFull";
+
+                const stepMaxDraftTokens = Math.max(0, Math.min(
+                    maxDraftTokens,
+                    remainingTokens - 1,
+                    this.contextSize - 2 - this._nextTokenIndex,
+                    draftSequence == null
+                        ? Infinity
+                        : draftSequence.contextSize + 1 - draftNextTokenIndex - draftInputTokens.length
+                ));
+
+                const runStep = () => this._context._ctx.speculativeStep(draftSequence?._context._ctx ?? null, removeNullFields({
+                    sequenceId: this._sequenceId,
+                    nextTokenIndex: this._nextTokenIndex,
+                    token,
+                    sampler: sampler._sampler,
+                    draftNextTokenIndex,
+                    draftTokens: Uint32Array.from(draftInputTokens),
+                    maxDraftTokens: stepMaxDraftTokens,
+                    draftSequenceId: draftSequence?._sequenceId,
+                    draftSampler: draftSampler?._sampler,
+                    ngram,
+                    branchSequenceIds: branchSequenceIds.length === 0
+                        ? undefined
+                        : Uint32Array.from(branchSequenceIds)
+                }));
+                const [
+                    stepTokensArray, draftedTokens, acceptedDraftTokens, nextTokenIndex, stepDraftNextTokenIndex, draftBranches
+                ] = (draftSequence == null || draftSequence._context === this._context)
+                    ? await withLock(this._context, "context", runStep)
+                    : await withLock(this._context, "context", () => withLock(draftSequence._context, "context", runStep));
+
+                const stepTokens = Array.from(stepTokensArray) as Token[];
+                const firstStepTokenIndex = this._nextTokenIndex + 1;
+
+                // the last token of the step is not evaluated into any of the sequences
+                this._contextTokens = this._contextTokens.concat([token], stepTokens.slice(0, -1));
+                this._nextTokenIndex = nextTokenIndex;
+                this._context._onSequenceTokensChange(this);
+                draftNextTokenIndex = stepDraftNextTokenIndex;
+
+                if (draftSequence != null) {
+                    draftSequence._contextTokens = this._contextTokens.slice(0, draftNextTokenIndex);
+                    draftSequence._nextTokenIndex = draftNextTokenIndex;
+                    draftSequence._context._onSequenceTokensChange(draftSequence);
+                }
+
+                this._usedTokenPredictions += acceptedDraftTokens;
+                this._validatedTokenPredictions += acceptedDraftTokens;
+                this._refutedTokenPredictions += draftedTokens - acceptedDraftTokens;
+                this._maxVerifiedDraftBranches = Math.max(this._maxVerifiedDraftBranches, draftBranches);
+
+                TokenMeter.useTokens(this._tokenMeter, 1 + draftedTokens, "input");
+                TokenMeter.useTokens(this._tokenMeter, stepTokens.length, "output");
+
+                if (draftSequence != null) {
+                    TokenMeter.useTokens(draftSequence._tokenMeter, draftInputTokens.length, "input");
+                    TokenMeter.useTokens(draftSequence._tokenMeter, draftedTokens, "output");
+                }
+
+                for (let i = 0; i < stepTokens.length; i++) {
+                    const stepToken = stepTokens[i]!;
+                    const isEogToken = this.model.isEogToken(stepToken);
+                    generatedTokens.push(stepToken);
+
+                    if (!isEogToken || yieldEogToken)
+                        yield stepToken;
+
+                    const finishReason: SequenceGenerateFinishReason | undefined = isEogToken
+                        ? "eogToken"
+                        : endsWithStopSequence(generatedTokens, stopSequences)
+                            ? "stopSequence"
+                            : (maxTokens != null && generatedTokens.length >= maxTokens)
+                                ? "maxTokens"
+                                : undefined;
+
+                    if (finishReason == null)
+                        continue;
+
+                    // keep the last generated token unevaluated, like when the generation finishes at the end of a step
+                    const generatedTokenIndex = firstStepTokenIndex + i;
+                    if (generatedTokenIndex < this._nextTokenIndex) {
+                        await this._eraseContextTokenRanges([{start: generatedTokenIndex, end: this._nextTokenIndex}], {skipLock: true});
+                        await draftSequence?._eraseContextTokenRanges([{
+                            start: generatedTokenIndex,
+                            end: draftSequence._nextTokenIndex
+                        }], {skipLock: true});
+                    }
+
+                    return finishReason;
+                }
+
+                token = stepTokens[stepTokens.length - 1]!;
+            }
+        } finally {
+            void withLock(sampler, "sample", sampler.asyncDispose);
+            if (draftSampler != null)
+                void withLock(draftSampler, "sample", draftSampler.asyncDispose);
+
+            for (const branchSequenceId of branchSequenceIds)
+                this._context._reclaimUnusedSequenceId(branchSequenceId);
+
+            draftEvaluatorLock?.dispose();
+            evaluatorLock.dispose();
+        }
+    }
+
+    /**
+     * Evaluate the provided tokens into the context sequence without generating new tokens.
+     */
+    public async evaluateWithoutGeneratingNewTokens(tokens: Token[], options: {
+        /**
+         * When a lot of tokens are queued for the next batch, more than the configured `batchSize`, the tokens for each sequence will be
+         * evaluated based on the strategy chosen for the context.
+         * By default, the `"maximumParallelism"` strategy is used, which will try to evaluate as many sequences in parallel as possible,
+         * but at some point, it'll have to choose which sequences to evaluate more tokens of, so it'll prioritize the sequences with the
+         * highest evaluation priority.
+         * Also, a custom strategy can be used to prioritize the sequences differently, but generally, the higher the evaluation priority
+         * is, the more likely and more tokens will be evaluated for that sequence in the next queued batch.
+         */
+        evaluationPriority?: EvaluationPriority,
+
+        /** Override the sequence context shift options for this evaluation */
+        contextShift?: ContextShiftOptions,
+
+        /** @internal */
+        _skipLock?: boolean
+    } = {}): Promise<void> {
+        const {
+            evaluationPriority = defaultEvaluationPriority,
             contextShift: {
                 size: contextShiftSize = this._contextShift.size,
                 strategy: contextShiftStrategy = this._contextShift.strategy
@@ -1546,7 +2579,10 @@ export class LlamaContextSequence {
             if (item instanceof Array) {
                 const [token, options] = item;
                 const generateNext = options?.generateNext ?? {};
-                if (generateNext.probabilities === true || generateNext.confidence === true || generateNext.token === true)
+                if (
+                    generateNext.probabilities === true || generateNext.confidence === true || generateNext.token === true ||
+                    generateNext.logits === true
+                )
                     logitsArray[index] = true;
 
                 return token;
@@ -1573,10 +2609,26 @@ export class LlamaContextSequence {
                     if (generateNext == null || (
                         (generateNext.probabilities == null || !generateNext.probabilities) &&
                         (generateNext.token == null || !generateNext.token) &&
-                        (generateNext.confidence == null || !generateNext.confidence)
+                        (generateNext.confidence == null || !generateNext.confidence) &&
+                        (generateNext.logits == null || !generateNext.logits)
                     ))
                         return undefined;
 
+                    const logits = generateNext.logits
+                        ? await this._context._ctx.getLogits(batchLogitIndex)
+                        : undefined;
+
+                    if (!generateNext.probabilities && !generateNext.token && !generateNext.confidence) {
+                        const output: ControlledEvaluateIndexOutput = {
+                            next: {
+                                logits
+                            }
+                        };
+                        onTokenResult?.(tokenIndex, output);
+
+                        return output;
+                    }
+
                     const sampleOptions = generateNext.options ?? {};
                     const samplerConfig = this._resolveSamplerConfig({
                         temperature: sampleOptions.temperature,
@@ -1597,7 +2649,9 @@ export class LlamaContextSequence {
                             batchLogitIndex,
                             sampler._sampler,
                             !!generateNext.probabilities,
-                            !!generateNext.confidence
+                            !!generateNext.confidence,
+                            generateNext.maxProbabilities,
+                            generateNext.minProbability
                         );
 
                         const output: ControlledEvaluateIndexOutput = {
@@ -1615,6 +2669,9 @@ export class LlamaContextSequence {
                         if (probabilities != null)
                             output.next.probabilities = reviveTokenProbabilities(probabilities);
 
+                        if (logits != null)
+                            output.next.logits = logits;
+
                         onTokenResult?.(tokenIndex, output);
 
                         return output;
@@ -1627,15 +2684,92 @@ export class LlamaContextSequence {
         }
     }
 
+    /**
+     * Create a new sequence on the same context that starts with the evaluated state of this sequence,
+     * so the shared prefix (like a long system prompt) doesn't have to be evaluated again on the new sequence.
+     *
+     * The KV cache cells of the prefix are copied to the new sequence without evaluating them again.
+     * When the context uses a unified KV cache, the cells are shared between the sequences instead of being duplicated.
+     *
+     * Before calling this method, make sure to call `context.sequencesLeft` to check if there are any sequences left.
+     * When there are no sequences left, this method will throw an error.
+     */
+    public async fork(options: {
+        /**
+         * The number of tokens from the beginning of the current state to copy to the new sequence.
+         *
+         * Defaults to all the tokens of the current state.
+         */
+        prefixLength?: number,
+
+        contextShift?: ContextShiftOptions,
+
+        /**
+         * Token predictor to use for the new sequence.
+         * Don't share the same token predictor between multiple sequences.
+         */
+        tokenPredictor?: TokenPredictor
+    } = {}): Promise<LlamaContextSequence> {
+        const {
+            prefixLength,
+            contextShift = this._contextShift,
+            tokenPredictor
+        } = options;
+        this._ensureNotDisposed();
+
+        const sequence = this._context.getSequence({contextShift, tokenPredictor});
+
+        const evaluatorLock = await acquireLock(this._lock, "evaluate");
+        const contextLock = await acquireLock(this._context, "context");
+
+        try {
+            this._ensureNotDisposed();
+
+            const resolvedPrefixLength = Math.max(0, Math.min(this.nextTokenIndex, Math.floor(prefixLength ?? this.nextTokenIndex)));
+
+            if (resolvedPrefixLength > 0)
+                await this._context._ctx.copySequenceTokenCells(this._sequenceId, sequence._sequenceId, 0, resolvedPrefixLength);
+
+            sequence._contextTokens = this._contextTokens.slice(0, resolvedPrefixLength);
+            sequence._nextTokenIndex = resolvedPrefixLength;
+            this._context._onSequenceTokensChange(sequence);
+
+            return sequence;
+        } catch (err) {
+            sequence.dispose();
+            throw err;
+        } finally {
+            contextLock.dispose();
+            evaluatorLock.dispose();
+        }
+    }
+
     /* eslint-disable @stylistic/max-len */
     /**
      * Save the current context sequence evaluation state to a file.
+     *
+     * Use the `compression` option to compress the state file.
+     * Compressed state files are detected automatically when loading them using `.loadStateFromFile()`.
      * @see [Saving and restoring a context sequence evaluation state](https://node-llama-cpp.withcat.ai/guide/chat-session#save-and-restore-with-context-sequence-state)
      */
-    public async saveStateToFile(filePath: string) {
+    public async saveStateToFile(filePath: string, {
+        compression
+    }: {
+        /**
+         * Compress the state file using the given compression.
+         *
+         * Only the compressions listed in `llama.supportedStateFileCompressions` can be used.
+         *
+         * `zstd` produces smaller files, while `lz4` is faster to save and load.
+         */
+        compression?: LlamaStateFileCompression
+    } = {}) {
         /* eslint-enable @stylistic/max-len */
         this._ensureNotDisposed();
 
+        if (compression != null && !this._context._llama.supportedStateFileCompressions.includes(compression))
+            throw new Error(`The "${compression}" state file compression is not supported by the current build`);
+
         const resolvedPath = path.resolve(process.cwd(), filePath);
 
         const evaluatorLock = await acquireLock(this._lock, "evaluate");
@@ -1647,7 +2781,8 @@ export class LlamaContextSequence {
             const fileSize = await this._context._ctx.saveSequenceStateToFile(
                 resolvedPath,
                 this._sequenceId,
-                Uint32Array.from(this.contextTokens)
+                Uint32Array.from(this.contextTokens),
+                compression
             );
             return {fileSize};
         } finally {
@@ -1665,16 +2800,42 @@ export class LlamaContextSequence {
      * You must ensure that the file was created from the exact same model, otherwise, using this function may crash the process.
      * @see [Saving and restoring a context sequence evaluation state](https://node-llama-cpp.withcat.ai/guide/chat-session#save-and-restore-with-context-sequence-state)
      */
-    public async loadStateFromFile(filePath: string, acceptRisk: {
+    public async loadStateFromFile(filePath: string, {
+        acceptRisk,
+        useMmap = this._context._llama.supportsMmap,
+        onProgress,
+        signal
+    }: {
         /**
          * Loading a state file created using a different model may crash the process.
          *
          * You must accept this risk to use this feature.
          */
-        acceptRisk: true
+        acceptRisk: true,
+
+        /**
+         * Memory-map the state file instead of reading all of it into memory before restoring it.
+         *
+         * Has no effect on compressed state files.
+         *
+         * Defaults to `true` when `llama.supportsMmap` is `true`.
+         */
+        useMmap?: boolean,
+
+        /**
+         * Called with the progress of loading the state file, a number between `0` and `1`
+         */
+        onProgress?(progress: number): void,
+
+        /**
+         * Abort loading the state file.
+         *
+         * When aborted, the current state of the sequence is left untouched.
+         */
+        signal?: AbortSignal
     }) {
         /* eslint-enable @stylistic/max-len */
-        if (!acceptRisk.acceptRisk)
+        if (!acceptRisk)
             throw new Error("The `acceptRisk` option must be set to `true` to use this feature");
 
         this._ensureNotDisposed();
@@ -1682,31 +2843,211 @@ export class LlamaContextSequence {
         const resolvedPath = path.resolve(process.cwd(), filePath);
 
         const evaluatorLock = await acquireLock(this._lock, "evaluate");
-        const contextLock = await acquireLock(this._context, "context");
+        let contextLock: Lock | undefined;
 
         try {
             this._ensureNotDisposed();
 
+            if (signal?.aborted)
+                throw signal.reason;
+
+            // the unconfirmed predictions are removed while the current state can still be kept when the load is aborted
             this._tokenPredictorOwner = {};
-            await this._abortTokenPredictor(true);
+            await this._abortTokenPredictor(false, true);
             this._ensureNotDisposed();
 
-            this._loadedTokenPredictions.length = 0;
-            this._nextTokenIndex = 0;
-            this._contextTokens = [];
+            contextLock = await acquireLock(this._context, "context");
+            this._ensureNotDisposed();
+
+            const onAbort = () => this._context._ctx.abortSequenceStateLoad(this._sequenceId);
+            signal?.addEventListener("abort", onAbort);
+
+            let loadedTokens: Uint32Array;
+            try {
+                loadedTokens = await this._context._ctx.loadSequenceStateFromFile(resolvedPath, this._sequenceId, this.contextSize, {
+                    useMmap,
+                    onProgress
+                });
+            } catch (err) {
+                // the sequence is only modified when restoring the state itself fails, in which case it's cleared
+                if (this._context._ctx.getSequenceKvCacheMaxPosition(this._sequenceId) < 0 && this._contextTokens.length > 0) {
+                    this._loadedTokenPredictions.length = 0;
+                    this._nextTokenIndex = 0;
+                    this._contextTokens = [];
+                    this._context._onSequenceTokensChange(this);
+                }
+
+                if (signal?.aborted)
+                    throw signal.reason;
 
-            const tokens = Array.from(
-                await this._context._ctx.loadSequenceStateFromFile(resolvedPath, this._sequenceId, this.contextSize)
-            ) as Token[];
+                throw err;
+            } finally {
+                signal?.removeEventListener("abort", onAbort);
+            }
+
+            const tokens = Array.from(loadedTokens) as Token[];
 
             if (tokens.length > this.contextSize) {
-                this._context._ctx.disposeSequence(this._sequenceId);
+                await this._context._ctx.disposeSequence(this._sequenceId);
+                this._loadedTokenPredictions.length = 0;
+                this._nextTokenIndex = 0;
+                this._contextTokens = [];
+                this._context._onSequenceTokensChange(this);
                 throw new Error("The given state file is too large for the current context size");
             }
 
             this._contextTokens = tokens;
             this._nextTokenIndex = tokens.length;
             this._loadedTokenPredictions.length = 0;
+            this._context._onSequenceTokensChange(this);
+        } finally {
+            contextLock?.dispose();
+            evaluatorLock.dispose();
+        }
+    }
+
+    /**
+     * Save the current context sequence evaluation state to memory.
+     *
+     * The returned snapshot can be used to restore the state later on using `.loadStateFromMemory()`,
+     * so sequences can be parked in RAM without writing them to a file.
+     */
+    public async saveStateToMemory(): Promise<LlamaContextSequenceStateSnapshot> {
+        this._ensureNotDisposed();
+
+        const evaluatorLock = await acquireLock(this._lock, "evaluate");
+        const contextLock = await acquireLock(this._context, "context");
+
+        try {
+            this._ensureNotDisposed();
+
+            const tokens = this.contextTokens;
+            const state = await this._context._ctx.getSequenceState(this._sequenceId);
+
+            return {tokens, state};
+        } finally {
+            contextLock.dispose();
+            evaluatorLock.dispose();
+        }
+    }
+
+    /**
+     * Load a context sequence evaluation state snapshot created using `.saveStateToMemory()`.
+     *
+     * Trying to load a snapshot with more tokens than the current sequence's context size will fail and throw an error.
+     *
+     * You must ensure that the snapshot was created from the exact same model, otherwise, using this function may crash the process.
+     */
+    public async loadStateFromMemory(snapshot: LlamaContextSequenceStateSnapshot, acceptRisk: {
+        /**
+         * Loading a snapshot created using a different model may crash the process.
+         *
+         * You must accept this risk to use this feature.
+         */
+        acceptRisk: true
+    }) {
+        if (!acceptRisk.acceptRisk)
+            throw new Error("The `acceptRisk` option must be set to `true` to use this feature");
+
+        if (snapshot.tokens.length > this.contextSize)
+            throw new Error("The given state snapshot is too large for the current context size");
+
+        this._ensureNotDisposed();
+
+        const evaluatorLock = await acquireLock(this._lock, "evaluate");
+        const contextLock = await acquireLock(this._context, "context");
+
+        try {
+            this._ensureNotDisposed();
+
+            this._tokenPredictorOwner = {};
+            await this._abortTokenPredictor(true);
+            this._ensureNotDisposed();
+
+            this._loadedTokenPredictions.length = 0;
+            this._nextTokenIndex = 0;
+            this._contextTokens = [];
+            await this._context._ctx.disposeSequence(this._sequenceId);
+            this._context._onSequenceTokensChange(this);
+
+            await this._context._ctx.setSequenceState(this._sequenceId, snapshot.state);
+
+            this._contextTokens = snapshot.tokens.slice();
+            this._nextTokenIndex = this._contextTokens.length;
+            this._loadedTokenPredictions.length = 0;
+            this._context._onSequenceTokensChange(this);
+        } finally {
+            contextLock.dispose();
+            evaluatorLock.dispose();
+        }
+    }
+
+    /**
+     * Save the current context sequence evaluation state to the session store of the context under the given key,
+     * replacing any existing snapshot of that key.
+     *
+     * Only available when the `sessionStore` option of the context is enabled.
+     */
+    public async saveStateToSessionStore(key: string) {
+        this._ensureNotDisposed();
+        this._context._ensureSessionStoreEnabled();
+
+        const evaluatorLock = await acquireLock(this._lock, "evaluate");
+        const contextLock = await acquireLock(this._context, "context");
+
+        try {
+            this._ensureNotDisposed();
+
+            await this._context._ctx.sessionStoreSave(key, this._sequenceId, Uint32Array.from(this.contextTokens));
+        } finally {
+            contextLock.dispose();
+            evaluatorLock.dispose();
+        }
+    }
+
+    /**
+     * Restore a context sequence evaluation state from the session store of the context.
+     *
+     * The current state of the sequence is replaced with the snapshot.
+     *
+     * Only available when the `sessionStore` option of the context is enabled.
+     * @returns `false` when the session store has no snapshot for the given key (for example, when it was evicted),
+     * in which case the current state of the sequence is left untouched
+     */
+    public async loadStateFromSessionStore(key: string) {
+        this._ensureNotDisposed();
+        this._context._ensureSessionStoreEnabled();
+
+        const evaluatorLock = await acquireLock(this._lock, "evaluate");
+        const contextLock = await acquireLock(this._context, "context");
+
+        try {
+            this._ensureNotDisposed();
+
+            if (!this._context._ctx.sessionStoreHas(key))
+                return false;
+
+            this._tokenPredictorOwner = {};
+            await this._abortTokenPredictor(true);
+            this._ensureNotDisposed();
+
+            this._loadedTokenPredictions.length = 0;
+            this._nextTokenIndex = 0;
+            this._contextTokens = [];
+            await this._context._ctx.disposeSequence(this._sequenceId);
+            this._context._onSequenceTokensChange(this);
+
+            // the snapshot can still be evicted in the meantime when writing or reading its file fails, leaving the sequence empty
+            const tokens = await this._context._ctx.sessionStoreRestore(key, this._sequenceId);
+            if (tokens == null)
+                return false;
+
+            this._contextTokens = Array.from(tokens) as Token[];
+            this._nextTokenIndex = this._contextTokens.length;
+            this._loadedTokenPredictions.length = 0;
+            this._context._onSequenceTokensChange(this);
+
+            return true;
         } finally {
             contextLock.dispose();
             evaluatorLock.dispose();
@@ -1750,6 +3091,8 @@ export class LlamaContextSequence {
 
         const sampleProbabilities = metadata.probabilities === true;
         const sampleConfidence = metadata.confidence === true;
+        const maxProbabilities = metadata.maxProbabilities;
+        const minProbability = metadata.minProbability;
 
         const sampler = new LlamaSampler(this.model);
         try {
@@ -1767,6 +3110,17 @@ export class LlamaContextSequence {
                     if (generateNewTokens)
                         logitsArray[evalTokens.length - 1] = true;
 
+                    const resolveSamplerConfig = () => this._resolveSamplerConfig({
+                        temperature,
+                        minP,
+                        topK,
+                        topP,
+                        seed,
+                        grammarEvaluationState,
+                        repeatPenalty,
+                        tokenBias
+                    });
+
                     // Evaluate to get the next token.
                     const decodeResult = await this._decodeTokens(
                         evalTokens,
@@ -1778,16 +3132,7 @@ export class LlamaContextSequence {
                             if (_noSampling)
                                 return null;
 
-                            const samplerConfig = this._resolveSamplerConfig({
-                                temperature,
-                                minP,
-                                topK,
-                                topP,
-                                seed,
-                                grammarEvaluationState,
-                                repeatPenalty,
-                                tokenBias
-                            });
+                            const samplerConfig = resolveSamplerConfig();
 
                             return withLock(sampler, "sample", async () => {
                                 if (sampler.disposed)
@@ -1799,12 +3144,17 @@ export class LlamaContextSequence {
                                         batchLogitIndex,
                                         sampler._sampler,
                                         sampleProbabilities,
-                                        sampleConfidence
+                                        sampleConfidence,
+                                        maxProbabilities,
+                                        minProbability
                                     );
                                 else
                                     return this._context._ctx.sampleToken(batchLogitIndex, sampler._sampler);
                             });
-                        }
+                        },
+                        (_noSampling || sampleProbabilities || sampleConfidence)
+                            ? undefined
+                            : () => ({sampler, resolveConfig: resolveSamplerConfig})
                     );
 
                     const lastDecodeResult = decodeResult[evalTokens.length - 1];
@@ -1885,6 +3235,8 @@ export class LlamaContextSequence {
 
         const sampleProbabilities = metadata.probabilities === true;
         const sampleConfidence = metadata.confidence === true;
+        const maxProbabilities = metadata.maxProbabilities;
+        const minProbability = metadata.minProbability;
 
         let logitsArray: (true | undefined)[] = [];
         let logitsStartIndex = evalTokens.length - 1;
@@ -2029,7 +3381,9 @@ export class LlamaContextSequence {
                                             batchLogitIndex,
                                             sampler._sampler,
                                             sampleProbabilities,
-                                            sampleConfidence
+                                            sampleConfidence,
+                                            maxProbabilities,
+                                            minProbability
                                         );
                                     else
                                         return this._context._ctx.sampleToken(batchLogitIndex, sampler._sampler);
@@ -2201,18 +3555,43 @@ export class LlamaContextSequence {
         evaluationPriority: EvaluationPriority,
         tokenMeter: TokenMeter,
         contextShiftOptions: Required<ContextShiftOptions>,
-        logitDataMapper: ((batchLogitIndex: BatchLogitIndex, tokenIndex: number) => T | Promise<T>)
-    ): Promise<Array<undefined | T>> {
+        logitDataMapper: ((batchLogitIndex: BatchLogitIndex, tokenIndex: number) => T | Promise<T>),
+        resolveFusedSampler?: FusedSamplerResolver
+    ): Promise<Array<undefined | T | Token | -1>> {
         this._ensureNotDisposed();
 
         const tokensLeftToDecode = tokens.slice();
         const tokenLogitsLeftToDecode = logits.slice();
         let currentTokenIndex = 0;
-        const res: Array<undefined | T> = [];
+        const res: Array<undefined | T | Token | -1> = [];
+
+        if (this._nextTokenIndex === 0 && this._contextTokens.length === 0 && this._loadedTokenPredictions.length === 0) {
+            // only tokens that don't need logits can be reused from other sequences
+            const firstLogitIndex = logits.findIndex((logit) => logit);
+            const reusedLength = await this._context._reusePrefixFromOtherSequences(
+                this,
+                tokens,
+                Math.min(firstLogitIndex < 0 ? tokens.length : firstLogitIndex, this._context.contextSize - 1)
+            );
+
+            if (reusedLength > 0) {
+                tokensLeftToDecode.splice(0, reusedLength);
+                tokenLogitsLeftToDecode.splice(0, reusedLength);
+                currentTokenIndex = reusedLength;
+                this._nextTokenIndex = reusedLength;
+                this._contextTokens = tokens.slice(0, reusedLength);
+                this._context._onSequenceTokensChange(this);
+            }
+        }
 
         const normalizedLogitDataMapper = (batchLogitIndex: BatchLogitIndex, contextStateTokenIndex: number) => {
             return logitDataMapper(batchLogitIndex, currentTokenIndex + (contextStateTokenIndex - this._nextTokenIndex));
         };
+        const normalizedFusedSamplerResolver = resolveFusedSampler == null
+            ? undefined
+            : (contextStateTokenIndex: number) => {
+                return resolveFusedSampler(currentTokenIndex + (contextStateTokenIndex - this._nextTokenIndex));
+            };
 
         while (tokensLeftToDecode.length > 0) {
             this._ensureNotDisposed();
@@ -2237,7 +3616,7 @@ export class LlamaContextSequence {
                 logits: tokensLogits,
                 evaluationPriority,
                 tokenMeter
-            }, normalizedLogitDataMapper);
+            }, normalizedLogitDataMapper, normalizedFusedSamplerResolver);
 
             for (const [index, value] of generatedLogits)
                 res[currentTokenIndex + (index - this._nextTokenIndex)] = value;
@@ -2245,6 +3624,7 @@ export class LlamaContextSequence {
             this._nextTokenIndex += tokensToDecode.length;
             currentTokenIndex += tokensToDecode.length;
             this._contextTokens = this._contextTokens.concat(tokensToDecode);
+            this._context._onSequenceTokensChange(this);
         }
 
         return res;
@@ -2333,7 +3713,31 @@ type InternalQueuedDecode = {
     evaluationPriority: EvaluationPriority,
     tokenMeter: TokenMeter,
     response: [accept: (res: any) => void, reject: (reason: unknown) => void],
-    logitDataMapper: ((batchLogitIndex: BatchLogitIndex, tokenIndex: number) => any | Promise<any>)
+    logitDataMapper: ((batchLogitIndex: BatchLogitIndex, tokenIndex: number) => any | Promise<any>),
+    resolveFusedSampler?: FusedSamplerResolver
+};
+
+/**
+ * Called right before a batch is decoded for each logit of a queued decode.
+ * When a sampler is returned, the token for that logit is sampled as part of the batch decoding (in a single native call),
+ * and the sampled token (or `-1`) is used as the mapped value of that logit instead of calling the logit data mapper,
+ * so it should be the same value the logit data mapper would have returned.
+ *
+ * An error thrown by the resolver or by `resolveConfig` rejects only the queued decode of that logit.
+ */
+type FusedSamplerResolver = (tokenIndex: number) => FusedSampler | null | undefined;
+type FusedSampler = {
+    sampler: LlamaSampler,
+
+    /** Called while holding the `"sample"` lock of the sampler, right before the config is applied to it */
+    resolveConfig(): Parameters<LlamaSampler["applyConfig"]>[0]
+};
+
+type BatchFillBuffers = {
+    tokens: Uint32Array,
+    positions: Int32Array,
+    sequenceIds: Int32Array,
+    logits: Uint8Array
 };
 
 type CurrentBatchItem = {
@@ -2378,18 +3782,22 @@ function getTokenBiasesForAddon(tokenBias: undefined | TokenBias | (() => TokenB
     };
 }
 
-function reviveTokenProbabilities(probabilities?: (Token | number)[]) {
+function endsWithStopSequence(tokens: readonly Token[], stopSequences: readonly (readonly Token[])[]) {
+    return stopSequences.some((stopSequence) => (
+        stopSequence.length <= tokens.length &&
+        stopSequence.every((token, index) => tokens[tokens.length - stopSequence.length + index] === token)
+    ));
+}
+
+function reviveTokenProbabilities(probabilities?: [tokens: Uint32Array, probabilities: Float32Array]) {
     if (probabilities == null)
         return undefined;
 
+    const [tokens, tokenProbabilities] = probabilities;
     const res = new Map<Token, number>();
 
-    for (let i = 1; i < probabilities.length; i += 2) {
-        const token = probabilities[i - 1]! as Token;
-        const probability = probabilities[i]! as number;
-
-        res.set(token, probability);
-    }
+    for (let i = 0; i < tokens.length; i++)
+        res.set(tokens[i]! as Token, tokenProbabilities[i]!);
 
     return res;
 }
@@ -2408,6 +3816,47 @@ function disposeContextSequenceIfReferenced(contextRef: WeakRef<LlamaContextSequ
         context.dispose();
 }
 
+function validateStandaloneBatchItems(items: readonly {tokens: readonly Token[]}[], batchSize: number) {
+    const totalTokens = items.reduce((res, item) => res + item.tokens.length, 0);
+
+    if (totalTokens > batchSize)
+        throw new Error("The given items don't fit in a single batch");
+    else if (items.some((item) => item.tokens.length === 0))
+        throw new Error("Cannot evaluate empty inputs");
+
+    return totalTokens;
+}
+
+function resolveSessionStoreOptions(sessionStore: Exclude<LlamaContextOptions["sessionStore"], false | undefined>) {
+    const options = sessionStore === true
+        ? {}
+        : sessionStore;
+
+    return removeNullFields({
+        memorySize: Math.max(0, Math.floor(options.memorySize ?? defaultSessionStoreMemorySize)),
+        directory: options.directory == null
+            ? undefined
+            : path.resolve(process.cwd(), options.directory),
+        diskSize: Math.max(0, Math.floor(options.diskSize ?? defaultSessionStoreDiskSize))
+    });
+}
+
+function resolveThreadpoolOptions({cpuMask, strictCpu, priority, poll}: LlamaContextThreadpoolOptions): AddonContextThreadpoolOptions {
+    if (cpuMask != null && cpuMask.some((cpu) => !Number.isInteger(cpu) || cpu < 0))
+        throw new Error("The threadpool CPU mask must only contain non-negative CPU indexes");
+
+    return removeNullFields({
+        cpuMask: cpuMask == null
+            ? undefined
+            : [...new Set(cpuMask)],
+        strictCpu,
+        priority,
+        poll: poll == null
+            ? undefined
+            : Math.max(0, Math.min(100, Math.floor(poll)))
+    });
+}
+
 export function getDefaultContextBatchSize({contextSize, sequences}: {contextSize: number, sequences: number}) {
     return Math.min(contextSize * sequences, 512);
 }
@@ -42,6 +42,20 @@ export type LlamaContextOptions = {
      */
     batchSize?: number,
 
+    /**
+     * The number of tokens that are physically processed at once by the backend.
+     *
+     * A batch of up to `batchSize` tokens is split into micro-batches of up to this many tokens,
+     * so the compute buffers of the context are sized according to this value rather than `batchSize`.
+     * Setting this to a lower value than `batchSize` reduces the peak memory usage of the context
+     * while still allowing large batches to be queued at once.
+     *
+     * Cannot be larger than `batchSize`.
+     *
+     * Defaults to `batchSize`.
+     */
+    microBatchSize?: number,
+
     /**
      * Flash attention is an optimization in the attention mechanism that makes inference faster, more efficient and uses less memory.
      *
@@ -92,6 +106,26 @@ export type LlamaContextOptions = {
         min?: number
     },
 
+    /**
+     * Use dedicated `ggml` threadpools for the CPU computations of this context,
+     * instead of the default thread management of `ggml`.
+     *
+     * Two threadpools are created for the context - one for batch evaluations (of more than one token)
+     * and one for single-token evaluations, each sized to the ideal number of threads of the context.
+     * This allows pinning the threads of each context to a specific set of CPUs (for example, to a single socket on
+     * multi-socket machines), so multiple contexts in the same process don't compete over the same cores.
+     *
+     * See {@link LlamaContextThreadpoolOptions} for more information.
+     *
+     * Defaults to `false`.
+     */
+    threadpool?: boolean | LlamaContextThreadpoolOptions & {
+        /**
+         * Options for the threadpool used for batch evaluations that override the options above
+         */
+        batch?: LlamaContextThreadpoolOptions
+    },
+
     /**
      * Control the parallel sequences processing behavior.
      *
@@ -99,6 +133,31 @@ export type LlamaContextOptions = {
      */
     batching?: BatchingOptions,
 
+    /**
+     * Run a native scheduler thread for this context that continuously builds batches, decodes them and samples the next tokens
+     * of the sequences that generate text using `sequence.generate(...)`, without waiting for the JS event loop between decodes.
+     *
+     * The sampled tokens are streamed back to JS as they're generated.
+     * Other evaluations on the context keep using the JS batching, and are interleaved with the batches of the native scheduler.
+     *
+     * Defaults to `false`.
+     */
+    nativeScheduler?: boolean,
+
+    /**
+     * Use a single KV cache buffer that is shared by all the sequences of the context,
+     * instead of a separate buffer for each sequence.
+     *
+     * This allows a token to belong to multiple sequences at once, which the `branches` option of `ngramDrafting` requires.
+     *
+     * A unified KV cache makes each decode attend over the cells of all the sequences (with the cells of other sequences masked out),
+     * so decoding is slower when the context has many sequences that are mostly filled.
+     * It doesn't change the memory usage of the context.
+     *
+     * Defaults to `false`.
+     */
+    unifiedKvCache?: boolean,
+
     /**
      * When using SWA (Sliding Window Attention) on a supported model,
      * extend the sliding window size to the current context size (meaning practically disabling SWA).
@@ -115,6 +174,28 @@ export type LlamaContextOptions = {
      */
     swaFullCache?: boolean,
 
+    /**
+     * The data type of the keys in the KV cache.
+     *
+     * Using a quantized type (like `q8_0` or `q4_0`) reduces the memory used by the context,
+     * allowing to fit a larger context size in the same amount of memory, at the cost of some quality.
+     *
+     * Defaults to `f16`.
+     */
+    kvCacheKeyType?: LlamaContextKvCacheType,
+
+    /**
+     * The data type of the values in the KV cache.
+     *
+     * Using a quantized type (like `q8_0` or `q4_0`) reduces the memory used by the context,
+     * allowing to fit a larger context size in the same amount of memory, at the cost of some quality.
+     *
+     * Quantized value types require `flashAttention` to be enabled.
+     *
+     * Defaults to `f16`.
+     */
+    kvCacheValueType?: LlamaContextKvCacheType,
+
     /**
      * Load the provided LoRA adapters onto the context.
      * LoRA adapters are used to modify the weights of a pretrained model to adapt to new tasks or domains
@@ -183,6 +264,58 @@ export type LlamaContextOptions = {
      */
     performanceTracking?: boolean,
 
+    /**
+     * Reuse the evaluated state of other sequences on the same context when a sequence starts evaluating from an empty state.
+     *
+     * The context keeps an index of the tokens held by each of its sequences,
+     * and when a sequence with an empty state evaluates new tokens,
+     * the KV cache cells of the longest matching prefix held by any other sequence are copied to it,
+     * so only the rest of the tokens have to be evaluated.
+     *
+     * This is useful when many sequences share the same prefix, like a system prompt, a template or function definitions.
+     *
+     * Use `context.prefixCacheStats` to see the effectiveness of the cache.
+     *
+     * Defaults to `false`.
+     */
+    prefixCache?: boolean,
+
+    /**
+     * Keep sequence state snapshots in a store owned by the context,
+     * so evaluated sessions can be parked and resumed later without having to evaluate their history again.
+     *
+     * Recently used snapshots are kept in memory, and colder ones are spilled to files in the `directory` if one is provided.
+     * When the budgets are exhausted, the least recently used snapshots are evicted.
+     *
+     * Use `sequence.saveStateToSessionStore(key)` and `sequence.loadStateFromSessionStore(key)` to use the store.
+     *
+     * Defaults to `false`.
+     */
+    sessionStore?: boolean | {
+        /**
+         * The maximum size in bytes of the snapshots kept in memory.
+         *
+         * Defaults to 1GiB.
+         */
+        memorySize?: number,
+
+        /**
+         * A directory to spill snapshots to when the memory budget is exhausted.
+         *
+         * The spilled files are deleted when the snapshots are evicted or when the context is disposed.
+         *
+         * When not provided, snapshots are evicted instead of being spilled.
+         */
+        directory?: string,
+
+        /**
+         * The maximum size in bytes of the snapshots spilled to the `directory`.
+         *
+         * Defaults to 8GiB.
+         */
+        diskSize?: number
+    },
+
     /**
      * embedding mode only
      * @internal
@@ -195,6 +328,116 @@ export type LlamaContextOptions = {
      */
     _ranking?: boolean
 };
+export type LlamaContextThreadpoolOptions = {
+    /**
+     * The indexes of the CPUs the threads of the pool are allowed to run on.
+     *
+     * Defaults to no affinity, so the threads can run on any CPU.
+     */
+    cpuMask?: readonly number[],
+
+    /**
+     * Pin each thread to a single CPU from `cpuMask`, instead of allowing each thread to run on any CPU in `cpuMask`.
+     *
+     * Defaults to `false`.
+     */
+    strictCpu?: boolean,
+
+    /**
+     * The scheduling priority of the threads of the pool.
+     *
+     * Raising the priority may require elevated permissions.
+     *
+     * Defaults to `"normal"`.
+     */
+    priority?: "low" | "normal" | "medium" | "high" | "realtime",
+
+    /**
+     * How aggressively the threads of the pool poll for new work before going to sleep, from `0` (no polling) to `100`.
+     *
+     * Polling reduces the latency of waking up the threads for each evaluation at the cost of CPU usage.
+     *
+     * Defaults to `50`.
+     */
+    poll?: number
+};
+
+export type LlamaContextKvCacheType = "f32" | "f16" | "bf16" | "q8_0" | "q4_0" | "q4_1" | "iq4_nl" | "q5_0" | "q5_1";
+
+export type LlamaContextPrefixCacheStats = {
+    /** The number of times a sequence started evaluating from an empty state and looked up a matching prefix */
+    lookups: number,
+
+    /** The number of lookups that reused a prefix from another sequence */
+    hits: number,
+
+    /** `hits / lookups` */
+    hitRate: number,
+
+    /** The number of tokens that didn't have to be evaluated thanks to reused prefixes */
+    savedTokens: number,
+
+    /**
+     * The number of indexed tokens that were evicted since the context was created,
+     * when their sequences were disposed or cleared
+     */
+    evictedTokens: number,
+
+    /** An estimation of the KV cache memory of the evicted tokens, in bytes */
+    evictedBytes: number,
+
+    /**
+     * The number of indexed tokens that were removed from the end of sequences that still hold some of their tokens,
+     * for example, when tokens are erased or the context is shifted
+     */
+    truncatedTokens: number
+};
+/**
+ * An in-memory snapshot of a context sequence evaluation state,
+ * created using `LlamaContextSequence.saveStateToMemory()`
+ */
+export type LlamaContextSequenceStateSnapshot = {
+    /** The tokens evaluated into the sequence state */
+    readonly tokens: readonly Token[],
+
+    /** The serialized sequence state, as returned by `llama.cpp` */
+    readonly state: ArrayBuffer
+};
+
+export type LlamaStateFileCompression = "zstd" | "lz4";
+
+export type LlamaContextSessionStoreStats = {
+    /** The number of snapshots in the store */
+    entries: number,
+
+    /** The number of snapshots kept in memory */
+    memoryEntries: number,
+
+    /** The number of snapshots spilled to the disk */
+    diskEntries: number,
+
+    /** The size in bytes of the snapshots kept in memory */
+    memorySize: number,
+
+    /** The size in bytes of the snapshots spilled to the disk */
+    diskSize: number,
+
+    /** The number of restores of snapshots that were kept in memory */
+    memoryHits: number,
+
+    /** The number of restores of snapshots that were read from the disk */
+    diskHits: number,
+
+    /** The number of restores of snapshots that were not found in the store */
+    misses: number,
+
+    /** The number of snapshots written to the disk */
+    spills: number,
+
+    /** The number of snapshots evicted from the store to stay within the budgets */
+    evictions: number
+};
+
 export type LlamaContextSequenceRepeatPenalty = {
     /** Tokens to lower the predication probability of to be the next predicted token */
     punishTokens: Token[] | (() => Token[]),
@@ -341,6 +584,132 @@ export type SequenceEvaluateOptions = {
     _noSampling?: boolean
 };
 
+export type SequenceGenerateOptions = {
+    temperature?: number, minP?: number, topK?: number, topP?: number,
+
+    /**
+     * Used to control the randomness of the generated text.
+     *
+     * Change the seed to get different results.
+     *
+     * Defaults to the current epoch time.
+     *
+     * Only relevant when using `temperature`.
+     */
+    seed?: number,
+
+    /**
+     * The state is resolved once when the generation starts
+     */
+    grammarEvaluationState?: LlamaGrammarEvaluationState | (() => LlamaGrammarEvaluationState | undefined),
+
+    /**
+     * The tokens to punish are resolved once when the generation starts,
+     * and the generated tokens are added to them as they're generated
+     */
+    repeatPenalty?: LlamaContextSequenceRepeatPenalty,
+
+    /**
+     * The token biases are resolved once when the generation starts
+     */
+    tokenBias?: TokenBias | (() => TokenBias),
+
+    /**
+     * The higher the evaluation priority is, the sooner the tokens of this generation are evaluated
+     * when there are more tokens to evaluate than can fit in a single batch.
+     */
+    evaluationPriority?: EvaluationPriority,
+
+    /**
+     * The maximum number of tokens to generate.
+     *
+     * Defaults to generating until an EOG token is generated or the context sequence is full.
+     */
+    maxTokens?: number,
+
+    /**
+     * Stop the generation when the generated tokens end with one of these token sequences.
+     *
+     * The tokens of the matched stop sequence are yielded.
+     */
+    stopSequences?: readonly (readonly Token[])[],
+
+    /**
+     * Yield an EOG (End Of Generation) token (like EOS and EOT) when it's generated.
+     * Defaults to `false`.
+     */
+    yieldEogToken?: boolean,
+
+    /**
+     * Use speculative decoding with this sequence as the draft sequence.
+     *
+     * Each step drafts tokens greedily on the draft sequence and verifies all of them in a single decode of this sequence,
+     * in a single native call.
+     * The draft sequence is aligned with the tokens of this sequence, and has to use a model with a compatible vocabulary.
+     *
+     * Cannot be this sequence.
+     */
+    draftSequence?: LlamaContextSequence,
+
+    /**
+     * Use speculative decoding with tokens drafted from a native n-gram index of this sequence, without a draft model.
+     *
+     * The index is keyed on the last few tokens of the sequence, and drafts the tokens that followed the most recent earlier
+     * occurrence of the longest n-gram the sequence ends with.
+     * This is useful in input-grounded tasks (when the model frequently repeats spans of the input, such as in code editing or RAG).
+     *
+     * The index is built from the tokens of the sequence when the generation starts,
+     * and is updated natively as tokens are accepted.
+     *
+     * Cannot be used together with `draftSequence`.
+     */
+    ngramDrafting?: boolean | {
+        /**
+         * The shortest n-gram to look up.
+         *
+         * Defaults to `2`.
+         */
+        minNgramSize?: number,
+
+        /**
+         * The longest n-gram to look up.
+         * Longer n-grams are tried first.
+         *
+         * Defaults to `4`.
+         */
+        maxNgramSize?: number,
+
+        /**
+         * The maximum number of distinct continuations to draft on each step.
+         *
+         * The continuations are merged into a token tree (where continuations that share a prefix share its tokens)
+         * that is verified in a single decode, with each branch laid out on its own sequence of the context.
+         * This increases the number of accepted tokens per decode, which matters most when decoding is expensive, like on CPU.
+         *
+         * The extra branches use the unused sequences of the context for the duration of the generation,
+         * so the context has to be created with enough `sequences` for them.
+         * When there aren't enough unused sequences, fewer branches are used.
+         *
+         * The branches share the tokens of their common prefix, which requires the context to be created with the `unifiedKvCache` option.
+         * Without it, only a single branch is used.
+         *
+         * Defaults to `1`.
+         */
+        branches?: number
+    },
+
+    /**
+     * The maximum number of tokens to draft on each speculative decoding step.
+     *
+     * Only relevant when using `draftSequence` or `ngramDrafting`.
+     *
+     * Defaults to `8`.
+     */
+    draftTokens?: number
+};
+
+export type SequenceGenerateFinishReason = "eogToken" | "maxTokens" | "stopSequence" | "contextFull";
+
 export type SequenceEvaluateMetadataOptions = {
     /**
      * Get the confidence (probability) of the selected token.
@@ -360,7 +729,28 @@ export type SequenceEvaluateMetadataOptions = {
      *
      * Defaults to `false`.
      */
-    readonly probabilities?: boolean
+    readonly probabilities?: boolean,
+
+    /**
+     * Limit the `probabilities` list to the given number of tokens with the highest probability.
+     *
+     * Computing only the top probabilities is much faster than computing the full list,
+     * so set this when you only need the top few alternatives.
+     *
+     * Only relevant when `probabilities` is enabled.
+     *
+     * Defaults to including all the tokens.
+     */
+    readonly maxProbabilities?: number,
+
+    /**
+     * Exclude tokens with a probability lower than the given value from the `probabilities` list.
+     *
+     * Only relevant when `probabilities` is enabled.
+     *
+     * Defaults to `0`.
+     */
+    readonly minProbability?: number
 };
 
 export type SequenceEvaluateOutput<
@@ -414,6 +804,27 @@ export type ControlledEvaluateInputItem = Token | [token: Token, options: {
          */
         probabilities?: boolean,
 
+        /**
+         * Limit the `probabilities` list to the given number of tokens with the highest probability.
+         *
+         * Computing only the top probabilities is much faster than computing the full list,
+         * so set this when you only need the top few alternatives.
+         *
+         * Only relevant when `probabilities` is enabled.
+         *
+         * Defaults to including all the tokens.
+         */
+        maxProbabilities?: number,
+
+        /**
+         * Exclude tokens with a probability lower than the given value from the `probabilities` list.
+         *
+         * Only relevant when `probabilities` is enabled.
+         *
+         * Defaults to `0`.
+         */
+        minProbability?: number,
+
         /**
          * Get the confidence (probability) of the selected token.
          *
@@ -425,6 +836,17 @@ export type ControlledEvaluateInputItem = Token | [token: Token, options: {
          */
         confidence?: boolean,
 
+        /**
+         * Get the raw logits the model produced for the next token, before applying any of the sampling options.
+         *
+         * The array has an item for each token in the vocabulary (the index of the item is the token).
+         *
+         * Useful for custom sampling, classification or perplexity scoring.
+         *
+         * Defaults to `false`.
+         */
+        logits?: boolean,
+
         /**
          * Generate the next token with the provided options using sampling.
          *
@@ -484,7 +906,17 @@ export type ControlledEvaluateIndexOutput = {
          * Use `.entries().next().value` to get the top probability pair
          * ([learn more](https://developer.mozilla.org/en-US/docs/Web/JavaScript/Reference/Global_Objects/Map/entries)).
          */
-        probabilities?: Map<Token, number>
+        probabilities?: Map<Token, number>,
+
+        /**
+         * The raw logits the model produced for the next token, before applying any of the sampling options.
+         *
+         * The array has an item for each token in the vocabulary (the index of the item is the token).
+         *
+         * This is a copy of the logits that stays valid after the next evaluation,
+         * since the native memory of the logits is overwritten by evaluations that can run on other threads.
+         */
+        logits?: Float32Array
     }
 };
 
@@ -0,0 +1,217 @@
+import {Token} from "../../../types.js";
+
+type RadixNode = {
+    /** The tokens of the edge leading to this node */
+    tokens: Token[],
+    children: Map<Token, RadixNode>,
+
+    /** The sequences whose tokens contain the entire path up to the end of this node */
+    sequenceIds: Set<number>
+};
+
+/**
+ * A radix tree of the tokens held by each context sequence,
+ * used to find the sequence that holds the longest prefix of a given tokens array.
+ */
+export class TokenPrefixIndex {
+    /** @internal */ private readonly _root: RadixNode = createNode([]);
+    /** @internal */ private readonly _sequenceTokens = new Map<number, Token[]>();
+
+    /** The number of indexed sequences */
+    public get size() {
+        return this._sequenceTokens.size;
+    }
+
+    /**
+     * Set the tokens held by the given sequence.
+     * @returns the number of previously indexed tokens of the sequence that are no longer held by it
+     */
+    public set(sequenceId: number, tokens: readonly Token[]) {
+        const previousTokens = this._sequenceTokens.get(sequenceId);
+        let removedTokens = 0;
+
+        if (previousTokens != null) {
+            const commonLength = getCommonPrefixLength(previousTokens, tokens);
+            if (commonLength === previousTokens.length && commonLength === tokens.length)
+                return 0;
+
+            removedTokens = previousTokens.length - commonLength;
+            this._remove(sequenceId, previousTokens);
+        }
+
+        if (tokens.length === 0) {
+            this._sequenceTokens.delete(sequenceId);
+            return removedTokens;
+        }
+
+        const sequenceTokens = tokens.slice();
+        this._sequenceTokens.set(sequenceId, sequenceTokens);
+        this._insert(sequenceId, sequenceTokens);
+
+        return removedTokens;
+    }
+
+    /**
+     * Remove the given sequence from the index.
+     * @returns the number of tokens of the sequence that were removed from the index
+     */
+    public delete(sequenceId: number) {
+        return this.set(sequenceId, []);
+    }
+
+    /**
+     * Find the sequence that holds the longest prefix of the given tokens
+     */
+    public findLongestPrefix(tokens: readonly Token[], excludeSequenceId?: number): {sequenceId: number, length: number} | undefined {
+        let node = this._root;
+        let length = 0;
+        let res: {sequenceId: number, length: number} | undefined = undefined;
+
+        while (length < tokens.length) {
+            const child = node.children.get(tokens[length]!);
+            if (child == null)
+                break;
+
+            const sequenceId = pickSequenceId(child.sequenceIds, excludeSequenceId);
+            if (sequenceId == null)
+                break;
+
+            const matchLength = getCommonPrefixLength(child.tokens, tokens, length);
+            length += matchLength;
+            res = {sequenceId, length};
+
+            if (matchLength < child.tokens.length)
+                break;
+
+            node = child;
+        }
+
+        return res;
+    }
+
+    /** @internal */
+    private _insert(sequenceId: number, tokens: readonly Token[]) {
+        let node = this._root;
+        let index = 0;
+
+        while (index < tokens.length) {
+            let child = node.children.get(tokens[index]!);
+
+            if (child == null) {
+                child = createNode(tokens.slice(index));
+                child.sequenceIds.add(sequenceId);
+                node.children.set(tokens[index]!, child);
+                return;
+            }
+
+            const matchLength = getCommonPrefixLength(child.tokens, tokens, index);
+            if (matchLength < child.tokens.length) {
+                // split the edge, so the sequence path ends on a node boundary
+                const splitNode = createNode(child.tokens.slice(0, matchLength));
+                for (const childSequenceId of child.sequenceIds)
+                    splitNode.sequenceIds.add(childSequenceId);
+
+                child.tokens = child.tokens.slice(matchLength);
+                splitNode.children.set(child.tokens[0]!, child);
+                node.children.set(splitNode.tokens[0]!, splitNode);
+                child = splitNode;
+            }
+
+            child.sequenceIds.add(sequenceId);
+            node = child;
+            index += matchLength;
+        }
+    }
+
+    /** @internal */
+    private _remove(sequenceId: number, tokens: readonly Token[]) {
+        const path: RadixNode[] = [];
+        let node = this._root;
+        let index = 0;
+
+        while (index < tokens.length) {
+            const child = node.children.get(tokens[index]!);
+            if (child == null)
+                break;
+
+            child.sequenceIds.delete(sequenceId);
+
+            if (child.sequenceIds.size === 0) {
+                // the sequences of all the descendants are a subset of the sequences of this node
+                node.children.delete(tokens[index]!);
+                break;
+            }
+
+            path.push(child);
+            node = child;
+            index += child.tokens.length;
+        }
+
+        // nodes that were only split for the removed sequence are merged back with their only child,
+        // from the bottom up, so a merged child already includes its own merged descendants
+        for (let i = path.length - 1; i >= 0; i--)
+            mergeWithOnlyChild(path[i]!);
+    }
+
+    /**
+     * The number of nodes in the tree, excluding the root
+     * @internal
+     */
+    public _getNodeCount() {
+        let count = 0;
+        const stack = [this._root];
+
+        while (stack.length > 0) {
+            const node = stack.pop()!;
+            for (const child of node.children.values()) {
+                count++;
+                stack.push(child);
+            }
+        }
+
+        return count;
+    }
+}
+
+function createNode(tokens: Token[]): RadixNode {
+    return {
+        tokens,
+        children: new Map(),
+        sequenceIds: new Set()
+    };
+}
+
+/**
+ * When no sequence path ends at the given node and it has a single child, the child is merged into it
+ */
+function mergeWithOnlyChild(node: RadixNode) {
+    if (node.children.size !== 1)
+        return;
+
+    const [onlyChild] = node.children.values();
+    if (onlyChild == null || onlyChild.sequenceIds.size !== node.sequenceIds.size)
+        return;
+
+    node.tokens = node.tokens.concat(onlyChild.tokens);
+    node.children = onlyChild.children;
+}
+
+function getCommonPrefixLength(edgeTokens: readonly Token[], tokens: readonly Token[], tokensOffset: number = 0) {
+    const maxLength = Math.min(edgeTokens.length, tokens.length - tokensOffset);
+
+    for (let i = 0; i < maxLength; i++) {
+        if (edgeTokens[i] !== tokens[tokensOffset + i])
+            return i;
+    }
+
+    return maxLength;
+}
+
+function pickSequenceId(sequenceIds: ReadonlySet<number>, excludeSequenceId?: number) {
+    for (const sequenceId of sequenceIds) {
+        if (sequenceId !== excludeSequenceId)
+            return sequenceId;
+    }
+
+    return undefined;
+}
@@ -0,0 +1,29 @@
+import {GgmlType} from "../../../gguf/types/GgufTensorInfoTypes.js";
+import type {LlamaContextKvCacheType} from "../types.js";
+
+// source: `kv_cache_types` in `common/arg.cpp`
+const kvCacheTypeToGgmlTypeMap = {
+    f32: GgmlType.F32,
+    f16: GgmlType.F16,
+    bf16: GgmlType.BF16,
+    q8_0: GgmlType.Q8_0,
+    q4_0: GgmlType.Q4_0,
+    q4_1: GgmlType.Q4_1,
+    iq4_nl: GgmlType.IQ4_NL,
+    q5_0: GgmlType.Q5_0,
+    q5_1: GgmlType.Q5_1
+} as const satisfies Record<LlamaContextKvCacheType, GgmlType>;
+
+export const defaultKvCacheType: LlamaContextKvCacheType = "f16";
+
+export function kvCacheTypeToGgmlType(kvCacheType: LlamaContextKvCacheType): GgmlType {
+    const ggmlType = kvCacheTypeToGgmlTypeMap[kvCacheType];
+    if (ggmlType == null)
+        throw new Error(`Unsupported KV cache type: "${kvCacheType}"`);
+
+    return ggmlType;
+}
+
+export function isQuantizedKvCacheType(kvCacheType: LlamaContextKvCacheType) {
+    return kvCacheType !== "f32" && kvCacheType !== "f16" && kvCacheType !== "bf16";
+}
@@ -4,6 +4,7 @@ import {LlamaText} from "../utils/LlamaText.js";
 import {tokenizeInput} from "../utils/tokenizeInput.js";
 import {resolveBeginningTokenToPrepend, resolveEndTokenToAppend} from "../utils/tokenizerUtils.js";
 import {LlamaEmbedding} from "./LlamaEmbedding.js";
+import type {AddonEmbeddingFormat, AddonEmbeddingFormatOutput} from "../bindings/AddonTypes.js";
 import type {LlamaModel} from "./LlamaModel/LlamaModel.js";
 import type {LlamaContext, LlamaContextSequence} from "./LlamaContext/LlamaContext.js";
 
@@ -28,6 +29,15 @@ export type LlamaEmbeddingContextOptions = {
     /** prompt processing batch size */
     batchSize?: number,
 
+    /**
+     * The number of inputs that can be evaluated together in a single batch when using `getEmbeddingsFor`.
+     *
+     * Each sequence reserves its own `contextSize` of the context memory, so increasing this value increases the memory usage.
+     *
+     * Defaults to `1`.
+     */
+    sequences?: number,
+
     /**
      * number of threads to use to evaluate tokens.
      * set to 0 to use the maximum threads supported by the current machine hardware
@@ -46,12 +56,44 @@ export type LlamaEmbeddingContextOptions = {
     ignoreMemorySafetyChecks?: boolean
 };
 
+export type LlamaEmbeddingFormat = "float32" | "normalized" | "float16" | "int8" | "binary";
+
+type LlamaEmbeddingFormatVectors = {
+    float32: Float32Array,
+    normalized: Float32Array,
+    float16: Uint16Array,
+    int8: Int8Array,
+    binary: Uint8Array
+};
+
+export type LlamaEmbeddingVectors<Format extends LlamaEmbeddingFormat = LlamaEmbeddingFormat> = Format extends LlamaEmbeddingFormat
+    ? {
+        format: Format,
+
+        /** The number of values in each vector */
+        vectorSize: number,
+
+        /** The number of vectors */
+        count: number,
+
+        /**
+         * The vectors, one after the other.
+         *
+         * For the `"binary"` format, each vector takes `ceil(vectorSize / 8)` bytes, with the first value at the most significant bit.
+         */
+        vectors: LlamaEmbeddingFormatVectors[Format]
+    } & (Format extends "int8" ? {
+        /** The scale factor of each vector, where `value = quantized * scales[vectorIndex]` */
+        scales: Float32Array
+    } : {})
+    : never;
+
 /**
  * @see [Using Embedding](https://node-llama-cpp.withcat.ai/guide/embedding) tutorial
  */
 export class LlamaEmbeddingContext {
     /** @internal */ private readonly _llamaContext: LlamaContext;
-    /** @internal */ private readonly _sequence: LlamaContextSequence;
+    /** @internal */ private readonly _sequences: LlamaContextSequence[] = [];
     /** @internal */ private readonly _disposeAggregator = new AsyncDisposeAggregator();
 
     public readonly onDispose = new EventRelay<void>();
@@ -62,7 +104,8 @@ export class LlamaEmbeddingContext {
         _llamaContext: LlamaContext
     }) {
         this._llamaContext = _llamaContext;
-        this._sequence = this._llamaContext.getSequence();
+        while (this._llamaContext.sequencesLeft > 0)
+            this._sequences.push(this._llamaContext.getSequence());
 
         this._disposeAggregator.add(
             this._llamaContext.onDispose.createListener(() => {
@@ -76,45 +119,114 @@ export class LlamaEmbeddingContext {
     }
 
     public async getEmbeddingFor(input: Token[] | string | LlamaText) {
-        const resolvedInput = tokenizeInput(input, this._llamaContext.model.tokenizer, undefined, true);
+        const [embedding] = await this.getEmbeddingsFor([input]);
+        return embedding!;
+    }
 
-        if (resolvedInput.length > this._llamaContext.contextSize)
-            throw new Error(
-                "Input is longer than the context size. " +
-                "Try to increase the context size or use another model that supports longer contexts."
-            );
-        else if (resolvedInput.length === 0)
-            return new LlamaEmbedding({
-                vector: []
-            });
+    /**
+     * Get the embeddings of multiple inputs.
+     *
+     * Inputs are packed together into batches of up to `sequences` inputs each,
+     * so each batch of inputs is evaluated with a single decode.
+     */
+    public async getEmbeddingsFor(inputs: readonly (Token[] | string | LlamaText)[]) {
+        const res: LlamaEmbedding[] = inputs.map(() => new LlamaEmbedding({vector: []}));
 
-        const beginningToken = resolveBeginningTokenToPrepend(this.model.vocabularyType, this.model.tokens);
-        if (beginningToken != null && resolvedInput[0] !== beginningToken)
-            resolvedInput.unshift(beginningToken);
+        await this._evaluateInputs(inputs, "float32", (inputIndexes, vectors) => {
+            const vectorSize = vectors.length / inputIndexes.length;
 
-        const endToken = resolveEndTokenToAppend(this.model.vocabularyType, this.model.tokens);
-        if (endToken != null && resolvedInput.at(-1) !== endToken)
-            resolvedInput.push(endToken);
+            for (let i = 0; i < inputIndexes.length; i++)
+                res[inputIndexes[i]!] = new LlamaEmbedding({
+                    vector: Array.from(vectors.subarray(i * vectorSize, (i + 1) * vectorSize))
+                });
+        });
+
+        return res;
+    }
+
+    /**
+     * Get the embeddings of multiple inputs as a single contiguous buffer in the given format,
+     * which is more efficient to store in a vector database than `LlamaEmbedding` objects.
+     *
+     * The conversion to the requested format is done on a background thread.
+     *
+     * The vector of an empty input is filled with zeros.
+     */
+    public async getEmbeddingVectorsFor<const Format extends LlamaEmbeddingFormat = "float32">(
+        inputs: readonly (Token[] | string | LlamaText)[],
+        {
+            format = "float32" as Format
+        }: {
+            /**
+             * The format of the returned vectors.
+             * - **`"float32"`** - the raw embedding values.
+             * - **`"normalized"`** - the embedding values L2-normalized to a unit vector.
+             * - **`"float16"`** - half precision values, stored as their IEEE 754 bits in a `Uint16Array`.
+             * - **`"int8"`** - symmetrically quantized values with a scale factor for each vector.
+             * - **`"binary"`** - the sign bit of each value (`1` for positive values), packed 8 per byte.
+             *
+             * Defaults to `"float32"`.
+             */
+            format?: Format
+        } = {}
+    ): Promise<LlamaEmbeddingVectors<Format>> {
+        const vectorSize = this.model.embeddingVectorSize;
+        const valuesPerVector = format === "binary"
+            ? Math.ceil(vectorSize / 8)
+            : vectorSize;
+        const count = inputs.length;
+
+        let vectors: Float32Array | Uint16Array | Int8Array | Uint8Array | undefined = undefined;
+        let scales: Float32Array | undefined = undefined;
 
-        return await withLock(this, "evaluate", async () => {
-            await this._sequence.eraseContextTokenRanges([{
-                start: 0,
-                end: this._sequence.nextTokenIndex
-            }]);
+        await this._evaluateInputs(inputs, format, (inputIndexes, output) => {
+            const [outputVectors, outputScales] = (
+                output instanceof Array
+                    ? output
+                    : [output, undefined]
+            ) as [Float32Array | Uint16Array | Int8Array | Uint8Array, Float32Array | undefined];
 
-            const iterator = this._sequence.evaluate(resolvedInput, {_noSampling: true});
-            // eslint-disable-next-line @typescript-eslint/no-unused-vars
-            for await (const token of iterator) {
-                break; // only generate one token to get embeddings
+            if (vectors == null && inputIndexes.length === count) {
+                // all the inputs were evaluated in a single batch, so the output can be used as is
+                vectors = outputVectors;
+                scales = outputScales;
+                return;
             }
 
-            const embedding = this._llamaContext._ctx.getEmbedding(resolvedInput.length);
-            const embeddingVector = Array.from(embedding);
+            if (vectors == null)
+                vectors = new (outputVectors.constructor as Float32ArrayConstructor)(count * valuesPerVector);
+
+            if (outputScales != null && scales == null)
+                scales = new Float32Array(count);
 
-            return new LlamaEmbedding({
-                vector: embeddingVector
-            });
+            for (let i = 0; i < inputIndexes.length; i++) {
+                const inputIndex = inputIndexes[i]!;
+                vectors.set(outputVectors.subarray(i * valuesPerVector, (i + 1) * valuesPerVector), inputIndex * valuesPerVector);
+
+                if (outputScales != null)
+                    scales![inputIndex] = outputScales[i]!;
+            }
         });
+
+        if (vectors == null)
+            vectors = format === "float16"
+                ? new Uint16Array(count * valuesPerVector)
+                : format === "int8"
+                    ? new Int8Array(count * valuesPerVector)
+                    : format === "binary"
+                        ? new Uint8Array(count * valuesPerVector)
+                        : new Float32Array(count * valuesPerVector);
+
+        if (format === "int8" && scales == null)
+            scales = new Float32Array(count);
+
+        return {
+            format,
+            vectorSize,
+            count,
+            vectors,
+            ...(format === "int8" ? {scales} : {})
+        } as LlamaEmbeddingVectors<Format>;
     }
 
     public async dispose() {
@@ -134,6 +246,107 @@ export class LlamaEmbeddingContext {
         return this._llamaContext.model;
     }
 
+    /** @internal */
+    private _resolveInput(input: Token[] | string | LlamaText) {
+        const resolvedInput = tokenizeInput(input, this._llamaContext.model.tokenizer, undefined, true);
+
+        if (resolvedInput.length > this._llamaContext.contextSize)
+            throw new Error(
+                "Input is longer than the context size. " +
+                "Try to increase the context size or use another model that supports longer contexts."
+            );
+        else if (resolvedInput.length === 0)
+            return resolvedInput;
+
+        const beginningToken = resolveBeginningTokenToPrepend(this.model.vocabularyType, this.model.tokens);
+        if (beginningToken != null && resolvedInput[0] !== beginningToken)
+            resolvedInput.unshift(beginningToken);
+
+        const endToken = resolveEndTokenToAppend(this.model.vocabularyType, this.model.tokens);
+        if (endToken != null && resolvedInput.at(-1) !== endToken)
+            resolvedInput.push(endToken);
+
+        return resolvedInput;
+    }
+
+    /**
+     * Evaluate the given inputs and call `onOutput` with the output of every evaluated group of inputs.
+     * Empty inputs are skipped.
+     * @internal
+     */
+    private async _evaluateInputs<const Format extends AddonEmbeddingFormat>(
+        inputs: readonly (Token[] | string | LlamaText)[],
+        format: Format,
+        onOutput: (inputIndexes: number[], output: AddonEmbeddingFormatOutput[Format]) => void
+    ) {
+        const resolvedInputs = inputs.map((input) => this._resolveInput(input));
+
+        await withLock(this, "evaluate", async () => {
+            const batchSize = this._llamaContext.batchSize;
+            let pendingIndexes: number[] = [];
+            let pendingTokens = 0;
+
+            const flush = async () => {
+                if (pendingIndexes.length === 0)
+                    return;
+
+                const indexes = pendingIndexes;
+                pendingIndexes = [];
+                pendingTokens = 0;
+
+                for (let i = 0; i < indexes.length; i++)
+                    await this._sequences[i]!.clearHistory();
+
+                const output = await this._llamaContext._evaluateEmbeddings(
+                    indexes.map((inputIndex, i) => ({
+                        sequenceId: this._sequences[i]!._sequenceId,
+                        tokens: resolvedInputs[inputIndex]!,
+                        tokenMeter: this._sequences[i]!.tokenMeter
+                    })),
+                    {format}
+                );
+                onOutput(indexes, output);
+            };
+
+            for (let i = 0; i < resolvedInputs.length; i++) {
+                const tokens = resolvedInputs[i]!;
+
+                if (tokens.length === 0)
+                    continue;
+                else if (tokens.length > batchSize) {
+                    onOutput([i], await this._evaluateLongInput(tokens, format));
+                    continue;
+                }
+
+                if (pendingIndexes.length === this._sequences.length || pendingTokens + tokens.length > batchSize)
+                    await flush();
+
+                pendingIndexes.push(i);
+                pendingTokens += tokens.length;
+            }
+
+            await flush();
+        });
+    }
+
+    /**
+     * Evaluate an input that doesn't fit in a single batch on the first sequence, spread across multiple batches
+     * @internal
+     */
+    private async _evaluateLongInput<const Format extends AddonEmbeddingFormat>(tokens: Token[], format: Format) {
+        const sequence = this._sequences[0]!;
+
+        await sequence.clearHistory();
+
+        const iterator = sequence.evaluate(tokens, {_noSampling: true});
+        // eslint-disable-next-line @typescript-eslint/no-unused-vars
+        for await (const token of iterator) {
+            break; // only generate one token to get embeddings
+        }
+
+        return await this._llamaContext._ctx.getEmbeddings(Uint32Array.from([sequence._sequenceId]), format);
+    }
+
     /** @internal */
     public static async _create({
         _model
@@ -142,6 +355,7 @@ export class LlamaEmbeddingContext {
     }, {
         contextSize,
         batchSize,
+        sequences = 1,
         threads = 6,
         createSignal,
         ignoreMemorySafetyChecks
@@ -152,6 +366,7 @@ export class LlamaEmbeddingContext {
         const llamaContext = await _model.createContext({
             contextSize,
             batchSize,
+            sequences,
             threads,
             createSignal,
             ignoreMemorySafetyChecks,
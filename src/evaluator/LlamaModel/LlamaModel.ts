@@ -76,6 +76,23 @@ export type LlamaModelOptions = {
      */
     useMmap?: boolean,
 
+    /**
+     * Interleave the memory of the model across all the NUMA nodes of the system,
+     * so the CPU computations on every node have the same memory bandwidth to the model weights,
+     * instead of all the weights being placed on a single node.
+     *
+     * This only affects the memory allocated while the model is loaded,
+     * so it requires `useMmap` to be `false`, as memory-mapped weights are placed by the page cache instead.
+     * When this option is enabled, `useMmap` defaults to `false`, and setting it to `true` throws an error.
+     *
+     * Replicating the weights on every node is not supported by `llama.cpp`.
+     *
+     * Only supported on Linux. Does nothing on systems with a single NUMA node.
+     *
+     * Defaults to `false`.
+     */
+    numaInterleave?: boolean,
+
     /**
      * Force the system to keep the model in the RAM/VRAM.
      * Use with caution as this can crash your system if the available resources are insufficient.
@@ -181,7 +198,8 @@ export class LlamaModel {
     public readonly onDispose = new EventRelay<void>();
 
     private constructor({
-        modelPath, gpuLayers, vocabOnly = false, useMmap, useMlock, checkTensors, onLoadProgress, loadSignal, metadataOverrides
+        modelPath, gpuLayers, vocabOnly = false, useMmap, numaInterleave, useMlock, checkTensors, onLoadProgress, loadSignal,
+        metadataOverrides
     }: LlamaModelOptions & {
         gpuLayers: number
     }, {
@@ -219,6 +237,7 @@ export class LlamaModel {
             gpuLayers,
             vocabOnly: this._vocabOnly,
             useMmap,
+            numaInterleave,
             useMlock: _llama.supportsMlock
                 ? useMlock
                 : undefined,
@@ -708,7 +727,11 @@ export class LlamaModel {
         _llama: Llama
     }) {
         const {loadSignal, defaultContextFlashAttention} = modelOptions;
-        const useMmap = _llama.supportsMmap && (modelOptions.useMmap ?? defaultUseMmap);
+
+        if (modelOptions.numaInterleave && modelOptions.useMmap)
+            throw new Error("The `numaInterleave` option requires `useMmap` to be `false`");
+
+        const useMmap = _llama.supportsMmap && (modelOptions.useMmap ?? (modelOptions.numaInterleave ? false : defaultUseMmap));
 
         const fileInfo = await readGgufFileInfo(modelOptions.modelPath, {
             sourceType: "filesystem",
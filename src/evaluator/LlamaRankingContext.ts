@@ -27,6 +27,15 @@ export type LlamaRankingContextOptions = {
     /** prompt processing batch size */
     batchSize?: number,
 
+    /**
+     * The number of documents that can be evaluated together in a single batch when using `rankAll` or `rankAndSort`.
+     *
+     * Each sequence reserves its own `contextSize` of the context memory, so increasing this value increases the memory usage.
+     *
+     * Defaults to `1`.
+     */
+    sequences?: number,
+
     /**
      * number of threads to use to evaluate tokens.
      * set to 0 to use the maximum threads supported by the current machine hardware
@@ -50,7 +59,7 @@ export type LlamaRankingContextOptions = {
  */
 export class LlamaRankingContext {
     /** @internal */ private readonly _llamaContext: LlamaContext;
-    /** @internal */ private readonly _sequence: LlamaContextSequence;
+    /** @internal */ private readonly _sequences: LlamaContextSequence[] = [];
     /** @internal */ private readonly _disposeAggregator = new AsyncDisposeAggregator();
 
     public readonly onDispose = new EventRelay<void>();
@@ -61,7 +70,8 @@ export class LlamaRankingContext {
         _llamaContext: LlamaContext
     }) {
         this._llamaContext = _llamaContext;
-        this._sequence = this._llamaContext.getSequence();
+        while (this._llamaContext.sequencesLeft > 0)
+            this._sequences.push(this._llamaContext.getSequence());
 
         this._disposeAggregator.add(
             this._llamaContext.onDispose.createListener(() => {
@@ -93,7 +103,8 @@ export class LlamaRankingContext {
                 "or use another model that supports longer contexts."
             );
 
-        return this._evaluateRankingForInput(resolvedInput);
+        const [score] = await this._evaluateRankingsForInputs([resolvedInput]);
+        return score!;
     }
 
     /**
@@ -115,9 +126,7 @@ export class LlamaRankingContext {
         else if (resolvedTokens.length === 0)
             return [];
 
-        return await Promise.all(
-            resolvedTokens.map((tokens) => this._evaluateRankingForInput(tokens))
-        );
+        return await this._evaluateRankingsForInputs(resolvedTokens);
     }
 
     /**
@@ -180,34 +189,88 @@ export class LlamaRankingContext {
         return resolvedInput;
     }
 
-    /** @internal */
-    private _evaluateRankingForInput(input: Token[]): Promise<number> {
-        if (input.length === 0)
-            return Promise.resolve(0);
-
+    /**
+     * Evaluate the given inputs in as few batches as possible, with up to `sequences` inputs in each batch
+     * @internal
+     */
+    private _evaluateRankingsForInputs(inputs: Token[][]): Promise<number[]> {
         return withLock(this, "evaluate", async () => {
-            await this._sequence.eraseContextTokenRanges([{
-                start: 0,
-                end: this._sequence.nextTokenIndex
-            }]);
-
-            const iterator = this._sequence.evaluate(input, {_noSampling: true});
-            // eslint-disable-next-line @typescript-eslint/no-unused-vars
-            for await (const token of iterator) {
-                break; // only generate one token to get embeddings
+            const res: number[] = inputs.map(() => 0);
+            const batchSize = this._llamaContext.batchSize;
+            let pendingIndexes: number[] = [];
+            let pendingTokens = 0;
+
+            const flush = async () => {
+                if (pendingIndexes.length === 0)
+                    return;
+
+                const indexes = pendingIndexes;
+                pendingIndexes = [];
+                pendingTokens = 0;
+
+                for (let i = 0; i < indexes.length; i++)
+                    await this._sequences[i]!.clearHistory();
+
+                const logits = await this._llamaContext._evaluateRankings(
+                    indexes.map((inputIndex, i) => ({
+                        sequenceId: this._sequences[i]!._sequenceId,
+                        tokens: inputs[inputIndex]!,
+                        tokenMeter: this._sequences[i]!.tokenMeter
+                    }))
+                );
+
+                for (let i = 0; i < indexes.length; i++)
+                    res[indexes[i]!] = logitToSigmoid(logits[i]!);
+            };
+
+            for (let i = 0; i < inputs.length; i++) {
+                const input = inputs[i]!;
+
+                if (input.length === 0)
+                    continue;
+                else if (input.length > batchSize) {
+                    res[i] = await this._evaluateRankingForLongInput(input);
+                    continue;
+                }
+
+                if (pendingIndexes.length === this._sequences.length || pendingTokens + input.length > batchSize)
+                    await flush();
+
+                pendingIndexes.push(i);
+                pendingTokens += input.length;
             }
 
-            const embedding = this._llamaContext._ctx.getEmbedding(input.length, 1);
-            if (embedding.length === 0)
-                return 0;
+            await flush();
 
-            const logit = embedding[0]!;
-            const probability = logitToSigmoid(logit);
-
-            return probability;
+            return res;
         });
     }
 
+    /**
+     * Evaluate an input that doesn't fit in a single batch on the first sequence, spread across multiple batches
+     * @internal
+     */
+    private async _evaluateRankingForLongInput(input: Token[]) {
+        const sequence = this._sequences[0]!;
+
+        await sequence.clearHistory();
+
+        const iterator = sequence.evaluate(input, {_noSampling: true});
+        // eslint-disable-next-line @typescript-eslint/no-unused-vars
+        for await (const token of iterator) {
+            break; // only generate one token to get embeddings
+        }
+
+        const embedding = this._llamaContext._ctx.getEmbedding(input.length, 1);
+        if (embedding.length === 0)
+            return 0;
+
+        const logit = embedding[0]!;
+        const probability = logitToSigmoid(logit);
+
+        return probability;
+    }
+
     /** @internal */
     public static async _create({
         _model
@@ -216,6 +279,7 @@ export class LlamaRankingContext {
     }, {
         contextSize,
         batchSize,
+        sequences = 1,
         threads = 6,
         createSignal,
         ignoreMemorySafetyChecks
@@ -239,6 +303,7 @@ export class LlamaRankingContext {
         const llamaContext = await _model.createContext({
             contextSize,
             batchSize,
+            sequences,
             threads,
             createSignal,
             ignoreMemorySafetyChecks,
@@ -1,6 +1,8 @@
 import {Llama} from "../../bindings/Llama.js";
 import {getLlamaWithoutBackend} from "../../bindings/utils/getLlamaWithoutBackend.js";
 import {getDefaultContextBatchSize, getDefaultContextSequences} from "../../evaluator/LlamaContext/LlamaContext.js";
+import {defaultKvCacheType, kvCacheTypeToGgmlType} from "../../evaluator/LlamaContext/utils/kvCacheTypes.js";
+import {LlamaContextKvCacheType} from "../../evaluator/LlamaContext/types.js";
 import {GgufFileInfo} from "../types/GgufFileInfoTypes.js";
 import {GgufTensorInfo} from "../types/GgufTensorInfoTypes.js";
 import {GgufArchitectureType} from "../types/GgufMetadataTypes.js";
@@ -164,15 +166,20 @@ export class GgufInsights {
      * The estimation for the graph overhead memory will be improved in the future to be more precise, but it's good enough for now.
      */
     public estimateContextResourceRequirements({
-        contextSize, modelGpuLayers, batchSize, sequences, isEmbeddingContext = false, includeGraphOverhead = true, flashAttention = false,
-        swaFullCache = false
+        contextSize, modelGpuLayers, batchSize, microBatchSize, sequences, isEmbeddingContext = false, includeGraphOverhead = true,
+        flashAttention = false, swaFullCache = false, kvCacheKeyType = defaultKvCacheType, kvCacheValueType = defaultKvCacheType
     }: {
-        contextSize: number, modelGpuLayers: number, batchSize?: number, sequences?: number, isEmbeddingContext?: boolean,
-        flashAttention?: boolean, includeGraphOverhead?: boolean, swaFullCache?: boolean
+        contextSize: number, modelGpuLayers: number, batchSize?: number, microBatchSize?: number, sequences?: number,
+        isEmbeddingContext?: boolean,
+        flashAttention?: boolean, includeGraphOverhead?: boolean, swaFullCache?: boolean,
+        kvCacheKeyType?: LlamaContextKvCacheType, kvCacheValueType?: LlamaContextKvCacheType
     }): GgufInsightsResourceRequirements {
         if (sequences == null) sequences = getDefaultContextSequences();
         if (batchSize == null) batchSize = getDefaultContextBatchSize({contextSize, sequences});
 
+        // the compute buffers are sized according to the micro-batch size (`n_ubatch`)
+        const computeBatchSize = Math.min(microBatchSize ?? batchSize, batchSize);
+
         const llmData = this._ggufFileInfo.architectureMetadata;
         const tensorInfo = this._ggufFileInfo.fullTensorInfo ?? [];
         const slidingWindow = this.swaSize ?? 0;
@@ -233,9 +240,6 @@ export class GgufInsights {
 
             let defaultCalculationAdjustment = 0;
 
-            if (batchSize == null)
-                return 0;
-
             if (this._ggufFileInfo.metadata.general?.architecture === GgufArchitectureType.llama) {
                 const expertCount = this._ggufFileInfo.architectureMetadata.expert_count ?? 0;
                 const headCount = this._ggufFileInfo.architectureMetadata.attention?.head_count ?? 0;
@@ -244,10 +248,10 @@ export class GgufInsights {
                 if (expertCount > 0) {
                     const expertsUsedCount = this._ggufFileInfo.architectureMetadata.expert_used_count ?? 2;
 
-                    return int32TBytes * batchSize * (((expertsUsedCount + 1) * embeddingLength) + (kvSize * headCount));
+                    return int32TBytes * computeBatchSize * (((expertsUsedCount + 1) * embeddingLength) + (kvSize * headCount));
                 }
 
-                return int32TBytes * batchSize * (embeddingLength + (kvSize * headCount));
+                return int32TBytes * computeBatchSize * (embeddingLength + (kvSize * headCount));
             } else if (this._ggufFileInfo.metadata.general?.architecture === GgufArchitectureType.qwen2) {
                 if (modelGpuLayers === this.totalLayers) {
                     defaultCalculationAdjustment -= (s1MB * 340) * (
@@ -266,7 +270,7 @@ export class GgufInsights {
                 }
             } else if (this._ggufFileInfo.metadata.general?.architecture === GgufArchitectureType.gemma) {
                 // only works properly when all layers are on the GPU, which is why it's commented out:
-                // return int32TBytes * batchSize * ((llmData.embedding_length ?? 0));
+                // return int32TBytes * computeBatchSize * ((llmData.embedding_length ?? 0));
 
                 if (modelGpuLayers === this.totalLayers) {
                     defaultCalculationAdjustment += (s1MB * 40) - (
@@ -288,7 +292,7 @@ export class GgufInsights {
             } else if (this._ggufFileInfo.metadata.general?.architecture === GgufArchitectureType.stablelm) {
                 const headCount = this._ggufFileInfo.architectureMetadata.attention?.head_count ?? 0;
 
-                return (int32TBytes * batchSize * kvSize * headCount) - (50 * s1MB);
+                return (int32TBytes * computeBatchSize * kvSize * headCount) - (50 * s1MB);
 
                 // if (modelGpuLayers === this.totalLayers) {
                 //     defaultCalculationAdjustment += -(s1MB * 20) + (
@@ -334,10 +338,11 @@ export class GgufInsights {
                 kvSize,
                 finalGpuLayers < totalFileLayers
                     ? (finalGpuLayers + 1)
-                    : finalGpuLayers
+                    : finalGpuLayers,
+                {kvCacheKeyType, kvCacheValueType}
             )
             : 0;
-        const cpuKVCacheSize = this._estimateKvMemorySizeInBytes(kvSize, finalCpuLayers);
+        const cpuKVCacheSize = this._estimateKvMemorySizeInBytes(kvSize, finalCpuLayers, {kvCacheKeyType, kvCacheValueType});
 
         // source: `llama_context::graph_max_nodes` in `llama-context.cpp`
         const maxNodes = Math.max(65536, 5 * tensorInfo.length);
@@ -469,7 +474,13 @@ export class GgufInsights {
     }
 
     /** @internal */
-    public _estimateKvMemorySizeInBytes(kvSize: number, layers: number) {
+    public _estimateKvMemorySizeInBytes(kvSize: number, layers: number, {
+        kvCacheKeyType = defaultKvCacheType,
+        kvCacheValueType = defaultKvCacheType
+    }: {
+        kvCacheKeyType?: LlamaContextKvCacheType,
+        kvCacheValueType?: LlamaContextKvCacheType
+    } = {}) {
         // source: `llama_kv_cache_init` in `llama.cpp`
         const nHead = this._ggufFileInfo.architectureMetadata.attention?.head_count ?? 0;
         const nEmbd = this._ggufFileInfo.architectureMetadata.embedding_length ?? 0;
@@ -507,16 +518,13 @@ export class GgufInsights {
             totalElementsV += totalNEmbdVGqa * kvSize;
         }
 
+        // the recurrent state of mamba models is always stored as f32, regardless of `type_k` and `type_v`
         const keyTypeSize = this._ggufFileInfo.metadata.general?.architecture === GgufArchitectureType.mamba
-            // if `type_k` of `llama_context_params` changes to be configurable in `LlamaContext`,
-            // this would have to depend on that value
             ? this._llama._consts.ggmlTypeF32Size
-            : this._llama._consts.ggmlTypeF16Size;
+            : this._getKvCacheTypeElementSize(kvCacheKeyType);
         const valueTypeSize = this._ggufFileInfo.metadata.general?.architecture === GgufArchitectureType.mamba
-            // if `type_v` of `llama_context_params` changes to be configurable in `LlamaContext`,
-            // this would have to depend on that value
             ? this._llama._consts.ggmlTypeF32Size
-            : this._llama._consts.ggmlTypeF16Size;
+            : this._getKvCacheTypeElementSize(kvCacheValueType);
 
         return (
             (totalElementsK * keyTypeSize) +
@@ -524,6 +532,23 @@ export class GgufInsights {
         );
     }
 
+    /** @internal */
+    private _getKvCacheTypeElementSize(kvCacheType: LlamaContextKvCacheType) {
+        if (kvCacheType === "f16")
+            return this._llama._consts.ggmlTypeF16Size;
+        else if (kvCacheType === "f32")
+            return this._llama._consts.ggmlTypeF32Size;
+
+        const ggmlType = kvCacheTypeToGgmlType(kvCacheType);
+        const typeSize = this._llama._bindings.getTypeSizeForGgmlType(ggmlType);
+        const blockSize = this._llama._bindings.getBlockSizeForGgmlType(ggmlType);
+
+        if (typeSize == null || blockSize == null || blockSize === 0)
+            return this._llama._consts.ggmlTypeF16Size;
+
+        return typeSize / blockSize;
+    }
+
     /** @internal */
     private _getTotalFileLayers() {
         if (this._totalFileLayers != null)
@@ -1,6 +1,6 @@
 import {BuildGpu} from "../../bindings/types.js";
 import {LlamaModelOptions} from "../../evaluator/LlamaModel/LlamaModel.js";
-import {LlamaContextOptions} from "../../evaluator/LlamaContext/types.js";
+import {LlamaContextKvCacheType, LlamaContextOptions} from "../../evaluator/LlamaContext/types.js";
 import {getDefaultContextSequences} from "../../evaluator/LlamaContext/LlamaContext.js";
 import {InsufficientMemoryError} from "../../utils/InsufficientMemoryError.js";
 import {resolveModelGpuLayersOption} from "./utils/resolveModelGpuLayersOption.js";
@@ -407,9 +407,12 @@ export class GgufInsightsConfigurationResolver {
     public async resolveContextContextSize(contextSize: LlamaContextOptions["contextSize"], {
         modelGpuLayers,
         batchSize,
+        microBatchSize,
         modelTrainContextSize,
         flashAttention = false,
         swaFullCache = false,
+        kvCacheKeyType,
+        kvCacheValueType,
         getVramState = (() => this._ggufInsights._llama._vramOrchestrator.getMemoryState()),
         getRamState = (async () => this._ggufInsights._llama._ramOrchestrator.getMemoryState()),
         getSwapState = (() => this._ggufInsights._llama._swapOrchestrator.getMemoryState()),
@@ -422,7 +425,10 @@ export class GgufInsightsConfigurationResolver {
         modelTrainContextSize: number,
         flashAttention?: boolean,
         swaFullCache?: boolean,
+        kvCacheKeyType?: LlamaContextKvCacheType,
+        kvCacheValueType?: LlamaContextKvCacheType,
         batchSize?: LlamaContextOptions["batchSize"],
+        microBatchSize?: LlamaContextOptions["microBatchSize"],
         sequences?: number,
         getVramState?(): Promise<{total: number, free: number, unifiedSize: number}>,
         getRamState?(): Promise<{total: number, free: number}>,
@@ -434,12 +440,15 @@ export class GgufInsightsConfigurationResolver {
         return await resolveContextContextSizeOption({
             contextSize,
             batchSize,
+            microBatchSize,
             sequences,
             modelFileInsights: this._ggufInsights,
             modelGpuLayers,
             modelTrainContextSize,
             flashAttention,
             swaFullCache,
+            kvCacheKeyType,
+            kvCacheValueType,
             getVramState,
             getRamState,
             getSwapState,
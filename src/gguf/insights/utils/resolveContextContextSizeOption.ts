@@ -1,4 +1,4 @@
-import {LlamaContextOptions} from "../../../evaluator/LlamaContext/types.js";
+import {LlamaContextKvCacheType, LlamaContextOptions} from "../../../evaluator/LlamaContext/types.js";
 import {GgufInsights} from "../GgufInsights.js";
 import {BuildGpu} from "../../../bindings/types.js";
 import {minAllowedContextSizeInCalculations} from "../../../config.js";
@@ -9,18 +9,21 @@ import {getRamUsageFromUnifiedVram} from "./getRamUsageFromUnifiedVram.js";
 const defaultMaxContextSizeSwapUse = 2048;
 
 export async function resolveContextContextSizeOption({
-    contextSize, batchSize, sequences, modelFileInsights, modelGpuLayers, modelTrainContextSize, flashAttention, swaFullCache,
-    getVramState, getRamState, getSwapState, ignoreMemorySafetyChecks = false, isEmbeddingContext = false,
+    contextSize, batchSize, microBatchSize, sequences, modelFileInsights, modelGpuLayers, modelTrainContextSize, flashAttention, swaFullCache,
+    kvCacheKeyType, kvCacheValueType, getVramState, getRamState, getSwapState, ignoreMemorySafetyChecks = false, isEmbeddingContext = false,
     maxContextSizeSwapUse = defaultMaxContextSizeSwapUse
 }: {
     contextSize?: LlamaContextOptions["contextSize"],
     batchSize?: LlamaContextOptions["batchSize"],
+    microBatchSize?: LlamaContextOptions["microBatchSize"],
     sequences: number,
     modelFileInsights: GgufInsights,
     modelGpuLayers: number,
     modelTrainContextSize: number,
     flashAttention: boolean,
     swaFullCache: boolean,
+    kvCacheKeyType?: LlamaContextKvCacheType,
+    kvCacheValueType?: LlamaContextKvCacheType,
     getVramState(): Promise<{total: number, free: number, unifiedSize: number}>,
     getRamState(): Promise<{total: number, free: number}>,
     getSwapState(): Promise<{total: number, free: number}>,
@@ -50,10 +53,13 @@ export async function resolveContextContextSizeOption({
         const contextResourceRequirements = modelFileInsights.estimateContextResourceRequirements({
             contextSize: resolvedContextSize,
             batchSize: batchSize ?? getDefaultContextBatchSize({contextSize: resolvedContextSize, sequences}),
+            microBatchSize,
             modelGpuLayers: modelGpuLayers,
             sequences,
             flashAttention,
             swaFullCache,
+            kvCacheKeyType,
+            kvCacheValueType,
             isEmbeddingContext
         });
 
@@ -96,10 +102,13 @@ export async function resolveContextContextSizeOption({
             const contextResourceRequirements = modelFileInsights.estimateContextResourceRequirements({
                 contextSize: testContextSize,
                 batchSize: batchSize ?? getDefaultContextBatchSize({contextSize: testContextSize, sequences}),
+                microBatchSize,
                 modelGpuLayers: modelGpuLayers,
                 sequences,
                 flashAttention,
                 swaFullCache,
+                kvCacheKeyType,
+                kvCacheValueType,
                 isEmbeddingContext
             });
 
@@ -145,10 +154,13 @@ export async function resolveContextContextSizeOption({
         const minContextSizeResourceRequirements = modelFileInsights.estimateContextResourceRequirements({
             contextSize: minContextSize,
             batchSize: batchSize ?? getDefaultContextBatchSize({contextSize: minContextSize, sequences}),
+            microBatchSize,
             modelGpuLayers: modelGpuLayers,
             sequences,
             flashAttention,
             swaFullCache,
+            kvCacheKeyType,
+            kvCacheValueType,
             isEmbeddingContext
         });
 
@@ -4,7 +4,7 @@ import {getLlama, type LlamaOptions, type LastBuildOptions} from "./bindings/get
 import {getLlamaGpuTypes} from "./bindings/utils/getLlamaGpuTypes.js";
 import {NoBinaryFoundError} from "./bindings/utils/NoBinaryFoundError.js";
 import {
-    type LlamaGpuType, LlamaLogLevel, LlamaLogLevelGreaterThan, LlamaLogLevelGreaterThanOrEqual, LlamaVocabularyType
+    type LlamaGpuType, type LlamaNuma, LlamaLogLevel, LlamaLogLevelGreaterThan, LlamaLogLevelGreaterThanOrEqual, LlamaVocabularyType
 } from "./bindings/types.js";
 import {resolveModelFile, type ResolveModelFileOptions} from "./utils/resolveModelFile.js";
 import {LlamaModel, LlamaModelInfillTokens, type LlamaModelOptions, LlamaModelTokens} from "./evaluator/LlamaModel/LlamaModel.js";
@@ -14,14 +14,19 @@ import {LlamaJsonSchemaGrammar} from "./evaluator/LlamaJsonSchemaGrammar.js";
 import {LlamaJsonSchemaValidationError} from "./utils/gbnfJson/utils/validateObjectAgainstGbnfSchema.js";
 import {LlamaGrammarEvaluationState, LlamaGrammarEvaluationStateOptions} from "./evaluator/LlamaGrammarEvaluationState.js";
 import {LlamaContext, LlamaContextSequence} from "./evaluator/LlamaContext/LlamaContext.js";
-import {LlamaEmbeddingContext, type LlamaEmbeddingContextOptions} from "./evaluator/LlamaEmbeddingContext.js";
+import {
+    LlamaEmbeddingContext, type LlamaEmbeddingContextOptions, type LlamaEmbeddingFormat, type LlamaEmbeddingVectors
+} from "./evaluator/LlamaEmbeddingContext.js";
 import {LlamaEmbedding, type LlamaEmbeddingOptions, type LlamaEmbeddingJSON} from "./evaluator/LlamaEmbedding.js";
 import {LlamaRankingContext, type LlamaRankingContextOptions} from "./evaluator/LlamaRankingContext.js";
 import {
     type LlamaContextOptions, type SequenceEvaluateOptions, type BatchingOptions, type LlamaContextSequenceRepeatPenalty,
+    type LlamaContextPrefixCacheStats, type LlamaContextSequenceStateSnapshot, type LlamaContextKvCacheType,
+    type LlamaContextSessionStoreStats, type LlamaContextThreadpoolOptions, type LlamaStateFileCompression,
     type CustomBatchingDispatchSchedule, type CustomBatchingPrioritizationStrategy, type BatchItem, type PrioritizedBatchItem,
     type ContextShiftOptions, type ContextTokensDeleteRange, type EvaluationPriority, type SequenceEvaluateMetadataOptions,
-    type SequenceEvaluateOutput, type ControlledEvaluateInputItem, type ControlledEvaluateIndexOutput
+    type SequenceEvaluateOutput, type SequenceGenerateOptions, type SequenceGenerateFinishReason, type ControlledEvaluateInputItem,
+    type ControlledEvaluateIndexOutput
 } from "./evaluator/LlamaContext/types.js";
 import {TokenBias} from "./evaluator/TokenBias.js";
 import {
@@ -124,6 +129,7 @@ export {
     type LlamaOptions,
     type LastBuildOptions,
     type LlamaGpuType,
+    type LlamaNuma,
     type LlamaClasses,
     LlamaLogLevel,
     NoBinaryFoundError,
@@ -154,12 +160,22 @@ export {
     type EvaluationPriority,
     type SequenceEvaluateMetadataOptions,
     type SequenceEvaluateOutput,
+    type SequenceGenerateOptions,
+    type SequenceGenerateFinishReason,
     type LlamaContextSequenceRepeatPenalty,
+    type LlamaContextPrefixCacheStats,
+    type LlamaContextSequenceStateSnapshot,
+    type LlamaContextKvCacheType,
+    type LlamaContextThreadpoolOptions,
+    type LlamaContextSessionStoreStats,
+    type LlamaStateFileCompression,
     type ControlledEvaluateInputItem,
     type ControlledEvaluateIndexOutput,
     TokenBias,
     LlamaEmbeddingContext,
     type LlamaEmbeddingContextOptions,
+    type LlamaEmbeddingFormat,
+    type LlamaEmbeddingVectors,
     LlamaEmbedding,
     type LlamaEmbeddingOptions,
     type LlamaEmbeddingJSON,
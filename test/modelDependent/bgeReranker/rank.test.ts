@@ -181,6 +181,42 @@ describe("bgeReranker", () => {
               ]
             `);
         });
+
+        test("rank all in batches", {timeout: 1000 * 60 * 60 * 2}, async () => {
+            const modelPath = await getModelFile("bge-reranker-v2-m3-Q8_0.gguf");
+            const llama = await getTestLlama();
+
+            const model = await llama.loadModel({
+                modelPath
+            });
+            const rankingContext = await model.createRankingContext({
+                contextSize: 512
+            });
+            const batchedRankingContext = await model.createRankingContext({
+                contextSize: 512,
+                sequences: 4
+            });
+
+            const documents = [
+                "The sky is clear and blue today",
+                "I love eating pizza with extra cheese",
+                "Dogs love to play fetch with their owners",
+                "The capital of France is Paris",
+                "Drinking water is important for staying hydrated",
+                "Mount Everest is the tallest mountain in the world",
+                "A warm cup of tea is perfect for a cold winter day",
+                "Painting is a form of creative expression",
+                "Not all the things that shine are made of gold",
+                "Cleaning the house is a good way to keep it tidy"
+            ];
+
+            const query = "Tell me a geographical fact";
+
+            const ranks = await rankingContext.rankAll(query, documents);
+            const batchedRanks = await batchedRankingContext.rankAll(query, documents);
+
+            expect(simplifyRanks(batchedRanks)).to.eql(simplifyRanks(ranks));
+        });
     });
 });
 
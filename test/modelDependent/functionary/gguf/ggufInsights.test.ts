@@ -386,6 +386,40 @@ describe("gguf", async () => {
               }
             `);
         });
+
+        test("quantized KV cache types reduce the estimated context memory footprint", async () => {
+            const llama = await getTestLlama();
+            const ggufMetadataParseResult = await readGgufFileInfo(modelPath);
+
+            const ggufInsights = await GgufInsights.from(ggufMetadataParseResult, llama);
+            const layers = ggufInsights._getFileLayers();
+
+            const f16KvSize = ggufInsights._estimateKvMemorySizeInBytes(8192, layers);
+            const q8_0KvSize = ggufInsights._estimateKvMemorySizeInBytes(8192, layers, {kvCacheKeyType: "q8_0", kvCacheValueType: "q8_0"});
+            const q4_0KvSize = ggufInsights._estimateKvMemorySizeInBytes(8192, layers, {kvCacheKeyType: "q4_0", kvCacheValueType: "q4_0"});
+
+            // q8_0 uses 34 bytes per 32 elements and q4_0 uses 18 bytes per 32 elements, compared to 64 bytes for f16
+            expect(q8_0KvSize).toBeCloseTo(f16KvSize * 34 / 64);
+            expect(q4_0KvSize).toBeCloseTo(f16KvSize * 18 / 64);
+
+            const f16Estimation = ggufInsights.estimateContextResourceRequirements({
+                contextSize: 8192,
+                modelGpuLayers: 0,
+                sequences: 1,
+                batchSize: 512,
+                flashAttention: true
+            });
+            const q8_0Estimation = ggufInsights.estimateContextResourceRequirements({
+                contextSize: 8192,
+                modelGpuLayers: 0,
+                sequences: 1,
+                batchSize: 512,
+                flashAttention: true,
+                kvCacheKeyType: "q8_0",
+                kvCacheValueType: "q8_0"
+            });
+            expect(f16Estimation.cpuRam - q8_0Estimation.cpuRam).toBeCloseTo(f16KvSize - q8_0KvSize);
+        });
     });
 });
 
@@ -170,5 +170,57 @@ describe("llama 3.1", () => {
               ]
             `);
         });
+
+        test("get logits", {timeout: 1000 * 60 * 60 * 2}, async () => {
+            const modelPath = await getModelFile("Meta-Llama-3.1-8B-Instruct.Q4_K_M.gguf");
+            const llama = await getTestLlama();
+
+            const model = await llama.loadModel({
+                modelPath
+            });
+            const context = await model.createContext({
+                contextSize: 512
+            });
+            const sequence = context.getSequence();
+
+            const inputTokens: ControlledEvaluateInputItem[] = model.tokenize("The quick brown fox jumps over the lazy dog");
+            expect(inputTokens.length).to.be.greaterThan(4);
+
+            inputTokens[2] = [inputTokens[2] as Token, {
+                generateNext: {
+                    logits: true
+                }
+            }];
+            inputTokens[3] = [inputTokens[3] as Token, {
+                generateNext: {
+                    token: true,
+                    logits: true
+                }
+            }];
+
+            const res = await sequence.controlledEvaluate(inputTokens);
+
+            const logitsOnly = res[2]?.next;
+            expect(logitsOnly?.token).to.eql(undefined);
+            expect(logitsOnly?.logits).to.be.instanceOf(Float32Array);
+
+            const withToken = res[3]?.next;
+            const logits = withToken?.logits;
+            expect(logits).to.be.instanceOf(Float32Array);
+            expect(logits!.length).to.eql(logitsOnly!.logits!.length);
+
+            // the default sampling options are greedy, so the sampled token is the one with the highest logit
+            let topToken = 0;
+            for (let i = 1; i < logits!.length; i++) {
+                if (logits![i]! > logits![topToken]!)
+                    topToken = i;
+            }
+            expect(withToken?.token).to.eql(topToken);
+
+            // the copied logits remain valid after evaluating more tokens
+            const logitsCopy = logits!.slice();
+            await sequence.evaluateWithoutGeneratingNewTokens(model.tokenize(" and runs away"));
+            expect(logits).to.eql(logitsCopy);
+        });
     });
 });
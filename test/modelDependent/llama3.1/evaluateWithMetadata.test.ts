@@ -559,6 +559,77 @@ describe("llama 3.1", () => {
 
             expect(probabilityRes).toEqual(confidenceRes);
         });
+
+        test("limiting the probabilities", {timeout: 1000 * 60 * 60 * 2}, async () => {
+            const modelPath = await getModelFile("Meta-Llama-3.1-8B-Instruct.Q4_K_M.gguf");
+            const llama = await getTestLlama();
+
+            const model = await llama.loadModel({
+                modelPath
+            });
+            const context = await model.createContext({
+                contextSize: 512
+            });
+            const sequence = context.getSequence();
+
+            const inputTokens = model.tokenize(text);
+            const maxTokens = 4;
+            const maxProbabilities = 5;
+            const minProbability = 0.01;
+
+            const evaluateProbabilities = async (options: {maxProbabilities?: number, minProbability?: number}) => {
+                await sequence.clearHistory();
+
+                const res: [token: Token, probability: number][][] = [];
+                for await (const output of sequence.evaluateWithMetadata(inputTokens, {probabilities: true, ...options})) {
+                    res.push([...output.probabilities.entries()]);
+
+                    if (res.length >= maxTokens)
+                        break;
+                }
+
+                return res;
+            };
+
+            const fullRes = await evaluateProbabilities({});
+            const limitedRes = await evaluateProbabilities({maxProbabilities});
+            const filteredRes = await evaluateProbabilities({minProbability});
+            const limitedAndFilteredRes = await evaluateProbabilities({maxProbabilities, minProbability});
+
+            const expectProbabilities = (res: [Token, number][], expected: [Token, number][]) => {
+                expect(res.map(([token]) => token)).toEqual(expected.map(([token]) => token));
+                for (let i = 0; i < res.length; i++)
+                    expect(res[i]![1]).toBeCloseTo(expected[i]![1], 6);
+            };
+
+            for (let i = 0; i < maxTokens; i++) {
+                const full = fullRes[i]!;
+                expect(full.length).toBeGreaterThan(maxProbabilities);
+
+                expectProbabilities(limitedRes[i]!, full.slice(0, maxProbabilities));
+                expectProbabilities(filteredRes[i]!, full.filter(([, probability]) => probability >= minProbability));
+                expectProbabilities(
+                    limitedAndFilteredRes[i]!,
+                    full.slice(0, maxProbabilities).filter(([, probability]) => probability >= minProbability)
+                );
+            }
+        });
+
+        test("a negative probabilities limit is rejected", {timeout: 1000 * 60 * 60 * 2}, async () => {
+            const modelPath = await getModelFile("Meta-Llama-3.1-8B-Instruct.Q4_K_M.gguf");
+            const llama = await getTestLlama();
+
+            const model = await llama.loadModel({
+                modelPath
+            });
+            const context = await model.createContext({
+                contextSize: 512
+            });
+            const sequence = context.getSequence();
+
+            const iterator = sequence.evaluateWithMetadata(model.tokenize(text), {probabilities: true, maxProbabilities: -1});
+            await expect(iterator.next()).rejects.toThrowError("The maximum number of probabilities must not be negative");
+        });
     });
 });
 
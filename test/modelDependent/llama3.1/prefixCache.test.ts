@@ -0,0 +1,85 @@
+import {describe, expect, test} from "vitest";
+import {LlamaContextSequence, Token} from "../../../src/index.js";
+import {getModelFile} from "../../utils/modelFiles.js";
+import {getTestLlama} from "../../utils/getTestLlama.js";
+
+describe("llama 3.1", () => {
+    describe("prefix cache", () => {
+        const prefix = "The quick brown fox jumps over the lazy dog, but! the lazy dog is too lazy to care. ";
+        const suffix = "The reason for this is that the lazy dog";
+
+        test("reuses a prefix held by another sequence", {timeout: 1000 * 60 * 60 * 2}, async () => {
+            const modelPath = await getModelFile("Meta-Llama-3.1-8B-Instruct.Q4_K_M.gguf");
+            const llama = await getTestLlama();
+
+            const model = await llama.loadModel({
+                modelPath
+            });
+            const context = await model.createContext({
+                contextSize: 512,
+                sequences: 3,
+                prefixCache: true
+            });
+            const prefixTokens = model.tokenize(prefix);
+            const suffixTokens = model.tokenize(suffix);
+
+            const firstSequence = context.getSequence();
+            const firstRes = await generateTokens(firstSequence, [...prefixTokens, ...suffixTokens], 8);
+            expect(context.prefixCacheStats).to.eql({
+                lookups: 1,
+                hits: 0,
+                hitRate: 0,
+                savedTokens: 0,
+                evictedTokens: 0,
+                evictedBytes: 0,
+                truncatedTokens: 0
+            });
+
+            const secondSequence = context.getSequence();
+            const secondRes = await generateTokens(secondSequence, [...prefixTokens, ...suffixTokens], 8);
+
+            expect(secondRes).to.eql(firstRes);
+            expect(secondSequence.tokenMeter.usedInputTokens).to.be.lessThan(prefixTokens.length);
+
+            const stats = context.prefixCacheStats!;
+            expect(stats.lookups).to.eql(2);
+            expect(stats.hits).to.eql(1);
+            expect(stats.hitRate).to.eql(0.5);
+            expect(stats.savedTokens).to.eql(prefixTokens.length + suffixTokens.length - 1);
+
+            firstSequence.dispose();
+            secondSequence.dispose();
+
+            const statsAfterDispose = context.prefixCacheStats!;
+            expect(statsAfterDispose.evictedTokens).to.be.greaterThan(0);
+            expect(statsAfterDispose.evictedBytes).to.be.greaterThan(0);
+        });
+
+        test("disabled by default", {timeout: 1000 * 60 * 60 * 2}, async () => {
+            const modelPath = await getModelFile("Meta-Llama-3.1-8B-Instruct.Q4_K_M.gguf");
+            const llama = await getTestLlama();
+
+            const model = await llama.loadModel({
+                modelPath
+            });
+            const context = await model.createContext({
+                contextSize: 512
+            });
+
+            expect(context.prefixCacheStats).to.eql(undefined);
+        });
+    });
+});
+
+async function generateTokens(sequence: LlamaContextSequence, input: Token[], maxTokens: number) {
+    const res: Token[] = [];
+
+    for await (const token of sequence.evaluate(input)) {
+        res.push(token);
+
+        if (res.length >= maxTokens)
+            break;
+    }
+
+    return res;
+}
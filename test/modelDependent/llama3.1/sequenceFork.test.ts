@@ -0,0 +1,78 @@
+import {describe, expect, test} from "vitest";
+import {LlamaContextSequence, Token} from "../../../src/index.js";
+import {getModelFile} from "../../utils/modelFiles.js";
+import {getTestLlama} from "../../utils/getTestLlama.js";
+
+describe("llama 3.1", () => {
+    describe("sequence fork", () => {
+        const prefix = "The quick brown fox jumps over the lazy dog, but! the lazy dog is too lazy to care. ";
+        const suffix = "The reason for this is that the lazy dog";
+
+        test("forked sequence continues from the shared prefix", {timeout: 1000 * 60 * 60 * 2}, async () => {
+            const modelPath = await getModelFile("Meta-Llama-3.1-8B-Instruct.Q4_K_M.gguf");
+            const llama = await getTestLlama();
+
+            const model = await llama.loadModel({
+                modelPath
+            });
+            const context = await model.createContext({
+                contextSize: 512,
+                sequences: 3
+            });
+            const prefixTokens = model.tokenize(prefix);
+            const suffixTokens = model.tokenize(suffix);
+
+            const baseSequence = context.getSequence();
+            await baseSequence.evaluateWithoutGeneratingNewTokens(prefixTokens);
+
+            const forkedSequence = await baseSequence.fork();
+            expect(forkedSequence.contextTokens).to.eql(baseSequence.contextTokens);
+            expect(forkedSequence.nextTokenIndex).to.eql(prefixTokens.length);
+            expect(forkedSequence.tokenMeter.usedInputTokens).to.eql(0);
+
+            const freshSequence = context.getSequence();
+
+            const forkedRes = await generateTokens(forkedSequence, suffixTokens, 8);
+            const freshRes = await generateTokens(freshSequence, [...prefixTokens, ...suffixTokens], 8);
+
+            expect(forkedRes).to.eql(freshRes);
+            expect(baseSequence.contextTokens).to.eql(prefixTokens);
+        });
+
+        test("fork a partial prefix", {timeout: 1000 * 60 * 60 * 2}, async () => {
+            const modelPath = await getModelFile("Meta-Llama-3.1-8B-Instruct.Q4_K_M.gguf");
+            const llama = await getTestLlama();
+
+            const model = await llama.loadModel({
+                modelPath
+            });
+            const context = await model.createContext({
+                contextSize: 512,
+                sequences: 2
+            });
+            const prefixTokens = model.tokenize(prefix);
+            const suffixTokens = model.tokenize(suffix);
+
+            const baseSequence = context.getSequence();
+            await baseSequence.evaluateWithoutGeneratingNewTokens([...prefixTokens, ...suffixTokens]);
+
+            const forkedSequence = await baseSequence.fork({prefixLength: prefixTokens.length});
+            expect(forkedSequence.contextTokens).to.eql(prefixTokens);
+
+            await expect(baseSequence.fork()).rejects.toThrow("No sequences left");
+        });
+    });
+});
+
+async function generateTokens(sequence: LlamaContextSequence, input: Token[], maxTokens: number) {
+    const res: Token[] = [];
+
+    for await (const token of sequence.evaluate(input)) {
+        res.push(token);
+
+        if (res.length >= maxTokens)
+            break;
+    }
+
+    return res;
+}
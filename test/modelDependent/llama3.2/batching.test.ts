@@ -0,0 +1,447 @@
+import {describe, expect, test} from "vitest";
+import {getModelFile} from "../../utils/modelFiles.js";
+import {getTestLlama} from "../../utils/getTestLlama.js";
+import {LlamaContextSequence, LlamaGrammarEvaluationState, Token, TokenBias} from "../../../src/index.js";
+
+describe("llama 3.2", () => {
+    describe("batching", () => {
+        test("the native batch is reused across decode cycles", {timeout: 1000 * 60 * 60 * 2}, async () => {
+            const modelPath = await getModelFile("Llama-3.2-3B-Instruct.Q4_K_M.gguf");
+            const llama = await getTestLlama();
+
+            const model = await llama.loadModel({
+                modelPath
+            });
+            const context = await model.createContext({
+                contextSize: 512,
+                sequences: 2
+            });
+            const sequence1 = context.getSequence();
+            const sequence2 = context.getSequence();
+
+            const generateTokens = async (sequence: typeof sequence1, text: string, maxTokens: number) => {
+                let generatedTokens = 0;
+                for await (const token of sequence.evaluate(model.tokenize(text))) {
+                    void token;
+                    generatedTokens++;
+
+                    if (generatedTokens >= maxTokens)
+                        break;
+                }
+            };
+
+            await Promise.all([
+                generateTokens(sequence1, "The quick brown fox", 4),
+                generateTokens(sequence2, "Once upon a time", 4)
+            ]);
+
+            const allocationsAfterWarmup = context._ctx.getBatchAllocations();
+            expect(allocationsAfterWarmup).to.be.greaterThan(0);
+
+            await Promise.all([
+                generateTokens(sequence1, " jumps over", 16),
+                generateTokens(sequence2, " there was", 16)
+            ]);
+
+            expect(context._ctx.getBatchAllocations()).to.eql(allocationsAfterWarmup);
+
+            await context.dispose();
+            await model.dispose();
+        });
+
+        test("parallel sequences predict the same next token as when evaluated alone", {timeout: 1000 * 60 * 60 * 2}, async () => {
+            const modelPath = await getModelFile("Llama-3.2-3B-Instruct.Q4_K_M.gguf");
+            const llama = await getTestLlama();
+
+            const model = await llama.loadModel({
+                modelPath
+            });
+            const context = await model.createContext({
+                contextSize: 1024,
+                sequences: 4
+            });
+            const texts = ["The quick brown fox", "Once upon a time", "The capital of France is", "1, 2, 3, 4,"];
+
+            const getNextTokenProbabilities = async (sequence: ReturnType<typeof context.getSequence>, text: string) => {
+                const evaluation = sequence.evaluateWithMetadata(model.tokenize(text), {probabilities: true, maxProbabilities: 10});
+                for await (const {probabilities} of evaluation)
+                    return probabilities;
+
+                throw new Error("No token was generated");
+            };
+
+            const sequences = texts.map(() => context.getSequence());
+            const parallelResults = await Promise.all(
+                texts.map((text, index) => getNextTokenProbabilities(sequences[index]!, text))
+            );
+
+            // the logits can differ slightly between batch shapes, so only a misplaced token in the batch would change the distribution
+            for (let i = 0; i < texts.length; i++) {
+                await sequences[i]!.clearHistory();
+                const aloneProbabilities = await getNextTokenProbabilities(sequences[i]!, texts[i]!);
+                const parallelProbabilities = parallelResults[i]!;
+
+                const [topToken, topProbability] = [...aloneProbabilities.entries()][0]!;
+                const [, secondProbability = 0] = [...aloneProbabilities.entries()][1] ?? [];
+                if (topProbability - secondProbability > 0.05)
+                    expect([...parallelProbabilities.keys()][0]).to.eql(topToken);
+
+                for (const [token, probability] of [...aloneProbabilities.entries()].slice(0, 5))
+                    expect(Math.abs((parallelProbabilities.get(token) ?? 0) - probability)).to.be.lessThan(0.02);
+            }
+
+            await context.dispose();
+            await model.dispose();
+        });
+
+        test("sampling during the batch decode selects the same tokens as sampling after it", {timeout: 1000 * 60 * 60 * 2}, async () => {
+            const modelPath = await getModelFile("Llama-3.2-3B-Instruct.Q4_K_M.gguf");
+            const llama = await getTestLlama();
+
+            const model = await llama.loadModel({
+                modelPath
+            });
+            const context = await model.createContext({
+                contextSize: 512,
+                sequences: 1
+            });
+            const sequence = context.getSequence();
+            const promptTokens = model.tokenize("Once upon a time");
+
+            // `evaluate` samples as part of the batch decode, while requesting the confidence samples after the decode
+            const generateFusedTokens = async (options: Parameters<typeof sequence.evaluate>[1]) => {
+                await sequence.clearHistory();
+
+                const res: Token[] = [];
+                for await (const token of sequence.evaluate(promptTokens, options)) {
+                    res.push(token);
+
+                    if (res.length >= 8)
+                        break;
+                }
+
+                return res;
+            };
+            const generateTwoStepTokens = async (options: Parameters<typeof sequence.evaluate>[1]) => {
+                await sequence.clearHistory();
+
+                const res: Token[] = [];
+                for await (const {token} of sequence.evaluateWithMetadata(promptTokens, {confidence: true}, options)) {
+                    res.push(token);
+
+                    if (res.length >= 8)
+                        break;
+                }
+
+                return res;
+            };
+
+            const optionsList: Parameters<typeof sequence.evaluate>[1][] = [
+                {},
+                {temperature: 0.8, topK: 40, topP: 0.9, seed: 1234},
+                {temperature: 0.8, seed: 5678, repeatPenalty: {punishTokens: () => sequence.contextTokens.slice(-16), penalty: 1.3}},
+                {tokenBias: () => new TokenBias(model.tokenizer).set(" there", "never")}
+            ];
+
+            for (const options of optionsList) {
+                const fusedTokens = await generateFusedTokens(options);
+                expect(fusedTokens.length).to.eql(8);
+                expect(await generateTwoStepTokens(options)).to.eql(fusedTokens);
+            }
+
+            await context.dispose();
+            await model.dispose();
+        });
+
+        test("parallel sequences can share a grammar evaluation state", {timeout: 1000 * 60 * 60 * 2}, async () => {
+            const modelPath = await getModelFile("Llama-3.2-3B-Instruct.Q4_K_M.gguf");
+            const llama = await getTestLlama();
+
+            const model = await llama.loadModel({
+                modelPath
+            });
+            const context = await model.createContext({
+                contextSize: 512,
+                sequences: 2
+            });
+            const grammar = await llama.createGrammar({
+                grammar: "root ::= [0-9]+"
+            });
+            const grammarEvaluationState = new LlamaGrammarEvaluationState({model, grammar});
+
+            const generateTokens = async (sequence: ReturnType<typeof context.getSequence>, text: string) => {
+                const res: Token[] = [];
+                for await (const token of sequence.evaluate(model.tokenize(text), {grammarEvaluationState})) {
+                    res.push(token);
+
+                    if (res.length >= 8)
+                        break;
+                }
+
+                return res;
+            };
+
+            // the samplers of both sequences are sampled in the same batch, and have to be grouped together by their grammar state
+            const results = await Promise.all([
+                generateTokens(context.getSequence(), "The year the first moon landing happened was"),
+                generateTokens(context.getSequence(), "The number of days in a leap year is")
+            ]);
+
+            for (const tokens of results) {
+                expect(tokens.length).to.eql(8);
+                expect(model.detokenize(tokens)).to.match(/^[0-9]+$/);
+            }
+
+            await context.dispose();
+            await model.dispose();
+        });
+
+        test("the native scheduler generates the same tokens as the JS evaluation", {timeout: 1000 * 60 * 60 * 2}, async () => {
+            const model = await loadTestModel();
+            const jsContext = await model.createContext({
+                contextSize: 512,
+                sequences: 1
+            });
+            const nativeContext = await model.createContext({
+                contextSize: 512,
+                sequences: 3,
+                nativeScheduler: true
+            });
+            const texts = ["The quick brown fox", "Once upon a time", "The capital of France is"];
+
+            const jsSequence = jsContext.getSequence();
+            const expectedResults: Token[][] = [];
+            for (const text of texts) {
+                await jsSequence.clearHistory();
+                expectedResults.push((await generateTokens(jsSequence, model.tokenize(text), {maxTokens: 8})).tokens);
+            }
+
+            const nativeSequences = texts.map(() => nativeContext.getSequence());
+            const nativeResults = await Promise.all(
+                texts.map(async (text, index) => (
+                    (await generateTokens(nativeSequences[index]!, model.tokenize(text), {maxTokens: 8})).tokens
+                ))
+            );
+
+            expect(nativeResults).to.eql(expectedResults);
+            for (let i = 0; i < texts.length; i++) {
+                expect(nativeResults[i]!.length).to.eql(8);
+                expect(nativeSequences[i]!.contextTokens).to.eql(
+                    model.tokenize(texts[i]!).concat(nativeResults[i]!.slice(0, -1))
+                );
+            }
+
+            await nativeContext.dispose();
+            await jsContext.dispose();
+            await model.dispose();
+        });
+
+        test("the native scheduler stops on stop sequences", {timeout: 1000 * 60 * 60 * 2}, async () => {
+            const model = await loadTestModel();
+            const context = await model.createContext({
+                contextSize: 512,
+                sequences: 1,
+                nativeScheduler: true
+            });
+            const sequence = context.getSequence();
+            const promptTokens = model.tokenize("The quick brown fox");
+
+            const fullResult = await generateTokens(sequence, promptTokens, {maxTokens: 8});
+            expect(fullResult.tokens.length).to.eql(8);
+            expect(fullResult.finishReason).to.eql("maxTokens");
+
+            await sequence.clearHistory();
+            const stoppedResult = await generateTokens(sequence, promptTokens, {
+                maxTokens: 8,
+                stopSequences: [fullResult.tokens.slice(3, 5)]
+            });
+            expect(stoppedResult.tokens).to.eql(fullResult.tokens.slice(0, 5));
+            expect(stoppedResult.finishReason).to.eql("stopSequence");
+
+            await context.dispose();
+            await model.dispose();
+        });
+
+        test("the native scheduler updates the context tokens as the tokens are generated", {timeout: 1000 * 60 * 60 * 2}, async () => {
+            const model = await loadTestModel();
+            const context = await model.createContext({
+                contextSize: 512,
+                sequences: 1,
+                nativeScheduler: true
+            });
+            const sequence = context.getSequence();
+            const promptTokens = model.tokenize("The quick brown fox");
+
+            const generatedTokens: Token[] = [];
+            for await (const token of sequence.generate(promptTokens, {maxTokens: 16})) {
+                // the prompt and all the previously generated tokens were evaluated to generate this token
+                expect(sequence.nextTokenIndex).to.be.greaterThanOrEqual(promptTokens.length + generatedTokens.length);
+                expect(sequence.contextTokens.slice(0, promptTokens.length + generatedTokens.length)).to.eql(
+                    promptTokens.concat(generatedTokens)
+                );
+
+                generatedTokens.push(token);
+            }
+
+            expect(generatedTokens.length).to.eql(16);
+            expect(sequence.contextTokens).to.eql(promptTokens.concat(generatedTokens.slice(0, -1)));
+
+            await context.dispose();
+            await model.dispose();
+        });
+
+        test("the native scheduler keeps generating while another sequence is modified", {timeout: 1000 * 60 * 60 * 2}, async () => {
+            const model = await loadTestModel();
+            const context = await model.createContext({
+                contextSize: 512,
+                sequences: 2,
+                nativeScheduler: true
+            });
+            const generatedSequence = context.getSequence();
+            const modifiedSequence = context.getSequence();
+            const promptTokens = model.tokenize("The quick brown fox");
+            const otherTokens = model.tokenize("Once upon a time, in a land far away");
+
+            let modifyingDone = false;
+            const modifySequence = async () => {
+                for (let i = 0; i < 8; i++) {
+                    await modifiedSequence.evaluateWithoutGeneratingNewTokens(otherTokens);
+                    await modifiedSequence.eraseContextTokenRanges([{start: 2, end: modifiedSequence.nextTokenIndex}]);
+                    await modifiedSequence.clearHistory();
+                }
+
+                modifyingDone = true;
+            };
+
+            const [generatedResult] = await Promise.all([
+                generateTokens(generatedSequence, promptTokens, {maxTokens: 16}),
+                modifySequence()
+            ]);
+            const generatedTokens = generatedResult.tokens;
+
+            // the exact tokens aren't compared with a generation without the other sequence,
+            // since the different placement of the cells can slightly change the logits
+            expect(modifyingDone).to.eql(true);
+            expect(generatedTokens.length).to.eql(16);
+            expect(generatedSequence.contextTokens).to.eql(promptTokens.concat(generatedTokens.slice(0, -1)));
+            expect(modifiedSequence.contextTokens).to.eql([]);
+
+            await modifiedSequence.evaluateWithoutGeneratingNewTokens(otherTokens);
+            expect(modifiedSequence.contextTokens).to.eql(otherTokens);
+
+            await context.dispose();
+            await model.dispose();
+        });
+
+        test("speculative generation with a draft sequence generates the same tokens", {timeout: 1000 * 60 * 60 * 2}, async () => {
+            const model = await loadTestModel();
+            const context = await model.createContext({
+                contextSize: 512,
+                sequences: 1
+            });
+            const draftContext = await model.createContext({
+                contextSize: 512,
+                sequences: 1
+            });
+            const sequence = context.getSequence();
+            const draftSequence = draftContext.getSequence();
+            const promptTokens = model.tokenize("The quick brown fox");
+
+            const expectedResult = await generateTokens(sequence, promptTokens, {maxTokens: 16});
+            expect(expectedResult.tokens.length).to.eql(16);
+
+            await sequence.clearHistory();
+            const speculativeResult = await generateTokens(sequence, promptTokens, {maxTokens: 16, draftSequence, draftTokens: 4});
+            expect(speculativeResult).to.eql(expectedResult);
+            expect(sequence.contextTokens).to.eql(promptTokens.concat(expectedResult.tokens.slice(0, -1)));
+
+            // the draft model is the same as the target model, so the greedy drafts are accepted
+            expect(sequence.tokenPredictions.validated).to.be.greaterThan(0);
+
+            await draftContext.dispose();
+            await context.dispose();
+            await model.dispose();
+        });
+
+        test("speculative generation with n-gram drafting generates the same tokens", {timeout: 1000 * 60 * 60 * 2}, async () => {
+            const model = await loadTestModel();
+            const context = await model.createContext({
+                contextSize: 512,
+                sequences: 1
+            });
+            const sequence = context.getSequence();
+            const promptTokens = model.tokenize(
+                "The quick brown fox jumps over the lazy dog. The quick brown fox jumps over the lazy dog. The quick brown fox"
+            );
+
+            const expectedResult = await generateTokens(sequence, promptTokens, {maxTokens: 16});
+            expect(expectedResult.tokens.length).to.eql(16);
+
+            await sequence.clearHistory();
+            const speculativeResult = await generateTokens(sequence, promptTokens, {maxTokens: 16, ngramDrafting: true});
+            expect(speculativeResult).to.eql(expectedResult);
+            expect(sequence.contextTokens).to.eql(promptTokens.concat(expectedResult.tokens.slice(0, -1)));
+
+            // the prompt repeats itself, so the drafts copied from it are accepted
+            expect(sequence.tokenPredictions.validated).to.be.greaterThan(0);
+
+            await context.dispose();
+            await model.dispose();
+        });
+
+        test("speculative generation with an n-gram draft tree generates the same tokens", {timeout: 1000 * 60 * 60 * 2}, async () => {
+            const model = await loadTestModel();
+            const context = await model.createContext({
+                contextSize: 512,
+                sequences: 3,
+                unifiedKvCache: true
+            });
+            const sequence = context.getSequence();
+            const promptTokens = model.tokenize(
+                "The quick brown fox runs across the green field. The quick brown fox jumps over the lazy dog. " +
+                "The quick brown fox jumps over the lazy dog. The quick brown fox"
+            );
+
+            const expectedResult = await generateTokens(sequence, promptTokens, {maxTokens: 16});
+            expect(expectedResult.tokens.length).to.eql(16);
+
+            await sequence.clearHistory();
+            const speculativeResult = await generateTokens(sequence, promptTokens, {maxTokens: 16, ngramDrafting: {branches: 3}});
+            expect(speculativeResult).to.eql(expectedResult);
+            expect(sequence.contextTokens).to.eql(promptTokens.concat(expectedResult.tokens.slice(0, -1)));
+            expect(sequence.tokenPredictions.validated).to.be.greaterThan(0);
+
+            // the prompt continues "The quick brown fox" in two different ways
+            expect(sequence.tokenPredictions.maxVerifiedBranches).to.be.greaterThan(1);
+
+            await context.dispose();
+            await model.dispose();
+        });
+    });
+});
+
+async function loadTestModel() {
+    const modelPath = await getModelFile("Llama-3.2-3B-Instruct.Q4_K_M.gguf");
+    const llama = await getTestLlama();
+
+    return await llama.loadModel({
+        modelPath
+    });
+}
+
+async function generateTokens(
+    sequence: LlamaContextSequence,
+    tokens: Token[],
+    options: Parameters<LlamaContextSequence["generate"]>[1]
+) {
+    const iterator = sequence.generate(tokens, options);
+    const res: Token[] = [];
+
+    while (true) {
+        const {value, done} = await iterator.next();
+        if (done)
+            return {tokens: res, finishReason: value};
+
+        res.push(value);
+    }
+}
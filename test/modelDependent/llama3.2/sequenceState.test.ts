@@ -1,4 +1,4 @@
-import {describe, expect, test} from "vitest";
+import {describe, expect, test, vi} from "vitest";
 import fs from "fs-extra";
 import {LlamaChatSession, TokenMeter} from "../../../src/index.js";
 import {getModelFile} from "../../utils/modelFiles.js";
@@ -294,6 +294,302 @@ describe("llama 3.2", () => {
 
                 expect(contextSequence2.contextTokens).to.eql([]);
             });
+
+            test("loading a state reports progress and can be aborted", {timeout: 1000 * 60 * 60 * 2}, async (test) => {
+                const modelPath = await getModelFile("Llama-3.2-3B-Instruct.Q4_K_M.gguf");
+                const llama = await getTestLlama();
+
+                const model = await llama.loadModel({
+                    modelPath
+                });
+                const context = await model.createContext({
+                    contextSize: 1024
+                });
+                const contextSequence = context.getSequence();
+
+                await contextSequence.evaluateWithoutGeneratingNewTokens(model.tokenize("The quick brown fox jumps over the lazy dog"));
+                const stateTokens = contextSequence.contextTokens.slice();
+
+                const stateFilePath = await getTempTestFilePath("state");
+                await contextSequence.saveStateToFile(stateFilePath);
+                test.onTestFinished(() => fs.remove(stateFilePath));
+
+                for (const useMmap of [true, false]) {
+                    const progress: number[] = [];
+                    await contextSequence.loadStateFromFile(stateFilePath, {
+                        acceptRisk: true,
+                        useMmap,
+                        onProgress(value) {
+                            progress.push(value);
+                        }
+                    });
+
+                    expect(contextSequence.contextTokens).to.eql(stateTokens);
+                    expect(progress.length).to.be.greaterThan(0);
+                    expect(progress.at(-1)).to.eql(1);
+                    expect(progress.slice().sort((a, b) => a - b)).to.eql(progress);
+                }
+
+                const abortController = new AbortController();
+                abortController.abort(new Error("aborted"));
+
+                try {
+                    await contextSequence.loadStateFromFile(stateFilePath, {
+                        acceptRisk: true,
+                        signal: abortController.signal
+                    });
+                    expect.unreachable("Should have thrown an error");
+                } catch (err) {
+                    expect(err).toMatchInlineSnapshot("[Error: aborted]");
+                }
+
+                expect(contextSequence.contextTokens).to.eql(stateTokens);
+            });
+
+            test("aborting a state load midway leaves the sequence untouched", {timeout: 1000 * 60 * 60 * 2}, async (test) => {
+                const modelPath = await getModelFile("Llama-3.2-3B-Instruct.Q4_K_M.gguf");
+                const llama = await getTestLlama();
+
+                const model = await llama.loadModel({
+                    modelPath
+                });
+                const context = await model.createContext({
+                    contextSize: 4096
+                });
+                const contextSequence = context.getSequence();
+
+                // a state large enough to be loaded in many chunks
+                await contextSequence.evaluateWithoutGeneratingNewTokens(
+                    model.tokenize("The quick brown fox jumps over the lazy dog. ".repeat(300))
+                );
+
+                const stateFilePaths: string[] = [await getTempTestFilePath("state")];
+                await contextSequence.saveStateToFile(stateFilePaths[0]!);
+                test.onTestFinished(() => fs.remove(stateFilePaths[0]!));
+
+                for (const compression of llama.supportedStateFileCompressions) {
+                    const stateFilePath = await getTempTestFilePath("state-" + compression);
+                    await contextSequence.saveStateToFile(stateFilePath, {compression});
+                    test.onTestFinished(() => fs.remove(stateFilePath));
+                    stateFilePaths.push(stateFilePath);
+                }
+
+                await contextSequence.clearHistory();
+                await contextSequence.evaluateWithoutGeneratingNewTokens(model.tokenize("Locks are not doors"));
+                const currentTokens = contextSequence.contextTokens.slice();
+
+                for (const stateFilePath of stateFilePaths) {
+                    for (const useMmap of [true, false]) {
+                        const abortController = new AbortController();
+                        const progress: number[] = [];
+
+                        try {
+                            await contextSequence.loadStateFromFile(stateFilePath, {
+                                acceptRisk: true,
+                                useMmap,
+                                signal: abortController.signal,
+                                onProgress(value) {
+                                    progress.push(value);
+                                    abortController.abort(new Error("aborted"));
+                                }
+                            });
+                            expect.unreachable("Should have thrown an error");
+                        } catch (err) {
+                            expect(err).toMatchInlineSnapshot("[Error: aborted]");
+                        }
+
+                        expect(progress.length).to.be.greaterThan(0);
+                        expect(progress.at(-1)).to.be.lessThan(1);
+                        expect(contextSequence.contextTokens).to.eql(currentTokens);
+                    }
+                }
+
+                const continuationTokens = model.tokenize(", and keys are not windows");
+                await contextSequence.evaluateWithoutGeneratingNewTokens(continuationTokens);
+                expect(contextSequence.contextTokens).to.eql([...currentTokens, ...continuationTokens]);
+            });
+
+            test("save and load a compressed state works properly", {timeout: 1000 * 60 * 60 * 2}, async (test) => {
+                const llama = await getTestLlama();
+                if (llama.supportedStateFileCompressions.length === 0)
+                    return test.skip();
+
+                const modelPath = await getModelFile("Llama-3.2-3B-Instruct.Q4_K_M.gguf");
+                const model = await llama.loadModel({
+                    modelPath
+                });
+                const context = await model.createContext({
+                    contextSize: 1024
+                });
+                const contextSequence = context.getSequence();
+
+                const chatSession = new LlamaChatSession({
+                    contextSequence
+                });
+                await chatSession.prompt("Remember: locks are not doors", {maxTokens: 4});
+
+                const stateTokens = contextSequence.contextTokens.slice();
+                const uncompressedStateFilePath = await getTempTestFilePath("state");
+                const {fileSize: uncompressedFileSize} = await contextSequence.saveStateToFile(uncompressedStateFilePath);
+                test.onTestFinished(() => fs.remove(uncompressedStateFilePath));
+
+                for (const compression of llama.supportedStateFileCompressions) {
+                    const stateFilePath = await getTempTestFilePath("state-" + compression);
+                    const {fileSize} = await contextSequence.saveStateToFile(stateFilePath, {compression});
+                    test.onTestFinished(() => fs.remove(stateFilePath));
+
+                    expect(fileSize).to.be.lessThan(uncompressedFileSize);
+
+                    await contextSequence.clearHistory();
+                    expect(contextSequence.contextTokens).to.eql([]);
+
+                    await contextSequence.loadStateFromFile(stateFilePath, {acceptRisk: true});
+                    expect(contextSequence.contextTokens).to.eql(stateTokens);
+                }
+            });
+
+            test("save and load a state in memory works properly", {timeout: 1000 * 60 * 60 * 2}, async () => {
+                const modelPath = await getModelFile("Llama-3.2-3B-Instruct.Q4_K_M.gguf");
+                const llama = await getTestLlama();
+
+                const model = await llama.loadModel({
+                    modelPath
+                });
+                const context = await model.createContext({
+                    contextSize: 1024
+                });
+                const contextSequence = context.getSequence();
+
+                const chatSession1 = new LlamaChatSession({
+                    contextSequence
+                });
+
+                const res1 = await chatSession1.prompt("Remember: locks are not doors", {maxTokens: 4});
+                expect(res1).to.toMatchInlineSnapshot("\"That's a clever\"");
+
+                const stateTokens = contextSequence.contextTokens.slice();
+                const snapshot = await contextSequence.saveStateToMemory();
+
+                expect(snapshot.tokens).to.eql(stateTokens);
+                expect(snapshot.state.byteLength).to.be.greaterThan(0);
+
+                await contextSequence.clearHistory();
+                expect(contextSequence.contextTokens).to.eql([]);
+                const tokenMeterState = contextSequence.tokenMeter.getState();
+
+                await contextSequence.loadStateFromMemory(snapshot, {acceptRisk: true});
+                expect(contextSequence.contextTokens).to.eql(stateTokens);
+                expect(TokenMeter.diff(contextSequence.tokenMeter.getState(), tokenMeterState)).to.eql({
+                    usedInputTokens: 0,
+                    usedOutputTokens: 0
+                });
+
+                const chatSession2 = new LlamaChatSession({
+                    contextSequence
+                });
+                chatSession2.setChatHistory(chatSession1.getChatHistory());
+                const res2 = await chatSession2.prompt("What did I tell you to remember?", {maxTokens: 12});
+                const res2TokenMeterDiff = TokenMeter.diff(contextSequence.tokenMeter.getState(), tokenMeterState);
+
+                expect(res2).to.toMatchInlineSnapshot('"You told me to remember that "locks are not doors"."');
+                expect(res2TokenMeterDiff.usedInputTokens).to.be.lessThan(stateTokens.length);
+            });
+
+            test("save and load a state using the session store works properly", {timeout: 1000 * 60 * 60 * 2}, async (test) => {
+                const modelPath = await getModelFile("Llama-3.2-3B-Instruct.Q4_K_M.gguf");
+                const llama = await getTestLlama();
+
+                const sessionStoreDirectory = await getTempTestFilePath("sessionStore");
+                test.onTestFinished(() => fs.remove(sessionStoreDirectory));
+
+                const model = await llama.loadModel({
+                    modelPath
+                });
+                const context = await model.createContext({
+                    contextSize: 1024,
+                    sessionStore: {
+                        memorySize: 1, // spill every snapshot to the disk
+                        directory: sessionStoreDirectory
+                    }
+                });
+                const contextSequence = context.getSequence();
+
+                const chatSession1 = new LlamaChatSession({
+                    contextSequence
+                });
+
+                const res1 = await chatSession1.prompt("Remember: locks are not doors", {maxTokens: 4});
+                expect(res1).to.toMatchInlineSnapshot("\"That's a clever\"");
+
+                const stateTokens = contextSequence.contextTokens.slice();
+                await contextSequence.saveStateToSessionStore("session1");
+
+                expect(context.hasSessionState("session1")).to.eql(true);
+                expect(context.sessionStoreStats).toMatchObject({
+                    entries: 1,
+                    memoryEntries: 0,
+                    diskEntries: 1,
+                    memorySize: 0
+                });
+
+                // the snapshot is written to the disk in the background
+                await vi.waitFor(() => expect(context.sessionStoreStats.spills).to.eql(1));
+                expect(await fs.readdir(sessionStoreDirectory)).to.have.length(1);
+
+                await contextSequence.clearHistory();
+                const tokenMeterState = contextSequence.tokenMeter.getState();
+
+                expect(await contextSequence.loadStateFromSessionStore("session1")).to.eql(true);
+                expect(contextSequence.contextTokens).to.eql(stateTokens);
+                expect(context.sessionStoreStats).toMatchObject({
+                    diskHits: 1,
+                    misses: 0
+                });
+
+                const chatSession2 = new LlamaChatSession({
+                    contextSequence
+                });
+                chatSession2.setChatHistory(chatSession1.getChatHistory());
+                const res2 = await chatSession2.prompt("What did I tell you to remember?", {maxTokens: 12});
+
+                expect(res2).to.toMatchInlineSnapshot('"You told me to remember that "locks are not doors"."');
+                expect(TokenMeter.diff(contextSequence.tokenMeter.getState(), tokenMeterState).usedInputTokens)
+                    .to.be.lessThan(stateTokens.length);
+
+                const contextTokensBeforeMiss = contextSequence.contextTokens.slice();
+                expect(context.deleteSessionState("session1")).to.eql(true);
+                expect(await contextSequence.loadStateFromSessionStore("session1")).to.eql(false);
+                expect(contextSequence.contextTokens).to.eql(contextTokensBeforeMiss);
+                expect(await fs.readdir(sessionStoreDirectory)).to.have.length(0);
+            });
+
+            test("session store evicts snapshots that exceed the budgets", {timeout: 1000 * 60 * 60 * 2}, async () => {
+                const modelPath = await getModelFile("Llama-3.2-3B-Instruct.Q4_K_M.gguf");
+                const llama = await getTestLlama();
+
+                const model = await llama.loadModel({
+                    modelPath
+                });
+                const context = await model.createContext({
+                    contextSize: 1024,
+                    sessionStore: {
+                        memorySize: 1
+                    }
+                });
+                const contextSequence = context.getSequence();
+
+                const tokens = model.tokenize("The quick brown fox jumps over the lazy dog");
+                await contextSequence.evaluateWithoutGeneratingNewTokens(tokens);
+                await contextSequence.saveStateToSessionStore("session1");
+
+                expect(context.hasSessionState("session1")).to.eql(false);
+                expect(context.sessionStoreStats).toMatchObject({
+                    entries: 0,
+                    evictions: 1
+                });
+                expect(await contextSequence.loadStateFromSessionStore("session1")).to.eql(false);
+                expect(contextSequence.contextTokens).to.eql(tokens);
+            });
         });
     });
 });
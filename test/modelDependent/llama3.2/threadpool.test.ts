@@ -0,0 +1,69 @@
+import {describe, expect, test} from "vitest";
+import {LlamaContextThreadpoolOptions, Token} from "../../../src/index.js";
+import {getModelFile} from "../../utils/modelFiles.js";
+import {getTestLlama} from "../../utils/getTestLlama.js";
+
+describe("llama 3.2", () => {
+    describe("threadpool", () => {
+        test("a context with dedicated threadpools generates the same tokens", {timeout: 1000 * 60 * 60 * 2}, async () => {
+            const modelPath = await getModelFile("Llama-3.2-3B-Instruct.Q4_K_M.gguf");
+            const llama = await getTestLlama();
+
+            const model = await llama.loadModel({
+                modelPath
+            });
+            const context = await model.createContext({
+                contextSize: 512
+            });
+            const threadpoolContext = await model.createContext({
+                contextSize: 512,
+                threadpool: {
+                    priority: "low",
+                    poll: 0,
+                    batch: {
+                        priority: "normal"
+                    }
+                }
+            });
+            const promptTokens = model.tokenize("The quick brown fox");
+
+            const generateTokens = async (sequence: ReturnType<typeof context.getSequence>) => {
+                const res: Token[] = [];
+                for await (const token of sequence.generate(promptTokens, {maxTokens: 8}))
+                    res.push(token);
+
+                return res;
+            };
+
+            const expectedTokens = await generateTokens(context.getSequence());
+            expect(await generateTokens(threadpoolContext.getSequence())).to.eql(expectedTokens);
+
+            await threadpoolContext.dispose();
+            await context.dispose();
+            await model.dispose();
+        });
+
+        test("an unsupported threadpool priority is rejected", {timeout: 1000 * 60 * 60 * 2}, async () => {
+            const modelPath = await getModelFile("Llama-3.2-3B-Instruct.Q4_K_M.gguf");
+            const llama = await getTestLlama();
+
+            const model = await llama.loadModel({
+                modelPath
+            });
+            const priority = "highest" as LlamaContextThreadpoolOptions["priority"];
+
+            await expect(model.createContext({
+                contextSize: 512,
+                threadpool: {priority}
+            })).rejects.toThrowError("Unsupported threadpool priority");
+            await expect(model.createContext({
+                contextSize: 512,
+                threadpool: {
+                    batch: {priority}
+                }
+            })).rejects.toThrowError("Unsupported threadpool priority");
+
+            await model.dispose();
+        });
+    });
+});
@@ -184,5 +184,85 @@ describe("nomic embed text", () => {
 
             expect(topSimilarDocument).to.eql("I love eating pizza with extra cheese");
         });
+
+        test("batched embeddings", {timeout: 1000 * 60 * 60 * 2}, async () => {
+            const modelPath = await getModelFile("nomic-embed-text-v1.5.Q4_K_M.gguf");
+            const llama = await getTestLlama();
+
+            const model = await llama.loadModel({
+                modelPath
+            });
+            const embeddingContext = await model.createEmbeddingContext({
+                contextSize: 512,
+                sequences: 3
+            });
+
+            const documents = [
+                "The sky is clear and blue today",
+                "I love eating pizza with extra cheese",
+                "Dogs love to play fetch with their owners",
+                "",
+                "The capital of France is Paris"
+            ];
+
+            const batchedEmbeddings = await embeddingContext.getEmbeddingsFor(documents);
+            expect(batchedEmbeddings.length).to.eql(documents.length);
+            expect(batchedEmbeddings[3]!.vector).to.eql([]);
+
+            for (let i = 0; i < documents.length; i++) {
+                if (documents[i] === "")
+                    continue;
+
+                const embedding = await embeddingContext.getEmbeddingFor(documents[i]!);
+                expect(batchedEmbeddings[i]!.vector.length).to.eql(embedding.vector.length);
+                expect(batchedEmbeddings[i]!.calculateCosineSimilarity(embedding)).to.be.closeTo(1, 0.0001);
+            }
+        });
+
+        test("embedding vector formats", {timeout: 1000 * 60 * 60 * 2}, async () => {
+            const modelPath = await getModelFile("nomic-embed-text-v1.5.Q4_K_M.gguf");
+            const llama = await getTestLlama();
+
+            const model = await llama.loadModel({
+                modelPath
+            });
+            const embeddingContext = await model.createEmbeddingContext({
+                contextSize: 512,
+                sequences: 2
+            });
+
+            const documents = [
+                "The sky is clear and blue today",
+                "I love eating pizza with extra cheese",
+                "Dogs love to play fetch with their owners"
+            ];
+            const vectorSize = model.embeddingVectorSize;
+            const embeddings = await embeddingContext.getEmbeddingsFor(documents);
+
+            const float32 = await embeddingContext.getEmbeddingVectorsFor(documents);
+            expect(float32.vectors).toBeInstanceOf(Float32Array);
+            expect(float32.count).to.eql(documents.length);
+            expect(float32.vectors.length).to.eql(documents.length * vectorSize);
+            expect(Array.from(float32.vectors.subarray(vectorSize, vectorSize * 2))).to.eql(embeddings[1]!.vector);
+
+            const normalized = await embeddingContext.getEmbeddingVectorsFor(documents, {format: "normalized"});
+            const normalizedVector = normalized.vectors.subarray(0, vectorSize);
+            expect(normalizedVector.reduce((res, value) => res + value * value, 0)).to.be.closeTo(1, 0.0001);
+
+            const float16 = await embeddingContext.getEmbeddingVectorsFor(documents, {format: "float16"});
+            expect(float16.vectors).toBeInstanceOf(Uint16Array);
+            expect(float16.vectors.length).to.eql(documents.length * vectorSize);
+
+            const int8 = await embeddingContext.getEmbeddingVectorsFor(documents, {format: "int8"});
+            expect(int8.vectors).toBeInstanceOf(Int8Array);
+            expect(int8.scales.length).to.eql(documents.length);
+            const dequantized = Array.from(int8.vectors.subarray(0, vectorSize), (value) => value * int8.scales[0]!);
+            expect(embeddings[0]!.calculateCosineSimilarity(dequantized)).to.be.closeTo(1, 0.001);
+
+            const binary = await embeddingContext.getEmbeddingVectorsFor(documents, {format: "binary"});
+            expect(binary.vectors).toBeInstanceOf(Uint8Array);
+            expect(binary.vectors.length).to.eql(documents.length * Math.ceil(vectorSize / 8));
+            expect((binary.vectors[0]! & 0x80) !== 0).to.eql(embeddings[0]!.vector[0]! > 0);
+        });
     });
 });
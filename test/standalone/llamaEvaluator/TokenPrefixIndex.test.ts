@@ -0,0 +1,123 @@
+import {describe, expect, test} from "vitest";
+import {TokenPrefixIndex} from "../../../src/evaluator/LlamaContext/utils/TokenPrefixIndex.js";
+import {Token} from "../../../src/index.js";
+
+describe("TokenPrefixIndex", () => {
+    test("finds the longest prefix", () => {
+        const index = new TokenPrefixIndex();
+        index.set(0, tokens(1, 2, 3, 4, 5));
+        index.set(1, tokens(1, 2, 3, 9));
+
+        expect(index.findLongestPrefix(tokens(1, 2, 3, 4, 5, 6))).to.eql({sequenceId: 0, length: 5});
+        expect(index.findLongestPrefix(tokens(1, 2, 3, 9, 9))).to.eql({sequenceId: 1, length: 4});
+        expect(index.findLongestPrefix(tokens(1, 2, 7))?.length).to.eql(2);
+        expect(index.findLongestPrefix(tokens(7, 1, 2))).to.eql(undefined);
+    });
+
+    test("excludes a sequence", () => {
+        const index = new TokenPrefixIndex();
+        index.set(0, tokens(1, 2, 3, 4, 5));
+        index.set(1, tokens(1, 2, 3, 9));
+
+        expect(index.findLongestPrefix(tokens(1, 2, 3, 4), 0)).to.eql({sequenceId: 1, length: 3});
+        expect(index.findLongestPrefix(tokens(1, 2, 3, 9), 1)).to.eql({sequenceId: 0, length: 3});
+    });
+
+    test("updates and removes sequences", () => {
+        const index = new TokenPrefixIndex();
+        index.set(0, tokens(1, 2, 3, 4, 5));
+        index.set(1, tokens(1, 2, 3, 9));
+
+        expect(index.set(0, tokens(1, 2, 3))).to.eql(2);
+        expect(index.set(0, tokens(1, 2, 3, 6))).to.eql(0);
+        expect(index.findLongestPrefix(tokens(1, 2, 3, 4, 5), 1)).to.eql({sequenceId: 0, length: 3});
+
+        expect(index.delete(1)).to.eql(4);
+        expect(index.findLongestPrefix(tokens(1, 2, 3, 9))).to.eql({sequenceId: 0, length: 3});
+
+        expect(index.delete(0)).to.eql(4);
+        expect(index.findLongestPrefix(tokens(1, 2))).to.eql(undefined);
+    });
+
+    test("merges split nodes back when a sequence is removed", () => {
+        const index = new TokenPrefixIndex();
+        index.set(0, tokens(1, 2, 3, 4, 5));
+        expect(index._getNodeCount()).to.eql(1);
+
+        index.set(1, tokens(1, 2, 3, 9));
+        expect(index._getNodeCount()).to.eql(3);
+
+        index.delete(1);
+        expect(index._getNodeCount()).to.eql(1);
+        expect(index.findLongestPrefix(tokens(1, 2, 3, 4, 5))).to.eql({sequenceId: 0, length: 5});
+
+        index.set(1, tokens(1, 2));
+        expect(index._getNodeCount()).to.eql(2);
+
+        index.set(1, tokens(1, 2, 3, 4, 5, 6));
+        expect(index._getNodeCount()).to.eql(2);
+
+        index.set(1, tokens(7));
+        expect(index._getNodeCount()).to.eql(2);
+        expect(index.size).to.eql(2);
+
+        index.delete(0);
+        expect(index._getNodeCount()).to.eql(1);
+        expect(index.size).to.eql(1);
+    });
+
+    test("matches a brute force search", () => {
+        const index = new TokenPrefixIndex();
+        const sequences = new Map<number, Token[]>();
+        let seed = 1;
+        const random = (max: number) => {
+            seed = (seed * 1103515245 + 12345) % 2147483648;
+            return seed % max;
+        };
+
+        for (let i = 0; i < 2000; i++) {
+            const sequenceId = random(6);
+            const sequenceTokens = Array.from({length: random(8)}, () => random(3) as Token);
+
+            index.set(sequenceId, sequenceTokens);
+            if (sequenceTokens.length === 0)
+                sequences.delete(sequenceId);
+            else
+                sequences.set(sequenceId, sequenceTokens);
+
+            const query = Array.from({length: random(8)}, () => random(3) as Token);
+            const excludeSequenceId = random(7);
+
+            let expectedLength = 0;
+            for (const [id, heldTokens] of sequences) {
+                if (id === excludeSequenceId)
+                    continue;
+
+                let length = 0;
+                while (length < heldTokens.length && length < query.length && heldTokens[length] === query[length])
+                    length++;
+
+                expectedLength = Math.max(expectedLength, length);
+            }
+
+            const match = index.findLongestPrefix(query, excludeSequenceId);
+            expect(match?.length ?? 0).to.eql(expectedLength);
+
+            if (match != null) {
+                expect(match.sequenceId).not.to.eql(excludeSequenceId);
+                expect(sequences.get(match.sequenceId)!.slice(0, match.length)).to.eql(query.slice(0, match.length));
+            }
+
+            // removing sequences must not leave behind more nodes than indexing the same sequences from scratch
+            const rebuiltIndex = new TokenPrefixIndex();
+            for (const [id, heldTokens] of sequences)
+                rebuiltIndex.set(id, heldTokens);
+
+            expect(index._getNodeCount()).to.eql(rebuiltIndex._getNodeCount());
+        }
+    });
+});
+
+function tokens(...values: number[]) {
+    return values as Token[];
+}
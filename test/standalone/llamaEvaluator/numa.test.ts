@@ -0,0 +1,101 @@
+import path from "path";
+import process from "process";
+import {describe, expect, test} from "vitest";
+import fs from "fs-extra";
+import {getTestLlama} from "../../utils/getTestLlama.js";
+import {getTempTestFilePath} from "../../utils/helpers/getTempTestDir.js";
+
+describe("NUMA", () => {
+    test("reads the NUMA nodes", async (test) => {
+        if (process.platform !== "linux")
+            return test.skip();
+
+        const llama = await getTestLlama();
+        const nodesPath = await getTempTestFilePath("numa-nodes");
+        test.onTestFinished(() => fs.remove(nodesPath));
+
+        await fs.outputFile(path.join(nodesPath, "node0", "cpulist"), "0-3,8,10-11\n");
+        await fs.outputFile(
+            path.join(nodesPath, "node0", "meminfo"),
+            "Node 0 MemTotal:       32768 kB\nNode 0 MemFree:        16384 kB\n"
+        );
+        await fs.outputFile(path.join(nodesPath, "node1", "cpulist"), "4-7,x-9,,12\n");
+        await fs.outputFile(path.join(nodesPath, "node1", "meminfo"), "Node 1 MemTotal:        1024 kB\n");
+        await fs.outputFile(path.join(nodesPath, "node10", "cpulist"), "\n");
+        await fs.ensureDir(path.join(nodesPath, "node2"));
+        await fs.ensureDir(path.join(nodesPath, "nodeX"));
+
+        expect(llama._bindings.getNumaInfo(nodesPath)).to.eql({
+            nodes: [{
+                id: 0,
+                cpus: [0, 1, 2, 3, 8, 10, 11],
+                totalMemory: 32768 * 1024,
+                freeMemory: 16384 * 1024
+            }, {
+                id: 1,
+                cpus: [4, 5, 6, 7, 12],
+                totalMemory: 1024 * 1024,
+                freeMemory: 0
+            }, {
+                id: 10,
+                cpus: [],
+                totalMemory: 0,
+                freeMemory: 0
+            }]
+        });
+    });
+
+    test("reports the NUMA topology of the system", async () => {
+        const llama = await getTestLlama();
+        const numaState = await llama.getNumaState();
+
+        expect(numaState.isNuma).to.eql(numaState.nodes.length > 1);
+
+        if (process.platform !== "linux") {
+            expect(numaState.nodes).to.eql([]);
+            return;
+        }
+
+        const nodesPath = "/sys/devices/system/node";
+        const nodeIds = (await fs.pathExists(nodesPath))
+            ? (await fs.readdir(nodesPath))
+                .filter((name) => /^node\d+$/.test(name))
+                .map((name) => Number(name.slice("node".length)))
+                .sort((a, b) => a - b)
+            : [];
+
+        expect(numaState.nodes.map((node) => node.id)).to.eql(nodeIds);
+
+        const cpus = numaState.nodes.flatMap((node) => node.cpus);
+        expect(new Set(cpus).size).to.eql(cpus.length);
+
+        for (const node of numaState.nodes)
+            expect(node.freeMemory).to.be.lessThanOrEqual(node.totalMemory);
+    });
+
+    test("initializing with a NUMA strategy validates it", async () => {
+        const llama = await getTestLlama();
+
+        expect(llama.numa).to.eql(false);
+        expect(() => llama._bindings.init({numa: "unsupported" as "distribute"})).toThrowError("Unsupported NUMA strategy");
+        await expect(llama._bindings.init()).resolves.toBeUndefined();
+    });
+
+    test("the NUMA strategy can't be changed after the backend is initialized", async () => {
+        const llama = await getTestLlama();
+
+        expect(llama.numa).to.eql(false);
+        expect(() => llama._bindings.init({numa: "distribute"}))
+            .toThrowError("The NUMA strategy can't be changed after the backend is initialized");
+    });
+
+    test("interleaving the model memory requires disabling mmap", async () => {
+        const llama = await getTestLlama();
+
+        await expect(llama.loadModel({
+            modelPath: "model.gguf",
+            numaInterleave: true,
+            useMmap: true
+        })).rejects.toThrowError("The `numaInterleave` option requires `useMmap` to be `false`");
+    });
+});
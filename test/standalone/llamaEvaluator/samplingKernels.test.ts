@@ -0,0 +1,40 @@
+import {describe, expect, test} from "vitest";
+import {getTestLlama} from "../../utils/getTestLlama.js";
+
+const smallestNormalFloat = 1.1754943508222875e-38;
+
+describe("sampling kernels", () => {
+    // sizes that aren't a multiple of the vector widths exercise the scalar tails of the kernels
+    const vocabSizes = [1, 7, 16, 33, 1023, 32_000, 128_256, 151_936];
+
+    for (const vocabSize of vocabSizes) {
+        test(`vectorized kernels match the scalar kernels for a vocabulary of ${vocabSize}`, async (test) => {
+            const llama = await getTestLlama();
+
+            // only available in builds with the `NLC_DEV_BINDINGS` CMake option enabled
+            if (llama._bindings.compareSamplingKernels == null)
+                return test.skip();
+
+            for (const seed of [0, 1, 2]) {
+                const res = llama._bindings.compareSamplingKernels(vocabSize, seed);
+
+                expect(res.fillMatches).to.eql(true);
+                expect(res.extractMatches).to.eql(true);
+                expect(res.maxMatches).to.eql(true);
+                expect(res.scaleMatches).to.eql(true);
+                expect(res.topSelectionMatches).to.eql(true);
+
+                // the vectorized exp is a polynomial approximation, accurate to a few ulps
+                expect(res.expMaxRelativeError).to.be.lessThan(1e-6);
+
+                // values below the smallest normal float are flushed to 0
+                expect(res.expMaxAbsoluteError).to.be.lessThan(smallestNormalFloat);
+
+                // the vectorized sum adds the values in a different order
+                expect(res.sumRelativeError).to.be.lessThan(1e-5);
+                expect(res.probabilitiesMaxAbsoluteError).to.be.lessThan(1e-6);
+                expect(res.softmaxMaxAbsoluteError).to.be.lessThan(1e-6);
+            }
+        });
+    }
+});
@@ -0,0 +1,53 @@
+import {getLlama} from "../../../src/index.js";
+import {getModelFile} from "../modelFiles.js";
+
+const modelName = "Llama-3.2-3B-Instruct.Q4_K_M.gguf";
+const promptTokens = 2048;
+const microBatchSizes = [32, 64, 128, 256, 512, 1024, 2048];
+const iterations = 3;
+
+const llama = await getLlama({gpu: false});
+const model = await llama.loadModel({
+    modelPath: await getModelFile(modelName)
+});
+
+const text = "The quick brown fox jumps over the lazy dog. ".repeat(promptTokens);
+const tokens = model.tokenize(text).slice(0, promptTokens);
+
+console.info(`Prefill of ${tokens.length} tokens on CPU with a batch size of ${promptTokens}, best of ${iterations} runs`);
+console.info("micro batch size".padStart(16) + " | " + "tokens/s".padStart(10) + " | " + "context RSS".padStart(12));
+
+for (const microBatchSize of microBatchSizes) {
+    const rssBefore = process.memoryUsage().rss;
+    const context = await model.createContext({
+        contextSize: promptTokens,
+        batchSize: promptTokens,
+        microBatchSize
+    });
+    const sequence = context.getSequence();
+
+    let contextRss = 0;
+    let bestTokensPerSecond = 0;
+    for (let i = 0; i < iterations; i++) {
+        await sequence.clearHistory();
+
+        const start = performance.now();
+        await sequence.evaluateWithoutGeneratingNewTokens(tokens);
+        const duration = performance.now() - start;
+
+        contextRss = Math.max(contextRss, process.memoryUsage().rss - rssBefore);
+        bestTokensPerSecond = Math.max(bestTokensPerSecond, tokens.length / (duration / 1000));
+    }
+
+    console.info(
+        String(context.microBatchSize).padStart(16) + " | " +
+        bestTokensPerSecond.toFixed(1).padStart(10) + " | " +
+        `${(contextRss / 1024 / 1024).toFixed(1)}MB`.padStart(12)
+    );
+
+    await context.dispose();
+}
+
+await model.dispose();
+await llama.dispose();
+process.exit(0);
@@ -0,0 +1,39 @@
+import {getTestLlama} from "../getTestLlama.js";
+
+const vocabSizes = [32_000, 65_536, 128_256, 151_936, 256_000];
+const iterations = 200;
+const topN = 10;
+
+const llama = await getTestLlama();
+
+if (llama._bindings.benchmarkSampling == null) {
+    console.error("The sampling benchmark requires a build with the development bindings. " +
+        "Build it with the `NODE_LLAMA_CPP_CMAKE_OPTION_NLC_DEV_BINDINGS=ON` environment variable set");
+    process.exit(1);
+}
+
+const formatMicroseconds = (value: number) => value.toFixed(1).padStart(10);
+const columns = ["fill", "confidence", "probabilities", "topProbabilities"] as const;
+
+let printedHeader = false;
+for (const vocabSize of vocabSizes) {
+    const result = llama._bindings.benchmarkSampling!(vocabSize, iterations, topN);
+
+    if (!printedHeader) {
+        console.info(`Sampling kernels: ${result.kernels}, per-token latency in microseconds (top ${topN} for "topProbabilities")`);
+        console.info(
+            "vocab size".padStart(10) + " | " + "impl".padEnd(10) + " | " +
+            columns.map((column) => column.padStart(16)).join(" | ")
+        );
+        printedHeader = true;
+    }
+
+    for (const [name, timings] of [["scalar", result.scalar], ["vectorized", result.vectorized]] as const)
+        console.info(
+            String(vocabSize).padStart(10) + " | " + name.padEnd(10) + " | " +
+            columns.map((column) => formatMicroseconds(timings[column]).padStart(16)).join(" | ")
+        );
+}
+
+await llama.dispose();
+process.exit(0);
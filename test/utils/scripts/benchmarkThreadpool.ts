@@ -0,0 +1,90 @@
+import os from "os";
+import {getLlama, LlamaContextOptions, LlamaModel} from "../../../src/index.js";
+import {getModelFile} from "../modelFiles.js";
+
+const modelName = "Llama-3.2-3B-Instruct.Q4_K_M.gguf";
+const concurrentContexts = 2;
+const promptTokens = 512;
+const generatedTokens = 64;
+
+const llama = await getLlama({gpu: false});
+const model = await llama.loadModel({
+    modelPath: await getModelFile(modelName)
+});
+
+const cpuCount = os.cpus().length;
+const cpusPerContext = Math.max(1, Math.floor(cpuCount / concurrentContexts));
+const tokens = model.tokenize("The quick brown fox jumps over the lazy dog. ".repeat(promptTokens)).slice(0, promptTokens);
+
+console.info(
+    `${concurrentContexts} concurrent contexts on ${cpuCount} CPUs, ${cpusPerContext} threads each, ` +
+    `prefill of ${tokens.length} tokens and generation of ${generatedTokens} tokens`
+);
+console.info("configuration".padEnd(24) + " | " + "prefill tokens/s".padStart(16) + " | " + "generation tokens/s".padStart(19));
+
+await runConfiguration("default", () => ({}));
+await runConfiguration("threadpool", () => ({threadpool: true}));
+await runConfiguration("pinned threadpool", (index) => ({
+    threadpool: {
+        cpuMask: Array.from({length: cpusPerContext}, (_, i) => (index * cpusPerContext + i) % cpuCount)
+    }
+}));
+await runConfiguration("pinned strict threadpool", (index) => ({
+    threadpool: {
+        cpuMask: Array.from({length: cpusPerContext}, (_, i) => (index * cpusPerContext + i) % cpuCount),
+        strictCpu: true
+    }
+}));
+
+await model.dispose();
+await llama.dispose();
+process.exit(0);
+
+async function runConfiguration(name: string, getOptions: (index: number) => LlamaContextOptions) {
+    const results = await Promise.all(
+        Array.from({length: concurrentContexts}, (_, index) => runContext(model, {
+            contextSize: promptTokens + generatedTokens,
+            batchSize: promptTokens,
+            threads: cpusPerContext,
+            ...getOptions(index)
+        }))
+    );
+
+    const prefillTokensPerSecond = results.reduce((res, result) => res + result.prefillTokensPerSecond, 0);
+    const generationTokensPerSecond = results.reduce((res, result) => res + result.generationTokensPerSecond, 0);
+
+    console.info(
+        name.padEnd(24) + " | " +
+        prefillTokensPerSecond.toFixed(1).padStart(16) + " | " +
+        generationTokensPerSecond.toFixed(1).padStart(19)
+    );
+}
+
+async function runContext(model: LlamaModel, options: LlamaContextOptions) {
+    const context = await model.createContext(options);
+    const sequence = context.getSequence();
+
+    try {
+        const prefillStart = performance.now();
+        await sequence.evaluateWithoutGeneratingNewTokens(tokens);
+        const prefillDuration = performance.now() - prefillStart;
+
+        let generated = 0;
+        const generationStart = performance.now();
+        for await (const token of sequence.evaluate([tokens[tokens.length - 1]!])) {
+            void token;
+            generated++;
+
+            if (generated >= generatedTokens)
+                break;
+        }
+        const generationDuration = performance.now() - generationStart;
+
+        return {
+            prefillTokensPerSecond: tokens.length / (prefillDuration / 1000),
+            generationTokensPerSecond: generated / (generationDuration / 1000)
+        };
+    } finally {
+        await context.dispose();
+    }
+}